@@ -0,0 +1,547 @@
+#include <cassert>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include "extentlist.h"
+#include "intersection.h"
+#include "../index/extentset.h"
+#include "../utils/all.h"
+
+ExtentList::~ExtentList() {
+}
+
+bool ExtentList::getFirstEndBiggerEq(offset position, offset *start, offset *end) {
+    // GCリストでは終了位置がposition未満の最後の区間の次が求める区間になる
+    offset s, e;
+    if (getLastEndSmallerEq(position - 1, &s, &e))
+        return getFirstStartBiggerEq(s + 1, start, end);
+    return getFirstStartBiggerEq(0, start, end);
+}
+
+bool ExtentList::getLastStartSmallerEq(offset position, offset *start, offset *end) {
+    // 開始位置がpositionより大きい最初の区間の直前が求める区間になる
+    offset s, e;
+    if (getFirstStartBiggerEq(position + 1, &s, &e))
+        return getLastEndSmallerEq(e - 1, start, end);
+    return getLastEndSmallerEq(MAX_OFFSET, start, end);
+}
+
+int ExtentList::getNextN(offset from, offset to, int n, offset *starts, offset *ends) {
+    int result = 0;
+    offset s, e;
+    while ((result < n) && (getFirstStartBiggerEq(from, &s, &e)) && (e <= to)) {
+        starts[result] = s;
+        ends[result] = e;
+        result++;
+        from = s + 1;
+    }
+    return result;
+}
+
+
+ExtentList_Set::ExtentList_Set(ExtentSet *extents) {
+    this->extents = extents;
+    extents->addReference();
+}
+
+ExtentList_Set::~ExtentList_Set() {
+    extents->release();
+}
+
+int64_t ExtentList_Set::findFirstGreater(offset position, bool ends) {
+    int64_t low = 0, high = extents->getCount();
+    offset start, end;
+    while (low < high) {
+        int64_t middle = (low + high) / 2;
+        extents->getExtent(middle, &start, &end);
+        if ((ends ? end : start) > position)
+            high = middle;
+        else
+            low = middle + 1;
+    }
+    return low;
+}
+
+bool ExtentList_Set::getFirstStartBiggerEq(offset position, offset *start, offset *end) {
+    int64_t i = findFirstGreater(position - 1, false);
+    if (i >= extents->getCount())
+        return false;
+    extents->getExtent(i, start, end);
+    return true;
+}
+
+bool ExtentList_Set::getFirstEndBiggerEq(offset position, offset *start, offset *end) {
+    int64_t i = findFirstGreater(position - 1, true);
+    if (i >= extents->getCount())
+        return false;
+    extents->getExtent(i, start, end);
+    return true;
+}
+
+bool ExtentList_Set::getLastEndSmallerEq(offset position, offset *start, offset *end) {
+    int64_t i = findFirstGreater(position, true) - 1;
+    if (i < 0)
+        return false;
+    extents->getExtent(i, start, end);
+    return true;
+}
+
+bool ExtentList_Set::getLastStartSmallerEq(offset position, offset *start, offset *end) {
+    int64_t i = findFirstGreater(position, false) - 1;
+    if (i < 0)
+        return false;
+    extents->getExtent(i, start, end);
+    return true;
+}
+
+int64_t ExtentList_Set::getLength() {
+    return extents->getCount();
+}
+
+ExtentList_AND::ExtentList_AND(ExtentList **elements, int elementCount) {
+    assert(elementCount > 0);
+    this->elements = elements;
+    this->elementCount = elementCount;
+}
+
+ExtentList_AND::~ExtentList_AND() {
+    for (int i = 0; i < elementCount; i++)
+        delete elements[i];
+    free(elements);
+}
+
+bool ExtentList_AND::getFirstStartBiggerEq(offset position, offset *start, offset *end) {
+    // 各要素のposition以降の最初の区間のうち最も遅く終わるものが結果の終了位置になり、
+    // そこから各要素を最も近い区間まで戻したときの最小の開始位置が結果の開始位置になる
+    offset s, e, maxEnd = -1;
+    for (int i = 0; i < elementCount; i++) {
+        if (!elements[i]->getFirstStartBiggerEq(position, &s, &e))
+            return false;
+        maxEnd = std::max(maxEnd, e);
+    }
+    offset minStart = MAX_OFFSET;
+    for (int i = 0; i < elementCount; i++) {
+        bool found = elements[i]->getLastEndSmallerEq(maxEnd, &s, &e);
+        assert(found);
+        minStart = std::min(minStart, s);
+    }
+    *start = minStart;
+    *end = maxEnd;
+    return true;
+}
+
+bool ExtentList_AND::getLastEndSmallerEq(offset position, offset *start, offset *end) {
+    offset s, e, minStart = MAX_OFFSET;
+    for (int i = 0; i < elementCount; i++) {
+        if (!elements[i]->getLastEndSmallerEq(position, &s, &e))
+            return false;
+        minStart = std::min(minStart, s);
+    }
+    offset maxEnd = -1;
+    for (int i = 0; i < elementCount; i++) {
+        bool found = elements[i]->getFirstStartBiggerEq(minStart, &s, &e);
+        assert(found);
+        maxEnd = std::max(maxEnd, e);
+    }
+    *start = minStart;
+    *end = maxEnd;
+    return true;
+}
+
+int64_t ExtentList_AND::getLength() {
+    int64_t result = elements[0]->getLength();
+    for (int i = 1; i < elementCount; i++)
+        result = std::min(result, elements[i]->getLength());
+    return result;
+}
+
+
+ExtentList_OR::ExtentList_OR(ExtentList **elements, int elementCount) {
+    assert(elementCount > 0);
+    this->elements = elements;
+    this->elementCount = elementCount;
+}
+
+ExtentList_OR::~ExtentList_OR() {
+    for (int i = 0; i < elementCount; i++)
+        delete elements[i];
+    free(elements);
+}
+
+bool ExtentList_OR::getFirstStartBiggerEq(offset position, offset *start, offset *end) {
+    // 最も早く終わる区間を選ぶ。終了位置が同じ場合は短い方(開始位置が大きい方)
+    bool found = false;
+    offset s, e;
+    for (int i = 0; i < elementCount; i++) {
+        if (!elements[i]->getFirstStartBiggerEq(position, &s, &e))
+            continue;
+        if ((!found) || (e < *end) || ((e == *end) && (s > *start))) {
+            *start = s;
+            *end = e;
+            found = true;
+        }
+    }
+    return found;
+}
+
+bool ExtentList_OR::getLastEndSmallerEq(offset position, offset *start, offset *end) {
+    // 最も遅く始まる区間を選ぶ。開始位置が同じ場合は短い方(終了位置が小さい方)
+    bool found = false;
+    offset s, e;
+    for (int i = 0; i < elementCount; i++) {
+        if (!elements[i]->getLastEndSmallerEq(position, &s, &e))
+            continue;
+        if ((!found) || (s > *start) || ((s == *start) && (e < *end))) {
+            *start = s;
+            *end = e;
+            found = true;
+        }
+    }
+    return found;
+}
+
+int64_t ExtentList_OR::getLength() {
+    int64_t result = 0;
+    for (int i = 0; i < elementCount; i++)
+        result += elements[i]->getLength();
+    return result;
+}
+
+
+ExtentList_Containment::ExtentList_Containment(ExtentList *container, ExtentList *containee,
+        bool returnContainer, bool inverted) {
+    this->container = container;
+    this->containee = containee;
+    this->returnContainer = returnContainer;
+    this->inverted = inverted;
+}
+
+ExtentList_Containment::~ExtentList_Containment() {
+    delete container;
+    delete containee;
+}
+
+bool ExtentList_Containment::getFirstStartBiggerEq(offset position, offset *start, offset *end) {
+    offset p, q, u, v;
+    if (returnContainer) {
+        if (!container->getFirstStartBiggerEq(position, &p, &q))
+            return false;
+        while (true) {
+            // pから始まる区間に含まれうる最初のcontaineeの区間
+            bool found = containee->getFirstStartBiggerEq(p, &u, &v);
+            if (!inverted) {
+                if (!found)
+                    return false;
+                if (v <= q)
+                    break;
+                // [u, v]を含むには終了位置がv以上でなければならない
+                if (!container->getFirstEndBiggerEq(v, &p, &q))
+                    return false;
+            }
+            else {
+                if ((!found) || (v > q))
+                    break;
+                // [u, v]を含まないには開始位置がuより大きくなければならない
+                if (!container->getFirstStartBiggerEq(u + 1, &p, &q))
+                    return false;
+            }
+        }
+    }
+    else {
+        if (!containee->getFirstStartBiggerEq(position, &p, &q))
+            return false;
+        while (true) {
+            // [p, q]を含みうるcontainerの区間のうち最も早く始まるもの
+            bool found = container->getFirstEndBiggerEq(q, &u, &v);
+            if (!inverted) {
+                if (!found)
+                    return false;
+                if (u <= p)
+                    break;
+                if (!containee->getFirstStartBiggerEq(u, &p, &q))
+                    return false;
+            }
+            else {
+                if ((!found) || (u > p))
+                    break;
+                // [u, v]に含まれる区間をすべて読み飛ばす
+                if (!containee->getFirstEndBiggerEq(v + 1, &p, &q))
+                    return false;
+            }
+        }
+    }
+    *start = p;
+    *end = q;
+    return true;
+}
+
+bool ExtentList_Containment::getLastEndSmallerEq(offset position, offset *start, offset *end) {
+    offset p, q, u, v;
+    if (returnContainer) {
+        if (!container->getLastEndSmallerEq(position, &p, &q))
+            return false;
+        while (true) {
+            // qまでに終わる区間のうち最も遅く始まるcontaineeの区間
+            bool found = containee->getLastEndSmallerEq(q, &u, &v);
+            if (!inverted) {
+                if (!found)
+                    return false;
+                if (u >= p)
+                    break;
+                if (!container->getLastStartSmallerEq(u, &p, &q))
+                    return false;
+            }
+            else {
+                if ((!found) || (u < p))
+                    break;
+                if (!container->getLastEndSmallerEq(v - 1, &p, &q))
+                    return false;
+            }
+        }
+    }
+    else {
+        if (!containee->getLastEndSmallerEq(position, &p, &q))
+            return false;
+        while (true) {
+            // [p, q]を含みうるcontainerの区間のうち最も遅く終わるもの
+            bool found = container->getLastStartSmallerEq(p, &u, &v);
+            if (!inverted) {
+                if (!found)
+                    return false;
+                if (v >= q)
+                    break;
+                if (!containee->getLastEndSmallerEq(v, &p, &q))
+                    return false;
+            }
+            else {
+                if ((!found) || (v < q))
+                    break;
+                if (!containee->getLastStartSmallerEq(u - 1, &p, &q))
+                    return false;
+            }
+        }
+    }
+    *start = p;
+    *end = q;
+    return true;
+}
+
+int64_t ExtentList_Containment::getLength() {
+    return (returnContainer ? container->getLength() : containee->getLength());
+}
+
+
+ExtentList_FollowedBy::ExtentList_FollowedBy(ExtentList *first, ExtentList *second) {
+    this->first = first;
+    this->second = second;
+}
+
+ExtentList_FollowedBy::~ExtentList_FollowedBy() {
+    delete first;
+    delete second;
+}
+
+bool ExtentList_FollowedBy::getFirstStartBiggerEq(offset position, offset *start, offset *end) {
+    offset p1, q1, p2, q2, u, v;
+    if (!first->getFirstStartBiggerEq(position, &p1, &q1))
+        return false;
+    if (!second->getFirstStartBiggerEq(q1 + 1, &p2, &q2))
+        return false;
+    // secondの区間の直前で終わるfirstの区間まで開始位置を進める
+    bool found = first->getLastEndSmallerEq(p2 - 1, &u, &v);
+    assert(found);
+    *start = u;
+    *end = q2;
+    return true;
+}
+
+bool ExtentList_FollowedBy::getLastEndSmallerEq(offset position, offset *start, offset *end) {
+    offset p1, q1, p2, q2, u, v;
+    if (!second->getLastEndSmallerEq(position, &p2, &q2))
+        return false;
+    if (!first->getLastEndSmallerEq(p2 - 1, &p1, &q1))
+        return false;
+    bool found = second->getFirstStartBiggerEq(q1 + 1, &u, &v);
+    assert(found);
+    *start = p1;
+    *end = v;
+    return true;
+}
+
+int64_t ExtentList_FollowedBy::getLength() {
+    return std::min(first->getLength(), second->getLength());
+}
+
+
+// 要素のリストが最初の要素のこの倍以上長い場合は、ポスティングをまとめて取り出さずに候補ごとに探す
+static const int64_t PHRASE_PROBE_RATIO = 32;
+
+ExtentList_Phrase::ExtentList_Phrase(ExtentList **elements, const int *shifts, int elementCount, int length) {
+    assert((elementCount > 0) && (length > 0));
+    this->elements = elements;
+    this->elementCount = elementCount;
+    this->length = length;
+    this->shifts = typed_malloc(int, elementCount);
+    memcpy(this->shifts, shifts, elementCount * sizeof(int));
+
+    // 短いリストを先に調べると、候補の位置が大きく進む
+    for (int i = 1; i < elementCount; i++)
+        for (int k = i; (k > 0) && (elements[k]->getLength() < elements[k - 1]->getLength()); k--) {
+            std::swap(elements[k], elements[k - 1]);
+            std::swap(this->shifts[k], this->shifts[k - 1]);
+        }
+
+    matches = candidates = postings = postingEnds = nullptr;
+    matchCount = matchHint = 0;
+    matchesFrom = 1;
+    matchesTo = 0;
+    batchSize = MIN_PHRASE_BATCH_SIZE;
+}
+
+ExtentList_Phrase::~ExtentList_Phrase() {
+    for (int i = 0; i < elementCount; i++)
+        delete elements[i];
+    free(elements);
+    free(shifts);
+    free(matches);
+    free(candidates);
+    free(postings);
+    free(postingEnds);
+}
+
+bool ExtentList_Phrase::findFirstMatch(offset position, offset *start) {
+    offset candidate = position, s, e;
+    int matched = 0, i = 0;
+    // すべての要素が候補の位置で一致するまで、一致しなかった要素の位置まで候補を進める
+    while (matched < elementCount) {
+        offset target = candidate + shifts[i];
+        if (!elements[i]->getFirstStartBiggerEq(target, &s, &e))
+            return false;
+        if (s == target)
+            matched++;
+        else {
+            candidate = s - shifts[i];
+            matched = 1;
+        }
+        i = (i + 1) % elementCount;
+    }
+    *start = candidate;
+    return true;
+}
+
+int ExtentList_Phrase::intersectWithElement(int i, int count) {
+    ExtentList *element = elements[i];
+    offset delta = shifts[i];
+    int kept = 0;
+    if (element->getLength() >= PHRASE_PROBE_RATIO * elements[0]->getLength()) {
+        // 要素のポスティングが候補よりずっと多い場合は、候補ごとに探す方が読む量が少ない
+        offset s, e;
+        for (int k = 0; k < count; k++)
+            if ((element->getFirstStartBiggerEq(matches[k] + delta, &s, &e)) && (s == matches[k] + delta))
+                candidates[kept++] = matches[k];
+    }
+    else {
+        int next = 0;
+        while (next < count) {
+            int n = element->getNextN(matches[next] + delta, matches[count - 1] + delta,
+                    MAX_PHRASE_BATCH_SIZE, postings, postingEnds);
+            if (n == 0)
+                break;
+            // 取り出したポスティングの範囲に収まる候補だけを比較する
+            int last = std::upper_bound(matches + next, matches + count, postings[n - 1] - delta) - matches;
+            kept += intersectPostings(matches + next, last - next, postings, n, delta, candidates + kept);
+            next = last;
+        }
+    }
+    std::swap(matches, candidates);
+    return kept;
+}
+
+void ExtentList_Phrase::fillBatch(offset position) {
+    if (matches == nullptr) {
+        matches = typed_malloc(offset, MAX_PHRASE_BATCH_SIZE);
+        candidates = typed_malloc(offset, MAX_PHRASE_BATCH_SIZE);
+        postings = typed_malloc(offset, MAX_PHRASE_BATCH_SIZE);
+        postingEnds = typed_malloc(offset, MAX_PHRASE_BATCH_SIZE);
+    }
+    if ((matchesTo < MAX_OFFSET) && (position == matchesTo + 1))
+        batchSize = std::min(2 * batchSize, (int)MAX_PHRASE_BATCH_SIZE);
+    else
+        batchSize = MIN_PHRASE_BATCH_SIZE;
+
+    matchesFrom = position;
+    matchCount = matchHint = 0;
+    int n = elements[0]->getNextN(position + shifts[0], MAX_OFFSET, batchSize, matches, postingEnds);
+    if (n == 0) {
+        matchesTo = MAX_OFFSET;
+        return;
+    }
+    for (int k = 0; k < n; k++)
+        matches[k] -= shifts[0];
+    /*
+    最初の要素のポスティングをすべて取り出した範囲では、フレーズの開始位置もすべて分かる。
+    削除された範囲を除くとbatchSize個より少なくなることがあるので、
+    リストの終わりは空の結果で判断する
+    */
+    matchesTo = matches[n - 1];
+    int count = n;
+    for (int i = 1; (i < elementCount) && (count > 0); i++)
+        count = intersectWithElement(i, count);
+    matchCount = count;
+}
+
+bool ExtentList_Phrase::getFirstStartBiggerEq(offset position, offset *start, offset *end) {
+    if (elementCount == 1) {
+        if (!findFirstMatch(position, start))
+            return false;
+        *end = *start + length - 1;
+        return true;
+    }
+    while (true) {
+        if ((position < matchesFrom) || (position > matchesTo))
+            fillBatch(position);
+        int first = ((matchHint < matchCount) && (matches[matchHint] < position) ? matchHint : 0);
+        int i = std::lower_bound(matches + first, matches + matchCount, position) - matches;
+        if (i < matchCount) {
+            matchHint = i;
+            *start = matches[i];
+            *end = matches[i] + length - 1;
+            return true;
+        }
+        if (matchesTo >= MAX_OFFSET)
+            return false;
+        position = matchesTo + 1;
+    }
+}
+
+bool ExtentList_Phrase::getFirstEndBiggerEq(offset position, offset *start, offset *end) {
+    return getFirstStartBiggerEq(position - length + 1, start, end);
+}
+
+bool ExtentList_Phrase::getLastEndSmallerEq(offset position, offset *start, offset *end) {
+    offset candidate = position - length + 1, s, e;
+    int matched = 0, i = 0;
+    while (matched < elementCount) {
+        offset target = candidate + shifts[i];
+        if (!elements[i]->getLastEndSmallerEq(target, &s, &e))
+            return false;
+        if (s == target)
+            matched++;
+        else {
+            candidate = s - shifts[i];
+            matched = 1;
+        }
+        i = (i + 1) % elementCount;
+    }
+    *start = candidate;
+    *end = candidate + length - 1;
+    return true;
+}
+
+bool ExtentList_Phrase::getLastStartSmallerEq(offset position, offset *start, offset *end) {
+    return getLastEndSmallerEq(position + length - 1, start, end);
+}
+
+int64_t ExtentList_Phrase::getLength() {
+    return elements[0]->getLength();
+}
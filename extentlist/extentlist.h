@@ -0,0 +1,406 @@
+#ifndef __EXTENTLIST_H
+#define __EXTENTLIST_H
+
+/*
+GCL(Generalized Concordance Lists)の区間代数の実装。
+ExtentListは互いに入れ子にならない区間[start, end]の列(GCリスト)を表し、開始位置と
+終了位置はどちらも狭義単調増加になる。区間は次の4つのアクセス関数で取り出す:
+
+    getFirstStartBiggerEq(k)   開始位置がk以上の最初の区間   (τ)
+    getFirstEndBiggerEq(k)     終了位置がk以上の最初の区間   (ρ)
+    getLastEndSmallerEq(k)     終了位置がk以下の最後の区間   (τ')
+    getLastStartSmallerEq(k)   開始位置がk以下の最後の区間   (ρ')
+
+演算子は子のリストのアクセス関数だけを使って結果の区間を1つずつ求めるので、
+リスト全体を展開することはない(Clarke, Cormack, Burkowski, "An Algebra for
+Structured Text Search and a Framework for its Implementation", 1995)。
+語のリスト(PostingList)はセグメントのスキップエントリを指数探索で読み飛ばし、
+必要なブロックだけを展開する。
+
+演算子は子のリストを所有し、破棄する際にdeleteする。
+インスタンスは1つのスレッドからのみ使うこと
+*/
+
+#include "../index/index_type.h"
+#include "../index/segment.h"
+
+class ExtentSet;
+class IndexView;
+class LongListStore;
+class PostingBlockCache;
+
+class ExtentList {
+
+public:
+
+    virtual ~ExtentList();
+
+    /*
+    以下の関数は条件を満たす区間があればstartとendに格納してtrueを返し、
+    なければfalseを返す
+    */
+    virtual bool getFirstStartBiggerEq(offset position, offset *start, offset *end) = 0;
+
+    virtual bool getFirstEndBiggerEq(offset position, offset *start, offset *end);
+
+    virtual bool getLastEndSmallerEq(offset position, offset *start, offset *end) = 0;
+
+    virtual bool getLastStartSmallerEq(offset position, offset *start, offset *end);
+
+    /*
+    開始位置がfrom以上で終了位置がto以下の区間を最大n個取り出してstartsとendsに格納し、
+    その数を返す
+    */
+    virtual int getNextN(offset from, offset to, int n, offset *starts, offset *ends);
+
+    // リストに含まれる区間の数の上限の見積もり。演算の順序を決めるために使う
+    virtual int64_t getLength() = 0;
+};
+
+// 語のポスティングの読み取り元(セグメント、LongListStore、UpdateList)
+typedef struct {
+
+    // ブロック一覧。LongListStoreの場合はコピーを所有する
+    const SegmentSkipEntry *blocks;
+    int blockCount;
+
+    // セグメントの場合は語辞書内の位置
+    Segment *segment;
+    int64_t termIndex;
+
+    // LongListStoreの場合はブロック一覧を取得した時点のデータファイルの世代
+    int64_t longListGeneration;
+
+    // ブロックを展開する領域
+    offset *buffer;
+
+    // 展開済みのブロック(bufferまたはPostingBlockCache内のコピー)とその番号(-1はなし)
+    const offset *data;
+    int bufferCount, bufferBlock;
+
+    // dataを取得した時点のPostingBlockCacheのepoch
+    int64_t cacheEpoch;
+
+    // 直前に探索したブロックとブロック内の位置。指数探索の起点にする
+    int blockHint, bufferHint;
+
+} PL_Source;
+
+/*
+PostingListはIndexViewから語のポスティングを遅延して読み取る。
+各区間はstart == endの1語分の区間になる。UpdateList内のポスティングだけは
+作成時にメモリ上へ取り出し、セグメントとLongListStoreのブロックは必要になった時点で展開する。
+削除された範囲のポスティングは読み飛ばす。バイグラムは2語分の位置を占めるので、
+どちらかの語が削除されていれば読み飛ばす。
+
+文書単位の語(doclevel.h)のリストでは、区間の値は符号化されたポスティングそのもので、
+削除範囲との比較だけを文書の開始位置で行う。このリストではスキップエントリに格納された
+ブロックごとのtfと文書長の上限をgetImpactBoundで取り出せる
+*/
+class PostingList : public ExtentList {
+
+private:
+
+    IndexView *view;
+
+    char *term;
+
+    PL_Source *sources;
+    int sourceCount;
+
+    // UpdateListから取り出したポスティング
+    offset *memoryPostings;
+    int64_t memoryCount, memoryHint;
+
+    // 文書単位の語の場合、memoryPostingsをSEGMENT_BLOCK_SIZE個ずつに区切ったブロック
+    SegmentSkipEntry *memoryBlocks;
+    int memoryBlockCount;
+
+    int64_t length;
+
+    // 展開済みのブロックを共有するキャッシュ(nullptrの場合は共有しない)
+    PostingBlockCache *blockCache;
+
+    // getNextNで複数の読み取り元のポスティングを併合するための作業領域
+    offset *mergeBuffer;
+    int64_t mergeBufferSize;
+
+    // 1つのポスティングが占める語数(バイグラムは2)
+    int span;
+
+    // ポスティングを位置に戻すための右シフト量(文書単位の語ではDOC_LEVEL_SHIFT)
+    int shift;
+
+public:
+
+    // viewへの参照を追加し、termのリストを作る
+    PostingList(IndexView *view, const char *term);
+
+    /*
+    blockCacheを通してブロックを展開するtermのリストを作る。
+    blockCacheはこのリストより後に破棄しなければいけない
+    */
+    PostingList(IndexView *view, const char *term, PostingBlockCache *blockCache);
+
+    ~PostingList();
+
+    bool getFirstStartBiggerEq(offset position, offset *start, offset *end);
+
+    bool getFirstEndBiggerEq(offset position, offset *start, offset *end);
+
+    bool getLastEndSmallerEq(offset position, offset *start, offset *end);
+
+    bool getLastStartSmallerEq(offset position, offset *start, offset *end);
+
+    /*
+    展開済みのブロックから直接コピーする。アクセス関数を1つずつ呼び出すより速く、
+    フレーズの照合ではこれで取り出したポスティングをまとめて比較する
+    */
+    int getNextN(offset from, offset to, int n, offset *starts, offset *ends);
+
+    int64_t getLength();
+
+    /*
+    文書単位の語のリストで、position以上の最初のポスティングを含むブロックのtfの最大値と
+    文書長の符号の最小値を返す。各読み取り元のブロックを合わせたものなので、
+    値はposition以上lastPosting以下のすべてのポスティングについて成り立つ。
+    position以上のポスティングがなければfalseを返す
+    */
+    bool getImpactBound(offset position, int *maxTF, int *minLengthCode, offset *lastPosting);
+
+    /*
+    文書単位の語のリストのすべてのブロックについてimpact(maxTF, minLengthCode, data)を求め、
+    その最大値を返す。リスト全体でのスコアの上限を求めるために使う
+    */
+    double getMaxImpact(double (*impact)(int maxTF, int minLengthCode, void *data), void *data);
+
+private:
+
+    // 削除された範囲を考慮しない、position以上の最初のポスティング
+    bool findFirst(offset position, offset *result);
+
+    // 削除された範囲を考慮しない、position以下の最後のポスティング
+    bool findLast(offset position, offset *result);
+
+    bool findFirstInSource(PL_Source *source, offset position, offset *result);
+
+    bool findLastInSource(PL_Source *source, offset position, offset *result);
+
+    /*
+    sourceのfrom以上to以下のポスティングを最大n個resultに格納し、その数を返す。
+    ブロックの展開に失敗した場合は-1を返す
+    */
+    int collectFromSource(PL_Source *source, offset from, offset to, int n, offset *result);
+
+    // UpdateListから取り出したポスティングについて、collectFromSourceと同じことを行う
+    int collectFromMemory(offset from, offset to, int n, offset *result);
+
+    void initialize(IndexView *view, const char *term, PostingBlockCache *blockCache);
+
+    // ブロックを展開する。失敗した場合はfalseを返す
+    bool loadBlock(PL_Source *source, int block);
+
+    // LongListStoreのブロック一覧を取得し直す
+    void reloadLongList(PL_Source *source);
+};
+
+/*
+ExtentList_SetはExtentSetの区間をそのままGCリストとして返す。ExtentSetの区間は
+互いに重ならないので入れ子にならない。SecurityManagerが求めたユーザーの見える範囲を
+問い合わせの演算対象にするために使う
+*/
+class ExtentList_Set : public ExtentList {
+
+private:
+
+    ExtentSet *extents;
+
+public:
+
+    // extentsへの参照を追加する。extentsは変更してはいけない
+    ExtentList_Set(ExtentSet *extents);
+
+    ~ExtentList_Set();
+
+    bool getFirstStartBiggerEq(offset position, offset *start, offset *end);
+
+    bool getFirstEndBiggerEq(offset position, offset *start, offset *end);
+
+    bool getLastEndSmallerEq(offset position, offset *start, offset *end);
+
+    bool getLastStartSmallerEq(offset position, offset *start, offset *end);
+
+    int64_t getLength();
+
+private:
+
+    // 開始位置(endsがtrueの場合は終了位置)がpositionより大きい最初の区間の番号
+    int64_t findFirstGreater(offset position, bool ends);
+};
+
+/*
+ExtentList_ANDはすべての子の区間を含む最小の区間のリスト(A ^ B)
+*/
+class ExtentList_AND : public ExtentList {
+
+private:
+
+    ExtentList **elements;
+    int elementCount;
+
+public:
+
+    // elementsの配列とその要素の所有権を受け取る
+    ExtentList_AND(ExtentList **elements, int elementCount);
+
+    ~ExtentList_AND();
+
+    bool getFirstStartBiggerEq(offset position, offset *start, offset *end);
+
+    bool getLastEndSmallerEq(offset position, offset *start, offset *end);
+
+    int64_t getLength();
+};
+
+/*
+ExtentList_ORはいずれかの子の区間のうち、他の区間を含まないもののリスト(A + B)
+*/
+class ExtentList_OR : public ExtentList {
+
+private:
+
+    ExtentList **elements;
+    int elementCount;
+
+public:
+
+    // elementsの配列とその要素の所有権を受け取る
+    ExtentList_OR(ExtentList **elements, int elementCount);
+
+    ~ExtentList_OR();
+
+    bool getFirstStartBiggerEq(offset position, offset *start, offset *end);
+
+    bool getLastEndSmallerEq(offset position, offset *start, offset *end);
+
+    int64_t getLength();
+};
+
+/*
+ExtentList_Containmentは包含関係による選択を行う。
+returnContainerがtrueの場合はcontaineeの区間を含むcontainerの区間(A > B)を、
+falseの場合はcontainerの区間に含まれるcontaineeの区間(B < A)を返す。
+invertedがtrueの場合は条件を満たさない区間(A /> B, B /< A)を返す
+*/
+class ExtentList_Containment : public ExtentList {
+
+private:
+
+    ExtentList *container, *containee;
+
+    bool returnContainer, inverted;
+
+public:
+
+    ExtentList_Containment(ExtentList *container, ExtentList *containee, bool returnContainer, bool inverted);
+
+    ~ExtentList_Containment();
+
+    bool getFirstStartBiggerEq(offset position, offset *start, offset *end);
+
+    bool getLastEndSmallerEq(offset position, offset *start, offset *end);
+
+    int64_t getLength();
+};
+
+/*
+ExtentList_FollowedByはfirstの区間の後にsecondの区間が続く最小の区間のリスト(A .. B)
+*/
+class ExtentList_FollowedBy : public ExtentList {
+
+private:
+
+    ExtentList *first, *second;
+
+public:
+
+    ExtentList_FollowedBy(ExtentList *first, ExtentList *second);
+
+    ~ExtentList_FollowedBy();
+
+    bool getFirstStartBiggerEq(offset position, offset *start, offset *end);
+
+    bool getLastEndSmallerEq(offset position, offset *start, offset *end);
+
+    int64_t getLength();
+};
+
+/*
+ExtentList_Phraseは連続する語の並びのリスト。i番目の要素のポスティングが
+フレーズの先頭からshifts[i]語目に現れる位置を探す。要素にはバイグラムの
+リストを使ってもよい。要素の区間は1語分(start == end)でなければならない。
+区間はフレーズの先頭からlength語分になる。
+
+前方への探索では、最も短い要素から候補の位置をまとめて取り出し、ほかの要素の
+ポスティングとの共通部分(位置の差付き)をintersectPostingsのSIMDカーネルで求めて、
+結果を先読みしておく。先読みの量は、続けて前から読まれるたびに倍にし
+(MAX_PHRASE_BATCH_SIZEまで)、離れた位置に飛んだ場合は最小に戻す。後方への探索は
+要素を1つずつ調べる
+*/
+class ExtentList_Phrase : public ExtentList {
+
+public:
+
+    // 一度に先読みする候補の数の範囲
+    static const int MIN_PHRASE_BATCH_SIZE = 16;
+    static const int MAX_PHRASE_BATCH_SIZE = 1024;
+
+private:
+
+    ExtentList **elements;
+    int *shifts;
+    int elementCount;
+
+    int length;
+
+    // 先読みしたフレーズの開始位置。[matchesFrom, matchesTo]の開始位置はすべてここにある
+    offset *matches;
+    int matchCount, matchHint;
+    offset matchesFrom, matchesTo;
+
+    // 次に先読みする候補の数
+    int batchSize;
+
+    // 候補の位置と要素のポスティングの作業領域
+    offset *candidates, *postings, *postingEnds;
+
+public:
+
+    // elementsの配列とその要素の所有権を受け取る。shiftsはコピーされる
+    ExtentList_Phrase(ExtentList **elements, const int *shifts, int elementCount, int length);
+
+    ~ExtentList_Phrase();
+
+    bool getFirstStartBiggerEq(offset position, offset *start, offset *end);
+
+    bool getFirstEndBiggerEq(offset position, offset *start, offset *end);
+
+    bool getLastEndSmallerEq(offset position, offset *start, offset *end);
+
+    bool getLastStartSmallerEq(offset position, offset *start, offset *end);
+
+    int64_t getLength();
+
+private:
+
+    // 要素を1つずつ調べて、開始位置がposition以上の最初のフレーズを探す
+    bool findFirstMatch(offset position, offset *start);
+
+    // 開始位置がposition以上のフレーズを先読みする
+    void fillBatch(offset position);
+
+    // candidates[0..count-1]のうち、i番目の要素と一致するものを残し、その数を返す
+    int intersectWithElement(int i, int count);
+};
+
+#endif
@@ -0,0 +1,191 @@
+#include "intersection.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define INTERSECTION_X86 1
+#endif
+
+// 長さの比がこれ以上の場合は、短い方の要素を長い方から指数探索する
+static const int64_t GALLOPING_RATIO = 32;
+
+typedef int64_t (*IntersectionKernel)(const offset *a, int64_t aCount, const offset *b, int64_t bCount,
+        offset delta, offset *result);
+
+// a[0..n-1]の中でa[i] + delta >= targetとなる最初のi(なければn)を、先頭から倍々に広げて探す
+static int64_t gallop(const offset *a, int64_t n, offset delta, offset target) {
+    int64_t low = -1, step = 1;
+    while ((low + step < n) && (a[low + step] + delta < target)) {
+        low += step;
+        step *= 2;
+    }
+    int64_t high = (low + step < n ? low + step : n);
+    while (high - low > 1) {
+        int64_t middle = (low + high) / 2;
+        if (a[middle] + delta < target)
+            low = middle;
+        else
+            high = middle;
+    }
+    return high;
+}
+
+int64_t intersectPostingsScalar(const offset *a, int64_t aCount, const offset *b, int64_t bCount,
+        offset delta, offset *result) {
+    int64_t i = 0, j = 0, count = 0;
+    while ((i < aCount) && (j < bCount)) {
+        offset x = a[i] + delta, y = b[j];
+        if (x == y)
+            result[count++] = a[i];
+        // 分岐を減らすため、等しい場合は両方を進める
+        i += (x <= y);
+        j += (y <= x);
+    }
+    return count;
+}
+
+int64_t intersectPostingsGalloping(const offset *a, int64_t aCount, const offset *b, int64_t bCount,
+        offset delta, offset *result) {
+    int64_t count = 0;
+    if (aCount <= bCount) {
+        int64_t j = 0;
+        for (int64_t i = 0; (i < aCount) && (j < bCount); i++) {
+            offset target = a[i] + delta;
+            j += gallop(b + j, bCount - j, 0, target);
+            if ((j < bCount) && (b[j] == target))
+                result[count++] = a[i];
+        }
+    }
+    else {
+        int64_t i = 0;
+        for (int64_t j = 0; (j < bCount) && (i < aCount); j++) {
+            i += gallop(a + i, aCount - i, delta, b[j]);
+            if ((i < aCount) && (a[i] + delta == b[j]))
+                result[count++] = a[i];
+        }
+    }
+    return count;
+}
+
+#ifdef INTERSECTION_X86
+
+/*
+4要素ずつのブロックaとbを、bを1要素ずつ回転させながら4回比較すれば、
+ブロック内のすべての組み合わせを調べられる。最後の要素が小さい方のブロックを進める
+(等しい場合は両方)。一度一致した要素は、相手のブロックが進むと二度と一致しない
+*/
+__attribute__((target("avx2")))
+int64_t intersectPostingsAVX2(const offset *a, int64_t aCount, const offset *b, int64_t bCount,
+        offset delta, offset *result) {
+    int64_t i = 0, j = 0, count = 0;
+    const __m256i d = _mm256_set1_epi64x(delta);
+    while ((i + 4 <= aCount) && (j + 4 <= bCount)) {
+        __m256i va = _mm256_add_epi64(_mm256_loadu_si256((const __m256i*)(a + i)), d);
+        __m256i vb = _mm256_loadu_si256((const __m256i*)(b + j));
+        __m256i m = _mm256_or_si256(
+                _mm256_or_si256(_mm256_cmpeq_epi64(va, vb),
+                        _mm256_cmpeq_epi64(va, _mm256_permute4x64_epi64(vb, 0x39))),
+                _mm256_or_si256(_mm256_cmpeq_epi64(va, _mm256_permute4x64_epi64(vb, 0x4E)),
+                        _mm256_cmpeq_epi64(va, _mm256_permute4x64_epi64(vb, 0x93))));
+        unsigned int mask = _mm256_movemask_pd(_mm256_castsi256_pd(m));
+        while (mask != 0) {
+            result[count++] = a[i + __builtin_ctz(mask)];
+            mask &= mask - 1;
+        }
+        offset lastA = a[i + 3] + delta, lastB = b[j + 3];
+        i += (lastA <= lastB ? 4 : 0);
+        j += (lastB <= lastA ? 4 : 0);
+    }
+    return count + intersectPostingsScalar(a + i, aCount - i, b + j, bCount - j, delta, result + count);
+}
+
+// AVX2と同じ方法を8要素ずつのブロックで行う。回転はvalignq、書き出しはvpcompressq
+__attribute__((target("avx512f")))
+int64_t intersectPostingsAVX512(const offset *a, int64_t aCount, const offset *b, int64_t bCount,
+        offset delta, offset *result) {
+    int64_t i = 0, j = 0, count = 0;
+    const __m512i d = _mm512_set1_epi64(delta);
+    while ((i + 8 <= aCount) && (j + 8 <= bCount)) {
+        __m512i original = _mm512_loadu_si512((const void*)(a + i));
+        __m512i va = _mm512_add_epi64(original, d);
+        __m512i vb = _mm512_loadu_si512((const void*)(b + j));
+        __mmask8 mask = _mm512_cmpeq_epi64_mask(va, vb);
+        mask |= _mm512_cmpeq_epi64_mask(va, _mm512_alignr_epi64(vb, vb, 1));
+        mask |= _mm512_cmpeq_epi64_mask(va, _mm512_alignr_epi64(vb, vb, 2));
+        mask |= _mm512_cmpeq_epi64_mask(va, _mm512_alignr_epi64(vb, vb, 3));
+        mask |= _mm512_cmpeq_epi64_mask(va, _mm512_alignr_epi64(vb, vb, 4));
+        mask |= _mm512_cmpeq_epi64_mask(va, _mm512_alignr_epi64(vb, vb, 5));
+        mask |= _mm512_cmpeq_epi64_mask(va, _mm512_alignr_epi64(vb, vb, 6));
+        mask |= _mm512_cmpeq_epi64_mask(va, _mm512_alignr_epi64(vb, vb, 7));
+        _mm512_mask_compressstoreu_epi64((void*)(result + count), mask, original);
+        count += __builtin_popcount((unsigned int)mask);
+        offset lastA = a[i + 7] + delta, lastB = b[j + 7];
+        i += (lastA <= lastB ? 8 : 0);
+        j += (lastB <= lastA ? 8 : 0);
+    }
+    return count + intersectPostingsScalar(a + i, aCount - i, b + j, bCount - j, delta, result + count);
+}
+
+bool isAVX2Supported() {
+    return __builtin_cpu_supports("avx2");
+}
+
+bool isAVX512Supported() {
+    return __builtin_cpu_supports("avx512f");
+}
+
+#else
+
+int64_t intersectPostingsAVX2(const offset *a, int64_t aCount, const offset *b, int64_t bCount,
+        offset delta, offset *result) {
+    return intersectPostingsScalar(a, aCount, b, bCount, delta, result);
+}
+
+int64_t intersectPostingsAVX512(const offset *a, int64_t aCount, const offset *b, int64_t bCount,
+        offset delta, offset *result) {
+    return intersectPostingsScalar(a, aCount, b, bCount, delta, result);
+}
+
+bool isAVX2Supported() {
+    return false;
+}
+
+bool isAVX512Supported() {
+    return false;
+}
+
+#endif
+
+static IntersectionKernel selectKernel(const char **name) {
+    if (isAVX512Supported()) {
+        *name = "avx512";
+        return intersectPostingsAVX512;
+    }
+    if (isAVX2Supported()) {
+        *name = "avx2";
+        return intersectPostingsAVX2;
+    }
+    *name = "scalar";
+    return intersectPostingsScalar;
+}
+
+static const char *kernelName;
+
+// 関数内のstatic変数の初期化はスレッドセーフなので、CPUを調べるのは一度だけ
+static IntersectionKernel getKernel() {
+    static IntersectionKernel kernel = selectKernel(&kernelName);
+    return kernel;
+}
+
+int64_t intersectPostings(const offset *a, int64_t aCount, const offset *b, int64_t bCount,
+        offset delta, offset *result) {
+    if ((aCount == 0) || (bCount == 0))
+        return 0;
+    if ((aCount >= GALLOPING_RATIO * bCount) || (bCount >= GALLOPING_RATIO * aCount))
+        return intersectPostingsGalloping(a, aCount, b, bCount, delta, result);
+    return getKernel()(a, aCount, b, bCount, delta, result);
+}
+
+const char *getIntersectionKernelName() {
+    getKernel();
+    return kernelName;
+}
@@ -0,0 +1,50 @@
+#ifndef __INTERSECTION_H
+#define __INTERSECTION_H
+
+/*
+展開済みのポスティングの配列どうしの共通部分を求めるカーネル。
+フレーズの照合では、フレーズの先頭の候補位置aのうち、a + k(kはフレーズ内での語の位置)が
+次の語のポスティングbに現れるものを残す。これを位置の差deltaを付けた共通部分として
+1回の呼び出しで求める。
+
+    スカラー    1要素ずつ比較するマージ
+    AVX2        4要素ずつのブロックを総当たりで比較する(Schlegel et al., 2011; Lemire et al., 2016)
+    AVX-512     8要素ずつのブロックを比較し、一致した要素をcompressで書き出す
+
+どのカーネルを使うかは最初の呼び出しでCPUの対応する命令セットを調べて決める。
+コンパイル時のフラグは必要ない(関数ごとにtarget属性を付けてコンパイルする)。
+片方の配列がもう片方よりずっと長い場合は、短い方の要素を長い方から指数探索する
+*/
+
+#include "../index/index_type.h"
+
+/*
+aの要素xのうち、x + deltaがbに含まれるものを昇順にresultに格納し、その数を返す。
+aとbは狭義単調増加でなければならない。resultはaCount要素分の大きさが必要で、
+aやbと重なってはいけない
+*/
+int64_t intersectPostings(const offset *a, int64_t aCount, const offset *b, int64_t bCount,
+        offset delta, offset *result);
+
+// 以下は各カーネルを直接呼び出す。CPUが対応していない命令セットのものは呼び出さないこと
+int64_t intersectPostingsScalar(const offset *a, int64_t aCount, const offset *b, int64_t bCount,
+        offset delta, offset *result);
+
+int64_t intersectPostingsGalloping(const offset *a, int64_t aCount, const offset *b, int64_t bCount,
+        offset delta, offset *result);
+
+int64_t intersectPostingsAVX2(const offset *a, int64_t aCount, const offset *b, int64_t bCount,
+        offset delta, offset *result);
+
+int64_t intersectPostingsAVX512(const offset *a, int64_t aCount, const offset *b, int64_t bCount,
+        offset delta, offset *result);
+
+// CPUがAVX2、AVX-512のカーネルに対応しているかどうか
+bool isAVX2Supported();
+
+bool isAVX512Supported();
+
+// intersectPostingsが使うカーネルの名前("scalar", "avx2", "avx512")
+const char *getIntersectionKernelName();
+
+#endif
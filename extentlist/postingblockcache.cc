@@ -0,0 +1,101 @@
+#include <cstdlib>
+#include <cstring>
+#include "postingblockcache.h"
+#include "../index/indexview.h"
+#include "../utils/all.h"
+
+const char *PostingBlockCache::LOG_ID = "PostingBlockCache";
+
+// エントリ1つあたりの管理用のメモリの概算
+static const int64_t ENTRY_OVERHEAD = 64;
+
+PostingBlockCache::PostingBlockCache(int64_t capacity) {
+    this->capacity = capacity;
+    memoryUsed = updateListMemory = 0;
+    sweepPosition = 0;
+    epoch = 0;
+    decodedBlockCount = sharedBlockCount = 0;
+}
+
+PostingBlockCache::~PostingBlockCache() {
+    for (auto &entry : blocks)
+        free(entry.second.postings);
+    for (auto &entry : updateListPostings)
+        free(entry.second.postings);
+}
+
+const offset *PostingBlockCache::getBlock(const PBC_Key &key, int *count) {
+    auto it = blocks.find(key);
+    if (it == blocks.end())
+        return nullptr;
+    sharedBlockCount++;
+    *count = it->second.count;
+    return it->second.postings;
+}
+
+const offset *PostingBlockCache::addBlock(const PBC_Key &key, const offset *postings, int count) {
+    decodedBlockCount++;
+    int64_t size = count * sizeof(offset) + ENTRY_OVERHEAD;
+    if ((memoryUsed + size > capacity) && (count > 0) && (postings[count - 1] < sweepPosition))
+        return nullptr;
+    if (memoryUsed + size > capacity)
+        evict();
+    if (memoryUsed + size > capacity)
+        return nullptr;
+    PBC_Block block;
+    block.postings = typed_malloc(offset, count + 1);
+    memcpy(block.postings, postings, count * sizeof(offset));
+    block.count = count;
+    blocks[key] = block;
+    memoryUsed += size;
+    return block.postings;
+}
+
+const offset *PostingBlockCache::getUpdateListPostings(IndexView *view, const char *term, int64_t *count) {
+    auto it = updateListPostings.find(term);
+    if (it == updateListPostings.end()) {
+        PBC_Postings postings;
+        postings.postings = view->getUpdateListPostings(term, &postings.count);
+        updateListMemory += postings.count * sizeof(offset) + ENTRY_OVERHEAD;
+        it = updateListPostings.emplace(term, postings).first;
+    }
+    *count = it->second.count;
+    return it->second.postings;
+}
+
+void PostingBlockCache::evict() {
+    bool evicted = false;
+    for (auto it = blocks.begin(); it != blocks.end(); ) {
+        PBC_Block &block = it->second;
+        if ((block.count > 0) && (block.postings[block.count - 1] >= sweepPosition)) {
+            ++it;
+            continue;
+        }
+        memoryUsed -= block.count * sizeof(offset) + ENTRY_OVERHEAD;
+        free(block.postings);
+        it = blocks.erase(it);
+        evicted = true;
+    }
+    if (evicted)
+        epoch++;
+}
+
+void PostingBlockCache::setSweepPosition(offset position) {
+    sweepPosition = position;
+}
+
+int64_t PostingBlockCache::getEpoch() {
+    return epoch;
+}
+
+int64_t PostingBlockCache::getDecodedBlockCount() {
+    return decodedBlockCount;
+}
+
+int64_t PostingBlockCache::getSharedBlockCount() {
+    return sharedBlockCount;
+}
+
+int64_t PostingBlockCache::getMemoryUsed() {
+    return memoryUsed + updateListMemory;
+}
@@ -0,0 +1,127 @@
+#ifndef __POSTINGBLOCKCACHE_H
+#define __POSTINGBLOCKCACHE_H
+
+/*
+PostingBlockCacheは、同じビューに対する複数の問い合わせの間で、展開済みの
+ポスティングブロックとUpdateListから取り出したポスティングを共有する。
+このキャッシュを与えて作ったPostingListは、ブロックを展開する前にキャッシュを探し、
+展開したブロックをキャッシュに追加する。同じ語を含む問い合わせがいくつあっても、
+各ブロックの読み込みと展開は(追い出されない限り)1回で済む。
+
+問い合わせをアドレス空間の前から順に評価する場合(QueryBatch)は、setSweepPositionで
+現在の位置を知らせる。メモリが上限を超えると、その位置より前で終わるブロックを捨てる。
+捨てるたびにepochを進め、PostingListはepochが変わっていれば現在のブロックを
+キャッシュから引き直すので、捨てられたブロックを参照し続けることはない。
+それでも上限を超える場合は、新しいブロックを保持せずに各PostingListの領域に展開させる。
+
+インスタンスは1つのスレッドからのみ使うこと
+*/
+
+#include <functional>
+#include <string>
+#include <unordered_map>
+#include "../index/index_type.h"
+
+class IndexView;
+
+// ブロックの識別子。セグメントでは(Segment, 語の番号, ブロック番号)、
+// LongListStoreでは(LongListStore, データファイルの世代, ファイル内の位置)
+typedef struct PBC_Key {
+
+    const void *owner;
+    int64_t list;
+    int64_t block;
+
+    bool operator==(const PBC_Key &other) const {
+        return (owner == other.owner) && (list == other.list) && (block == other.block);
+    }
+
+} PBC_Key;
+
+struct PBC_KeyHash {
+    size_t operator()(const PBC_Key &key) const {
+        size_t h = std::hash<const void*>()(key.owner);
+        h = h * 1000003 ^ std::hash<int64_t>()(key.list);
+        return h * 1000003 ^ std::hash<int64_t>()(key.block);
+    }
+};
+
+typedef struct {
+
+    offset *postings;
+    int count;
+
+} PBC_Block;
+
+typedef struct {
+
+    offset *postings;
+    int64_t count;
+
+} PBC_Postings;
+
+class PostingBlockCache {
+
+public:
+
+    static const char *LOG_ID;
+
+private:
+
+    std::unordered_map<PBC_Key, PBC_Block, PBC_KeyHash> blocks;
+
+    // 語ごとのUpdateListのポスティング。PostingListが参照するので捨てない
+    std::unordered_map<std::string, PBC_Postings> updateListPostings;
+
+    // capacityはブロックだけに適用する。UpdateListのポスティングは捨てられないので別に数える
+    int64_t capacity, memoryUsed, updateListMemory;
+
+    // これより前で終わるブロックは、メモリが足りなければ捨ててよい
+    offset sweepPosition;
+
+    // ブロックを捨てるたびに1つ進む
+    int64_t epoch;
+
+    int64_t decodedBlockCount, sharedBlockCount;
+
+public:
+
+    // 最大capacityバイトまでのポスティングを保持するキャッシュを作る
+    PostingBlockCache(int64_t capacity);
+
+    ~PostingBlockCache();
+
+    // 展開済みのブロックを探し、あればその内容を返す。なければnullptrを返す
+    const offset *getBlock(const PBC_Key &key, int *count);
+
+    /*
+    展開したブロックを追加し、キャッシュ内のコピーを返す。
+    メモリが足りない場合は追加せずにnullptrを返す
+    */
+    const offset *addBlock(const PBC_Key &key, const offset *postings, int count);
+
+    /*
+    viewのUpdateListに含まれるtermのポスティングを返す。同じ語については1回だけ取り出す。
+    返される配列はキャッシュが所有する
+    */
+    const offset *getUpdateListPostings(IndexView *view, const char *term, int64_t *count);
+
+    void setSweepPosition(offset position);
+
+    int64_t getEpoch();
+
+    // addBlockで追加された(実際に展開された)ブロックの数
+    int64_t getDecodedBlockCount();
+
+    // getBlockで見つかった(展開を省略できた)ブロックの数
+    int64_t getSharedBlockCount();
+
+    int64_t getMemoryUsed();
+
+private:
+
+    // sweepPositionより前で終わるブロックを捨てる
+    void evict();
+};
+
+#endif
@@ -0,0 +1,482 @@
+#include <cassert>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include "extentlist.h"
+#include "postingblockcache.h"
+#include "../index/doclevel.h"
+#include "../index/extentset.h"
+#include "../index/indexview.h"
+#include "../index/longliststore.h"
+#include "../utils/all.h"
+
+/*
+key(0..n-1)は単調増加。key(i) >= targetとなる最初のiを返す(なければn)。
+hintから前後に幅を倍々に広げて範囲を絞り込んでから2分探索するので、
+直前の位置から近い要素ほど少ない比較回数で見つかる
+*/
+template<typename KeyFunction>
+static int64_t gallopFirstAtLeast(int64_t n, int64_t hint, offset target, KeyFunction key) {
+    if (n == 0)
+        return 0;
+    if ((hint < 0) || (hint >= n))
+        hint = 0;
+    // 答えは(low, high]にある
+    int64_t low, high, step = 1;
+    if (key(hint) < target) {
+        low = hint;
+        while ((low + step < n) && (key(low + step) < target)) {
+            low += step;
+            step *= 2;
+        }
+        high = std::min(low + step, n);
+    }
+    else {
+        high = hint;
+        while ((high - step >= 0) && (key(high - step) >= target)) {
+            high -= step;
+            step *= 2;
+        }
+        low = std::max(high - step, (int64_t)-1);
+    }
+    while (high - low > 1) {
+        int64_t middle = (low + high) / 2;
+        if (key(middle) < target)
+            low = middle;
+        else
+            high = middle;
+    }
+    return high;
+}
+
+PostingList::PostingList(IndexView *view, const char *term) {
+    initialize(view, term, nullptr);
+}
+
+PostingList::PostingList(IndexView *view, const char *term, PostingBlockCache *blockCache) {
+    initialize(view, term, blockCache);
+}
+
+void PostingList::initialize(IndexView *view, const char *term, PostingBlockCache *blockCache) {
+    this->view = view;
+    this->blockCache = blockCache;
+    view->addReference();
+    this->term = duplicateString(term);
+    length = 0;
+    span = (strchr(term, BIGRAM_SEPARATOR) != nullptr ? 2 : 1);
+    shift = getPostingShift(term);
+
+    sources = typed_malloc(PL_Source, view->segmentCount + 1);
+    sourceCount = 0;
+    for (int i = 0; i < view->segmentCount; i++) {
+        Segment *segment = view->segments[i];
+        int64_t termIndex = segment->findTerm(term);
+        if (termIndex < 0)
+            continue;
+        const SegmentTermEntry *entry = segment->getTermEntry(termIndex);
+        if (entry->blockCount == 0)
+            continue;
+        PL_Source *source = &sources[sourceCount++];
+        memset(source, 0, sizeof(PL_Source));
+        source->segment = segment;
+        source->termIndex = termIndex;
+        source->blocks = segment->getSkipEntries(termIndex);
+        source->blockCount = entry->blockCount;
+        source->bufferBlock = -1;
+        length += entry->postingCount;
+    }
+    if (view->longLists != nullptr) {
+        PL_Source *source = &sources[sourceCount];
+        memset(source, 0, sizeof(PL_Source));
+        source->bufferBlock = -1;
+        reloadLongList(source);
+        if (source->blockCount > 0) {
+            for (int b = 0; b < source->blockCount; b++)
+                length += source->blocks[b].postingCount;
+            sourceCount++;
+        }
+        else
+            free((void*)source->blocks);
+    }
+
+    if (blockCache != nullptr)
+        memoryPostings = (offset*)blockCache->getUpdateListPostings(view, term, &memoryCount);
+    else
+        memoryPostings = view->getUpdateListPostings(term, &memoryCount);
+    memoryHint = 0;
+    length += memoryCount;
+
+    memoryBlocks = nullptr;
+    memoryBlockCount = 0;
+    mergeBuffer = nullptr;
+    mergeBufferSize = 0;
+    if ((shift > 0) && (memoryCount > 0)) {
+        memoryBlockCount = (memoryCount + SEGMENT_BLOCK_SIZE - 1) / SEGMENT_BLOCK_SIZE;
+        memoryBlocks = typed_malloc(SegmentSkipEntry, memoryBlockCount);
+        for (int b = 0; b < memoryBlockCount; b++) {
+            int64_t start = (int64_t)b * SEGMENT_BLOCK_SIZE;
+            int n = std::min(memoryCount - start, (int64_t)SEGMENT_BLOCK_SIZE);
+            memset(&memoryBlocks[b], 0, sizeof(SegmentSkipEntry));
+            memoryBlocks[b].firstPosting = memoryPostings[start];
+            memoryBlocks[b].lastPosting = memoryPostings[start + n - 1];
+            memoryBlocks[b].postingCount = n;
+            computeBlockImpact(term, &memoryPostings[start], n, &memoryBlocks[b]);
+        }
+    }
+}
+
+PostingList::~PostingList() {
+    for (int i = 0; i < sourceCount; i++) {
+        if (sources[i].segment == nullptr)
+            free((void*)sources[i].blocks);
+        free(sources[i].buffer);
+    }
+    free(sources);
+    free(memoryBlocks);
+    free(mergeBuffer);
+    if (blockCache == nullptr)
+        free(memoryPostings);
+    free(term);
+    view->release();
+}
+
+void PostingList::reloadLongList(PL_Source *source) {
+    free((void*)source->blocks);
+    source->blocks = view->longLists->getSkipEntries(term, &source->blockCount, &source->longListGeneration,
+            view->longListSequence);
+    source->bufferBlock = -1;
+    source->blockHint = source->bufferHint = 0;
+}
+
+bool PostingList::loadBlock(PL_Source *source, int block) {
+    if ((source->bufferBlock == block) && ((blockCache == nullptr) || (source->cacheEpoch == blockCache->getEpoch())))
+        return true;
+    int previousBlock = source->bufferBlock;
+    PBC_Key key;
+    if (blockCache != nullptr) {
+        if (source->segment != nullptr)
+            key = { source->segment, source->termIndex, block };
+        else
+            key = { view->longLists, source->longListGeneration, source->blocks[block].filePosition };
+        int count;
+        const offset *cached = blockCache->getBlock(key, &count);
+        if (cached != nullptr) {
+            source->data = cached;
+            source->bufferCount = count;
+            source->bufferBlock = block;
+            source->cacheEpoch = blockCache->getEpoch();
+            if (block != previousBlock)
+                source->bufferHint = 0;
+            return true;
+        }
+    }
+
+    if (source->buffer == nullptr)
+        source->buffer = typed_malloc(offset, SEGMENT_BLOCK_SIZE);
+    int count;
+    if (source->segment != nullptr)
+        count = source->segment->decodeBlock(source->termIndex, block, source->buffer);
+    else
+        count = view->longLists->decodeBlock(&source->blocks[block], source->buffer, source->longListGeneration);
+    if (count <= 0) {
+        source->bufferBlock = -1;
+        return false;
+    }
+    source->data = source->buffer;
+    if (blockCache != nullptr) {
+        const offset *shared = blockCache->addBlock(key, source->buffer, count);
+        if (shared != nullptr)
+            source->data = shared;
+        source->cacheEpoch = blockCache->getEpoch();
+    }
+    source->bufferCount = count;
+    source->bufferBlock = block;
+    if (block != previousBlock)
+        source->bufferHint = 0;
+    return true;
+}
+
+bool PostingList::findFirstInSource(PL_Source *source, offset position, offset *result) {
+    // LongListStoreがガベージコレクションで置き換えられた場合は、ブロック一覧を取得し直して再試行する
+    for (int attempt = 0; attempt < 2; attempt++) {
+        const SegmentSkipEntry *blocks = source->blocks;
+        int block = gallopFirstAtLeast(source->blockCount, source->blockHint, position,
+                [blocks](int64_t i) { return blocks[i].lastPosting; });
+        if (block >= source->blockCount)
+            return false;
+        source->blockHint = block;
+        if (!loadBlock(source, block)) {
+            if (source->segment != nullptr)
+                return false;
+            reloadLongList(source);
+            continue;
+        }
+        const offset *buffer = source->data;
+        int64_t i = gallopFirstAtLeast(source->bufferCount, source->bufferHint, position,
+                [buffer](int64_t i) { return buffer[i]; });
+        if (i >= source->bufferCount)
+            return false;
+        source->bufferHint = i;
+        *result = buffer[i];
+        return true;
+    }
+    return false;
+}
+
+bool PostingList::findLastInSource(PL_Source *source, offset position, offset *result) {
+    for (int attempt = 0; attempt < 2; attempt++) {
+        // 最初のポスティングがposition以下の最後のブロック
+        const SegmentSkipEntry *blocks = source->blocks;
+        int block = gallopFirstAtLeast(source->blockCount, source->blockHint, position + 1,
+                [blocks](int64_t i) { return blocks[i].firstPosting; }) - 1;
+        if (block < 0)
+            return false;
+        source->blockHint = block;
+        if (!loadBlock(source, block)) {
+            if (source->segment != nullptr)
+                return false;
+            reloadLongList(source);
+            continue;
+        }
+        const offset *buffer = source->data;
+        int64_t i = gallopFirstAtLeast(source->bufferCount, source->bufferHint, position + 1,
+                [buffer](int64_t i) { return buffer[i]; }) - 1;
+        if (i < 0)
+            return false;
+        source->bufferHint = i;
+        *result = buffer[i];
+        return true;
+    }
+    return false;
+}
+
+bool PostingList::findFirst(offset position, offset *result) {
+    bool found = false;
+    offset p;
+    for (int i = 0; i < sourceCount; i++)
+        if (findFirstInSource(&sources[i], position, &p))
+            if ((!found) || (p < *result)) {
+                *result = p;
+                found = true;
+            }
+    if (memoryCount > 0) {
+        const offset *postings = memoryPostings;
+        int64_t i = gallopFirstAtLeast(memoryCount, memoryHint, position,
+                [postings](int64_t i) { return postings[i]; });
+        if (i < memoryCount) {
+            memoryHint = i;
+            if ((!found) || (postings[i] < *result)) {
+                *result = postings[i];
+                found = true;
+            }
+        }
+    }
+    return found;
+}
+
+bool PostingList::findLast(offset position, offset *result) {
+    bool found = false;
+    offset p;
+    for (int i = 0; i < sourceCount; i++)
+        if (findLastInSource(&sources[i], position, &p))
+            if ((!found) || (p > *result)) {
+                *result = p;
+                found = true;
+            }
+    if (memoryCount > 0) {
+        const offset *postings = memoryPostings;
+        int64_t i = gallopFirstAtLeast(memoryCount, memoryHint, position + 1,
+                [postings](int64_t i) { return postings[i]; }) - 1;
+        if (i >= 0) {
+            memoryHint = i;
+            if ((!found) || (postings[i] > *result)) {
+                *result = postings[i];
+                found = true;
+            }
+        }
+    }
+    return found;
+}
+
+bool PostingList::getFirstStartBiggerEq(offset position, offset *start, offset *end) {
+    offset posting, deletedStart, deletedEnd;
+    while (findFirst(position, &posting)) {
+        if (view->deletedExtents->findContaining(posting >> shift, &deletedStart, &deletedEnd))
+            position = (deletedEnd + 1) << shift;
+        else if ((span > 1) && (view->deletedExtents->intersects(posting, posting + span - 1)))
+            position = posting + 1;
+        else {
+            *start = *end = posting;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool PostingList::getFirstEndBiggerEq(offset position, offset *start, offset *end) {
+    return getFirstStartBiggerEq(position, start, end);
+}
+
+bool PostingList::getLastEndSmallerEq(offset position, offset *start, offset *end) {
+    offset posting, deletedStart, deletedEnd;
+    while (findLast(position, &posting)) {
+        if (view->deletedExtents->findContaining((posting >> shift) + span - 1, &deletedStart, &deletedEnd))
+            position = ((deletedStart - span + 1) << shift) - 1;
+        else if ((span > 1) && (view->deletedExtents->contains(posting)))
+            position = posting - 1;
+        else {
+            *start = *end = posting;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool PostingList::getLastStartSmallerEq(offset position, offset *start, offset *end) {
+    return getLastEndSmallerEq(position, start, end);
+}
+
+int PostingList::collectFromSource(PL_Source *source, offset from, offset to, int n, offset *result) {
+    offset first;
+    if ((n <= 0) || (!findFirstInSource(source, from, &first)) || (first > to))
+        return 0;
+    int block = source->bufferBlock, count = 0;
+    int64_t i = source->bufferHint;
+    while (true) {
+        const offset *buffer = source->data;
+        while ((i < source->bufferCount) && (count < n) && (buffer[i] <= to))
+            result[count++] = buffer[i++];
+        if ((count >= n) || (i < source->bufferCount))
+            break;
+        if ((block + 1 >= source->blockCount) || (source->blocks[block + 1].firstPosting > to))
+            break;
+        if (!loadBlock(source, ++block))
+            return -1;
+        i = 0;
+    }
+    source->blockHint = block;
+    source->bufferHint = std::min(i, (int64_t)source->bufferCount - 1);
+    return count;
+}
+
+int PostingList::collectFromMemory(offset from, offset to, int n, offset *result) {
+    const offset *postings = memoryPostings;
+    int64_t i = gallopFirstAtLeast(memoryCount, memoryHint, from,
+            [postings](int64_t i) { return postings[i]; });
+    int count = 0;
+    while ((i < memoryCount) && (count < n) && (postings[i] <= to))
+        result[count++] = postings[i++];
+    memoryHint = std::min(i, memoryCount - 1);
+    return count;
+}
+
+int PostingList::getNextN(offset from, offset to, int n, offset *starts, offset *ends) {
+    int result = 0;
+    if ((n <= 0) || (from > to))
+        return 0;
+    // 新しい読み取り元のポスティング(最大n個)の後ろに、併合の結果(最大2n個)を書く
+    if (mergeBufferSize < 3 * (int64_t)n) {
+        mergeBufferSize = 3 * (int64_t)n;
+        typed_realloc(offset, mergeBuffer, mergeBufferSize);
+    }
+    bool checkDeletions = (view->deletedExtents->getCount() > 0);
+    while (result < n) {
+        /*
+        読み取り元ごとに最大wanted個を取り出して併合し、小さい方からwanted個を使う。
+        wanted個を返した読み取り元があるか、併合で切り捨てたポスティングがあれば、
+        最後に使ったポスティングより後ろにまだ読んでいないポスティングがあるので、
+        次の回で続きを読む
+        */
+        int wanted = n - result, count = 0;
+        bool more = false;
+        offset *merged = starts + result;
+        for (int s = 0; s <= sourceCount; s++) {
+            offset *target = (count == 0 ? merged : mergeBuffer);
+            int found;
+            if (s < sourceCount)
+                found = collectFromSource(&sources[s], from, to, wanted, target);
+            else
+                found = (memoryCount > 0 ? collectFromMemory(from, to, wanted, target) : 0);
+            if (found < 0)
+                return result + ExtentList::getNextN(from, to, n - result, starts + result, ends + result);
+            if (found == wanted)
+                more = true;
+            if ((found == 0) || (target == merged)) {
+                count += found;
+                continue;
+            }
+            std::merge(merged, merged + count, mergeBuffer, mergeBuffer + found, mergeBuffer + found);
+            if (count + found > wanted)
+                more = true;
+            count = std::min(count + found, wanted);
+            memcpy(merged, mergeBuffer + found, count * sizeof(offset));
+        }
+        if (count == 0)
+            break;
+        offset last = merged[count - 1];
+        if (checkDeletions) {
+            // getFirstStartBiggerEqと同じ条件で、削除された範囲のポスティングを取り除く
+            int kept = 0;
+            for (int k = 0; k < count; k++) {
+                offset posting = merged[k];
+                if (view->deletedExtents->contains(posting >> shift))
+                    continue;
+                if ((span > 1) && (view->deletedExtents->intersects(posting, posting + span - 1)))
+                    continue;
+                merged[kept++] = posting;
+            }
+            count = kept;
+        }
+        memcpy(ends + result, merged, count * sizeof(offset));
+        result += count;
+        if ((!more) || (last >= to))
+            break;
+        from = last + 1;
+    }
+    return result;
+}
+
+int64_t PostingList::getLength() {
+    return length;
+}
+
+bool PostingList::getImpactBound(offset position, int *maxTF, int *minLengthCode, offset *lastPosting) {
+    bool found = false;
+    *maxTF = 0;
+    *minLengthCode = DOC_LEVEL_MAX_LENGTH_CODE;
+    auto addBlock = [&](const SegmentSkipEntry *block) {
+        if (block->maxTF > *maxTF)
+            *maxTF = block->maxTF;
+        if (block->minLengthCode < *minLengthCode)
+            *minLengthCode = block->minLengthCode;
+        if ((!found) || (block->lastPosting < *lastPosting))
+            *lastPosting = block->lastPosting;
+        found = true;
+    };
+    for (int i = 0; i < sourceCount; i++) {
+        PL_Source *source = &sources[i];
+        const SegmentSkipEntry *blocks = source->blocks;
+        int block = gallopFirstAtLeast(source->blockCount, source->blockHint, position,
+                [blocks](int64_t i) { return blocks[i].lastPosting; });
+        if (block < source->blockCount)
+            addBlock(&blocks[block]);
+    }
+    if (memoryBlockCount > 0) {
+        const SegmentSkipEntry *blocks = memoryBlocks;
+        int block = gallopFirstAtLeast(memoryBlockCount, memoryHint / SEGMENT_BLOCK_SIZE, position,
+                [blocks](int64_t i) { return blocks[i].lastPosting; });
+        if (block < memoryBlockCount)
+            addBlock(&blocks[block]);
+    }
+    return found;
+}
+
+double PostingList::getMaxImpact(double (*impact)(int maxTF, int minLengthCode, void *data), void *data) {
+    double result = 0;
+    for (int i = 0; i < sourceCount; i++)
+        for (int b = 0; b < sources[i].blockCount; b++)
+            result = std::max(result, impact(sources[i].blocks[b].maxTF, sources[i].blocks[b].minLengthCode, data));
+    for (int b = 0; b < memoryBlockCount; b++)
+        result = std::max(result, impact(memoryBlocks[b].maxTF, memoryBlocks[b].minLengthCode, data));
+    return result;
+}
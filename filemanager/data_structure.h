@@ -6,16 +6,16 @@
 #include <sys/stat.h>
 #include <unistd.h>
 
-// このマジックナンバーは、DirectoryContent内のソートされた配列で空スロットを示すために使用される
-#define DC_TYPE_SLOT 984732861
+// DirectoryContentのハッシュ表で空スロットを示すID(子のIDは0にならない)
+#define DC_EMPTY_SLOT 0
 
 typedef struct {
-    /* スロットのハッシュ値　ソートのために使用される */
+    /* 子の名前のハッシュ値。ハッシュ表での位置を決めるために使用される */
     int32_t hashValue;
 
     /*
     参照するオブジェクト(ファイルまたはディレクトリ)のID
-    スロットが何も含んでいない(子が削除された)場合はDC_EMPTY_SLOTになる
+    スロットが何も含んでいない場合はDC_EMPTY_SLOTになる
     */
     int32_t id;
 
@@ -23,23 +23,14 @@ typedef struct {
 
 typedef struct DicrectoryContent {
 
-    /*
-    ディレクトリ内のファイルおよびディレクトリの数
-    最近ファイルが削除された場合、この数値は(longAllocated + shortCount)と異なることがある
-    */
+    /* ディレクトリ内のファイルおよびディレクトリの数 */
     int32_t count;
 
-    /* ロングリスト内のIDの数 */
-    int32_t longAllocated;
-
-    /* ロングリスト本体 */
-    DC_ChildSlot *longList;
+    /* ハッシュ表のスロット数。子が無い場合は0 */
+    int32_t slotCount;
 
-    /* ソート済みリストにまだ統合されていない追加済みの子の数 */
-    int16_t shortCount, shortSlotsAllocated;
-
-    /* ディレクトリに追加された子のリスト */
-    DC_ChildSlot *shortList;
+    /* 開番地法(Robin Hood hashing)のハッシュ表 */
+    DC_ChildSlot *slots;
 
 } DicrectoryContent;
 
@@ -48,9 +39,8 @@ typedef struct DicrectoryContent {
 /*
 IndexDirectoryデータ構造はファイルシステムのディレクトリ構造を表すために使用される
 各ディレクトリには一意のIDと親ディレクトリが割当てられる
-各ディレクトリについて、その子(ディレクトリとファイル)すべてを含む
-平衡探索木(バランスドツリー)を保持する
-木のノードは名前のハッシュ値によってソートされる
+ディスク上の表(FM_TableHeaderに続く配列)をそのままmmapして使うので、ポインタは含めない。
+子(ディレクトリとファイル)の一覧はFileManagerがメモリ上のDirectoryContentとして別に持つ
 */
 typedef struct {
 
@@ -82,19 +72,85 @@ typedef struct {
     /* 高速アクセスのために、名前のハッシュ値をここに保存する */
     int32_t hashValue;
 
-    /* このディレクトリのすべての子(ファイルとディレクトリ)を格納する構造体 */
-    DicrectoryContent children;
-
 } IndexDirectory;
 
 #define MAX_FILE_NAME_LENGTH (64 - 2 * sizeof(int32_t) - 1)
 
 typedef struct {
+    /* ファイルの実体を表すINodeのID。スロットが空の場合は-1 */
     int32_t iNode;
 
+    /* ファイルを含むディレクトリのID */
     int32_t parent;
 
+    /* 高速アクセスのために、名前のハッシュ値をここに保存する */
     int32_t hashValue;
+
+    /* ファイル名 */
+    char name[MAX_FILE_NAME_LENGTH + 1];
 } IndexedFile;
 
+/*
+IndexedINodeはインデックスに含まれるファイルの実体を表す。
+INodeのIDはファイルが追加された順(アドレス空間の昇順)に割り当てられ、再利用されない
+*/
+typedef struct {
+    /* ファイルが占めるアドレス空間の先頭とトークン数 */
+    offset startOffset;
+    uint32_t tokenCount;
+
+    /* ファイルの所有者とグループ、Unixスタイルのパーミッション */
+    uid_t owner;
+    gid_t group;
+    mode_t permissions;
+
+    /*
+    このINodeを参照するファイルのID。ファイルが削除された場合は-1になるが、
+    startOffsetとtokenCountは削除された範囲を知るために残される
+    */
+    int32_t file;
+} IndexedINode;
+
+/* ディスク上の表の先頭を示すマジックナンバーと、表の形式の版 */
+#define FM_TABLE_MAGIC 0x464d5442
+#define FM_TABLE_VERSION 1
+
+/*
+FileManagerの表(ディレクトリ、ファイル、INode)のファイルの先頭に置くヘッダ。
+ヘッダの領域はFM_TABLE_HEADER_SIZEバイトで、その後にslotsAllocated個の要素が
+固定の配置で続く。要素の配列はページ境界から始まるので、ファイルをmmapすれば
+読み込みや変換なしにそのまま配列として使える
+*/
+typedef struct {
+
+    /* FM_TABLE_MAGIC */
+    int32_t magic;
+
+    /* FM_TABLE_VERSION。異なる場合は読み込まない */
+    int32_t version;
+
+    /* 1つの要素の大きさ(バイト)。構造体の配置が変わった場合に検出するために使う */
+    int32_t recordSize;
+
+    /* 確保されているスロット数 */
+    int32_t slotsAllocated;
+
+    /* 使用中の要素の数 */
+    int32_t count;
+
+    /* これまでに使われたことのあるIDの最大値 + 1(これより後のスロットはすべて空) */
+    int32_t slotsUsed;
+
+    /* INodeの表のみ: 最も最近追加されたINodeのID、最大のオフセット、ファイルが占めるアドレス空間 */
+    int32_t biggestINodeID;
+    offset biggestOffset;
+    offset addressSpaceCovered;
+
+    /* ディレクトリの表のみ: マウントポイント */
+    char mountPoint[256];
+
+} FM_TableHeader;
+
+#define FM_TABLE_HEADER_SIZE 4096
+
 #endif
\ No newline at end of file
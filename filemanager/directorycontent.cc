@@ -1,16 +1,135 @@
-#include <cmath>
 #include <cstdio>
 #include <cstring>
+#include <utility>
 #include "directorycontent.h"
 #include "data_structure.h"
 #include "filemanager.h"
 #include "../utils/all.h"
 
+// 表の使用率の上限と下限(10分の1単位)。大きさを変えた後の使用率は約0.75になる
+static const int MAX_LOAD = 9;
+static const int MIN_LOAD = 5;
+
+static const int32_t MINIMUM_SLOT_COUNT = 4;
+
 void initializeDirectoryContent(DicrectoryContent *dc) {
     dc->count = 0;
-    dc->longAllocated = 0;
-    dc->longList = nullptr;
-    dc->shortCount = 0;
-    dc->shortSlotsAllocated = 4;
-    dc->shortList = typed_malloc(DC_ChildSlot, dc->shortSlotsAllocated);
-}
\ No newline at end of file
+    dc->slotCount = 0;
+    dc->slots = nullptr;
+}
+
+void freeDirectoryContent(DicrectoryContent *dc) {
+    free(dc->slots);
+    dc->slots = nullptr;
+    dc->count = dc->slotCount = 0;
+}
+
+// ハッシュ値のホームスロット。名前のハッシュ値の下位ビットは偏るので混ぜてから上位ビットを使う
+static inline int32_t getHomeSlot(int32_t hashValue, int32_t slotCount) {
+    uint32_t mixed = (uint32_t)hashValue * 2654435761u;
+    return (int32_t)(((uint64_t)mixed * (uint32_t)slotCount) >> 32);
+}
+
+// スロットposに置かれた要素のホームスロットからの距離
+static inline int32_t getProbeDistance(const DC_ChildSlot &slot, int32_t position, int32_t slotCount) {
+    int32_t distance = position - getHomeSlot(slot.hashValue, slotCount);
+    return (distance < 0 ? distance + slotCount : distance);
+}
+
+static void insertSlot(DC_ChildSlot *slots, int32_t slotCount, DC_ChildSlot slot) {
+    int32_t position = getHomeSlot(slot.hashValue, slotCount), distance = 0;
+    while (slots[position].id != DC_EMPTY_SLOT) {
+        // ホームスロットからの距離が短い要素を追い出して、距離のばらつきを抑える
+        int32_t existing = getProbeDistance(slots[position], position, slotCount);
+        if (existing < distance) {
+            std::swap(slot, slots[position]);
+            distance = existing;
+        }
+        if (++position == slotCount)
+            position = 0;
+        distance++;
+    }
+    slots[position] = slot;
+}
+
+// 表をslotCount個のスロットに作り直す
+static void resize(DicrectoryContent *dc, int32_t slotCount) {
+    DC_ChildSlot *slots = typed_malloc(DC_ChildSlot, slotCount);
+    for (int32_t i = 0; i < slotCount; i++)
+        slots[i].id = DC_EMPTY_SLOT;
+    for (int32_t i = 0; i < dc->slotCount; i++)
+        if (dc->slots[i].id != DC_EMPTY_SLOT)
+            insertSlot(slots, slotCount, dc->slots[i]);
+    free(dc->slots);
+    dc->slots = slots;
+    dc->slotCount = slotCount;
+}
+
+// 子がcount個の場合の表の大きさ(使用率約0.75)
+static int32_t getSlotCount(int32_t count) {
+    int32_t result = count + count / 3 + 1;
+    return (result < MINIMUM_SLOT_COUNT ? MINIMUM_SLOT_COUNT : result);
+}
+
+void addChild(DicrectoryContent *dc, int32_t hashValue, int32_t id) {
+    if ((int64_t)(dc->count + 1) * 10 > (int64_t)dc->slotCount * MAX_LOAD) {
+        // 1.25倍ずつ大きくするので、再配置のコストは子1つあたり定数になる
+        int32_t slotCount = getSlotCount(dc->count + 1);
+        if (slotCount < dc->slotCount + dc->slotCount / 4)
+            slotCount = dc->slotCount + dc->slotCount / 4;
+        resize(dc, slotCount);
+    }
+    DC_ChildSlot slot;
+    slot.hashValue = hashValue;
+    slot.id = id;
+    insertSlot(dc->slots, dc->slotCount, slot);
+    dc->count++;
+}
+
+bool removeChild(DicrectoryContent *dc, int32_t hashValue, int32_t id) {
+    if (dc->slotCount == 0)
+        return false;
+    int32_t position = getHomeSlot(hashValue, dc->slotCount), distance = 0;
+    while (true) {
+        DC_ChildSlot &slot = dc->slots[position];
+        if ((slot.id == DC_EMPTY_SLOT) || (getProbeDistance(slot, position, dc->slotCount) < distance))
+            return false;
+        if (slot.id == id)
+            break;
+        if (++position == dc->slotCount)
+            position = 0;
+        distance++;
+    }
+    // 後続の要素をホームスロットに近づく方向に1つずつ詰める
+    int32_t next = (position + 1 == dc->slotCount ? 0 : position + 1);
+    while ((dc->slots[next].id != DC_EMPTY_SLOT) && (getProbeDistance(dc->slots[next], next, dc->slotCount) > 0)) {
+        dc->slots[position] = dc->slots[next];
+        position = next;
+        next = (next + 1 == dc->slotCount ? 0 : next + 1);
+    }
+    dc->slots[position].id = DC_EMPTY_SLOT;
+    dc->count--;
+    if (dc->count == 0)
+        freeDirectoryContent(dc);
+    else if (((int64_t)dc->count * 10 < (int64_t)dc->slotCount * MIN_LOAD) && (dc->slotCount > MINIMUM_SLOT_COUNT))
+        resize(dc, getSlotCount(dc->count));
+    return true;
+}
+
+int getChildrenByHash(DicrectoryContent *dc, int32_t hashValue, int32_t *ids, int maxCount) {
+    if (dc->slotCount == 0)
+        return 0;
+    int result = 0;
+    int32_t position = getHomeSlot(hashValue, dc->slotCount), distance = 0;
+    while (result < maxCount) {
+        const DC_ChildSlot &slot = dc->slots[position];
+        if ((slot.id == DC_EMPTY_SLOT) || (getProbeDistance(slot, position, dc->slotCount) < distance))
+            break;
+        if (slot.hashValue == hashValue)
+            ids[result++] = slot.id;
+        if (++position == dc->slotCount)
+            position = 0;
+        distance++;
+    }
+    return result;
+}
@@ -3,13 +3,18 @@
 
 /*
 DirectoryContentはディレクトリの内容(ファイルとサブディレクトリ)を管理するために
-使用される。メモリ使用量を抑えるため、２分探索木ではなく長いソート済みリストと、
-短いソートされていないIDリストを使用する。
-短いリストの長さはsqrt(n)となり、nは長いリストの長さ
-これにより、O(sqrt(n))で検索できる
-これは、約10000個未満の子ディレクトリを含むディレクトリであれば許容できる時間
+使用される。子は名前のハッシュ値をキーとする開番地法のハッシュ表(Robin Hood hashing)に
+格納するので、子が数百万あるディレクトリでも検索、追加、削除は期待O(1)で、
+ソートし直しのような全体の作業は表の大きさを変える場合にしか起きない。
+探索はホームスロットからの距離が自分より短いスロットに出会った時点で打ち切り、
+削除は後ろのスロットを前に詰める(backward shift)ので削除済みの印は残らない。
+
+スロットは8バイトで、使用率を0.5から0.9の間に保つので、子1つあたりのメモリは
+およそ9バイトから16バイトになる。表の大きさは2のべき乗ではなく、
+子の数に合わせて1.25倍ずつ増やす。
 DirectoryContentオブジェクトには多数のファイルIDとディレクトリIDが含まれる
 正のID値はファイルを参照し、負のID値はディレクトリを参照する
+(makeFileEntryとmakeDirectoryEntryで変換する)
 */
 
 #include <sys/types.h>
@@ -18,6 +23,39 @@ DirectoryContentオブジェクトには多数のファイルIDとディレク
 
 class FileManager;
 
+// ファイルIDとディレクトリIDを、DirectoryContentに格納する値に変換する
+static inline int32_t makeFileEntry(int32_t fileID) {
+    return fileID + 1;
+}
+
+static inline int32_t makeDirectoryEntry(int32_t directoryID) {
+    return -(directoryID + 1);
+}
+
+static inline bool isFileEntry(int32_t entry) {
+    return entry > 0;
+}
+
+// makeFileEntryまたはmakeDirectoryEntryの逆変換
+static inline int32_t getEntryID(int32_t entry) {
+    return (entry > 0 ? entry - 1 : -entry - 1);
+}
+
 void initializeDirectoryContent(DicrectoryContent *dc);
 
-#endif
\ No newline at end of file
+// dcが確保したメモリを開放する
+void freeDirectoryContent(DicrectoryContent *dc);
+
+// ハッシュ値hashValueを持つ子idを追加する
+void addChild(DicrectoryContent *dc, int32_t hashValue, int32_t id);
+
+// 子idを取り除く。見つからなかった場合はfalseを返す
+bool removeChild(DicrectoryContent *dc, int32_t hashValue, int32_t id);
+
+/*
+ハッシュ値がhashValueの子を最大maxCount個idsに格納し、その数を返す。
+名前の比較は呼び出し元で行う
+*/
+int getChildrenByHash(DicrectoryContent *dc, int32_t hashValue, int32_t *ids, int maxCount);
+
+#endif
@@ -3,10 +3,14 @@
 #include <pwd.h>
 #include <cstring>
 #include <cassert>
+#include <string>
+#include <unistd.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include "filemanager.h"
 #include "directorycontent.h"
+#include "pathcache.h"
 #include "../utils/all.h"
 #include "../index/index.h"
 
@@ -16,21 +20,134 @@
 
 const char *FileManager::LOG_ID = "FileManager";
 const int FileManager::MINIMUM_SLOT_COUNT;
-const double FileManager::SLOT_GROWTH_RATE;
-const double FileManager::SLOT_REPACK_THRESHOLD;
-const off_t FileManager::INODE_FILE_HEADER_SIZE;
+
+// 1つのディレクトリの中で同じハッシュ値を持つ子の最大数
+static const int MAX_HASH_COLLISIONS = 64;
+
+static char errorMessage[256];
+
+static void openTable(FM_Table *table, const char *fileName, int flags, bool shared) {
+    table->fd = open(fileName, flags, DEFAULT_FILE_PERMISSIONS);
+    table->shared = shared;
+    table->mapping = nullptr;
+    table->mappingSize = 0;
+}
+
+static void unmapTable(FM_Table *table) {
+    if (table->mapping != nullptr)
+        munmap(table->mapping, table->mappingSize);
+    table->mapping = nullptr;
+    table->mappingSize = 0;
+}
+
+static FM_TableHeader *getHeader(FM_Table *table) {
+    return (FM_TableHeader*)table->mapping;
+}
+
+static void *getRecords(FM_Table *table) {
+    return table->mapping + FM_TABLE_HEADER_SIZE;
+}
+
+/*
+表の割り当てをslots個の要素が入る大きさに広げる。共有の割り当てではファイルも拡張する。
+MAP_PRIVATEでファイルを割り当てている場合はファイルの末尾を越えて広げられないのでfalseを返す
+*/
+static bool resizeTable(FM_Table *table, int32_t recordSize, int32_t slots) {
+    size_t size = FM_TABLE_HEADER_SIZE + (size_t)slots * recordSize;
+    if ((table->mapping != nullptr) && (size <= table->mappingSize))
+        return true;
+    if (table->fd >= 0) {
+        if (table->shared) {
+            if (ftruncate(table->fd, size) != 0)
+                return false;
+        }
+        else if (table->mapping != nullptr)
+            return false;
+    }
+    void *mapping;
+    if (table->mapping != nullptr)
+        mapping = mremap(table->mapping, table->mappingSize, size, MREMAP_MAYMOVE);
+    else if (table->fd >= 0)
+        mapping = mmap(nullptr, size, PROT_READ | PROT_WRITE, (table->shared ? MAP_SHARED : MAP_PRIVATE), table->fd, 0);
+    else
+        mapping = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mapping == MAP_FAILED)
+        return false;
+    table->mapping = (char*)mapping;
+    table->mappingSize = size;
+    return true;
+}
+
+/*
+表のヘッダを読み込んで検証し、成功した場合はファイルを割り当ててheaderに内容を格納する。
+ファイルの内容は読まないので、表の大きさに関係なく一定の時間で終わる
+*/
+static bool mapTable(FM_Table *table, int32_t recordSize, FM_TableHeader *header) {
+    struct stat buf;
+    if ((table->fd < 0) || (fstat(table->fd, &buf) != 0) || (buf.st_size < FM_TABLE_HEADER_SIZE))
+        return false;
+    if (pread(table->fd, header, sizeof(FM_TableHeader), 0) != sizeof(FM_TableHeader))
+        return false;
+    if ((header->magic != FM_TABLE_MAGIC) || (header->version != FM_TABLE_VERSION) ||
+            (header->recordSize != recordSize) || (header->count < 0) ||
+            (header->slotsUsed < header->count) || (header->slotsAllocated < header->slotsUsed))
+        return false;
+    if (buf.st_size < FM_TABLE_HEADER_SIZE + (off_t)header->slotsAllocated * recordSize)
+        return false;
+    return resizeTable(table, recordSize, header->slotsAllocated);
+}
+
+static void writeHeader(FM_Table *table, int32_t recordSize, int32_t slotsAllocated, int32_t count, int32_t slotsUsed) {
+    FM_TableHeader *header = getHeader(table);
+    header->magic = FM_TABLE_MAGIC;
+    header->version = FM_TABLE_VERSION;
+    header->recordSize = recordSize;
+    header->slotsAllocated = slotsAllocated;
+    header->count = count;
+    header->slotsUsed = slotsUsed;
+}
+
+/*
+表の割り当てとファイルをslots個の要素の大きさに縮める。縮める部分のスロットはすべて空で、
+ヘッダは縮めた後の大きさで同期済みでなければならない(途中でクラッシュしても表を開ける)
+*/
+static bool truncateTable(FM_Table *table, int32_t recordSize, int32_t slots) {
+    size_t size = FM_TABLE_HEADER_SIZE + (size_t)slots * recordSize;
+    if (size >= table->mappingSize)
+        return true;
+    // 縮める場合は同じアドレスのまま変わるので、要素へのポインタはそのまま使える
+    if (mremap(table->mapping, table->mappingSize, size, 0) == MAP_FAILED)
+        return false;
+    table->mappingSize = size;
+    if ((table->fd >= 0) && (table->shared))
+        return ftruncate(table->fd, size) == 0;
+    return true;
+}
+
+static bool syncTable(FM_Table *table, size_t size) {
+    if ((table->fd < 0) || (!table->shared))
+        return true;
+    return msync(table->mapping, size, MS_SYNC) == 0;
+}
 
 FileManager::FileManager(Index *owner, const char *workDirectory, bool create) {
     this->owner = owner;
+    getConfiguration();
     biggestINodeID = -1;
-    cachedFileID = -1;
-    cacheDirID = -1;
     addressSpaceCovered = 0;
     memset(mountPoint, 0, sizeof(mountPoint));
-
-    transactionLog = typed_malloc(AddressSpaceChange, INITIAL_TRANSACTION_LOG_SPACE);
-    transactionLogSize = 0;
-    transactionLogAllocated = INITIAL_TRANSACTION_LOG_SPACE;
+    pthread_mutex_init(&lock, nullptr);
+    changeSequence = changeLogStart = 0;
+    directoryContents = nullptr;
+    directoryContentsLoaded = false;
+    directorySlotsUsed = fileSlotsUsed = 0;
+    repackingDirectories = repackingFiles = false;
+    directoryCache = fileCache = nullptr;
+    if (PATH_CACHE_SIZE > 0) {
+        directoryCache = new PathCache(PATH_CACHE_SIZE, PATH_CACHE_SHARDS);
+        fileCache = new PathCache(PATH_CACHE_SIZE, PATH_CACHE_SHARDS);
+    }
+    invalidationCount = 0;
 
     fileDataFile = evaluateRelativePathName(workDirectory, FILE_DATA_FILE);
     iNodeDataFile = evaluateRelativePathName(workDirectory, INODE_DATA_FILE);
@@ -44,33 +161,1089 @@ FileManager::FileManager(Index *owner, const char *workDirectory, bool create) {
 
         // 与えられたディレクトリ内で新しいファイルマネージャーインスタンスを作成する
         int flags = O_RDWR | O_CREAT | O_TRUNC | O_LARGEFILE;
-        mode_t mode = DEFAULT_FILE_PERMISSIONS;
-        fileData = open(fileDataFile, flags, mode);
-        if (fileData < 0)
+        openTable(&fileTable, fileDataFile, flags, true);
+        if (fileTable.fd < 0)
             assert("Unable to open " FILE_DATA_FILE == nullptr);
-        iNodeData = open(iNodeDataFile, flags, mode);
-        if (iNodeData < 0)
+        openTable(&iNodeTable, iNodeDataFile, flags, true);
+        if (iNodeTable.fd < 0)
             assert("Unable to open " INODE_DATA_FILE == nullptr);
-        directoryData = open(directoryDataFile, flags, mode);
-        if (directoryData < 0)
+        openTable(&directoryTable, directoryDataFile, flags, true);
+        if (directoryTable.fd < 0)
             assert("Unable to open " DIRECTORY_DATA_FILE == nullptr);
+    }
+    else {
+        /*
+        FileManagerのデータを持たない既存のインデックスでは、空のファイルを作る。
+        読み取り専用の場合は変更がファイルに書き戻されないようにMAP_PRIVATEで割り当てる
+        */
+        int flags = (owner->readOnly ? O_RDONLY : O_RDWR | O_CREAT) | O_LARGEFILE;
+        openTable(&fileTable, fileDataFile, flags, !owner->readOnly);
+        openTable(&iNodeTable, iNodeDataFile, flags, !owner->readOnly);
+        openTable(&directoryTable, directoryDataFile, flags, !owner->readOnly);
+    }
+
+    if ((create) || (!loadFromDisk())) {
+        struct stat buf;
+        if ((!create) && (directoryTable.fd >= 0) && (fstat(directoryTable.fd, &buf) == 0) && (buf.st_size > 0)) {
+            snprintf(errorMessage, sizeof(errorMessage), "Unable to load file data from %s. Starting empty.", workDirectory);
+            log(LOG_ERROR, LOG_ID, errorMessage);
+        }
+        initializeEmpty();
+    }
+}
+
+FileManager::~FileManager() {
+    if (!owner->readOnly)
+        saveToDisk();
+    discardDirectoryContents();
+    if (directoryCache != nullptr)
+        delete directoryCache;
+    if (fileCache != nullptr)
+        delete fileCache;
+    FM_Table *tables[3] = { &directoryTable, &fileTable, &iNodeTable };
+    for (int i = 0; i < 3; i++) {
+        unmapTable(tables[i]);
+        if (tables[i]->fd >= 0)
+            close(tables[i]->fd);
+    }
+    free(fileDataFile);
+    free(iNodeDataFile);
+    free(directoryDataFile);
+    pthread_mutex_destroy(&lock);
+}
+
+void FileManager::getConfiguration() {
+    getConfigurationInt64("PATH_CACHE_SIZE", &PATH_CACHE_SIZE, DEFAULT_PATH_CACHE_SIZE);
+    getConfigurationInt("PATH_CACHE_SHARDS", &PATH_CACHE_SHARDS, DEFAULT_PATH_CACHE_SHARDS);
+    getConfigurationInt("REPACK_SLOTS_PER_UPDATE", &REPACK_SLOTS_PER_UPDATE, DEFAULT_REPACK_SLOTS_PER_UPDATE);
+}
+
+void FileManager::initializeEmpty() {
+    FM_Table *tables[3] = { &directoryTable, &fileTable, &iNodeTable };
+    int32_t recordSizes[3] = { sizeof(IndexDirectory), sizeof(IndexedFile), sizeof(IndexedINode) };
+    for (int i = 0; i < 3; i++) {
+        unmapTable(tables[i]);
+        if ((tables[i]->fd >= 0) && (!tables[i]->shared)) {
+            // 読み取り専用で既存のファイルが使えない場合は、メモリ上だけで空の表を持つ
+            close(tables[i]->fd);
+            tables[i]->fd = -1;
+        }
+        if ((tables[i]->fd >= 0) && (ftruncate(tables[i]->fd, 0) != 0)) {
+            close(tables[i]->fd);
+            tables[i]->fd = -1;
+        }
+        if (!resizeTable(tables[i], recordSizes[i], MINIMUM_SLOT_COUNT)) {
+            log(LOG_ERROR, LOG_ID, "Unable to map file data.");
+            exit(1);
+        }
+    }
+
+    // マウント場所を"/"に初期化
+    strcpy(mountPoint, "/");
+
+    // ディレクトリデータ内部を初期化
+    directoryCount = 0;
+    directorySlotsAllocated = MINIMUM_SLOT_COUNT;
+    directories = (IndexDirectory*)getRecords(&directoryTable);
+    for (int i = 0; i < directorySlotsAllocated; i++)
+        directories[i].id = -1;
+    directoryContents = typed_malloc(DicrectoryContent, directorySlotsAllocated);
+    directoryAllocator.reset(directorySlotsAllocated);
+
+    // rootディレクトリを作成
+    directories[0].id = 0;
+    directories[0].parent = 0;
+    directories[0].owner = Index::SUPERUSER;
+    directories[0].group = 0;
+    directories[0].permissions = 0755;
+    directories[0].name[0] = 0;
+    directories[0].hashValue = 0;
+    directoryCount++;
+    directoryAllocator.markUsed(0);
+    initializeDirectoryContent(&directoryContents[0]);
+
+    fileCount = 0;
+    fileSlotsAllocated = MINIMUM_SLOT_COUNT;
+    files = (IndexedFile*)getRecords(&fileTable);
+    for (int i = 0; i < fileSlotsAllocated; i++)
+        files[i].iNode = -1;
+    fileAllocator.reset(fileSlotsAllocated);
+
+    iNodeCount = 0;
+    iNodeSlotsAllocated = MINIMUM_SLOT_COUNT;
+    iNodes = (IndexedINode*)getRecords(&iNodeTable);
+    biggestINodeID = -1;
+    biggestOffset = -1;
+    addressSpaceCovered = 0;
+    directoryContentsLoaded = true;
+}
+
+void FileManager::saveToDisk() {
+    pthread_mutex_lock(&lock);
+    /*
+    要素の配列は割り当てを通して書き込み済みなので、先にそれを同期してからヘッダを更新する。
+    ディレクトリの内容(DirectoryContent)と空きIDのビットマップは保存せず、必要になった時点で組み立て直す
+    */
+    bool success =
+        (syncTable(&directoryTable, directoryTable.mappingSize)) &&
+        (syncTable(&fileTable, fileTable.mappingSize)) &&
+        (syncTable(&iNodeTable, iNodeTable.mappingSize));
+    if (success) {
+        // リパックで空いた末尾は、縮めた大きさのヘッダを同期してから切り捨てる
+        shrinkTables();
+        writeHeader(&directoryTable, sizeof(IndexDirectory), directorySlotsAllocated,
+                directoryCount, getDirectorySlotsUsed());
+        memcpy(getHeader(&directoryTable)->mountPoint, mountPoint, sizeof(mountPoint));
+        writeHeader(&fileTable, sizeof(IndexedFile), fileSlotsAllocated, fileCount, getFileSlotsUsed());
+        writeHeader(&iNodeTable, sizeof(IndexedINode), iNodeSlotsAllocated, iNodeCount, biggestINodeID + 1);
+        FM_TableHeader *header = getHeader(&iNodeTable);
+        header->biggestINodeID = biggestINodeID;
+        header->biggestOffset = biggestOffset;
+        header->addressSpaceCovered = addressSpaceCovered;
+        success =
+            (syncTable(&directoryTable, FM_TABLE_HEADER_SIZE)) &&
+            (syncTable(&fileTable, FM_TABLE_HEADER_SIZE)) &&
+            (syncTable(&iNodeTable, FM_TABLE_HEADER_SIZE)) &&
+            (truncateTable(&directoryTable, sizeof(IndexDirectory), directorySlotsAllocated)) &&
+            (truncateTable(&fileTable, sizeof(IndexedFile), fileSlotsAllocated));
+    }
+    if (!success)
+        log(LOG_ERROR, LOG_ID, "Unable to save file data.");
+    pthread_mutex_unlock(&lock);
+}
+
+bool FileManager::loadFromDisk() {
+    FM_TableHeader directoryHeader, fileHeader, iNodeHeader;
+    if ((!mapTable(&directoryTable, sizeof(IndexDirectory), &directoryHeader)) ||
+            (!mapTable(&fileTable, sizeof(IndexedFile), &fileHeader)) ||
+            (!mapTable(&iNodeTable, sizeof(IndexedINode), &iNodeHeader)) ||
+            (directoryHeader.count < 1) || (iNodeHeader.biggestINodeID < -1) ||
+            (iNodeHeader.biggestINodeID >= iNodeHeader.slotsAllocated)) {
+        unmapTable(&directoryTable);
+        unmapTable(&fileTable);
+        unmapTable(&iNodeTable);
+        return false;
+    }
+    directoryCount = directoryHeader.count;
+    directorySlotsAllocated = directoryHeader.slotsAllocated;
+    directorySlotsUsed = directoryHeader.slotsUsed;
+    memcpy(mountPoint, directoryHeader.mountPoint, sizeof(mountPoint));
+    mountPoint[sizeof(mountPoint) - 1] = 0;
+    fileCount = fileHeader.count;
+    fileSlotsAllocated = fileHeader.slotsAllocated;
+    fileSlotsUsed = fileHeader.slotsUsed;
+    iNodeCount = iNodeHeader.count;
+    iNodeSlotsAllocated = iNodeHeader.slotsAllocated;
+    biggestINodeID = iNodeHeader.biggestINodeID;
+    biggestOffset = iNodeHeader.biggestOffset;
+    addressSpaceCovered = iNodeHeader.addressSpaceCovered;
+    directories = (IndexDirectory*)getRecords(&directoryTable);
+    files = (IndexedFile*)getRecords(&fileTable);
+    iNodes = (IndexedINode*)getRecords(&iNodeTable);
+    return true;
+}
 
-        // マウント場所を"/"に初期化
-        strcpy(mountPoint, "/");
+void FileManager::recover(const std::vector<WAL_Record> &records) {
+    pthread_mutex_lock(&lock);
+    // 表を直接書き直すので、組み立て済みの子の一覧は捨てて後で組み立て直す
+    discardDirectoryContents();
+    for (size_t i = 0; i < records.size(); i++) {
+        if (records[i].type != WAL_FILE_MANAGER)
+            continue;
+        const char *data = records[i].data.data();
+        size_t length = records[i].data.size(), position = 0;
+        while (position + sizeof(FM_LogSlot) <= length) {
+            FM_LogSlot slot;
+            memcpy(&slot, &data[position], sizeof(slot));
+            int32_t size = getSlotSize(slot.table);
+            if ((size == 0) || (position + sizeof(slot) + size > length))
+                break;
+            if (reserveSlot(slot.table, slot.id)) {
+                memcpy(getSlot(slot.table, slot.id), &data[position + sizeof(slot)], size);
+                if ((slot.table == FM_LOG_INODE) && (slot.id > biggestINodeID))
+                    biggestINodeID = slot.id;
+            }
+            position += sizeof(slot) + size;
+        }
+    }
+    repairTables();
+    pthread_mutex_unlock(&lock);
+}
 
-        // ディレクトリデータ内部を初期化
-        directoryCount = 0;
-        directorySlotsAllocated = MINIMUM_SLOT_COUNT;
-        directories = typed_malloc(IndexDirectory, directorySlotsAllocated);
-        for (int i = 0; i < directorySlotsAllocated; i++)
+bool FileManager::reserveSlot(int32_t table, int32_t id) {
+    if ((id < 0) || (getSlotSize(table) == 0))
+        return false;
+    FM_Table *tables[3] = { &directoryTable, &fileTable, &iNodeTable };
+    int32_t *slotsAllocated[3] = { &directorySlotsAllocated, &fileSlotsAllocated, &iNodeSlotsAllocated };
+    int32_t oldSize = *slotsAllocated[table];
+    if (id < oldSize)
+        return true;
+    int32_t newSize = (int32_t)(oldSize * SLOT_GROWTH_RATE) + 1;
+    if (newSize <= id)
+        newSize = id + 1;
+    if (!resizeTable(tables[table], getSlotSize(table), newSize)) {
+        log(LOG_ERROR, LOG_ID, "Unable to grow file data table for recovery.");
+        return false;
+    }
+    directories = (IndexDirectory*)getRecords(&directoryTable);
+    files = (IndexedFile*)getRecords(&fileTable);
+    iNodes = (IndexedINode*)getRecords(&iNodeTable);
+    for (int32_t i = oldSize; i < newSize; i++) {
+        if (table == FM_LOG_DIRECTORY)
             directories[i].id = -1;
+        else if (table == FM_LOG_FILE)
+            files[i].iNode = -1;
+    }
+    *slotsAllocated[table] = newSize;
+    return true;
+}
 
-        // rootディレクトリを作成
+void FileManager::repairTables() {
+    if (directories[0].id != 0) {
         directories[0].id = 0;
-        directories[0].parent = 0;
+        directories[0].owner = Index::SUPERUSER;
+        directories[0].group = 0;
+        directories[0].permissions = 0755;
         directories[0].name[0] = 0;
         directories[0].hashValue = 0;
-        directoryCount++;
-        initializeDirectoryContent(&directories[0].children);
     }
+    directories[0].parent = 0;
+
+    // 親をたどってルートに着かないディレクトリ(親が無い、または循環している)を取り除く
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (int32_t i = 1; i < directorySlotsAllocated; i++) {
+            if (directories[i].id < 0)
+                continue;
+            bool valid = (directories[i].id == i);
+            int32_t d = directories[i].parent;
+            for (int32_t steps = 0; (valid) && (d != 0); steps++) {
+                valid = (d > 0) && (d < directorySlotsAllocated) && (directories[d].id >= 0) &&
+                    (steps < directorySlotsAllocated);
+                if (valid)
+                    d = directories[d].parent;
+            }
+            if (!valid) {
+                directories[i].id = -1;
+                changed = true;
+            }
+        }
+    }
+    directorySlotsUsed = 0;
+    directoryCount = 0;
+    for (int32_t i = 0; i < directorySlotsAllocated; i++) {
+        if (directories[i].id >= 0) {
+            directoryCount++;
+            directorySlotsUsed = i + 1;
+        }
+    }
+
+    // ファイルとINodeは互いを参照している場合だけ残す
+    if (biggestINodeID >= iNodeSlotsAllocated)
+        biggestINodeID = iNodeSlotsAllocated - 1;
+    fileSlotsUsed = 0;
+    fileCount = 0;
+    for (int32_t i = 0; i < fileSlotsAllocated; i++) {
+        IndexedFile *f = &files[i];
+        if (f->iNode < 0)
+            continue;
+        int32_t parent = f->parent;
+        if ((f->iNode > biggestINodeID) || (iNodes[f->iNode].file != i) ||
+                (parent < 0) || (parent >= directorySlotsAllocated) || (directories[parent].id < 0))
+            f->iNode = -1;
+        else {
+            fileCount++;
+            fileSlotsUsed = i + 1;
+        }
+    }
+    iNodeCount = 0;
+    addressSpaceCovered = 0;
+    for (int32_t i = 0; i <= biggestINodeID; i++) {
+        IndexedINode *iNode = &iNodes[i];
+        if ((iNode->file >= 0) && ((iNode->file >= fileSlotsAllocated) || (files[iNode->file].iNode != i)))
+            iNode->file = -1;
+        if (iNode->file >= 0) {
+            iNodeCount++;
+            addressSpaceCovered += iNode->tokenCount;
+        }
+        if ((iNode->tokenCount > 0) && (iNode->startOffset + iNode->tokenCount - 1 > biggestOffset))
+            biggestOffset = iNode->startOffset + iNode->tokenCount - 1;
+    }
+}
+
+void FileManager::loadDirectoryContents() {
+    if (directoryContentsLoaded)
+        return;
+    directoryContents = typed_malloc(DicrectoryContent, directorySlotsAllocated);
+    directoryAllocator.reset(directorySlotsAllocated);
+    fileAllocator.reset(fileSlotsAllocated);
+    for (int32_t i = 0; i < directorySlotsUsed; i++) {
+        if (directories[i].id >= 0) {
+            initializeDirectoryContent(&directoryContents[i]);
+            directoryAllocator.markUsed(i);
+        }
+    }
+    for (int32_t i = 1; i < directorySlotsUsed; i++)
+        if (directories[i].id >= 0)
+            addChild(&directoryContents[directories[i].parent], directories[i].hashValue, makeDirectoryEntry(i));
+    for (int32_t i = 0; i < fileSlotsUsed; i++) {
+        if (files[i].iNode >= 0) {
+            fileAllocator.markUsed(i);
+            addChild(&directoryContents[files[i].parent], files[i].hashValue, makeFileEntry(i));
+        }
+    }
+    repackingDirectories = repackingFiles = false;
+    directoryContentsLoaded = true;
+}
+
+void FileManager::discardDirectoryContents() {
+    if (directoryContentsLoaded) {
+        directorySlotsUsed = directoryAllocator.getSlotsUsed();
+        fileSlotsUsed = fileAllocator.getSlotsUsed();
+        for (int32_t i = 0; i < directorySlotsUsed; i++)
+            if (directories[i].id >= 0)
+                freeDirectoryContent(&directoryContents[i]);
+        directoryAllocator.reset(0);
+        fileAllocator.reset(0);
+    }
+    free(directoryContents);
+    directoryContents = nullptr;
+    directoryContentsLoaded = false;
+}
+
+int32_t FileManager::getDirectorySlotsUsed() {
+    return (directoryContentsLoaded ? directoryAllocator.getSlotsUsed() : directorySlotsUsed);
+}
+
+int32_t FileManager::getFileSlotsUsed() {
+    return (directoryContentsLoaded ? fileAllocator.getSlotsUsed() : fileSlotsUsed);
+}
+
+int32_t FileManager::resolveDirectoryID(int32_t directory) {
+    // 組み立てる前にはリパックしていないので、転送表は空
+    return (directoryContentsLoaded ? directoryAllocator.resolve(directory) : directory);
+}
+
+int32_t FileManager::resolveFileID(int32_t file) {
+    return (directoryContentsLoaded ? fileAllocator.resolve(file) : file);
+}
+
+bool FileManager::isValidName(const char *name, int maxLength) {
+    int length = strlen(name);
+    return (length > 0) && (length <= maxLength) && (strchr(name, '/') == nullptr) &&
+        (strcmp(name, ".") != 0) && (strcmp(name, "..") != 0);
+}
+
+int32_t FileManager::findChild(int32_t directory, const char *name) {
+    int32_t candidates[MAX_HASH_COLLISIONS];
+    int32_t hashValue = (int32_t)simpleHashFunction(name);
+    int n = getChildrenByHash(&directoryContents[directory], hashValue, candidates, MAX_HASH_COLLISIONS);
+    for (int i = 0; i < n; i++) {
+        int32_t id = getEntryID(candidates[i]);
+        const char *childName = (isFileEntry(candidates[i]) ? files[id].name : directories[id].name);
+        if (strcmp(childName, name) == 0)
+            return candidates[i];
+    }
+    return 0;
+}
+
+bool FileManager::growDirectorySlots() {
+    int32_t newSize = (int32_t)(directorySlotsAllocated * SLOT_GROWTH_RATE) + 1;
+    if (!resizeTable(&directoryTable, sizeof(IndexDirectory), newSize)) {
+        log(LOG_ERROR, LOG_ID, "Unable to grow directory table.");
+        return false;
+    }
+    directories = (IndexDirectory*)getRecords(&directoryTable);
+    typed_realloc(DicrectoryContent, directoryContents, newSize);
+    for (int32_t i = directorySlotsAllocated; i < newSize; i++)
+        directories[i].id = -1;
+    directorySlotsAllocated = newSize;
+    directoryAllocator.setCapacity(newSize);
+    return true;
+}
+
+bool FileManager::growFileSlots() {
+    int32_t newSize = (int32_t)(fileSlotsAllocated * SLOT_GROWTH_RATE) + 1;
+    if (!resizeTable(&fileTable, sizeof(IndexedFile), newSize)) {
+        log(LOG_ERROR, LOG_ID, "Unable to grow file table.");
+        return false;
+    }
+    files = (IndexedFile*)getRecords(&fileTable);
+    for (int32_t i = fileSlotsAllocated; i < newSize; i++)
+        files[i].iNode = -1;
+    fileSlotsAllocated = newSize;
+    fileAllocator.setCapacity(newSize);
+    return true;
+}
+
+bool FileManager::growINodeSlots() {
+    if (biggestINodeID + 1 < iNodeSlotsAllocated)
+        return true;
+    int32_t newSize = (int32_t)(iNodeSlotsAllocated * SLOT_GROWTH_RATE) + 1;
+    if (!resizeTable(&iNodeTable, sizeof(IndexedINode), newSize)) {
+        log(LOG_ERROR, LOG_ID, "Unable to grow inode table.");
+        return false;
+    }
+    iNodes = (IndexedINode*)getRecords(&iNodeTable);
+    iNodeSlotsAllocated = newSize;
+    return true;
+}
+
+int32_t FileManager::allocateDirectoryID() {
+    int32_t id = directoryAllocator.allocate();
+    if ((id < 0) && (growDirectorySlots()))
+        id = directoryAllocator.allocate();
+    return id;
+}
+
+int32_t FileManager::allocateFileID() {
+    int32_t id = fileAllocator.allocate();
+    if ((id < 0) && (growFileSlots()))
+        id = fileAllocator.allocate();
+    return id;
+}
+
+void FileManager::repackSlots(std::string *record) {
+    int32_t budget = REPACK_SLOTS_PER_UPDATE;
+    if ((!repackingFiles) && (fileSlotsAllocated > MINIMUM_SLOT_COUNT) &&
+            (fileCount < SLOT_REPACK_THRESHOLD * fileAllocator.getSlotsUsed()))
+        repackingFiles = true;
+    while ((repackingFiles) && (budget > 0)) {
+        // 使われている最大のIDのスロットを、最も小さい空きIDに移す
+        int32_t from = fileAllocator.getSlotsUsed() - 1;
+        int32_t to = (from > 0 ? fileAllocator.move(from) : -1);
+        if (to < 0) {
+            // 詰め終わった
+            repackingFiles = false;
+            break;
+        }
+        moveFile(from, to, record);
+        budget--;
+    }
+
+    if ((!repackingDirectories) && (directorySlotsAllocated > MINIMUM_SLOT_COUNT) &&
+            (directoryCount < SLOT_REPACK_THRESHOLD * directoryAllocator.getSlotsUsed()))
+        repackingDirectories = true;
+    while ((repackingDirectories) && (budget > 0)) {
+        int32_t from = directoryAllocator.getSlotsUsed() - 1;
+        /*
+        子の親もすべて書き換えるので、子の数が残りの予算を超える場合は次の更新操作に回す。
+        1回分の予算にも収まらないディレクトリは移せないので、ここでリパックをやめる
+        */
+        int32_t cost = 1 + directoryContents[from].count;
+        if (cost > REPACK_SLOTS_PER_UPDATE) {
+            repackingDirectories = false;
+            break;
+        }
+        if (cost > budget)
+            break;
+        int32_t to = (from > 0 ? directoryAllocator.move(from) : -1);
+        if (to < 0) {
+            repackingDirectories = false;
+            break;
+        }
+        moveDirectory(from, to, record);
+        budget -= cost;
+    }
+}
+
+void FileManager::moveFile(int32_t from, int32_t to, std::string *record) {
+    files[to] = files[from];
+    files[from].iNode = -1;
+    IndexedFile *f = &files[to];
+    if (fileCache != nullptr)
+        fileCache->remove(makeFileKey(f->parent, f->name));
+    invalidationCount++;
+    removeChild(&directoryContents[f->parent], f->hashValue, makeFileEntry(from));
+    addChild(&directoryContents[f->parent], f->hashValue, makeFileEntry(to));
+    iNodes[f->iNode].file = to;
+    addSlotToRecord(record, FM_LOG_FILE, to);
+    addSlotToRecord(record, FM_LOG_FILE, from);
+    addSlotToRecord(record, FM_LOG_INODE, f->iNode);
+}
+
+void FileManager::moveDirectory(int32_t from, int32_t to, std::string *record) {
+    if (directoryCache != nullptr) {
+        // サブディレクトリのパスは、そのIDが変わらないのでキャッシュに残してよい
+        std::string path;
+        getDirectoryPath(from, &path);
+        directoryCache->remove(path);
+    }
+    invalidationCount++;
+    directories[to] = directories[from];
+    directories[to].id = to;
+    directories[from].id = -1;
+    IndexDirectory *d = &directories[to];
+    removeChild(&directoryContents[d->parent], d->hashValue, makeDirectoryEntry(from));
+    addChild(&directoryContents[d->parent], d->hashValue, makeDirectoryEntry(to));
+
+    // 子の一覧はそのまま引き継ぎ、子の親を書き換える
+    directoryContents[to] = directoryContents[from];
+    DicrectoryContent *content = &directoryContents[to];
+    for (int32_t i = 0; i < content->slotCount; i++) {
+        int32_t entry = content->slots[i].id;
+        if (entry == DC_EMPTY_SLOT)
+            continue;
+        int32_t child = getEntryID(entry);
+        if (isFileEntry(entry)) {
+            if (fileCache != nullptr)
+                fileCache->remove(makeFileKey(from, files[child].name));
+            files[child].parent = to;
+            addSlotToRecord(record, FM_LOG_FILE, child);
+        }
+        else {
+            directories[child].parent = to;
+            addSlotToRecord(record, FM_LOG_DIRECTORY, child);
+        }
+    }
+    addSlotToRecord(record, FM_LOG_DIRECTORY, to);
+    addSlotToRecord(record, FM_LOG_DIRECTORY, from);
+}
+
+void FileManager::shrinkTables() {
+    if (!directoryContentsLoaded)
+        return;
+    // 縮めた直後に再び大きくすることがないように、成長率の2段階分より小さい場合だけ縮める
+    int32_t size = (int32_t)(directoryAllocator.getSlotsUsed() * SLOT_GROWTH_RATE) + 1;
+    if (size < MINIMUM_SLOT_COUNT)
+        size = MINIMUM_SLOT_COUNT;
+    if (size * SLOT_GROWTH_RATE < directorySlotsAllocated) {
+        directoryAllocator.setCapacity(size);
+        typed_realloc(DicrectoryContent, directoryContents, size);
+        directorySlotsAllocated = size;
+    }
+    size = (int32_t)(fileAllocator.getSlotsUsed() * SLOT_GROWTH_RATE) + 1;
+    if (size < MINIMUM_SLOT_COUNT)
+        size = MINIMUM_SLOT_COUNT;
+    if (size * SLOT_GROWTH_RATE < fileSlotsAllocated) {
+        fileAllocator.setCapacity(size);
+        fileSlotsAllocated = size;
+    }
+}
+
+void FileManager::recordChange(int32_t iNode) {
+    changeSequence++;
+    if (changeLog.size() >= MAX_CHANGE_LOG_LENGTH) {
+        // 古い半分をまとめて捨てる
+        size_t discarded = changeLog.size() / 2;
+        changeLogStart = changeLog[discarded - 1].sequence;
+        changeLog.erase(changeLog.begin(), changeLog.begin() + discarded);
+    }
+    changeLog.push_back({ changeSequence, iNode });
+}
+
+int32_t FileManager::getSlotSize(int32_t table) {
+    switch (table) {
+        case FM_LOG_DIRECTORY:
+            return sizeof(IndexDirectory);
+        case FM_LOG_FILE:
+            return sizeof(IndexedFile);
+        case FM_LOG_INODE:
+            return sizeof(IndexedINode);
+        default:
+            return 0;
+    }
+}
+
+char *FileManager::getSlot(int32_t table, int32_t id) {
+    switch (table) {
+        case FM_LOG_DIRECTORY:
+            return (char*)&directories[id];
+        case FM_LOG_FILE:
+            return (char*)&files[id];
+        default:
+            return (char*)&iNodes[id];
+    }
+}
+
+void FileManager::addSlotToRecord(std::string *record, int32_t table, int32_t id) {
+    FM_LogSlot slot = { table, id };
+    record->append((const char*)&slot, sizeof(slot));
+    record->append(getSlot(table, id), getSlotSize(table));
+}
+
+void FileManager::appendToLog(const std::string &record) {
+    if (owner->wal == nullptr)
+        return;
+    if (record.size() <= (size_t)WriteAheadLog::MAX_RECORD_LENGTH) {
+        owner->wal->append(WAL_FILE_MANAGER, record.data(), record.size());
+        return;
+    }
+    // 長すぎるレコードは読み込み時に壊れているとみなされるので、スロットの境界で分割する
+    size_t start = 0, position = 0;
+    while (position < record.size()) {
+        FM_LogSlot slot;
+        memcpy(&slot, &record[position], sizeof(slot));
+        size_t size = sizeof(slot) + getSlotSize(slot.table);
+        if (position + size - start > (size_t)WriteAheadLog::MAX_RECORD_LENGTH) {
+            owner->wal->append(WAL_FILE_MANAGER, &record[start], position - start);
+            start = position;
+        }
+        position += size;
+    }
+    owner->wal->append(WAL_FILE_MANAGER, &record[start], position - start);
+}
+
+void FileManager::commitLog() {
+    if ((owner->wal != nullptr) && (!owner->wal->commit(owner->wal->getLastLSN())))
+        log(LOG_ERROR, LOG_ID, "Unable to write file data changes to the log.");
+}
+
+int32_t FileManager::createDirectory(int32_t parent, const char *name, uid_t owner, gid_t group, mode_t permissions) {
+    if (!isValidName(name, MAX_DIRECTORY_NAME_LENGTH))
+        return -1;
+    pthread_mutex_lock(&lock);
+    loadDirectoryContents();
+    parent = resolveDirectoryID(parent);
+    if ((parent < 0) || (parent >= directorySlotsAllocated) || (directories[parent].id < 0) ||
+            (findChild(parent, name) != 0)) {
+        pthread_mutex_unlock(&lock);
+        return -1;
+    }
+    int32_t id = allocateDirectoryID();
+    if (id < 0) {
+        pthread_mutex_unlock(&lock);
+        return -1;
+    }
+    IndexDirectory *directory = &directories[id];
+    directory->id = id;
+    directory->parent = parent;
+    directory->owner = owner;
+    directory->group = group;
+    directory->permissions = permissions;
+    strcpy(directory->name, name);
+    directory->hashValue = (int32_t)simpleHashFunction(name);
+    initializeDirectoryContent(&directoryContents[id]);
+    addChild(&directoryContents[parent], directory->hashValue, makeDirectoryEntry(id));
+    directoryCount++;
+    std::string record;
+    addSlotToRecord(&record, FM_LOG_DIRECTORY, id);
+    repackSlots(&record);
+    id = resolveDirectoryID(id);
+    appendToLog(record);
+    pthread_mutex_unlock(&lock);
+    commitLog();
+    return id;
+}
+
+bool FileManager::removeDirectory(int32_t directory) {
+    pthread_mutex_lock(&lock);
+    loadDirectoryContents();
+    directory = resolveDirectoryID(directory);
+    if ((directory <= 0) || (directory >= directorySlotsAllocated) || (directories[directory].id < 0) ||
+            (directoryContents[directory].count > 0)) {
+        pthread_mutex_unlock(&lock);
+        return false;
+    }
+    IndexDirectory *d = &directories[directory];
+    if (directoryCache != nullptr) {
+        // 空のディレクトリなので、その下のパスはキャッシュに無い
+        std::string path;
+        getDirectoryPath(directory, &path);
+        directoryCache->remove(path);
+        invalidationCount++;
+    }
+    removeChild(&directoryContents[d->parent], d->hashValue, makeDirectoryEntry(directory));
+    freeDirectoryContent(&directoryContents[directory]);
+    d->id = -1;
+    directoryCount--;
+    directoryAllocator.release(directory);
+    std::string record;
+    addSlotToRecord(&record, FM_LOG_DIRECTORY, directory);
+    repackSlots(&record);
+    appendToLog(record);
+    pthread_mutex_unlock(&lock);
+    commitLog();
+    return true;
+}
+
+int32_t FileManager::addFile(int32_t parent, const char *name, uid_t owner, gid_t group, mode_t permissions,
+        offset startOffset, uint32_t tokenCount) {
+    if (!isValidName(name, MAX_FILE_NAME_LENGTH))
+        return -1;
+    pthread_mutex_lock(&lock);
+    loadDirectoryContents();
+    parent = resolveDirectoryID(parent);
+    if ((parent < 0) || (parent >= directorySlotsAllocated) || (directories[parent].id < 0) ||
+            (startOffset <= biggestOffset) || (findChild(parent, name) != 0) ||
+            (!growINodeSlots())) {
+        pthread_mutex_unlock(&lock);
+        return -1;
+    }
+    int32_t id = allocateFileID();
+    if (id < 0) {
+        pthread_mutex_unlock(&lock);
+        return -1;
+    }
+    int32_t iNodeID = ++biggestINodeID;
+    IndexedINode *iNode = &iNodes[iNodeID];
+    iNode->startOffset = startOffset;
+    iNode->tokenCount = tokenCount;
+    iNode->owner = owner;
+    iNode->group = group;
+    iNode->permissions = permissions;
+    iNode->file = id;
+    iNodeCount++;
+    if (tokenCount > 0)
+        biggestOffset = startOffset + tokenCount - 1;
+
+    IndexedFile *file = &files[id];
+    file->iNode = iNodeID;
+    file->parent = parent;
+    file->hashValue = (int32_t)simpleHashFunction(name);
+    strcpy(file->name, name);
+    addChild(&directoryContents[parent], file->hashValue, makeFileEntry(id));
+    fileCount++;
+    addressSpaceCovered += tokenCount;
+    recordChange(iNodeID);
+    std::string record;
+    addSlotToRecord(&record, FM_LOG_FILE, id);
+    addSlotToRecord(&record, FM_LOG_INODE, iNodeID);
+    repackSlots(&record);
+    id = resolveFileID(id);
+    appendToLog(record);
+    pthread_mutex_unlock(&lock);
+
+    if (tokenCount > 0) {
+        this->owner->notifyOfAddressSpaceChange(1, startOffset, tokenCount);
+        // ポスティングが先に追加されていた場合、範囲はここで見えるようになる
+        this->owner->notifyOfVisibilityChange(startOffset, startOffset + tokenCount - 1);
+    }
+    commitLog();
+    return id;
+}
+
+bool FileManager::removeFile(int32_t file) {
+    pthread_mutex_lock(&lock);
+    loadDirectoryContents();
+    file = resolveFileID(file);
+    if ((file < 0) || (file >= fileSlotsAllocated) || (files[file].iNode < 0)) {
+        pthread_mutex_unlock(&lock);
+        return false;
+    }
+    IndexedFile *f = &files[file];
+    IndexedINode *iNode = &iNodes[f->iNode];
+    offset startOffset = iNode->startOffset;
+    uint32_t tokenCount = iNode->tokenCount;
+    if (fileCache != nullptr) {
+        fileCache->remove(makeFileKey(f->parent, f->name));
+        invalidationCount++;
+    }
+    removeChild(&directoryContents[f->parent], f->hashValue, makeFileEntry(file));
+    int32_t iNodeID = f->iNode;
+    iNode->file = -1;
+    iNodeCount--;
+    recordChange(iNodeID);
+    f->iNode = -1;
+    fileCount--;
+    fileAllocator.release(file);
+    addressSpaceCovered -= tokenCount;
+    std::string record;
+    addSlotToRecord(&record, FM_LOG_FILE, file);
+    addSlotToRecord(&record, FM_LOG_INODE, iNodeID);
+    repackSlots(&record);
+    appendToLog(record);
+    pthread_mutex_unlock(&lock);
+
+    if (tokenCount > 0)
+        owner->notifyOfAddressSpaceChange(-1, startOffset, tokenCount);
+    commitLog();
+    return true;
+}
+
+bool FileManager::changeFileAttributes(int32_t file, uid_t owner, gid_t group, mode_t permissions) {
+    pthread_mutex_lock(&lock);
+    file = resolveFileID(file);
+    if ((file < 0) || (file >= fileSlotsAllocated) || (files[file].iNode < 0)) {
+        pthread_mutex_unlock(&lock);
+        return false;
+    }
+    IndexedINode *iNode = &iNodes[files[file].iNode];
+    iNode->owner = owner;
+    iNode->group = group;
+    iNode->permissions = permissions;
+    recordChange(files[file].iNode);
+    offset startOffset = iNode->startOffset;
+    uint32_t tokenCount = iNode->tokenCount;
+    std::string record;
+    addSlotToRecord(&record, FM_LOG_INODE, files[file].iNode);
+    appendToLog(record);
+    pthread_mutex_unlock(&lock);
+    commitLog();
+
+    if (tokenCount > 0)
+        this->owner->notifyOfVisibilityChange(startOffset, startOffset + tokenCount - 1);
+    return true;
+}
+
+bool FileManager::changeDirectoryAttributes(int32_t directory, uid_t owner, gid_t group, mode_t permissions) {
+    pthread_mutex_lock(&lock);
+    directory = resolveDirectoryID(directory);
+    if ((directory < 0) || (directory >= directorySlotsAllocated) || (directories[directory].id < 0)) {
+        pthread_mutex_unlock(&lock);
+        return false;
+    }
+    directories[directory].owner = owner;
+    directories[directory].group = group;
+    directories[directory].permissions = permissions;
+    recordChange(-1);
+    offset end = biggestOffset;
+    std::string record;
+    addSlotToRecord(&record, FM_LOG_DIRECTORY, directory);
+    appendToLog(record);
+    pthread_mutex_unlock(&lock);
+    commitLog();
+
+    // サブツリーの範囲は連続していないので、アドレス空間全体の変更として扱う
+    this->owner->notifyOfVisibilityChange(0, end);
+    return true;
+}
+
+bool FileManager::renameFile(int32_t file, int32_t parent, const char *name) {
+    if (!isValidName(name, MAX_FILE_NAME_LENGTH))
+        return false;
+    pthread_mutex_lock(&lock);
+    loadDirectoryContents();
+    file = resolveFileID(file);
+    parent = resolveDirectoryID(parent);
+    if ((file < 0) || (file >= fileSlotsAllocated) || (files[file].iNode < 0) ||
+            (parent < 0) || (parent >= directorySlotsAllocated) || (directories[parent].id < 0) ||
+            (findChild(parent, name) != 0)) {
+        pthread_mutex_unlock(&lock);
+        return false;
+    }
+    IndexedFile *f = &files[file];
+    if (fileCache != nullptr) {
+        fileCache->remove(makeFileKey(f->parent, f->name));
+        invalidationCount++;
+    }
+    removeChild(&directoryContents[f->parent], f->hashValue, makeFileEntry(file));
+    bool moved = (f->parent != parent);
+    f->parent = parent;
+    f->hashValue = (int32_t)simpleHashFunction(name);
+    strcpy(f->name, name);
+    addChild(&directoryContents[parent], f->hashValue, makeFileEntry(file));
+    IndexedINode *iNode = &iNodes[f->iNode];
+    offset startOffset = iNode->startOffset;
+    uint32_t tokenCount = iNode->tokenCount;
+    if (moved)
+        recordChange(f->iNode);
+    std::string record;
+    addSlotToRecord(&record, FM_LOG_FILE, file);
+    repackSlots(&record);
+    appendToLog(record);
+    pthread_mutex_unlock(&lock);
+    commitLog();
+
+    // 別のディレクトリに移った場合は、途中のディレクトリのパーミッションが変わる
+    if ((moved) && (tokenCount > 0))
+        owner->notifyOfVisibilityChange(startOffset, startOffset + tokenCount - 1);
+    return true;
+}
+
+bool FileManager::renameDirectory(int32_t directory, int32_t parent, const char *name) {
+    if (!isValidName(name, MAX_DIRECTORY_NAME_LENGTH))
+        return false;
+    pthread_mutex_lock(&lock);
+    loadDirectoryContents();
+    directory = resolveDirectoryID(directory);
+    parent = resolveDirectoryID(parent);
+    bool valid = (directory > 0) && (directory < directorySlotsAllocated) && (directories[directory].id >= 0) &&
+        (parent >= 0) && (parent < directorySlotsAllocated) && (directories[parent].id >= 0) &&
+        (findChild(parent, name) == 0);
+    // 移動先がdirectory自身またはそのサブツリーの中であってはいけない
+    for (int32_t d = parent; (valid) && (d != 0); d = directories[d].parent)
+        valid = (d != directory);
+    if (!valid) {
+        pthread_mutex_unlock(&lock);
+        return false;
+    }
+    IndexDirectory *d = &directories[directory];
+    if (directoryCache != nullptr) {
+        // サブツリーのすべてのパスが変わる。名前の変更はまれなので、まとめて捨てる
+        directoryCache->clear();
+        invalidationCount++;
+    }
+    removeChild(&directoryContents[d->parent], d->hashValue, makeDirectoryEntry(directory));
+    bool moved = (d->parent != parent);
+    d->parent = parent;
+    d->hashValue = (int32_t)simpleHashFunction(name);
+    strcpy(d->name, name);
+    addChild(&directoryContents[parent], d->hashValue, makeDirectoryEntry(directory));
+    if (moved)
+        recordChange(-1);
+    offset end = biggestOffset;
+    std::string record;
+    addSlotToRecord(&record, FM_LOG_DIRECTORY, directory);
+    repackSlots(&record);
+    appendToLog(record);
+    pthread_mutex_unlock(&lock);
+    commitLog();
+
+    // サブツリーの範囲は連続していないので、アドレス空間全体の変更として扱う
+    if (moved)
+        owner->notifyOfVisibilityChange(0, end);
+    return true;
+}
+
+bool FileManager::normalizePath(const char *path, std::string *result) {
+    result->clear();
+    const char *p = path;
+    while (*p != 0) {
+        while (*p == '/')
+            p++;
+        int length = 0;
+        while ((p[length] != 0) && (p[length] != '/'))
+            length++;
+        if (length == 0)
+            break;
+        if (length > (int)MAX_DIRECTORY_NAME_LENGTH)
+            return false;
+        result->push_back('/');
+        result->append(p, length);
+        p += length;
+    }
+    if (result->empty())
+        result->push_back('/');
+    return true;
+}
+
+std::string FileManager::makeFileKey(int32_t directory, const char *name) {
+    std::string key((const char*)&directory, sizeof(directory));
+    key.append(name);
+    return key;
+}
+
+void FileManager::getDirectoryPath(int32_t directory, std::string *path) {
+    std::vector<int32_t> ancestors;
+    for (int32_t d = directory; d != 0; d = directories[d].parent)
+        ancestors.push_back(d);
+    path->clear();
+    for (size_t i = ancestors.size(); i > 0; i--) {
+        path->push_back('/');
+        path->append(directories[ancestors[i - 1]].name);
+    }
+    if (path->empty())
+        path->push_back('/');
+}
+
+int32_t FileManager::resolveDirectory(const std::string &path) {
+    loadDirectoryContents();
+    if (path.size() == 1)
+        return 0;
+    // キャッシュにある最も長い接頭辞を探す。見つからなければルートから
+    int32_t directory = 0;
+    size_t start = path.size();
+    while (start > 0) {
+        if ((directoryCache != nullptr) && (directoryCache->lookup(path.substr(0, start), &directory)))
+            break;
+        start = path.rfind('/', start - 1);
+        directory = 0;
+    }
+    while (start < path.size()) {
+        size_t end = path.find('/', start + 1);
+        if (end == std::string::npos)
+            end = path.size();
+        std::string name = path.substr(start + 1, end - start - 1);
+        int32_t entry = findChild(directory, name.c_str());
+        if (entry >= 0)
+            return -1;
+        directory = getEntryID(entry);
+        if (directoryCache != nullptr)
+            directoryCache->insert(path.substr(0, end), directory);
+        start = end;
+    }
+    return directory;
+}
+
+int32_t FileManager::getDirectoryID(const char *path) {
+    std::string normalized;
+    if ((path[0] != '/') || (!normalizePath(path, &normalized)))
+        return -1;
+    int32_t result;
+    if ((directoryCache != nullptr) && (directoryCache->lookup(normalized, &result)))
+        return result;
+    pthread_mutex_lock(&lock);
+    result = resolveDirectory(normalized);
+    pthread_mutex_unlock(&lock);
+    return result;
+}
+
+int32_t FileManager::getFileID(const char *path) {
+    const char *slash = strrchr(path, '/');
+    if ((slash == nullptr) || (slash[1] == 0) || (strlen(slash + 1) > MAX_FILE_NAME_LENGTH))
+        return -1;
+    std::string directoryPath;
+    if ((path[0] != '/') || (!normalizePath(std::string(path, slash - path).c_str(), &directoryPath)))
+        return -1;
+    const char *name = slash + 1;
+    int32_t directory, result;
+    if ((directoryCache != nullptr) && (fileCache != nullptr)) {
+        // 2つのキャッシュを引く間に削除や名前の変更がなければ、結果は組み合わせても正しい
+        int64_t before = invalidationCount;
+        if ((directoryCache->lookup(directoryPath, &directory)) &&
+                (fileCache->lookup(makeFileKey(directory, name), &result)) &&
+                (invalidationCount == before))
+            return result;
+    }
+    pthread_mutex_lock(&lock);
+    directory = resolveDirectory(directoryPath);
+    result = -1;
+    if (directory >= 0) {
+        int32_t entry = findChild(directory, name);
+        if (isFileEntry(entry)) {
+            result = getEntryID(entry);
+            if (fileCache != nullptr)
+                fileCache->insert(makeFileKey(directory, name), result);
+        }
+    }
+    pthread_mutex_unlock(&lock);
+    return result;
+}
+
+bool FileManager::getFileAttributes(int32_t file, IndexedINode *result) {
+    pthread_mutex_lock(&lock);
+    file = resolveFileID(file);
+    bool found = (file >= 0) && (file < fileSlotsAllocated) && (files[file].iNode >= 0);
+    if (found)
+        *result = iNodes[files[file].iNode];
+    pthread_mutex_unlock(&lock);
+    return found;
+}
+
+int32_t FileManager::getFileCount() {
+    pthread_mutex_lock(&lock);
+    int32_t result = fileCount;
+    pthread_mutex_unlock(&lock);
+    return result;
+}
+
+int32_t FileManager::getDirectoryCount() {
+    pthread_mutex_lock(&lock);
+    int32_t result = directoryCount;
+    pthread_mutex_unlock(&lock);
+    return result;
+}
+
+int64_t FileManager::getPathCacheHitCount() {
+    if (directoryCache == nullptr)
+        return 0;
+    return directoryCache->getHitCount() + fileCache->getHitCount();
+}
+
+int64_t FileManager::getPathCacheMissCount() {
+    if (directoryCache == nullptr)
+        return 0;
+    return directoryCache->getMissCount() + fileCache->getMissCount();
+}
+
+void FileManager::getSlotUsage(int32_t *directorySlotsAllocated, int32_t *directorySlotsUsed,
+        int32_t *fileSlotsAllocated, int32_t *fileSlotsUsed) {
+    pthread_mutex_lock(&lock);
+    *directorySlotsAllocated = this->directorySlotsAllocated;
+    *directorySlotsUsed = getDirectorySlotsUsed();
+    *fileSlotsAllocated = this->fileSlotsAllocated;
+    *fileSlotsUsed = getFileSlotsUsed();
+    pthread_mutex_unlock(&lock);
 }
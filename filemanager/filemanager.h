@@ -1,29 +1,97 @@
 #ifndef __FILE_MANAGER_H
 #define __FILE_MANAGER_H
 
+#include <pthread.h>
+#include <atomic>
+#include <string>
+#include <vector>
 #include "data_structure.h"
+#include "slotallocator.h"
 #include "../index/index_type.h"
+#include "../index/writeaheadlog.h"
+#include "../utils/all.h"
 
 /*
 FileManagerクラスはファイルシステムの構造(リンク、inode、　ディレクトリ)
 を管理するために使用される
+
+ファイルとディレクトリの所有者とパーミッションはSecurityManagerがユーザーごとの
+見えるアドレス範囲を求めるために使う。見え方に影響する変更は変更の記録(changeLog)に
+残され、SecurityManagerはそれを使って求めた範囲を差分で更新する。
+public関数はlockで排他される。ただし名前の解決(getDirectoryID、getFileID)は
+PathCacheにヒットした場合はlockを取らずに結果を返す
+
+ディレクトリ、ファイル、INodeの表は固定の配置のバイナリ配列(FM_TableHeader)として保存され、
+起動時にはmmapするだけで読み込みや組み立て直しは行わない。変更は割り当てを通して
+そのまま書き込まれ、saveToDiskでヘッダを更新してmsyncで同期する。
+名前から子を引くためのDirectoryContentと空きIDのビットマップ(SlotAllocator)はメモリ上にしかなく、
+最初に名前やIDの割り当てが必要になった時点で表を1回走査して組み立てる。
+
+ディレクトリとファイルを削除して表が疎になった場合は、更新操作のたびに少しずつ末尾のスロットを
+先頭の空きに移して詰め(リパック)、詰め終わった表はsaveToDiskで小さくする。移したスロットの
+古いIDは転送表で新しいIDに読み替えるので、呼び出し元が持っているIDはそのまま使える。
+1回に移すスロットの数には上限があるので、lockを長く保持して問い合わせを止めることはない。
+INodeのIDはアドレス空間の順序を表すので、INodeの表はリパックしない。
+
+表の割り当てのページはsaveToDiskより前にも書き戻されうるので、変更した後のスロットの
+内容をインデックスのログ(WriteAheadLog)にWAL_FILE_MANAGERレコードとして残し、
+呼び出し元に戻る前にcommitする。クラッシュした場合はrecoverがそれらのスロットを書き直し、
+ログに残っていない変更の一部だけが書き戻された場合に備えて表の整合性を確かめる
 */
 
 class Index;
+class PathCache;
+class SecurityManager;
 
+// アドレス空間の変化。ログのWAL_ADDRESS_SPACE_CHANGEレコードの内容
 typedef struct {
     offset startOffset;
     uint32_t tokenCount;
+
+    // 使用されるようになった場合は1、削除された場合は-1
     int32_t delta;
 } AddressSpaceChange;
 
+// WAL_FILE_MANAGERレコードのスロットの種類
+#define FM_LOG_DIRECTORY 0
+#define FM_LOG_FILE 1
+#define FM_LOG_INODE 2
+
+/*
+WAL_FILE_MANAGERレコードは、1回の操作で変更したスロットごとに、このヘッダと
+変更後のスロットの内容(IndexDirectory、IndexedFile、IndexedINode)を並べたもの
+*/
+typedef struct {
+    int32_t table;
+    int32_t id;
+} FM_LogSlot;
+
+typedef struct {
+    // 変更の通し番号
+    int64_t sequence;
+
+    // 見え方が変わった可能性のあるINode。-1の場合はディレクトリの変更(影響はサブツリー全体)
+    int32_t iNode;
+} FM_Change;
+
+// mmapしたFileManagerの表。ヘッダと要素の配列を含むファイル全体を割り当てる
+typedef struct {
+    // 表のファイル。-1の場合は(読み取り専用でファイルが無いなど)無名の割り当て
+    int fd;
+
+    // ファイルへの変更を書き戻すかどうか(読み取り専用の場合はMAP_PRIVATE)
+    bool shared;
+
+    char *mapping;
+    size_t mappingSize;
+} FM_Table;
+
 class FileManager {
     friend class Index;
+    friend class SecurityManager;
 
 public:
 
-    static const int INITIAL_TRANSACTION_LOG_SPACE = 8;
-
     /*
     デフォルトではディレクトリ、ファイル、INodeに対して
     少なくともこの数のスロットが割当てられる
@@ -34,15 +102,32 @@ public:
     スロットが不足した場合は、スロット用メモリを再割当てを行う
     このときに使用される成長率
     */
-    static const double SLOT_GROWTH_RATE = 1.23;
+    static constexpr double SLOT_GROWTH_RATE = 1.23;
 
     /*
-    あるタイプ(ディレクトリ、ファイル、INode)のスロット使用率がこの値より
-    小さくなった場合、メモリを節約するために該当する配列を再配置(リパック)する
+    ディレクトリまたはファイルのスロット使用率(使用中のスロット数 / 使われている最大のID + 1)が
+    この値より小さくなった場合、メモリを節約するために該当する配列を再配置(リパック)する
     */
-    static const double SLOT_REPACK_THRESHOLD = 0.78;
+    static constexpr double SLOT_REPACK_THRESHOLD = 0.78;
 
-    static const off_t INODE_FILE_HEADER_SIZE = 2 * sizeof(int32_t) + sizeof(offset);
+    /*
+    リパック中は、1回の更新操作でディレクトリとファイルを合わせて最大この数のスロットを移す
+    (ディレクトリを移す場合は、親を書き換える子の数も含める)
+    */
+    static const int DEFAULT_REPACK_SLOTS_PER_UPDATE = 32;
+    configurable int REPACK_SLOTS_PER_UPDATE;
+
+
+    // 変更の記録として保持するFM_Changeの最大数
+    static const int MAX_CHANGE_LOG_LENGTH = 65536;
+
+    // 名前の解決結果のキャッシュのエントリ数(ディレクトリとファイルのそれぞれ)。0の場合は使わない
+    static const int64_t DEFAULT_PATH_CACHE_SIZE = 65536;
+    configurable int64_t PATH_CACHE_SIZE;
+
+    // 名前の解決結果のキャッシュのシャードの数。シャードごとにロックを持つ
+    static const int DEFAULT_PATH_CACHE_SHARDS = 16;
+    configurable int PATH_CACHE_SHARDS;
 
     static const char *LOG_ID;
 
@@ -53,16 +138,21 @@ private:
     // データファイルのファイル名
     char *directoryDataFile, *fileDataFile, *iNodeDataFile;
 
-    // データファイルのファイルハンドル
-    int directoryData, fileData, iNodeData;
+    // データファイルをmmapした表
+    FM_Table directoryTable, fileTable, iNodeTable;
 
-    // 最も最近にアクセスされたファイルのキャッシュ
-    int cachedFileID;
-    char cachedDirName[256];
+    /*
+    正規化したパス(およびその接頭辞)からディレクトリIDへのキャッシュと、
+    ディレクトリIDと名前からファイルIDへのキャッシュ。PATH_CACHE_SIZEが0の場合はnullptr。
+    エントリの追加と無効化はlockを保持して行う
+    */
+    PathCache *directoryCache, *fileCache;
 
-    // 最も最近にサクセスされたディレクトリのキャッシュ
-    int cacheDirID;
-    char caccheDirName[256];
+    /*
+    削除と名前の変更のたびに増加する。lockを取らずに2つのキャッシュを続けて引く場合に、
+    その間にエントリが無効になっていないことを確かめるために使う
+    */
+    std::atomic<int64_t> invalidationCount;
 
     /*
     このディレクトリツリーが存在するマウントポイント
@@ -76,18 +166,24 @@ private:
     // 確保されているスロット数(IndexedDirectoryインスタンスの数)
     int32_t directorySlotsAllocated;
 
-    // 把握しているすべてのディレクトリのリスト
+    // 把握しているすべてのディレクトリのリスト(directoryTable内)
     IndexDirectory *directories;
 
-    // freeDirectoryIDs配列に含まれる空きディレクトリの数
-    int32_t freeDirectoryCount;
+    // 各ディレクトリの子の一覧。directoryContentsLoadedがtrueの場合のみ有効
+    DicrectoryContent *directoryContents;
+
+    // directoryContentsと空きIDのビットマップを組み立て済みかどうか
+    bool directoryContentsLoaded;
 
     /*
-    空きディレクトリIDのリストを含む配列
+    ディレクトリIDの割り当てと、リパックで移したIDの転送表。directoryContentsLoadedがtrueの場合のみ有効。
     これですべての割り当て済みディレクトリスロットを線形にスキャンせずに
     新しいディレクトリにIDを割り当てることができる
     */
-    int32_t *freeDirectoryIDs;
+    SlotAllocator directoryAllocator;
+
+    // 使われている最大のディレクトリID + 1。directoryContentsLoadedがfalseの場合のみ有効
+    int32_t directorySlotsUsed;
 
     // FileManagerが管理しているファイルの数
     int32_t fileCount;
@@ -95,11 +191,17 @@ private:
     // 確保されているスロット数(indexFileインスタンスの数)
     int32_t fileSlotsAllocated;
 
-    // 把握しているすべてのファイル
-    IndexedFile files;
+    // 把握しているすべてのファイル(fileTable内)
+    IndexedFile *files;
+
+    // ファイルIDの割り当てと転送表。directoryContentsLoadedがtrueの場合のみ有効
+    SlotAllocator fileAllocator;
+
+    // 使われている最大のファイルID + 1。directoryContentsLoadedがfalseの場合のみ有効
+    int32_t fileSlotsUsed;
 
-    // freeFileIDs配列に含まれる空きファイルの数
-    int32_t freeFileIDs;
+    // ディレクトリとファイルの表をリパック中かどうか
+    bool repackingDirectories, repackingFiles;
 
     // システム内のINodeの数
     int32_t iNodeCount;
@@ -110,6 +212,9 @@ private:
     // FileManagerに最も最近追加されたINodeのID
     int32_t biggestINodeID;
 
+    // すべてのINode。IDの順(アドレス空間の昇順)に並ぶ(iNodeTable内)
+    IndexedINode *iNodes;
+
     /*
     これまでに観測された最大のオフセット値
     INodesが常に昇順に並ぶことを保証するために使用される
@@ -123,13 +228,13 @@ private:
     offset addressSpaceCovered;
 
     /*
-    現在のトランザクション中に何が起こったか要約する
-    AddressSpaceChangeインスタンスのリスト
+    見え方に影響する最近の変更(古い順)。最大MAX_CHANGE_LOG_LENGTH個で、あふれた場合は
+    古いものから捨て、changeLogStartに捨てた変更の最後の通し番号を記録する
     */
-    AddressSpaceChange *transactionLog;
+    std::vector<FM_Change> changeLog;
+    int64_t changeSequence, changeLogStart;
 
-    // トランザクションログ内の要素数
-    int transactionLogSize, transactionLogAllocated;
+    pthread_mutex_t lock;
 
 public:
 
@@ -142,7 +247,201 @@ public:
     // データをディスクに保存し、メモリを開放する
     ~FileManager();
 
+    // 表のヘッダを更新し、ディレクトリ、ファイル、INodeのデータをディスクに同期する
+    void saveToDisk();
+
+    /*
+    前回クラッシュした場合に、ログのWAL_FILE_MANAGERレコードのスロットを書き直し、
+    件数や最大値を表から求め直す。他の操作より前に呼び出すこと
+    */
+    void recover(const std::vector<WAL_Record> &records);
+
+    /*
+    ディレクトリparentの中にディレクトリnameを作り、そのIDを返す。
+    親が存在しない場合や同じ名前の子が既にある場合は-1を返す
+    */
+    int32_t createDirectory(int32_t parent, const char *name, uid_t owner, gid_t group, mode_t permissions);
+
+    // 空のディレクトリを削除する。ルートディレクトリは削除できない
+    bool removeDirectory(int32_t directory);
+
+    /*
+    ディレクトリparentの中に、アドレス空間の[startOffset, startOffset + tokenCount - 1]を
+    占めるファイルnameを追加し、そのIDを返す。startOffsetはこれまでに追加された
+    どのファイルの範囲よりも後でなければならない。失敗した場合は-1を返す
+    */
+    int32_t addFile(int32_t parent, const char *name, uid_t owner, gid_t group, mode_t permissions,
+            offset startOffset, uint32_t tokenCount);
+
+    // ファイルを削除し、その範囲をインデックスに削除されたものとして通知する
+    bool removeFile(int32_t file);
+
+    // ファイルの所有者、グループ、パーミッションを変更する
+    bool changeFileAttributes(int32_t file, uid_t owner, gid_t group, mode_t permissions);
+
+    // ディレクトリの所有者、グループ、パーミッションを変更する
+    bool changeDirectoryAttributes(int32_t directory, uid_t owner, gid_t group, mode_t permissions);
+
+    /*
+    ファイルをディレクトリparentに移し、名前をnameにする。
+    移動先に同じ名前の子が既にある場合はfalseを返す
+    */
+    bool renameFile(int32_t file, int32_t parent, const char *name);
+
+    /*
+    ディレクトリをディレクトリparentに移し、名前をnameにする。ルートディレクトリと、
+    自分のサブツリーの中への移動はできない
+    */
+    bool renameDirectory(int32_t directory, int32_t parent, const char *name);
+
+    /*
+    マウントポイントからの絶対パスpathのディレクトリのIDを返す。
+    見つからない場合は-1を返す("/"はルートディレクトリの0)
+    */
+    int32_t getDirectoryID(const char *path);
+
+    // 絶対パスpathのファイルのIDを返す。見つからない場合は-1を返す
+    int32_t getFileID(const char *path);
+
+    // ファイルのINodeの内容をresultに格納する
+    bool getFileAttributes(int32_t file, IndexedINode *result);
+
+    int32_t getFileCount();
+
+    int32_t getDirectoryCount();
+
+    // 名前の解決結果のキャッシュのヒット数とミス数(ディレクトリとファイルの合計)
+    int64_t getPathCacheHitCount();
+
+    int64_t getPathCacheMissCount();
+
+    /*
+    ディレクトリとファイルの表の確保されているスロット数と、使われている最大のID + 1。
+    リパックで詰めると後者が小さくなり、saveToDiskで前者も小さくなる
+    */
+    void getSlotUsage(int32_t *directorySlotsAllocated, int32_t *directorySlotsUsed,
+            int32_t *fileSlotsAllocated, int32_t *fileSlotsUsed);
+
+private:
+
+    void getConfiguration();
+
+    // 表のファイルをmmapし、ヘッダを検証する
+    bool loadFromDisk();
+
+    // 空の表を作る。ファイルが使えない場合は無名の割り当てにする
+    void initializeEmpty();
+
+    /*
+    ディレクトリの内容と空きIDのビットマップを組み立てていなければ、表を走査して組み立てる。
+    lockを保持して呼び出すこと
+    */
+    void loadDirectoryContents();
+
+    // 組み立てたディレクトリの内容と空きIDのビットマップ(転送表を含む)を捨てる
+    void discardDirectoryContents();
+
+    // 使われている最大のID + 1
+    int32_t getDirectorySlotsUsed();
+
+    int32_t getFileSlotsUsed();
+
+    /*
+    呼び出し元から渡されたIDを、リパックで移されていれば移動先のIDに読み替える。
+    lockを保持して呼び出すこと
+    */
+    int32_t resolveDirectoryID(int32_t directory);
+
+    int32_t resolveFileID(int32_t file);
+
+    // 最も小さい空きIDを割り当てる。空きが無ければ表を大きくする。失敗した場合は-1
+    int32_t allocateDirectoryID();
+
+    int32_t allocateFileID();
+
+    /*
+    表が疎であればリパックを始め、リパック中であればREPACK_SLOTS_PER_UPDATEまでのスロットを移す。
+    書き換えたスロットはrecordに追加する。更新操作の最後にlockを保持して呼び出すこと
+    */
+    void repackSlots(std::string *record);
+
+    // ディレクトリfromをtoに移し、子の親を書き換える
+    void moveDirectory(int32_t from, int32_t to, std::string *record);
+
+    void moveFile(int32_t from, int32_t to, std::string *record);
+
+    /*
+    リパックで詰め終わった表を小さくする。要素とヘッダを同期した後にsaveToDiskから呼び出すので、
+    ログに残っていないスロットを切り捨てることはない
+    */
+    void shrinkTables();
+
+    // ディレクトリdirectoryの子nameを探し、DirectoryContentの値を返す。見つからない場合は0
+    int32_t findChild(int32_t directory, const char *name);
+
+    /*
+    正規化したパスのディレクトリを、キャッシュにある最も長い接頭辞からたどって探す。
+    たどった接頭辞はキャッシュに追加する。lockを保持して呼び出すこと
+    */
+    int32_t resolveDirectory(const std::string &path);
+
+    // ディレクトリの正規化したパスをpathに格納する。lockを保持して呼び出すこと
+    void getDirectoryPath(int32_t directory, std::string *path);
+
+    /*
+    pathを、連続する'/'と末尾の'/'を取り除いた形(ルートは"/")にする。
+    要素がMAX_DIRECTORY_NAME_LENGTHより長い場合はfalseを返す
+    */
+    static bool normalizePath(const char *path, std::string *result);
+
+    // fileCacheのキー
+    static std::string makeFileKey(int32_t directory, const char *name);
+
+    /*
+    スロットの配列を大きくする(ディレクトリとファイルは空きが無い場合、INodeは必要であれば)。
+    ファイルを拡張できない場合はfalseを返す
+    */
+    bool growDirectorySlots();
+
+    bool growFileSlots();
+
+    bool growINodeSlots();
+
+    // 見え方に影響する変更を記録する。lockを保持して呼び出すこと
+    void recordChange(int32_t iNode);
+
+    // スロットの現在の内容をWAL_FILE_MANAGERレコードrecordに追加する
+    void addSlotToRecord(std::string *record, int32_t table, int32_t id);
+
+    /*
+    recordをログに追加する。WriteAheadLog::MAX_RECORD_LENGTHを超える場合は複数のレコードに分ける。
+    lockを保持して呼び出すこと
+    */
+    void appendToLog(const std::string &record);
+
+    /*
+    これまでにログに追加したレコード(notifyOfAddressSpaceChangeが追加したものを含む)を
+    ディスクに書き込む。同時に呼び出された他の操作の分とまとめて書き込まれるので、
+    lockを開放してから呼び出すこと
+    */
+    void commitLog();
+
+    // スロットの種類ごとの要素の大きさと、スロットのアドレス
+    static int32_t getSlotSize(int32_t table);
+
+    char *getSlot(int32_t table, int32_t id);
+
+    // 再実行のために、表をスロットidが入る大きさに広げる
+    bool reserveSlot(int32_t table, int32_t id);
+
+    /*
+    再実行の後、ディレクトリ、ファイル、INodeの件数と最大値を表から求め直す。
+    ログに残っていない変更の一部だけが書き戻されていた場合、矛盾するスロットは取り除く
+    */
+    void repairTables();
 
+    // nameが'/'を含まない、maxLength文字以下の空でない名前かどうか
+    static bool isValidName(const char *name, int maxLength);
 };
 
 #endif
\ No newline at end of file
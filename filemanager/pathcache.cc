@@ -0,0 +1,141 @@
+#include <functional>
+#include "pathcache.h"
+#include "../utils/all.h"
+
+const char *PathCache::LOG_ID = "PathCache";
+
+PathCache::PathCache(int64_t capacity, int shardCount) {
+    if (shardCount < 1)
+        shardCount = 1;
+    this->shardCount = shardCount;
+    shardCapacity = capacity / shardCount;
+    if (shardCapacity < 1)
+        shardCapacity = 1;
+    shards = new PC_Shard[shardCount];
+    for (int i = 0; i < shardCount; i++) {
+        pthread_mutex_init(&shards[i].lock, nullptr);
+        shards[i].first = shards[i].last = nullptr;
+    }
+    hitCount = missCount = 0;
+}
+
+PathCache::~PathCache() {
+    clear();
+    for (int i = 0; i < shardCount; i++)
+        pthread_mutex_destroy(&shards[i].lock);
+    delete[] shards;
+}
+
+PC_Shard *PathCache::getShard(const std::string &key) {
+    return &shards[std::hash<std::string>()(key) % shardCount];
+}
+
+void PathCache::unlink(PC_Shard *shard, PC_Entry *entry) {
+    if (entry->previous != nullptr)
+        entry->previous->next = entry->next;
+    else
+        shard->first = entry->next;
+    if (entry->next != nullptr)
+        entry->next->previous = entry->previous;
+    else
+        shard->last = entry->previous;
+}
+
+void PathCache::pushFront(PC_Shard *shard, PC_Entry *entry) {
+    entry->previous = nullptr;
+    entry->next = shard->first;
+    if (shard->first != nullptr)
+        shard->first->previous = entry;
+    shard->first = entry;
+    if (shard->last == nullptr)
+        shard->last = entry;
+}
+
+bool PathCache::lookup(const std::string &key, int32_t *value) {
+    PC_Shard *shard = getShard(key);
+    pthread_mutex_lock(&shard->lock);
+    auto it = shard->entries.find(key);
+    if (it == shard->entries.end()) {
+        pthread_mutex_unlock(&shard->lock);
+        missCount++;
+        return false;
+    }
+    PC_Entry *entry = it->second;
+    *value = entry->value;
+    unlink(shard, entry);
+    pushFront(shard, entry);
+    pthread_mutex_unlock(&shard->lock);
+    hitCount++;
+    return true;
+}
+
+void PathCache::insert(const std::string &key, int32_t value) {
+    PC_Shard *shard = getShard(key);
+    pthread_mutex_lock(&shard->lock);
+    auto it = shard->entries.find(key);
+    if (it != shard->entries.end()) {
+        it->second->value = value;
+        unlink(shard, it->second);
+        pushFront(shard, it->second);
+        pthread_mutex_unlock(&shard->lock);
+        return;
+    }
+    PC_Entry *entry;
+    if ((int64_t)shard->entries.size() >= shardCapacity) {
+        // 最も古いエントリを再利用する
+        entry = shard->last;
+        unlink(shard, entry);
+        shard->entries.erase(entry->key);
+    }
+    else
+        entry = new PC_Entry;
+    entry->key = key;
+    entry->value = value;
+    shard->entries[key] = entry;
+    pushFront(shard, entry);
+    pthread_mutex_unlock(&shard->lock);
+}
+
+void PathCache::remove(const std::string &key) {
+    PC_Shard *shard = getShard(key);
+    pthread_mutex_lock(&shard->lock);
+    auto it = shard->entries.find(key);
+    if (it != shard->entries.end()) {
+        PC_Entry *entry = it->second;
+        unlink(shard, entry);
+        shard->entries.erase(it);
+        delete entry;
+    }
+    pthread_mutex_unlock(&shard->lock);
+}
+
+void PathCache::clear() {
+    for (int i = 0; i < shardCount; i++) {
+        pthread_mutex_lock(&shards[i].lock);
+        while (shards[i].first != nullptr) {
+            PC_Entry *entry = shards[i].first;
+            unlink(&shards[i], entry);
+            delete entry;
+        }
+        shards[i].entries.clear();
+        pthread_mutex_unlock(&shards[i].lock);
+    }
+}
+
+int64_t PathCache::getEntryCount() {
+    int64_t result = 0;
+    for (int i = 0; i < shardCount; i++) {
+        pthread_mutex_lock(&shards[i].lock);
+        result += shards[i].entries.size();
+        pthread_mutex_unlock(&shards[i].lock);
+    }
+    return result;
+}
+
+int64_t PathCache::getHitCount() {
+    return hitCount;
+}
+
+int64_t PathCache::getMissCount() {
+    return missCount;
+}
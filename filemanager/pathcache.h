@@ -0,0 +1,93 @@
+#ifndef __PATHCACHE_H
+#define __PATHCACHE_H
+
+/*
+PathCacheはFileManagerの名前の解決結果(パスからディレクトリID、ディレクトリIDと名前から
+ファイルID)を保持するLRUキャッシュ。キーのハッシュ値で選ばれるシャードごとにロックと
+LRUリストを持ち、シャードごとのエントリ数がcapacity / shardCountを超えないように
+古いエントリを捨てる。
+
+ヒットした場合はFileManagerのlockを取らずに結果を返せるので、同じディレクトリの下の
+ファイルを次々に引く場合(ファイルシステムの変更通知の一括処理など)にロックを取り合わない。
+エントリの無効化(削除と名前の変更)は呼び出し元がFileManagerのlockを保持して行う
+*/
+
+#include <atomic>
+#include <pthread.h>
+#include <string>
+#include <unordered_map>
+
+typedef struct PC_Entry {
+
+    std::string key;
+
+    int32_t value;
+
+    // LRUリスト。先頭が最近使われたもの
+    struct PC_Entry *previous, *next;
+
+} PC_Entry;
+
+typedef struct {
+
+    pthread_mutex_t lock;
+
+    std::unordered_map<std::string, PC_Entry*> entries;
+
+    PC_Entry *first, *last;
+
+} PC_Shard;
+
+class PathCache {
+
+public:
+
+    static const char *LOG_ID;
+
+private:
+
+    PC_Shard *shards;
+    int shardCount;
+
+    // シャードごとのエントリ数の上限
+    int64_t shardCapacity;
+
+    // 統計。シャードのロックの外で更新される
+    std::atomic<int64_t> hitCount, missCount;
+
+public:
+
+    // 最大capacity個のエントリを保持するキャッシュを作る
+    PathCache(int64_t capacity, int shardCount);
+
+    ~PathCache();
+
+    // keyのエントリがあればvalueに格納してtrueを返す
+    bool lookup(const std::string &key, int32_t *value);
+
+    // keyのエントリを追加または更新する
+    void insert(const std::string &key, int32_t value);
+
+    // keyのエントリを捨てる
+    void remove(const std::string &key);
+
+    // すべてのエントリを捨てる
+    void clear();
+
+    int64_t getEntryCount();
+
+    int64_t getHitCount();
+
+    int64_t getMissCount();
+
+private:
+
+    PC_Shard *getShard(const std::string &key);
+
+    // シャードのロックを保持して呼び出すこと
+    void unlink(PC_Shard *shard, PC_Entry *entry);
+
+    void pushFront(PC_Shard *shard, PC_Entry *entry);
+};
+
+#endif
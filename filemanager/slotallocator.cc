@@ -0,0 +1,177 @@
+#include <cassert>
+#include <cstring>
+#include "slotallocator.h"
+
+SlotAllocator::SlotAllocator() {
+    freeBits = nullptr;
+    wordCount = 0;
+    capacity = slotsUsed = usedCount = 0;
+    firstFreeWord = 0;
+}
+
+SlotAllocator::~SlotAllocator() {
+    free(freeBits);
+}
+
+void SlotAllocator::reset(int32_t capacity) {
+    free(freeBits);
+    freeBits = nullptr;
+    wordCount = 0;
+    this->capacity = slotsUsed = usedCount = 0;
+    firstFreeWord = 0;
+    forward.clear();
+    reverse.clear();
+    setCapacity(capacity);
+}
+
+void SlotAllocator::setCapacity(int32_t capacity) {
+    assert(capacity >= slotsUsed);
+    int32_t newWordCount = (capacity + 63) / 64;
+    if (newWordCount != wordCount) {
+        typed_realloc(uint64_t, freeBits, newWordCount > 0 ? newWordCount : 1);
+        for (int32_t i = wordCount; i < newWordCount; i++)
+            freeBits[i] = 0;
+        wordCount = newWordCount;
+    }
+    if (capacity > this->capacity) {
+        for (int32_t id = this->capacity; id < capacity; id++)
+            setFree(id, true);
+        if (firstFreeWord > this->capacity / 64)
+            firstFreeWord = this->capacity / 64;
+    }
+    else if ((capacity % 64 != 0) && (wordCount > 0)) {
+        // 取り除いたスロットのビットを落とす
+        freeBits[wordCount - 1] &= (1ULL << (capacity % 64)) - 1;
+    }
+    this->capacity = capacity;
+    if (firstFreeWord > wordCount)
+        firstFreeWord = wordCount;
+}
+
+bool SlotAllocator::isFree(int32_t id) {
+    return (freeBits[id / 64] >> (id % 64)) & 1;
+}
+
+void SlotAllocator::setFree(int32_t id, bool free) {
+    if (free)
+        freeBits[id / 64] |= 1ULL << (id % 64);
+    else
+        freeBits[id / 64] &= ~(1ULL << (id % 64));
+}
+
+int32_t SlotAllocator::findFirstFree() {
+    while ((firstFreeWord < wordCount) && (freeBits[firstFreeWord] == 0))
+        firstFreeWord++;
+    if (firstFreeWord >= wordCount)
+        return -1;
+    return firstFreeWord * 64 + __builtin_ctzll(freeBits[firstFreeWord]);
+}
+
+void SlotAllocator::trimSlotsUsed() {
+    while (slotsUsed > 0) {
+        int32_t word = (slotsUsed - 1) / 64;
+        if ((slotsUsed % 64 == 0) && (freeBits[word] == ~0ULL)) {
+            // ワード全体が空きであればまとめて飛ばす
+            slotsUsed -= 64;
+            continue;
+        }
+        if (!isFree(slotsUsed - 1))
+            break;
+        slotsUsed--;
+    }
+}
+
+void SlotAllocator::removeForwarding(int32_t id) {
+    auto it = forward.find(id);
+    if (it == forward.end())
+        return;
+    auto range = reverse.equal_range(it->second);
+    for (auto r = range.first; r != range.second; ++r) {
+        if (r->second == id) {
+            reverse.erase(r);
+            break;
+        }
+    }
+    forward.erase(it);
+}
+
+void SlotAllocator::markUsed(int32_t id) {
+    assert((id >= 0) && (id < capacity) && (isFree(id)));
+    setFree(id, false);
+    usedCount++;
+    if (id >= slotsUsed)
+        slotsUsed = id + 1;
+}
+
+int32_t SlotAllocator::allocate() {
+    int32_t id = findFirstFree();
+    if (id < 0)
+        return -1;
+    // 古いIDとして転送されていたIDを別のスロットに使うので、転送は無効になる
+    removeForwarding(id);
+    markUsed(id);
+    return id;
+}
+
+void SlotAllocator::release(int32_t id) {
+    assert((id >= 0) && (id < capacity) && (!isFree(id)));
+    setFree(id, true);
+    usedCount--;
+    if (id / 64 < firstFreeWord)
+        firstFreeWord = id / 64;
+    // idに転送されていた古いIDは、指すスロットが無くなった
+    auto range = reverse.equal_range(id);
+    for (auto r = range.first; r != range.second; ++r)
+        forward.erase(r->second);
+    reverse.erase(id);
+    if (id == slotsUsed - 1)
+        trimSlotsUsed();
+}
+
+int32_t SlotAllocator::move(int32_t from) {
+    int32_t to = findFirstFree();
+    if ((to < 0) || (to >= from))
+        return -1;
+    removeForwarding(to);
+    setFree(to, false);
+    setFree(from, true);
+    if (from / 64 < firstFreeWord)
+        firstFreeWord = from / 64;
+
+    // fromに転送されていた古いIDも、新しいIDを直接指すようにする
+    std::vector<int32_t> olds;
+    auto range = reverse.equal_range(from);
+    for (auto r = range.first; r != range.second; ++r)
+        olds.push_back(r->second);
+    reverse.erase(from);
+    for (size_t i = 0; i < olds.size(); i++) {
+        forward[olds[i]] = to;
+        reverse.emplace(to, olds[i]);
+    }
+    forward[from] = to;
+    reverse.emplace(to, from);
+    if (from == slotsUsed - 1)
+        trimSlotsUsed();
+    return to;
+}
+
+int32_t SlotAllocator::resolve(int32_t id) {
+    auto it = forward.find(id);
+    return (it == forward.end() ? id : it->second);
+}
+
+int32_t SlotAllocator::getCapacity() {
+    return capacity;
+}
+
+int32_t SlotAllocator::getSlotsUsed() {
+    return slotsUsed;
+}
+
+int32_t SlotAllocator::getUsedCount() {
+    return usedCount;
+}
+
+int32_t SlotAllocator::getForwardingCount() {
+    return (int32_t)forward.size();
+}
@@ -0,0 +1,105 @@
+#ifndef __SLOTALLOCATOR_H
+#define __SLOTALLOCATOR_H
+
+/*
+SlotAllocatorはFileManagerのディレクトリとファイルの表のスロットIDを管理する。
+空きスロットは1スロット1ビットのビットマップで持ち、常に最も小さい空きIDを割り当てる。
+空きIDのリスト(スロットごとにint32_t)に比べてメモリは1/32で、使用中のスロットが
+表の先頭に集まるので、リパックで動かすスロットが少なくて済む。
+
+リパック(move)で末尾のスロットを先頭の空きに移した場合は、古いIDから新しいIDへの
+転送表に記録し、呼び出し元が古いIDを持ち続けていてもresolveで引き直せるようにする。
+同じスロットが何度移されても転送表は常に最終的なIDを指す。
+転送元のIDが再び割り当てられた場合や、転送先が開放された場合はその記録を捨てる。
+転送表はメモリ上にしかないので、再起動の後は古いIDは使えない
+*/
+
+#include <sys/types.h>
+#include <unordered_map>
+#include <vector>
+#include "../utils/all.h"
+
+class SlotAllocator {
+
+private:
+
+    // 空きスロットのビットマップ(1が空き)。capacityより後のビットは常に0
+    uint64_t *freeBits;
+
+    int32_t wordCount;
+
+    // 管理するスロットの数
+    int32_t capacity;
+
+    // 使用中の最大のID + 1
+    int32_t slotsUsed;
+
+    // 使用中のスロットの数
+    int32_t usedCount;
+
+    // これより前のワードには空きが無い
+    int32_t firstFreeWord;
+
+    // 移したスロットの古いIDから新しいIDへの転送表と、その逆引き
+    std::unordered_map<int32_t, int32_t> forward;
+    std::unordered_multimap<int32_t, int32_t> reverse;
+
+public:
+
+    SlotAllocator();
+
+    ~SlotAllocator();
+
+    // capacity個のスロットをすべて空きにし、転送表を捨てる
+    void reset(int32_t capacity);
+
+    /*
+    スロットの数をcapacityにする。増えた分は空きになる。
+    減らす場合、取り除かれるスロットはすべて空きでなければならない
+    */
+    void setCapacity(int32_t capacity);
+
+    // 空きのスロットidを使用中にする(表を走査して組み立てる場合に使う)
+    void markUsed(int32_t id);
+
+    // 最も小さい空きIDを使用中にして返す。空きが無い場合は-1を返す
+    int32_t allocate();
+
+    // 使用中のスロットidを空きにする
+    void release(int32_t id);
+
+    /*
+    使用中のスロットfromを、それより小さい最も小さい空きIDに移して、そのIDを返す。
+    fromより前に空きが無い場合は何もせずに-1を返す。スロットの内容は呼び出し元が移す
+    */
+    int32_t move(int32_t from);
+
+    // idが移されていれば移動先のIDを、そうでなければidを返す
+    int32_t resolve(int32_t id);
+
+    int32_t getCapacity();
+
+    int32_t getSlotsUsed();
+
+    int32_t getUsedCount();
+
+    // 転送表のエントリ数
+    int32_t getForwardingCount();
+
+private:
+
+    bool isFree(int32_t id);
+
+    void setFree(int32_t id, bool free);
+
+    // 最も小さい空きID。無ければ-1
+    int32_t findFirstFree();
+
+    // 末尾の空きスロットの分だけslotsUsedを減らす
+    void trimSlotsUsed();
+
+    // idが転送元として登録されていれば取り除く
+    void removeForwarding(int32_t id);
+};
+
+#endif
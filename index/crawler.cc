@@ -0,0 +1,340 @@
+#include <cassert>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include "crawler.h"
+
+const char *Crawler::DISALLOW_FILE = ".index_disallow";
+const char *Crawler::LOG_ID = "Crawler";
+
+static char errorMessage[256];
+
+// getdents64が返すエントリ。glibcはこの構造体を公開していない
+struct linux_dirent64 {
+    ino64_t d_ino;
+    off64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+
+typedef struct {
+    const char *name;
+    unsigned char type;
+} CR_DirectoryEntry;
+
+static void *workerFunction(void *data) {
+    Crawler **args = (Crawler**)data;
+    Crawler *crawler = args[0];
+    int id = (int)(intptr_t)args[1];
+    free(args);
+    crawler->runWorker(id);
+    return nullptr;
+}
+
+// dirとnameを"/"でつなぐ
+static char *makePath(const char *dir, const char *name) {
+    int dirLength = strlen(dir), nameLength = strlen(name);
+    char *result = typed_malloc(char, dirLength + nameLength + 2);
+    memcpy(result, dir, dirLength);
+    if ((dirLength == 0) || (dir[dirLength - 1] != '/'))
+        result[dirLength++] = '/';
+    memcpy(&result[dirLength], name, nameLength + 1);
+    return result;
+}
+
+void Crawler::getConfiguration() {
+    getConfigurationInt("CRAWLER_THREADS", &CRAWLER_THREADS, DEFAULT_CRAWLER_THREADS);
+    if (CRAWLER_THREADS <= 0) {
+        CRAWLER_THREADS = sysconf(_SC_NPROCESSORS_ONLN);
+        if (CRAWLER_THREADS < 1)
+            CRAWLER_THREADS = 1;
+    }
+    getConfigurationInt("CRAWLER_QUEUE_SIZE", &CRAWLER_QUEUE_SIZE, DEFAULT_CRAWLER_QUEUE_SIZE);
+    if (CRAWLER_QUEUE_SIZE < 1)
+        CRAWLER_QUEUE_SIZE = 1;
+}
+
+Crawler::Crawler(const char *baseDirectory, int64_t minFileSize, int64_t maxFileSize) {
+    getConfiguration();
+    this->baseDirectory = duplicateString(baseDirectory);
+    this->minFileSize = minFileSize;
+    this->maxFileSize = maxFileSize;
+
+    threadCount = CRAWLER_THREADS;
+    threads = typed_malloc(pthread_t, threadCount);
+    workQueues = new CR_WorkQueue[threadCount];
+    for (int i = 0; i < threadCount; i++)
+        pthread_mutex_init(&workQueues[i].lock, nullptr);
+    pendingDirectories = 0;
+    activeThreads = 0;
+    stopped = false;
+    started = joined = false;
+
+    queueCapacity = CRAWLER_QUEUE_SIZE;
+    queue = typed_malloc(CrawledFile, queueCapacity);
+    queueStart = queueLength = 0;
+    queueClosed = false;
+    pthread_mutex_init(&queueLock, nullptr);
+    pthread_cond_init(&queueNotEmpty, nullptr);
+    pthread_cond_init(&queueNotFull, nullptr);
+
+    fileCount = directoryCount = skippedCount = 0;
+}
+
+Crawler::~Crawler() {
+    stop();
+    for (int i = 0; i < threadCount; i++) {
+        for (char *path : workQueues[i].directories)
+            free(path);
+        pthread_mutex_destroy(&workQueues[i].lock);
+    }
+    delete[] workQueues;
+    free(threads);
+    free(queue);
+    pthread_mutex_destroy(&queueLock);
+    pthread_cond_destroy(&queueNotEmpty);
+    pthread_cond_destroy(&queueNotFull);
+    free(baseDirectory);
+}
+
+void Crawler::start() {
+    assert(!started);
+    started = true;
+    pendingDirectories = 1;
+    pthread_mutex_lock(&workQueues[0].lock);
+    workQueues[0].directories.push_back(duplicateString(baseDirectory));
+    pthread_mutex_unlock(&workQueues[0].lock);
+    activeThreads = threadCount;
+    for (int i = 0; i < threadCount; i++) {
+        void **args = typed_malloc(void*, 2);
+        args[0] = this;
+        args[1] = (void*)(intptr_t)i;
+        if (pthread_create(&threads[i], nullptr, workerFunction, args) != 0) {
+            log(LOG_ERROR, LOG_ID, "Unable to start crawler thread.");
+            exit(1);
+        }
+    }
+}
+
+void Crawler::stop() {
+    stopped = true;
+    closeQueue();
+    if ((started) && (!joined)) {
+        for (int i = 0; i < threadCount; i++)
+            pthread_join(threads[i], nullptr);
+        joined = true;
+    }
+    // キューに残っているファイルを破棄する
+    pthread_mutex_lock(&queueLock);
+    for (int i = 0; i < queueLength; i++)
+        free(queue[(queueStart + i) % queueCapacity].path);
+    queueLength = 0;
+    pthread_mutex_unlock(&queueLock);
+}
+
+void Crawler::closeQueue() {
+    pthread_mutex_lock(&queueLock);
+    queueClosed = true;
+    pthread_cond_broadcast(&queueNotEmpty);
+    pthread_cond_broadcast(&queueNotFull);
+    pthread_mutex_unlock(&queueLock);
+}
+
+bool Crawler::getNextFile(CrawledFile *file) {
+    pthread_mutex_lock(&queueLock);
+    while ((queueLength == 0) && (!queueClosed))
+        pthread_cond_wait(&queueNotEmpty, &queueLock);
+    if (queueLength == 0) {
+        pthread_mutex_unlock(&queueLock);
+        return false;
+    }
+    *file = queue[queueStart];
+    queueStart = (queueStart + 1) % queueCapacity;
+    queueLength--;
+    pthread_cond_signal(&queueNotFull);
+    pthread_mutex_unlock(&queueLock);
+    return true;
+}
+
+void Crawler::putFiles(CrawledFile *files, int count) {
+    int done = 0;
+    pthread_mutex_lock(&queueLock);
+    while ((done < count) && (!queueClosed)) {
+        while ((queueLength == queueCapacity) && (!queueClosed))
+            pthread_cond_wait(&queueNotFull, &queueLock);
+        // 空いている分をまとめて入れる
+        while ((done < count) && (queueLength < queueCapacity) && (!queueClosed)) {
+            queue[(queueStart + queueLength) % queueCapacity] = files[done++];
+            queueLength++;
+        }
+        pthread_cond_broadcast(&queueNotEmpty);
+    }
+    pthread_mutex_unlock(&queueLock);
+    // 中止された場合、入れられなかったファイルは破棄する
+    for (int i = done; i < count; i++)
+        free(files[i].path);
+}
+
+void Crawler::addDirectory(int id, char *path) {
+    pendingDirectories++;
+    pthread_mutex_lock(&workQueues[id].lock);
+    workQueues[id].directories.push_back(path);
+    pthread_mutex_unlock(&workQueues[id].lock);
+}
+
+char *Crawler::getDirectory(int id) {
+    char *result = nullptr;
+    pthread_mutex_lock(&workQueues[id].lock);
+    if (!workQueues[id].directories.empty()) {
+        result = workQueues[id].directories.back();
+        workQueues[id].directories.pop_back();
+    }
+    pthread_mutex_unlock(&workQueues[id].lock);
+    if (result != nullptr)
+        return result;
+
+    // 他のスレッドのdequeの先頭から盗む
+    for (int i = 1; (i < threadCount) && (result == nullptr); i++) {
+        CR_WorkQueue *victim = &workQueues[(id + i) % threadCount];
+        if (pthread_mutex_trylock(&victim->lock) != 0)
+            continue;
+        if (!victim->directories.empty()) {
+            result = victim->directories.front();
+            victim->directories.pop_front();
+        }
+        pthread_mutex_unlock(&victim->lock);
+    }
+    return result;
+}
+
+void Crawler::runWorker(int id) {
+    int idleRounds = 0;
+    while (!stopped) {
+        char *path = getDirectory(id);
+        if (path == nullptr) {
+            // 処理中のディレクトリが無くなれば走査は終わり
+            if (pendingDirectories == 0)
+                break;
+            if (++idleRounds < 64)
+                sched_yield();
+            else
+                usleep(100);
+            continue;
+        }
+        idleRounds = 0;
+        processDirectory(id, path);
+        free(path);
+        pendingDirectories--;
+    }
+    if (--activeThreads == 0)
+        closeQueue();
+}
+
+void Crawler::processDirectory(int id, const char *path) {
+    int fd = open(path, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+    if (fd < 0) {
+        snprintf(errorMessage, sizeof(errorMessage), "Unable to open directory: %s", path);
+        log(LOG_DEBUG, LOG_ID, errorMessage);
+        return;
+    }
+    directoryCount++;
+
+    // ディレクトリの内容をすべて読み取ってから処理する(.index_disallowが後ろにあることもある)
+    int bufferSize = DIRENT_BUFFER_SIZE, bufferUsed = 0;
+    char *buffer = typed_malloc(char, bufferSize);
+    while (true) {
+        if (bufferSize - bufferUsed < DIRENT_BUFFER_SIZE / 2) {
+            bufferSize *= 2;
+            typed_realloc(char, buffer, bufferSize);
+        }
+        long result = syscall(SYS_getdents64, fd, &buffer[bufferUsed], bufferSize - bufferUsed);
+        if (result <= 0)
+            break;
+        bufferUsed += result;
+    }
+
+    int entryCount = 0, entriesAllocated = 256;
+    CR_DirectoryEntry *entries = typed_malloc(CR_DirectoryEntry, entriesAllocated);
+    bool disallowed = false;
+    for (int pos = 0; pos < bufferUsed; ) {
+        struct linux_dirent64 *dirent = (struct linux_dirent64*)&buffer[pos];
+        pos += dirent->d_reclen;
+        const char *name = dirent->d_name;
+        if ((name[0] == '.') && ((name[1] == 0) || ((name[1] == '.') && (name[2] == 0))))
+            continue;
+        if (strcmp(name, DISALLOW_FILE) == 0) {
+            disallowed = true;
+            break;
+        }
+        if (entryCount >= entriesAllocated) {
+            entriesAllocated *= 2;
+            typed_realloc(CR_DirectoryEntry, entries, entriesAllocated);
+        }
+        entries[entryCount].name = name;
+        entries[entryCount].type = dirent->d_type;
+        entryCount++;
+    }
+    if (disallowed) {
+        skippedCount++;
+        entryCount = 0;
+    }
+
+    // ファイルの情報はディレクトリからの相対名で取得し、見つかったファイルはまとめてキューに入れる
+    CrawledFile *files = typed_malloc(CrawledFile, entryCount + 1);
+    int found = 0;
+    for (int i = 0; (i < entryCount) && (!stopped); i++) {
+        unsigned char type = entries[i].type;
+        if ((type != DT_REG) && (type != DT_DIR) && (type != DT_UNKNOWN))
+            continue;
+        if (type == DT_DIR) {
+            addDirectory(id, makePath(path, entries[i].name));
+            continue;
+        }
+        struct statx buf;
+        if (statx(fd, entries[i].name, AT_SYMLINK_NOFOLLOW | AT_STATX_DONT_SYNC,
+                STATX_TYPE | STATX_SIZE | STATX_INO | STATX_MTIME, &buf) != 0)
+            continue;
+        if (S_ISDIR(buf.stx_mode)) {
+            addDirectory(id, makePath(path, entries[i].name));
+            continue;
+        }
+        if (!S_ISREG(buf.stx_mode))
+            continue;
+        if (((int64_t)buf.stx_size < minFileSize) || ((int64_t)buf.stx_size > maxFileSize))
+            continue;
+        files[found].path = makePath(path, entries[i].name);
+        files[found].fileSize = buf.stx_size;
+        files[found].inode = buf.stx_ino;
+        files[found].modificationTime = buf.stx_mtime.tv_sec;
+        found++;
+    }
+    close(fd);
+    free(entries);
+    free(buffer);
+    fileCount += found;
+    putFiles(files, found);
+    free(files);
+}
+
+int Crawler::getThreadCount() {
+    return threadCount;
+}
+
+int64_t Crawler::getFileCount() {
+    return fileCount;
+}
+
+int64_t Crawler::getDirectoryCount() {
+    return directoryCount;
+}
+
+int64_t Crawler::getSkippedCount() {
+    return skippedCount;
+}
@@ -0,0 +1,150 @@
+#ifndef __CRAWLER_H
+#define __CRAWLER_H
+
+/*
+Crawlerはインデックス化の対象となるファイルをディレクトリツリーから並列に探し出す。
+ディレクトリの走査は複数のワーカースレッドで行い、各スレッドは自分のdequeの末尾から
+ディレクトリを取り出して(深さ優先)処理する。自分のdequeが空になったスレッドは、
+他のスレッドのdequeの先頭(ツリーの根に近い、大きな部分木)を盗む(work stealing)。
+
+ディレクトリの内容はgetdents64でまとめて読み取り、ファイルの情報はディレクトリの
+ファイル記述子からの相対名でstatxを呼んで取得するので、パス名の解決は繰り返されない。
+.index_disallowを含むディレクトリはその下の部分木ごと対象外になる。
+シンボリックリンクはたどらない。
+
+見つかったファイルは容量に上限のある受け渡しキューに入れられ、トークナイザ側が
+getNextFileで取り出す。キューがいっぱいの場合、ワーカーは空きができるまで待つ
+*/
+
+#include <atomic>
+#include <deque>
+#include <pthread.h>
+#include "index_type.h"
+#include "../utils/all.h"
+
+typedef struct {
+
+    // ファイルの絶対パス。メモリは受け取った側で開放しなければいけない
+    char *path;
+
+    int64_t fileSize;
+
+    ino_t inode;
+
+    time_t modificationTime;
+
+} CrawledFile;
+
+typedef struct {
+
+    pthread_mutex_t lock;
+
+    // 走査待ちのディレクトリ。所有者は末尾、他のスレッドは先頭から取り出す
+    std::deque<char*> directories;
+
+} CR_WorkQueue;
+
+class Crawler {
+
+public:
+
+    // ワーカースレッドの数。0の場合はオンラインのCPU数
+    static const int DEFAULT_CRAWLER_THREADS = 0;
+    configurable int CRAWLER_THREADS;
+
+    // 受け渡しキューの容量(ファイル数)
+    static const int DEFAULT_CRAWLER_QUEUE_SIZE = 4096;
+    configurable int CRAWLER_QUEUE_SIZE;
+
+    // getdents64の読み取りバッファの大きさ
+    static const int DIRENT_BUFFER_SIZE = 64 * 1024;
+
+    // このファイルを含むディレクトリはインデックス化しない
+    static const char *DISALLOW_FILE;
+
+    static const char *LOG_ID;
+
+private:
+
+    char *baseDirectory;
+
+    int64_t minFileSize, maxFileSize;
+
+    int threadCount;
+    pthread_t *threads;
+    CR_WorkQueue *workQueues;
+
+    // 走査が終わっていないディレクトリの数(deque内のものと処理中のものの合計)
+    std::atomic<int64_t> pendingDirectories;
+
+    // 実行中のワーカースレッドの数
+    std::atomic<int> activeThreads;
+
+    std::atomic<bool> stopped;
+
+    // startでスレッドを起動したか、stopでスレッドの終了を待ったか
+    bool started, joined;
+
+    // 受け渡しキュー(リングバッファ)
+    CrawledFile *queue;
+    int queueCapacity, queueStart, queueLength;
+    // 走査が終わるか中止されると閉じられ、それ以降ファイルは追加されない
+    bool queueClosed;
+    pthread_mutex_t queueLock;
+    pthread_cond_t queueNotEmpty, queueNotFull;
+
+    // 統計情報
+    std::atomic<int64_t> fileCount, directoryCount, skippedCount;
+
+public:
+
+    /*
+    baseDirectory以下で、サイズがminFileSize以上maxFileSize以下のファイルを探すCrawlerを作る。
+    走査はstartを呼び出すまで始まらない
+    */
+    Crawler(const char *baseDirectory, int64_t minFileSize, int64_t maxFileSize);
+
+    ~Crawler();
+
+    // ワーカースレッドを起動する
+    void start();
+
+    /*
+    次のファイルを取り出す。キューが空の場合は、ファイルが見つかるか走査が終わるまで待つ。
+    走査が終わってキューが空になった場合はfalseを返す
+    */
+    bool getNextFile(CrawledFile *file);
+
+    // 走査を中止する。キューに残っているファイルは破棄される
+    void stop();
+
+    int getThreadCount();
+
+    // これまでに見つかったファイル、走査したディレクトリ、除外したディレクトリの数
+    int64_t getFileCount();
+    int64_t getDirectoryCount();
+    int64_t getSkippedCount();
+
+    // ワーカースレッドの本体。外部から呼び出してはいけない
+    void runWorker(int id);
+
+private:
+
+    void getConfiguration();
+
+    // dequeからディレクトリを取り出す。自分のdequeが空なら他のスレッドから盗む
+    char *getDirectory(int id);
+
+    void addDirectory(int id, char *path);
+
+    // ディレクトリの内容を読み取り、ファイルをキューに、サブディレクトリをdequeに入れる
+    void processDirectory(int id, const char *path);
+
+    // filesをまとめて受け渡しキューに入れる。キューに空きがなければ待つ
+    void putFiles(CrawledFile *files, int count);
+
+    // 受け渡しキューを閉じ、待っているスレッドを起こす
+    void closeQueue();
+};
+
+#endif
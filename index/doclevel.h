@@ -0,0 +1,105 @@
+#ifndef __DOCLEVEL_H
+#define __DOCLEVEL_H
+
+/*
+文書単位のポスティング(DOCUMENT_LEVEL_INDEXING)の形式。
+文書(<doc>から</doc>までの範囲)に現れる語tごとに、語"<!>t"のポスティングを1つ追加する。
+ポスティングは文書の開始位置を上位ビットに、文書内の出現回数(tf)と文書長の符号を
+下位DOC_LEVEL_SHIFTビットに持つ:
+
+    (文書の開始位置 << DOC_LEVEL_SHIFT) | (tf << 8) | 文書長の符号
+
+ポスティングの順序は文書の開始位置の順と一致するので、位置のポスティングと同じように
+セグメントやLongListStoreに格納し、指数探索で読み飛ばすことができる。
+tfはDOC_LEVEL_MAX_TFで打ち切る。文書長(文書内の語の数)は4ビットの仮数部を持つ
+浮動小数点数のように符号化され、切り捨てによる誤差は1/16以下になる
+*/
+
+#include <cstring>
+#include "index_type.h"
+#include "segment.h"
+#include "../utils/compression.h"
+
+#define DOC_LEVEL_PREFIX "<!>"
+#define DOC_LEVEL_PREFIX_LENGTH 3
+
+#define DOC_LEVEL_SHIFT 16
+
+#define DOC_LEVEL_MAX_TF 255
+
+// 符号化できる最大の文書長は(2^19 - 1)。それより長い文書はこの長さとして扱う
+#define DOC_LEVEL_MAX_LENGTH_CODE 255
+
+static inline bool isDocumentLevelTerm(const char *term) {
+    return strncmp(term, DOC_LEVEL_PREFIX, DOC_LEVEL_PREFIX_LENGTH) == 0;
+}
+
+/*
+termのポスティングを位置に戻すための右シフト量。
+削除範囲との比較はポスティングをこの量だけシフトしてから行う
+*/
+static inline int getPostingShift(const char *term) {
+    return (isDocumentLevelTerm(term) ? DOC_LEVEL_SHIFT : 0);
+}
+
+static_assert(DOC_LEVEL_SHIFT == COMPRESSION_DOCUMENT_SHIFT, "COMPRESSION_DOCUMENT assumes DOC_LEVEL_SHIFT");
+
+/*
+termのリストの圧縮方式。文書単位の語は専用の圧縮方式(COMPRESSION_DOCUMENT)で圧縮し、
+それ以外の語はPOSTING_COMPRESSIONで指定された方式を使う
+*/
+static inline int getTermCompressionMethod(const char *term, int compressionMethod) {
+    return (isDocumentLevelTerm(term) ? COMPRESSION_DOCUMENT : compressionMethod);
+}
+
+static inline int encodeDocumentLength(offset length) {
+    if (length < 16)
+        return (length < 0 ? 0 : (int)length);
+    int exponent = 63 - __builtin_clzll((unsigned long long)length);
+    int code = 16 * (exponent - 3) + (int)((length >> (exponent - 4)) & 15);
+    return (code > DOC_LEVEL_MAX_LENGTH_CODE ? DOC_LEVEL_MAX_LENGTH_CODE : code);
+}
+
+// 符号が表す範囲の最小の文書長
+static inline offset decodeDocumentLength(int code) {
+    if (code < 16)
+        return code;
+    return (offset)(16 + (code & 15)) << (code / 16 - 4 + 3);
+}
+
+static inline offset encodeDocumentPosting(offset documentStart, int tf, offset length) {
+    if (tf > DOC_LEVEL_MAX_TF)
+        tf = DOC_LEVEL_MAX_TF;
+    return (documentStart << DOC_LEVEL_SHIFT) | ((offset)tf << 8) | encodeDocumentLength(length);
+}
+
+static inline offset getDocumentStart(offset posting) {
+    return posting >> DOC_LEVEL_SHIFT;
+}
+
+static inline int getDocumentTF(offset posting) {
+    return (int)((posting >> 8) & 255);
+}
+
+static inline int getDocumentLengthCode(offset posting) {
+    return (int)(posting & 255);
+}
+
+/*
+スキップエントリのmaxTFとminLengthCodeを、ブロック内のポスティングから求める。
+文書単位の語でなければ0にする
+*/
+static inline void computeBlockImpact(const char *term, const offset *postings, int count, SegmentSkipEntry *entry) {
+    entry->maxTF = entry->minLengthCode = 0;
+    if (!isDocumentLevelTerm(term))
+        return;
+    entry->minLengthCode = DOC_LEVEL_MAX_LENGTH_CODE;
+    for (int i = 0; i < count; i++) {
+        if (getDocumentTF(postings[i]) > entry->maxTF)
+            entry->maxTF = getDocumentTF(postings[i]);
+        if (getDocumentLengthCode(postings[i]) < entry->minLengthCode)
+            entry->minLengthCode = getDocumentLengthCode(postings[i]);
+    }
+}
+
+#endif
@@ -0,0 +1,195 @@
+#include <cassert>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include "extentset.h"
+#include "../utils/all.h"
+
+ExtentSet::ExtentSet() {
+    allocated = 16;
+    starts = typed_malloc(offset, allocated);
+    ends = typed_malloc(offset, allocated);
+    count = 0;
+    totalSize = 0;
+}
+
+ExtentSet::~ExtentSet() {
+    free(starts);
+    free(ends);
+}
+
+// ends[i] >= positionとなる最初の区間の位置を返す
+static int64_t findFirstEndingAtOrAfter(offset *ends, int64_t count, offset position) {
+    int64_t lower = 0, upper = count;
+    while (lower < upper) {
+        int64_t middle = (lower + upper) >> 1;
+        if (ends[middle] < position)
+            lower = middle + 1;
+        else
+            upper = middle;
+    }
+    return lower;
+}
+
+void ExtentSet::add(offset start, offset end) {
+    if (end < start)
+        return;
+    // [first, last)の区間は新しい区間と重なるか隣接している
+    int64_t first = findFirstEndingAtOrAfter(ends, count, start - 1);
+    int64_t last = first;
+    while ((last < count) && (starts[last] <= end + 1)) {
+        if (starts[last] < start)
+            start = starts[last];
+        if (ends[last] > end)
+            end = ends[last];
+        totalSize -= ends[last] - starts[last] + 1;
+        last++;
+    }
+    int64_t newCount = count - (last - first) + 1;
+    if (newCount > allocated) {
+        allocated = newCount * 2;
+        typed_realloc(offset, starts, allocated);
+        typed_realloc(offset, ends, allocated);
+    }
+    if (last - first != 1) {
+        memmove(&starts[first + 1], &starts[last], (count - last) * sizeof(offset));
+        memmove(&ends[first + 1], &ends[last], (count - last) * sizeof(offset));
+    }
+    starts[first] = start;
+    ends[first] = end;
+    count = newCount;
+    totalSize += end - start + 1;
+}
+
+void ExtentSet::remove(offset start, offset end) {
+    if (end < start)
+        return;
+    int64_t i = findFirstEndingAtOrAfter(ends, count, start);
+    while ((i < count) && (starts[i] <= end)) {
+        offset s = starts[i], e = ends[i];
+        if ((s < start) && (e > end)) {
+            // 区間の中央を取り除くと2つに分かれる。後半はaddで挿入し直す
+            totalSize -= e - start + 1;
+            ends[i] = start - 1;
+            add(end + 1, e);
+            return;
+        }
+        if (s < start) {
+            totalSize -= e - start + 1;
+            ends[i] = start - 1;
+            i++;
+        } else if (e > end) {
+            totalSize -= end - s + 1;
+            starts[i] = end + 1;
+            i++;
+        } else {
+            totalSize -= e - s + 1;
+            memmove(&starts[i], &starts[i + 1], (count - i - 1) * sizeof(offset));
+            memmove(&ends[i], &ends[i + 1], (count - i - 1) * sizeof(offset));
+            count--;
+        }
+    }
+}
+
+bool ExtentSet::contains(offset posting) {
+    int64_t i = findFirstEndingAtOrAfter(ends, count, posting);
+    return (i < count) && (starts[i] <= posting);
+}
+
+bool ExtentSet::findContaining(offset posting, offset *start, offset *end) {
+    int64_t i = findFirstEndingAtOrAfter(ends, count, posting);
+    if ((i >= count) || (starts[i] > posting))
+        return false;
+    *start = starts[i];
+    *end = ends[i];
+    return true;
+}
+
+bool ExtentSet::intersects(offset start, offset end) {
+    int64_t i = findFirstEndingAtOrAfter(ends, count, start);
+    return (i < count) && (starts[i] <= end);
+}
+
+int64_t ExtentSet::removeContained(offset *postings, int64_t postingCount, int shift) {
+    if (count == 0)
+        return postingCount;
+    int64_t out = 0, extent = 0;
+    for (int64_t i = 0; i < postingCount; i++) {
+        offset p = postings[i] >> shift;
+        while ((extent < count) && (ends[extent] < p))
+            extent++;
+        if ((extent < count) && (starts[extent] <= p))
+            continue;
+        postings[out++] = postings[i];
+    }
+    return out;
+}
+
+int64_t ExtentSet::getCount() {
+    return count;
+}
+
+offset ExtentSet::getTotalSize() {
+    return totalSize;
+}
+
+void ExtentSet::getExtent(int64_t i, offset *start, offset *end) {
+    assert((i >= 0) && (i < count));
+    *start = starts[i];
+    *end = ends[i];
+}
+
+void ExtentSet::clear() {
+    count = 0;
+    totalSize = 0;
+}
+
+ExtentSet *ExtentSet::copy() {
+    ExtentSet *result = new ExtentSet();
+    result->allocated = (count > 16 ? count : 16);
+    typed_realloc(offset, result->starts, result->allocated);
+    typed_realloc(offset, result->ends, result->allocated);
+    memcpy(result->starts, starts, count * sizeof(offset));
+    memcpy(result->ends, ends, count * sizeof(offset));
+    result->count = count;
+    result->totalSize = totalSize;
+    return result;
+}
+
+bool ExtentSet::saveToFile(const char *fileName) {
+    int fd = open(fileName, O_WRONLY | O_CREAT | O_TRUNC | O_LARGEFILE, DEFAULT_FILE_PERMISSIONS);
+    if (fd < 0)
+        return false;
+    bool ok = (write(fd, &count, sizeof(count)) == sizeof(count));
+    ok = ok && (write(fd, starts, count * sizeof(offset)) == (ssize_t)(count * sizeof(offset)));
+    ok = ok && (write(fd, ends, count * sizeof(offset)) == (ssize_t)(count * sizeof(offset)));
+    close(fd);
+    return ok;
+}
+
+bool ExtentSet::loadFromFile(const char *fileName) {
+    clear();
+    int fd = open(fileName, O_RDONLY | O_LARGEFILE);
+    if (fd < 0)
+        return true;
+    int64_t n;
+    bool ok = (read(fd, &n, sizeof(n)) == sizeof(n)) && (n >= 0);
+    if (ok) {
+        if (n > allocated) {
+            allocated = n;
+            typed_realloc(offset, starts, allocated);
+            typed_realloc(offset, ends, allocated);
+        }
+        ok = (read(fd, starts, n * sizeof(offset)) == (ssize_t)(n * sizeof(offset))) &&
+            (read(fd, ends, n * sizeof(offset)) == (ssize_t)(n * sizeof(offset)));
+    }
+    close(fd);
+    if (!ok)
+        return false;
+    count = n;
+    for (int64_t i = 0; i < count; i++)
+        totalSize += ends[i] - starts[i] + 1;
+    return true;
+}
@@ -0,0 +1,77 @@
+#ifndef __EXTENTSET_H
+#define __EXTENTSET_H
+
+/*
+ExtentSetはアドレス空間上の互いに重ならない区間[start, end]の集合を表す。
+区間は開始位置の昇順に並んだ配列で保持され、隣接または重なる区間は
+追加時に一つにまとめられる。ポスティングの列(昇順)との突き合わせは
+2つのポインタを進めるだけで済むため、線形時間で行える。
+
+インデックスのスナップショットに含まれるExtentSetは参照カウントで共有され、変更しない。
+変更する場合はcopyで複製したものを変更して置き換える
+*/
+
+#include "index_type.h"
+#include "../utils/refcounted.h"
+
+class ExtentSet : public RefCounted {
+
+private:
+
+    // 区間の開始位置と終了位置(両端を含む)
+    offset *starts, *ends;
+
+    int64_t count, allocated;
+
+    // すべての区間の長さの合計
+    offset totalSize;
+
+public:
+
+    ExtentSet();
+
+    ~ExtentSet();
+
+    // 区間[start, end]を追加する
+    void add(offset start, offset end);
+
+    // 区間[start, end]を取り除く
+    void remove(offset start, offset end);
+
+    // postingがいずれかの区間に含まれるかどうか
+    bool contains(offset posting);
+
+    // postingを含む区間があれば、その両端をstartとendに格納してtrueを返す
+    bool findContaining(offset posting, offset *start, offset *end);
+
+    // 区間[start, end]と重なる区間が存在するかどうか
+    bool intersects(offset start, offset end);
+
+    /*
+    昇順に並んだpostingsから、いずれかの区間に含まれるものを取り除き(その場で詰める)、
+    残ったポスティングの数を返す。ポスティングはshiftビット右シフトした値を位置として比較する
+    (文書単位のポスティングの場合。doclevel.hを参照)
+    */
+    int64_t removeContained(offset *postings, int64_t postingCount, int shift = 0);
+
+    // 区間の数
+    int64_t getCount();
+
+    // 区間の長さの合計
+    offset getTotalSize();
+
+    // i番目の区間を取得する
+    void getExtent(int64_t i, offset *start, offset *end);
+
+    void clear();
+
+    // このインスタンスの複製を作る
+    ExtentSet *copy();
+
+    bool saveToFile(const char *fileName);
+
+    // fileNameから区間を読み込む。ファイルが存在しない場合は空の集合になる
+    bool loadFromFile(const char *fileName);
+};
+
+#endif
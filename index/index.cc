@@ -8,11 +8,48 @@
 #include <unistd.h>
 #include <cassert>
 #include <fcntl.h>
+#include <algorithm>
+#include <cmath>
+#include <vector>
 #include "index.h"
+#include "crawler.h"
+#include "doclevel.h"
+#include "extentset.h"
+#include "securitymanager.h"
+#include "indexview.h"
+#include "longliststore.h"
+#include "resultcache.h"
+#include "segment.h"
+#include "segmentmerger.h"
+#include "stemmer.h"
+#include "updatelist.h"
+#include "writeaheadlog.h"
+#include "../filemanager/filemanager.h"
 #include "../utils/all.h"
 
 static const char *INDEX_WORKFILE = "index";
 
+// セグメントファイル名の接頭辞。後ろに6桁のセグメントIDが付く
+static const char *SEGMENT_FILE_PREFIX = "index.seg.";
+
+// 長いポスティングリストのデータとディレクトリ
+static const char *LONGLIST_DATA_FILE = "index.longlists";
+static const char *LONGLIST_DIRECTORY_FILE = "index.longlists.dir";
+
+// 削除されたアドレス範囲
+static const char *DELETED_EXTENTS_FILE = "index.deleted";
+
+// FileManagerとIndexのメタデータの変更のログ
+static const char *WAL_FILE = "index.wal";
+
+// この大きさ未満のセグメントはすべて世代0とみなされる
+static const int64_t MERGE_BASE_SIZE = 1024 * 1024;
+
+static void *mergeThreadFunction(void *data) {
+    ((Index*)data)->runMergeThread();
+    return nullptr;
+}
+
 const char *Index::TEMP_DIRECTORY = "/tmp";
 const char *Index::LOG_ID = "Index";
 
@@ -33,6 +70,35 @@ void Index::getConfiguration() {
 		MAX_SIMULTANEOUS_READERS = 1;
 	getConfigurationInt("STEMMING_LEVEL", &STEMMING_LEVEL, DEFAULT_STEMMING_LEVEL);
 	getConfigurationBool("BIGRAM_INDEXING", &BIGRAM_INDEXING, DEFAULT_BIGRAM_INDEXING);
+	bigramFirstWords.clear();
+	char **firstWords = getConfigurationArray("BIGRAM_FIRST_WORDS");
+	if (firstWords != nullptr) {
+		for (int i = 0; firstWords[i] != nullptr; i++) {
+			bigramFirstWords.insert(firstWords[i]);
+			free(firstWords[i]);
+		}
+		free(firstWords);
+	}
+
+	char compression[MAX_CONFIG_VALUE_LENGTH];
+	POSTING_COMPRESSION = DEFAULT_POSTING_COMPRESSION;
+	if (getConfigurationValue("POSTING_COMPRESSION", compression)) {
+		POSTING_COMPRESSION = getCompressionMethod(compression);
+		if (POSTING_COMPRESSION < 0) {
+			snprintf(errorMessage, sizeof(errorMessage), "Unknown posting compression: %.64s", compression);
+			log(LOG_ERROR, LOG_ID, errorMessage);
+			POSTING_COMPRESSION = DEFAULT_POSTING_COMPRESSION;
+		}
+	}
+
+	getConfigurationInt("MERGE_RATIO", &MERGE_RATIO, DEFAULT_MERGE_RATIO);
+	if (MERGE_RATIO < 2)
+		MERGE_RATIO = 2;
+	getConfigurationInt64("LONG_LIST_THRESHOLD", &LONG_LIST_THRESHOLD, DEFAULT_LONG_LIST_THRESHOLD);
+	getConfigurationInt64("RESULT_CACHE_SIZE", &RESULT_CACHE_SIZE, DEFAULT_RESULT_CACHE_SIZE);
+	getConfigurationInt("RESULT_CACHE_SHARDS", &RESULT_CACHE_SHARDS, DEFAULT_RESULT_CACHE_SHARDS);
+	if (LONG_LIST_THRESHOLD < SEGMENT_BLOCK_SIZE)
+		LONG_LIST_THRESHOLD = SEGMENT_BLOCK_SIZE;
 
 	getConfigurationInt("TCP_PORT", &TCP_PORT, DEFAULT_TCP_PORT);
 	getConfigurationBool("MONITOR_FILESYSTEM", &MONITOR_FILESYSTEM, DEFAULT_MONITOR_FILESYSTEM);
@@ -49,13 +115,40 @@ void Index::getConfiguration() {
 }
 
 Index::Index() {
+    directory = nullptr;
     readOnly = false;
     shutDownInitiated = false;
 
+    updateList = nullptr;
+    segments = nullptr;
+    segmentCount = segmentsAllocated = 0;
+    nextSegmentID = 0;
+    longLists = nullptr;
+    frozenUpdateList = nullptr;
+    currentView = nullptr;
+    viewGeneration = 0;
+    longListSequence = 0;
+    longListSize = -1;
+    mergeThreadRunning = false;
+    pendingMergeRequests = 0;
+    deletedExtents = nullptr;
+    garbageCollectionRequested = false;
+    stemCache = nullptr;
+    documentStart = -1;
+    documentLength = 0;
+    documentCount = documentLengthSum = 0;
+    updateOperationsPerformed = 0;
+    changeLogStart = 0;
+    lastChangeObserved = false;
+    resultCache = nullptr;
+    fileManager = nullptr;
+    securityManager = nullptr;
+    wal = nullptr;
+    checkpointLSN = 0;
+    pendingGarbageCollectionLSN = 0;
+
     getConfiguration();
     baseDirectory[0] = 0;
-
-    
 }
 
 Index::Index(const char *directory, bool isSubIndex) {
@@ -63,10 +156,46 @@ Index::Index(const char *directory, bool isSubIndex) {
     this->isSubIndex = isSubIndex;
     registerdUserCount = 0;
     registrationID = 0;
-    SEM_INIT(registeredUserSemaphore, MAX_REGISTERED_USERS);
+    SEM_INIT(updateSemaphore, 1);
+    SEM_INIT(mergeRequestSemaphore, 0);
+    pthread_rwlock_init(&updateListLock, nullptr);
+    pthread_mutex_init(&viewLock, nullptr);
+    pthread_mutex_init(&mergeLock, nullptr);
+    pthread_cond_init(&mergeCondition, nullptr);
     indexType = TYPE_INDEX;
-    indexIsBeingUpdated = false;
     shutDownInitiated = false;
+    updateList = nullptr;
+    frozenUpdateList = nullptr;
+    currentView = nullptr;
+    viewGeneration = 0;
+    longListSequence = 0;
+    longListSize = -1;
+    segments = nullptr;
+    segmentCount = segmentsAllocated = 0;
+    nextSegmentID = 0;
+    longLists = nullptr;
+    mergeThreadRunning = false;
+    pendingMergeRequests = 0;
+    deletedExtents = new ExtentSet();
+    garbageCollectionRequested = false;
+    stemCache = nullptr;
+    pthread_mutex_init(&bigramLock, nullptr);
+    lastBigramWord[0] = 0;
+    lastBigramPosition = -2;
+    pthread_mutex_init(&documentLock, nullptr);
+    pthread_mutex_init(&xpathLock, nullptr);
+    pthread_mutex_init(&changeLock, nullptr);
+    changeLogStart = 0;
+    lastChangeObserved = false;
+    resultCache = nullptr;
+    fileManager = nullptr;
+    securityManager = nullptr;
+    wal = nullptr;
+    checkpointLSN = 0;
+    pendingGarbageCollectionLSN = 0;
+    documentStart = -1;
+    documentLength = 0;
+    documentCount = documentLengthSum = 0;
 
     struct stat statBuf;
     if (stat(directory, &statBuf) != 0) {
@@ -113,6 +242,10 @@ Index::Index(const char *directory, bool isSubIndex) {
     struct stat fileInfo;
     if (lstat(fileName, &fileInfo) == 0) {
         loadDataFromDisk();
+        /*
+        セグメントや削除範囲のファイルが失われた場合だけ作り直す。
+        ガベージコレクションの失敗はisConsistentを落とさず、ログをもとに起動時に完了させる
+        */
         if (!isConsistent) {
             snprintf(errorMessage, sizeof(errorMessage),
                     "On-disk index found in inconsistent state: %s. Creating new index.", directory);
@@ -133,6 +266,14 @@ Index::Index(const char *directory, bool isSubIndex) {
                 free(fn);
             }
             closedir(dir);
+
+            // 読み込んだ状態を捨てる。残したままだと、削除したセグメントが新しいインデックスに保存される
+            closeSegments();
+            deletedExtents->clear();
+            nextSegmentID = 0;
+            usedAddressSpace = deletedAddressSpace = 0;
+            biggestOffsetSeenSoFar = 0;
+            documentCount = documentLengthSum = 0;
         }
     }
 
@@ -148,6 +289,12 @@ Index::Index(const char *directory, bool isSubIndex) {
 
         updateOperationsPerformed = 0;
         isConsistent = true;
+        checkpointLSN = 0;
+        pendingGarbageCollectionLSN = 0;
+        // 以前のインデックスのログが残っていれば、新しいインデックスには関係ない
+        char *walFileName = evaluateRelativePathName(directory, WAL_FILE);
+        unlink(walFileName);
+        free(walFileName);
         int fd = open(fileName, O_RDWR | O_CREAT | O_TRUNC | O_LARGEFILE, DEFAULT_FILE_PERMISSIONS);
         if (fd < 0) {
             snprintf(errorMessage, sizeof(errorMessage), "Unable to create index: %s", fileName);
@@ -155,8 +302,97 @@ Index::Index(const char *directory, bool isSubIndex) {
             assert(fd >= 0);
         }
         close(fd);
+        saveDataToDisk();
         createFromScrach = true;
     }
+    free(fileName);
+
+    // STEMMING_LEVELは既存のインデックスから読み込んだ値が使われる
+    if (STEMMING_LEVEL > 0)
+        stemCache = new StemCache();
+
+    updateList = new UpdateList(MAX_UPDATE_SPACE);
+
+    // 前回正常に終了しなかった場合は、最後のチェックポイントより後の変更をログから読み込む
+    char *walFileName = evaluateRelativePathName(directory, WAL_FILE);
+    wal = new WriteAheadLog(walFileName, checkpointLSN, readOnly);
+    free(walFileName);
+    bool recovering = !wal->wasClosedCleanly();
+    std::vector<WAL_Record> pendingChanges;
+    if (recovering) {
+        wal->read(checkpointLSN, &pendingChanges);
+        snprintf(errorMessage, sizeof(errorMessage), "Index was not shut down cleanly: %s. Replaying %d log records.",
+                directory, (int)pendingChanges.size());
+        log(LOG_ERROR, LOG_ID, errorMessage);
+    }
+
+    // LongListStoreの置き換えがログに記録されていれば完了させ、そうでなければ途中のファイルを捨てる
+    bool garbageCollectionCommitted = false;
+    for (size_t i = 0; i < pendingChanges.size(); i++)
+        if (pendingChanges[i].type == WAL_GARBAGE_COLLECTION)
+            garbageCollectionCommitted = true;
+    bool rollForward = false;
+    if ((pendingGarbageCollectionLSN > 0) && (!readOnly)) {
+        // 前回完了できなかった置き換えのレコードはチェックポイントより前にあるので、個別に読む
+        std::vector<WAL_Record> records;
+        wal->read(pendingGarbageCollectionLSN - 1, &records);
+        if ((!records.empty()) && (records[0].lsn == pendingGarbageCollectionLSN) &&
+                (records[0].type == WAL_GARBAGE_COLLECTION)) {
+            pendingChanges.insert(pendingChanges.begin(), records[0]);
+            garbageCollectionCommitted = true;
+        }
+        pendingGarbageCollectionLSN = 0;
+        rollForward = true;
+    }
+    char *longListData = evaluateRelativePathName(directory, LONGLIST_DATA_FILE);
+    char *longListDirectory = evaluateRelativePathName(directory, LONGLIST_DIRECTORY_FILE);
+    if (!readOnly)
+        LongListStore::recoverGarbageCollection(longListData, longListDirectory, garbageCollectionCommitted);
+    longLists = new LongListStore(longListData, longListDirectory, createFromScrach);
+    /*
+    ディレクトリを保存した後、セグメントの一覧を保存する前に止まったマージの追記を取り除く。
+    入力のセグメントが残っているので、残すと同じポスティングが二重に読まれる。
+    置き換えを完了させたガベージコレクションのデータファイルは、記録したサイズと関係ない
+    */
+    if ((longListSize >= 0) && (!garbageCollectionCommitted) && (longLists->getFileSize() > longListSize)) {
+        snprintf(errorMessage, sizeof(errorMessage), "Discarding uncommitted long list data: %s", directory);
+        log(LOG_ERROR, LOG_ID, errorMessage);
+        longLists->discardAppends(longListSize);
+        if (!readOnly)
+            longLists->saveDirectory();
+    }
+    longListSize = longLists->getFileSize();
+    longListSequence = longLists->getAppendSequence();
+    free(longListData);
+    free(longListDirectory);
+    replayLog(pendingChanges);
+    publishView();
+
+    fileManager = new FileManager(this, directory, createFromScrach);
+    if (recovering)
+        fileManager->recover(pendingChanges);
+    if ((recovering) || (rollForward)) {
+        // 再実行した結果をチェックポイントとして保存し、ログを空にする
+        saveDataToDisk();
+    }
+    securityManager = new SecurityManager(this, fileManager);
+
+    // 読み込んだ世代より前の変更の記録は無い
+    changeLogStart = updateOperationsPerformed;
+    if (RESULT_CACHE_SIZE > 0)
+        resultCache = new ResultCache(this, RESULT_CACHE_SIZE, RESULT_CACHE_SHARDS);
+
+    if (!readOnly) {
+        if (pthread_create(&mergeThread, nullptr, mergeThreadFunction, this) == 0)
+            mergeThreadRunning = true;
+        else
+            log(LOG_ERROR, LOG_ID, "Unable to start merge thread.");
+        // 前回の終了時に保留されていたマージがあれば実行する
+        if (mustCollectGarbage(garbageThreshold))
+            garbageCollectionRequested = true;
+        if ((segmentCount > 1) || (garbageCollectionRequested))
+            requestMerge();
+    }
 
     // TODO FileManager実装から
     
@@ -167,20 +403,86 @@ Index::~Index() {
 
     shutDownInitiated = true;
 
+    if ((updateList != nullptr) && (!readOnly))
+        flushUpdateList();
+    if (mergeThreadRunning) {
+        // 実行中のマージは完了させ、保留中の要求は次回の起動時に処理する
+        sem_post(&mergeRequestSemaphore);
+        pthread_join(mergeThread, nullptr);
+        mergeThreadRunning = false;
+    }
+    // notifyOfAddressSpaceChangeによる変更はまだ保存されていない場合がある
+    if (deletedExtents != nullptr) {
+        sem_wait(&updateSemaphore);
+        saveDataToDisk();
+        sem_post(&updateSemaphore);
+    }
+    // すべての変更がチェックポイントに反映されたので、次回の起動ではログを再実行しない
+    if (wal != nullptr)
+        wal->close();
+    if (resultCache != nullptr)
+        delete resultCache;
+    resultCache = nullptr;
+    if (securityManager != nullptr)
+        delete securityManager;
+    securityManager = nullptr;
+    if (fileManager != nullptr)
+        delete fileManager;
+    fileManager = nullptr;
+    if (wal != nullptr)
+        delete wal;
+    wal = nullptr;
+    // この時点でビューを固定しているクエリがあってはいけない
+    if (currentView != nullptr) {
+        assert(currentView->getReferenceCount() == 1);
+        currentView->release();
+        currentView = nullptr;
+    }
+    // ガベージコレクションはマージスレッドからUpdateListを書き出すことがある
+    if (updateList != nullptr)
+        updateList->release();
+    updateList = nullptr;
+    if (longLists != nullptr) {
+        delete longLists;
+        longLists = nullptr;
+    }
+    closeSegments();
+    free(segments);
+    segments = nullptr;
+    if (deletedExtents != nullptr)
+        deletedExtents->release();
+    deletedExtents = nullptr;
+    if (stemCache != nullptr)
+        delete stemCache;
+    stemCache = nullptr;
+    if (directory != nullptr) {
+        // ロックはディレクトリを指定するコンストラクタでのみ初期化される
+        pthread_rwlock_destroy(&updateListLock);
+        pthread_mutex_destroy(&viewLock);
+        pthread_mutex_destroy(&mergeLock);
+        pthread_cond_destroy(&mergeCondition);
+        pthread_mutex_destroy(&bigramLock);
+        pthread_mutex_destroy(&documentLock);
+        pthread_mutex_destroy(&xpathLock);
+        pthread_mutex_destroy(&changeLock);
+    }
+    free(directory);
 
 }
 
 void Index::loadDataFromDisk() {
     char *fileName = evaluateRelativePathName(directory, INDEX_WORKFILE);
     FILE *f = fopen(fileName, "r");
-    free(fileName);
     if (f == nullptr) {
         snprintf(errorMessage, sizeof(errorMessage), "Unable to open index: %s", fileName);
         log(LOG_ERROR, LOG_ID, errorMessage);
         exit(1);
     }
+    free(fileName);
+    closeSegments();
     char line[1024];
     STEMMING_LEVEL = -1;
+    bigramFirstWords.clear();
     while (fgets(line, 1022, f) != nullptr) {
         if (strlen(line) > 1) {
             while (line[strlen(line) - 1] == '\n')
@@ -190,7 +492,15 @@ void Index::loadDataFromDisk() {
             sscanf(&line[strlen("STEMMING_LEVEL = ")], "%d", &STEMMING_LEVEL);
         if (startsWith(line, "BIGRAM_INDEXING = "))
             BIGRAM_INDEXING = (strcasecmp(&line[strlen("BIGRAM_INDEXING = ")], "true") == 0);
-        if (startsWith(line, "UPDATE_OPERATORS = "))
+        if (startsWith(line, "BIGRAM_FIRST_WORDS = ")) {
+            StringTokenizer tok(&line[strlen("BIGRAM_FIRST_WORDS = ")], " ");
+            while (tok.hasNext()) {
+                char *word = tok.getNext();
+                if (word[0] != 0)
+                    bigramFirstWords.insert(word);
+            }
+        }
+        if (startsWith(line, "UPDATE_OPERATIONS = "))
             sscanf(&line[strlen("UPDATE_OPERATIONS = ")], "%d", &updateOperationsPerformed);
         if (startsWith(line, "IS_CONSISTENT = ")) {
             if (strcasecmp(&line[strlen("IS_CONSISTENT = ")], "true") == 0)
@@ -200,13 +510,49 @@ void Index::loadDataFromDisk() {
         }
         if (startsWith(line, "DOCUMENT_LEVEL_INDEXING = "))
             sscanf(&line[strlen("DOCUMENT_LEVEL_INDEXING = ")], "%d", &DOCUMENT_LEVEL_INDEXING);
+        if (startsWith(line, "DOCUMENT_COUNT = "))
+            sscanf(&line[strlen("DOCUMENT_COUNT = ")], "%" PRId64, &documentCount);
+        if (startsWith(line, "DOCUMENT_LENGTH_SUM = "))
+            sscanf(&line[strlen("DOCUMENT_LENGTH_SUM = ")], "%" PRId64, &documentLengthSum);
         if (startsWith(line, "USED_ADDRESS_SPACE = "))
             sscanf(&line[strlen("USED_ADDRESS_SPACE = ")], OFFSET_FORMAT, &usedAddressSpace);
         if (startsWith(line, "DELETED_ADDRESS_SPACE = "))
-            sscanf(&line[strlen("DELETED_ADDRESS_SPACE = ")], OFFSET_FORMAT, &usedAddressSpace);
+            sscanf(&line[strlen("DELETED_ADDRESS_SPACE = ")], OFFSET_FORMAT, &deletedAddressSpace);
         if (startsWith(line, "BIGGEST_OFFSET = "))
-            sscanf(&line[strlen("BIGGEST_OFFSET = ")], OFFSET_FORMAT, &usedAddressSpace);
+            sscanf(&line[strlen("BIGGEST_OFFSET = ")], OFFSET_FORMAT, &biggestOffsetSeenSoFar);
+        if (startsWith(line, "WAL_CHECKPOINT = "))
+            sscanf(&line[strlen("WAL_CHECKPOINT = ")], "%" PRId64, &checkpointLSN);
+        if (startsWith(line, "PENDING_GARBAGE_COLLECTION = "))
+            sscanf(&line[strlen("PENDING_GARBAGE_COLLECTION = ")], "%" PRId64, &pendingGarbageCollectionLSN);
+        if (startsWith(line, "NEXT_SEGMENT_ID = "))
+            sscanf(&line[strlen("NEXT_SEGMENT_ID = ")], "%d", &nextSegmentID);
+        if (startsWith(line, "LONG_LIST_SIZE = "))
+            sscanf(&line[strlen("LONG_LIST_SIZE = ")], "%" PRId64, &longListSize);
+        if (startsWith(line, "SEGMENT = ")) {
+            char *segmentFile = evaluateRelativePathName(directory, &line[strlen("SEGMENT = ")]);
+            Segment *segment = Segment::open(segmentFile);
+            if (segment == nullptr) {
+                snprintf(errorMessage, sizeof(errorMessage), "Missing segment: %s", segmentFile);
+                log(LOG_ERROR, LOG_ID, errorMessage);
+                isConsistent = false;
+            } else {
+                if (segmentCount >= segmentsAllocated) {
+                    segmentsAllocated = (segmentsAllocated == 0 ? 8 : segmentsAllocated * 2);
+                    typed_realloc(Segment*, segments, segmentsAllocated);
+                }
+                segments[segmentCount++] = segment;
+            }
+            free(segmentFile);
+        }
+    }
+    char *extentsFile = evaluateRelativePathName(directory, DELETED_EXTENTS_FILE);
+    if (!deletedExtents->loadFromFile(extentsFile)) {
+        snprintf(errorMessage, sizeof(errorMessage), "Corrupt deleted extents: %s", extentsFile);
+        log(LOG_ERROR, LOG_ID, errorMessage);
+        isConsistent = false;
     }
+    free(extentsFile);
+    deletedAddressSpace = deletedExtents->getTotalSize();
     if ((STEMMING_LEVEL < 0) || (STEMMING_LEVEL > 3)) {
         snprintf(errorMessage, sizeof(errorMessage),
                 "Illegal configurate values in index file: %s", directory);
@@ -214,4 +560,932 @@ void Index::loadDataFromDisk() {
         exit(1);
     }
     fclose(f);
-}
\ No newline at end of file
+}
+
+void Index::saveDataToDisk() {
+    if (readOnly)
+        return;
+    /*
+    updateSemaphoreを保持しているので、Indexのレコードはすべてこの時点の状態に反映されている。
+    FileManagerのレコードは表を変更してから追加されるので、この後のsaveToDiskで保存される
+    */
+    int64_t lsn = (wal == nullptr ? checkpointLSN : wal->getLastLSN());
+    // 削除されたアドレス範囲はマスターインデックスファイルより先に書き出す
+    char *extentsFile = evaluateRelativePathName(directory, DELETED_EXTENTS_FILE);
+    char *tempExtentsFile = concatenateStrings(extentsFile, ".temp");
+    if ((!deletedExtents->saveToFile(tempExtentsFile)) || (rename(tempExtentsFile, extentsFile) != 0)) {
+        snprintf(errorMessage, sizeof(errorMessage), "Unable to write deleted extents: %s", extentsFile);
+        log(LOG_ERROR, LOG_ID, errorMessage);
+    }
+    free(tempExtentsFile);
+    free(extentsFile);
+    if (fileManager != nullptr)
+        fileManager->saveToDisk();
+
+    char *fileName = evaluateRelativePathName(directory, INDEX_WORKFILE);
+    char *tempFileName = concatenateStrings(fileName, ".temp");
+    int fd = open(tempFileName, O_WRONLY | O_CREAT | O_TRUNC | O_LARGEFILE, DEFAULT_FILE_PERMISSIONS);
+    FILE *f = (fd < 0 ? nullptr : fdopen(fd, "w"));
+    if (f == nullptr) {
+        snprintf(errorMessage, sizeof(errorMessage), "Unable to write index: %s", tempFileName);
+        log(LOG_ERROR, LOG_ID, errorMessage);
+        free(tempFileName);
+        free(fileName);
+        return;
+    }
+    fprintf(f, "STEMMING_LEVEL = %d\n", STEMMING_LEVEL);
+    fprintf(f, "BIGRAM_INDEXING = %s\n", (BIGRAM_INDEXING ? "true" : "false"));
+    if (!bigramFirstWords.empty()) {
+        fprintf(f, "BIGRAM_FIRST_WORDS =");
+        for (auto iter = bigramFirstWords.begin(); iter != bigramFirstWords.end(); ++iter)
+            fprintf(f, " %s", iter->c_str());
+        fprintf(f, "\n");
+    }
+    fprintf(f, "DOCUMENT_LEVEL_INDEXING = %d\n", DOCUMENT_LEVEL_INDEXING);
+    pthread_mutex_lock(&documentLock);
+    fprintf(f, "DOCUMENT_COUNT = %" PRId64 "\n", documentCount);
+    fprintf(f, "DOCUMENT_LENGTH_SUM = %" PRId64 "\n", documentLengthSum);
+    pthread_mutex_unlock(&documentLock);
+    fprintf(f, "UPDATE_OPERATIONS = %u\n", updateOperationsPerformed);
+    fprintf(f, "IS_CONSISTENT = %s\n", (isConsistent ? "true" : "false"));
+    fprintf(f, "USED_ADDRESS_SPACE = " OFFSET_FORMAT "\n", usedAddressSpace);
+    fprintf(f, "DELETED_ADDRESS_SPACE = " OFFSET_FORMAT "\n", deletedAddressSpace);
+    fprintf(f, "BIGGEST_OFFSET = " OFFSET_FORMAT "\n", biggestOffsetSeenSoFar);
+    fprintf(f, "WAL_CHECKPOINT = %" PRId64 "\n", lsn);
+    if (pendingGarbageCollectionLSN > 0)
+        fprintf(f, "PENDING_GARBAGE_COLLECTION = %" PRId64 "\n", pendingGarbageCollectionLSN);
+    fprintf(f, "NEXT_SEGMENT_ID = %d\n", nextSegmentID);
+    if (longListSize >= 0)
+        fprintf(f, "LONG_LIST_SIZE = %" PRId64 "\n", longListSize);
+    for (int i = 0; i < segmentCount; i++) {
+        const char *segmentFile = strrchr(segments[i]->getFileName(), '/');
+        fprintf(f, "SEGMENT = %s\n", (segmentFile == nullptr ? segments[i]->getFileName() : &segmentFile[1]));
+    }
+    fflush(f);
+    fsync(fd);
+    fclose(f);
+    if (rename(tempFileName, fileName) != 0) {
+        snprintf(errorMessage, sizeof(errorMessage), "Unable to replace index: %s", fileName);
+        log(LOG_ERROR, LOG_ID, errorMessage);
+    } else {
+        checkpointLSN = lsn;
+        // 完了していないガベージコレクションのレコードは、次回の起動時に読めるようにログに残す
+        if ((wal != nullptr) && (pendingGarbageCollectionLSN > 0))
+            wal->checkpoint(std::min(lsn, pendingGarbageCollectionLSN - 1));
+        else if (wal != nullptr)
+            wal->checkpoint(lsn);
+    }
+    free(tempFileName);
+    free(fileName);
+}
+
+char *Index::getSegmentFileName(int32_t segmentID) {
+    char name[64];
+    snprintf(name, sizeof(name), "%s%06d", SEGMENT_FILE_PREFIX, segmentID);
+    return evaluateRelativePathName(directory, name);
+}
+
+void Index::closeSegments() {
+    for (int i = 0; i < segmentCount; i++)
+        segments[i]->release();
+    segmentCount = 0;
+}
+
+void Index::publishView() {
+    IndexView *view = new IndexView(++viewGeneration, segments, segmentCount,
+            frozenUpdateList, updateList, longLists, longListSequence, deletedExtents, &updateListLock);
+    // 読み取り側がビューを固定する処理と重ならないように、ポインタの交換だけをロック内で行う
+    pthread_mutex_lock(&viewLock);
+    IndexView *oldView = currentView;
+    currentView = view;
+    pthread_mutex_unlock(&viewLock);
+    if (oldView != nullptr)
+        oldView->release();
+}
+
+IndexView *Index::acquireView() {
+    pthread_mutex_lock(&viewLock);
+    IndexView *view = currentView;
+    if (view != nullptr)
+        view->addReference();
+    pthread_mutex_unlock(&viewLock);
+    return view;
+}
+
+unsigned int Index::getUpdateGeneration() {
+    pthread_mutex_lock(&changeLock);
+    unsigned int result = updateOperationsPerformed;
+    lastChangeObserved = true;
+    pthread_mutex_unlock(&changeLock);
+    return result;
+}
+
+bool Index::getChangesSince(unsigned int generation, std::vector<IndexChange> *changes) {
+    changes->clear();
+    pthread_mutex_lock(&changeLock);
+    bool result = (generation >= changeLogStart);
+    if (result) {
+        for (int i = (int)changeLog.size() - 1; (i >= 0) && (changeLog[i].lastGeneration > generation); i--)
+            changes->push_back(changeLog[i]);
+    }
+    pthread_mutex_unlock(&changeLock);
+    return result;
+}
+
+ResultCache *Index::getResultCache() {
+    return resultCache;
+}
+
+FileManager *Index::getFileManager() {
+    return fileManager;
+}
+
+SecurityManager *Index::getSecurityManager() {
+    return securityManager;
+}
+
+void Index::recordChange(offset start, offset end, bool deletion) {
+    pthread_mutex_lock(&changeLock);
+    updateOperationsPerformed++;
+    if ((!deletion) && (!lastChangeObserved) && (!changeLog.empty()) && (!changeLog.back().deletion)) {
+        IndexChange *last = &changeLog.back();
+        last->start = std::min(last->start, start);
+        last->end = std::max(last->end, end);
+        last->lastGeneration = updateOperationsPerformed;
+    }
+    else {
+        if (changeLog.size() >= MAX_CHANGE_LOG_LENGTH) {
+            // 古い半分をまとめて捨てる
+            size_t discarded = changeLog.size() / 2;
+            changeLogStart = changeLog[discarded - 1].lastGeneration;
+            changeLog.erase(changeLog.begin(), changeLog.begin() + discarded);
+        }
+        changeLog.push_back({ updateOperationsPerformed, updateOperationsPerformed, start, end, deletion });
+    }
+    lastChangeObserved = false;
+    pthread_mutex_unlock(&changeLock);
+}
+
+void Index::requestMerge() {
+    if (!mergeThreadRunning)
+        return;
+    pthread_mutex_lock(&mergeLock);
+    pendingMergeRequests++;
+    pthread_mutex_unlock(&mergeLock);
+    sem_post(&mergeRequestSemaphore);
+}
+
+void Index::addPostings(char **terms, offset *postings, int count) {
+    // 1: 位置のポスティングと文書単位のポスティングの両方 2: 文書単位のポスティングのみ
+    bool documentLevel = (DOCUMENT_LEVEL_INDEXING == 1) || (DOCUMENT_LEVEL_INDEXING == 2);
+    if ((stemCache == nullptr) && (!BIGRAM_INDEXING) && (!documentLevel) && (!ENABLE_XPATH)) {
+        int longTerms = 0;
+        for (int i = 0; i < count; i++)
+            if (strlen(terms[i]) >= MAX_STEM_LENGTH)
+                longTerms++;
+        if (longTerms == 0) {
+            addPostingsToUpdateList(terms, postings, count);
+            return;
+        }
+        /*
+        語辞書に入らない長さの語があるとセグメントを書き出せないので、
+        下の経路やgetQueryTermと同じくMAX_STEM_LENGTH - 1バイトに切り詰める
+        */
+        char *buffer = typed_malloc(char, longTerms * MAX_STEM_LENGTH);
+        char **truncatedTerms = typed_malloc(char*, count);
+        for (int i = 0, k = 0; i < count; i++) {
+            truncatedTerms[i] = terms[i];
+            if (strlen(terms[i]) >= MAX_STEM_LENGTH) {
+                truncatedTerms[i] = &buffer[(k++) * MAX_STEM_LENGTH];
+                strncpy(truncatedTerms[i], terms[i], MAX_STEM_LENGTH - 1);
+                truncatedTerms[i][MAX_STEM_LENGTH - 1] = 0;
+            }
+        }
+        addPostingsToUpdateList(truncatedTerms, postings, count);
+        free(truncatedTerms);
+        free(buffer);
+        return;
+    }
+
+    /*
+    ステミングとバイグラムの生成はupdateSemaphoreの外で行う。
+    語ごとに最大2つのステミング後の語と1つのバイグラムに展開される。
+    呼び出しをまたぐバイグラムが1つ加わる場合がある
+    */
+    int allocated = count * 3 + 1;
+    char *buffer = typed_malloc(char, allocated * MAX_BIGRAM_LENGTH);
+    char **expandedTerms = typed_malloc(char*, allocated);
+    offset *expandedPostings = typed_malloc(offset, allocated);
+    int expandedCount = 0;
+    char indexTerms[2][MAX_STEM_LENGTH];
+    char previous[MAX_STEM_LENGTH];
+    offset previousPosting = -2;
+
+    if ((BIGRAM_INDEXING) && (count > 0)) {
+        pthread_mutex_lock(&bigramLock);
+        if (lastBigramPosition == postings[0] - 1) {
+            strcpy(previous, lastBigramWord);
+            previousPosting = lastBigramPosition;
+        }
+        pthread_mutex_unlock(&bigramLock);
+    }
+
+    // </doc>で完了したドキュメントの文書単位のポスティングと、ネストレベルのタグ
+    std::vector<std::string> documentPostingTerms;
+    std::vector<offset> documentPostings;
+    std::vector<std::string> levelTerms;
+    std::vector<offset> levelPostings;
+    char levelTag[MAX_STEM_LENGTH];
+    if (documentLevel)
+        pthread_mutex_lock(&documentLock);
+    if (ENABLE_XPATH)
+        pthread_mutex_lock(&xpathLock);
+
+    for (int i = 0; i < count; i++) {
+        int n = 1;
+        if (stemCache != nullptr)
+            n = stemCache->getIndexTerms(terms[i], STEMMING_LEVEL, indexTerms);
+        else {
+            strncpy(indexTerms[0], terms[i], MAX_STEM_LENGTH - 1);
+            indexTerms[0][MAX_STEM_LENGTH - 1] = 0;
+        }
+
+        if ((ENABLE_XPATH) && (terms[i][0] == '<')) {
+            if (terms[i][1] != '/') {
+                openElements.push_back(terms[i] + 1);
+                makeLevelTag(openElements.size(), false, levelTag);
+                levelTerms.push_back(levelTag);
+                levelPostings.push_back(postings[i]);
+            }
+            else {
+                // 対応する開始タグまでの要素をすべて閉じる。開始タグがなければ無視する
+                int k = (int)openElements.size() - 1;
+                while ((k >= 0) && (openElements[k] != terms[i] + 2))
+                    k--;
+                while ((k >= 0) && ((int)openElements.size() > k)) {
+                    makeLevelTag(openElements.size(), true, levelTag);
+                    levelTerms.push_back(levelTag);
+                    levelPostings.push_back(postings[i]);
+                    openElements.pop_back();
+                }
+            }
+        }
+
+        if (documentLevel) {
+            bool isTag = (terms[i][0] == '<');
+            if (strcmp(terms[i], "<doc>") == 0) {
+                documentStart = postings[i];
+                documentLength = 0;
+                documentTerms.clear();
+            }
+            else if ((strcmp(terms[i], "</doc>") == 0) && (documentStart >= 0)) {
+                for (auto &entry : documentTerms) {
+                    documentPostingTerms.push_back(DOC_LEVEL_PREFIX + entry.first);
+                    documentPostings.push_back(encodeDocumentPosting(documentStart, entry.second, documentLength));
+                }
+                documentCount++;
+                documentLengthSum += documentLength;
+                documentStart = -1;
+                documentTerms.clear();
+            }
+            else if ((!isTag) && (documentStart >= 0)) {
+                documentLength++;
+                for (int k = 0; k < n; k++)
+                    documentTerms[indexTerms[k]]++;
+            }
+            // 2の場合、語の位置情報(バイグラムを含む)は保持しない
+            if ((!isTag) && (DOCUMENT_LEVEL_INDEXING == 2))
+                continue;
+        }
+
+        if (BIGRAM_INDEXING) {
+            // バイグラムは主な語(STEMMING_LEVEL 1では語幹、それ以外では語そのもの)から作る
+            bool isWord = (indexTerms[0][0] != '<');
+            if ((isWord) && (previousPosting == postings[i] - 1) && (isBigramFirstWord(previous))) {
+                expandedTerms[expandedCount] = &buffer[expandedCount * MAX_BIGRAM_LENGTH];
+                makeBigram(previous, indexTerms[0], expandedTerms[expandedCount]);
+                expandedPostings[expandedCount++] = previousPosting;
+            }
+            if (isWord) {
+                strcpy(previous, indexTerms[0]);
+                previousPosting = postings[i];
+            }
+            else
+                previousPosting = -2;
+        }
+
+        for (int k = 0; k < n; k++) {
+            expandedTerms[expandedCount] = &buffer[expandedCount * MAX_BIGRAM_LENGTH];
+            strcpy(expandedTerms[expandedCount], indexTerms[k]);
+            expandedPostings[expandedCount++] = postings[i];
+        }
+    }
+
+    if ((BIGRAM_INDEXING) && (count > 0)) {
+        pthread_mutex_lock(&bigramLock);
+        if (previousPosting == postings[count - 1])
+            strcpy(lastBigramWord, previous);
+        lastBigramPosition = (previousPosting == postings[count - 1] ? previousPosting : -2);
+        pthread_mutex_unlock(&bigramLock);
+    }
+
+    if (ENABLE_XPATH)
+        pthread_mutex_unlock(&xpathLock);
+    if (documentLevel)
+        pthread_mutex_unlock(&documentLock);
+
+    addPostingsToUpdateList(expandedTerms, expandedPostings, expandedCount);
+    free(expandedPostings);
+    free(expandedTerms);
+    free(buffer);
+
+    if (!documentPostings.empty()) {
+        char **documentTermPointers = typed_malloc(char*, documentPostingTerms.size());
+        for (size_t i = 0; i < documentPostingTerms.size(); i++)
+            documentTermPointers[i] = (char*)documentPostingTerms[i].c_str();
+        addPostingsToUpdateList(documentTermPointers, documentPostings.data(), documentPostings.size());
+        free(documentTermPointers);
+    }
+
+    if (!levelPostings.empty()) {
+        char **levelTermPointers = typed_malloc(char*, levelTerms.size());
+        for (size_t i = 0; i < levelTerms.size(); i++)
+            levelTermPointers[i] = (char*)levelTerms[i].c_str();
+        addPostingsToUpdateList(levelTermPointers, levelPostings.data(), levelPostings.size());
+        free(levelTermPointers);
+    }
+}
+
+void Index::addPostingsToUpdateList(char **terms, offset *postings, int count) {
+    if (count <= 0)
+        return;
+    // 追加した範囲。文書単位のポスティングはドキュメントの開始位置で数える
+    offset changeStart = MAX_OFFSET, changeEnd = 0;
+    sem_wait(&updateSemaphore);
+    pthread_rwlock_wrlock(&updateListLock);
+    for (int i = 0; i < count; i++) {
+        offset position = (isDocumentLevelTerm(terms[i]) ? getDocumentStart(postings[i]) : postings[i]);
+        changeStart = std::min(changeStart, position);
+        changeEnd = std::max(changeEnd, position);
+        if (!updateList->addPosting(terms[i], postings[i])) {
+            pthread_rwlock_unlock(&updateListLock);
+            flushUpdateListLocked();
+            pthread_rwlock_wrlock(&updateListLock);
+            bool added = updateList->addPosting(terms[i], postings[i]);
+            assert(added);
+        }
+        if ((postings[i] > biggestOffsetSeenSoFar) && (!isDocumentLevelTerm(terms[i])))
+            biggestOffsetSeenSoFar = postings[i];
+    }
+    pthread_rwlock_unlock(&updateListLock);
+    // 世代はポスティングが読めるようになってから進める
+    recordChange(changeStart, changeEnd, false);
+    sem_post(&updateSemaphore);
+}
+
+void Index::flushUpdateList() {
+    sem_wait(&updateSemaphore);
+    flushUpdateListLocked();
+    sem_post(&updateSemaphore);
+}
+
+void Index::flushUpdateListLocked() {
+    if ((updateList == nullptr) || (updateList->getTermCount() == 0))
+        return;
+    if (readOnly) {
+        log(LOG_ERROR, LOG_ID, "Cannot write new segment while in read-only mode.");
+        return;
+    }
+    /*
+    いっぱいになったUpdateListを凍結して新しいものと入れ替える。
+    凍結したUpdateListは書き出しの間もビューから読み取られ、変更されることはない
+    */
+    pthread_rwlock_wrlock(&updateListLock);
+    frozenUpdateList = updateList;
+    updateList = new UpdateList(MAX_UPDATE_SPACE);
+    pthread_rwlock_unlock(&updateListLock);
+    publishView();
+
+    char *fileName = getSegmentFileName(nextSegmentID);
+    if (!writeSegment(frozenUpdateList, fileName, POSTING_COMPRESSION)) {
+        snprintf(errorMessage, sizeof(errorMessage), "Unable to flush update list: %s", fileName);
+        log(LOG_ERROR, LOG_ID, errorMessage);
+        exit(1);
+    }
+    Segment *segment = Segment::open(fileName);
+    assert(segment != nullptr);
+    free(fileName);
+    if (segmentCount >= segmentsAllocated) {
+        segmentsAllocated = (segmentsAllocated == 0 ? 8 : segmentsAllocated * 2);
+        typed_realloc(Segment*, segments, segmentsAllocated);
+    }
+    segments[segmentCount++] = segment;
+    nextSegmentID++;
+    frozenUpdateList->release();
+    frozenUpdateList = nullptr;
+    publishView();
+    saveDataToDisk();
+    requestMerge();
+}
+
+offset *Index::getPostings(const char *term, int64_t *count) {
+    IndexView *view = acquireView();
+    if (view == nullptr) {
+        *count = 0;
+        return nullptr;
+    }
+    offset *result;
+    if ((STEMMING_LEVEL == 1) && (stemCache != nullptr)) {
+        char stem[MAX_STEM_LENGTH];
+        stemCache->getStem(term, stem);
+        result = view->getPostings(stem, count);
+    }
+    else
+        result = view->getPostings(term, count);
+    view->release();
+    return result;
+}
+
+void Index::getDocumentStatistics(int64_t *count, int64_t *lengthSum) {
+    pthread_mutex_lock(&documentLock);
+    *count = documentCount;
+    *lengthSum = documentLengthSum;
+    pthread_mutex_unlock(&documentLock);
+}
+
+bool Index::isBigramFirstWord(const char *word) {
+    if (!BIGRAM_INDEXING)
+        return false;
+    return (bigramFirstWords.empty()) || (bigramFirstWords.find(word) != bigramFirstWords.end());
+}
+
+void Index::makeBigram(const char *first, const char *second, char *result) {
+    int firstLength = strlen(first), secondLength = strlen(second);
+    assert((firstLength < MAX_STEM_LENGTH) && (secondLength < MAX_STEM_LENGTH));
+    memcpy(result, first, firstLength);
+    result[firstLength] = BIGRAM_SEPARATOR;
+    memcpy(&result[firstLength + 1], second, secondLength + 1);
+}
+
+void Index::makeLevelTag(int level, bool endTag, char *result) {
+    snprintf(result, MAX_STEM_LENGTH, (endTag ? "</level!%d>" : "<level!%d>"), level);
+}
+
+// firstとsecondの組がバイグラムとしてインデックスに含まれるかどうか
+static bool canUseBigram(Index *index, const char *first, const char *second) {
+    // タグと印の付いた語幹からはバイグラムを作らない
+    if ((first[0] == '<') || (second[0] == '<'))
+        return false;
+    if ((strchr(first, STEM_MARKER) != nullptr) || (strchr(second, STEM_MARKER) != nullptr))
+        return false;
+    return index->isBigramFirstWord(first);
+}
+
+void Index::getQueryTerm(const char *word, bool stem, char *result) {
+    if ((stemCache != nullptr) && ((STEMMING_LEVEL == 1) || ((stem) && (STEMMING_LEVEL >= 2)))) {
+        stemCache->getStem(word, result);
+        // STEMMING_LEVEL 3では、ステミングの対象となる語の語幹に印が付いている
+        if ((STEMMING_LEVEL == 3) && (Stemmer::isStemmable(word))) {
+            int length = strlen(result);
+            result[length] = STEM_MARKER;
+            result[length + 1] = 0;
+        }
+        return;
+    }
+    strncpy(result, word, MAX_STEM_LENGTH - 1);
+    result[MAX_STEM_LENGTH - 1] = 0;
+}
+
+int Index::rewritePhrase(const char **terms, int termCount, char (*rewritten)[MAX_BIGRAM_LENGTH], int *shifts) {
+    // 2語ずつバイグラムに置き換え、語数が奇数の場合は最後の語を直前の語とのバイグラムで覆う
+    int result = 0;
+    for (int i = 0; i < termCount; ) {
+        if ((i + 1 < termCount) && (canUseBigram(this, terms[i], terms[i + 1]))) {
+            makeBigram(terms[i], terms[i + 1], rewritten[result]);
+            shifts[result++] = i;
+            i += 2;
+        }
+        else if ((i == termCount - 1) && (i > 0) && (canUseBigram(this, terms[i - 1], terms[i]))) {
+            makeBigram(terms[i - 1], terms[i], rewritten[result]);
+            shifts[result++] = i - 1;
+            i++;
+        }
+        else {
+            strcpy(rewritten[result], terms[i]);
+            shifts[result++] = i;
+            i++;
+        }
+    }
+    return result;
+}
+
+typedef struct {
+    offset *postings;
+    int64_t count;
+    // フレーズの先頭からの位置。フレーズの位置はポスティングからこの値を引いたものになる
+    int shift;
+} IX_PhraseComponent;
+
+/*
+昇順のcandidatesのうち、c + shiftがlistに含まれるものだけを残し、その数を返す。
+listは指数探索で読み飛ばすので、candidatesがlistより十分短ければlistの大部分は参照しない
+*/
+static int64_t filterByShiftedList(offset *candidates, int64_t count,
+        const offset *list, int64_t listLength, int shift) {
+    int64_t result = 0, position = 0;
+    for (int64_t i = 0; (i < count) && (position < listLength); i++) {
+        offset target = candidates[i] + shift;
+        int64_t step = 1;
+        while ((position + step < listLength) && (list[position + step] < target))
+            step *= 2;
+        int64_t end = std::min(position + step + 1, listLength);
+        position = std::lower_bound(&list[position], &list[end], target) - list;
+        if ((position < listLength) && (list[position] == target))
+            candidates[result++] = candidates[i];
+    }
+    return result;
+}
+
+offset *Index::getPhrasePostings(const char **words, int wordCount, int64_t *count) {
+    *count = 0;
+    if (wordCount <= 0)
+        return nullptr;
+    IndexView *view = acquireView();
+    if (view == nullptr)
+        return nullptr;
+
+    // クエリの語をインデックスに追加される主な語と同じ形にする
+    char *normalized = typed_malloc(char, wordCount * MAX_STEM_LENGTH);
+    const char **terms = typed_malloc(const char*, wordCount);
+    for (int i = 0; i < wordCount; i++) {
+        getQueryTerm(words[i], false, &normalized[i * MAX_STEM_LENGTH]);
+        terms[i] = &normalized[i * MAX_STEM_LENGTH];
+    }
+
+    char (*rewritten)[MAX_BIGRAM_LENGTH] = new char[wordCount][MAX_BIGRAM_LENGTH];
+    int *shifts = typed_malloc(int, wordCount);
+    int componentCount = rewritePhrase(terms, wordCount, rewritten, shifts);
+    IX_PhraseComponent *components = typed_malloc(IX_PhraseComponent, componentCount);
+    for (int i = 0; i < componentCount; i++) {
+        components[i].postings = view->getPostings(rewritten[i], &components[i].count);
+        components[i].shift = shifts[i];
+    }
+    view->release();
+    free(shifts);
+    delete[] rewritten;
+
+    // 短いリストから順に照合する
+    std::sort(components, components + componentCount,
+            [](const IX_PhraseComponent &a, const IX_PhraseComponent &b) { return a.count < b.count; });
+    offset *result = nullptr;
+    int64_t resultCount = 0;
+    if (components[0].count > 0) {
+        result = components[0].postings;
+        components[0].postings = nullptr;
+        resultCount = components[0].count;
+        for (int64_t k = 0; k < resultCount; k++)
+            result[k] -= components[0].shift;
+        for (int i = 1; (i < componentCount) && (resultCount > 0); i++)
+            resultCount = filterByShiftedList(result, resultCount,
+                    components[i].postings, components[i].count, components[i].shift);
+    }
+    for (int i = 0; i < componentCount; i++)
+        free(components[i].postings);
+    free(components);
+    free(terms);
+    free(normalized);
+
+    if (resultCount == 0) {
+        free(result);
+        return nullptr;
+    }
+    *count = resultCount;
+    return result;
+}
+
+int Index::getSegmentLevel(int64_t segmentSize) {
+    if (segmentSize < MERGE_BASE_SIZE)
+        return 0;
+    return 1 + (int)(log((double)segmentSize / MERGE_BASE_SIZE) / log((double)MERGE_RATIO));
+}
+
+int Index::chooseMergeRange() {
+    if (segmentCount < 2)
+        return -1;
+    // 新しいセグメントから順に、世代が追いつかれたセグメントをまとめていく
+    int first = segmentCount - 1;
+    int64_t size = segments[first]->getFileSize();
+    while ((first > 0) && (getSegmentLevel(segments[first - 1]->getFileSize()) <= getSegmentLevel(size))) {
+        first--;
+        size += segments[first]->getFileSize();
+    }
+    return (first < segmentCount - 1 ? first : -1);
+}
+
+bool Index::performMerge() {
+    sem_wait(&updateSemaphore);
+    int first = chooseMergeRange();
+    if (first < 0) {
+        sem_post(&updateSemaphore);
+        return false;
+    }
+    // セグメントは不変なので、マージ自体はロックを開放して行う
+    int count = segmentCount - first;
+    Segment **inputs = typed_malloc(Segment*, count);
+    memcpy(inputs, &segments[first], count * sizeof(Segment*));
+    char *fileName = getSegmentFileName(nextSegmentID++);
+    // 不要ポスティングが多い場合は、マージのついでに取り除く
+    ExtentSet *garbage = nullptr;
+    if (mustCollectGarbage(onTheFlyGarbageThreshold)) {
+        garbage = deletedExtents;
+        garbage->addReference();
+    }
+    // 置き換えを完了できなかったガベージコレクションがある間は、LongListStoreに追記しない
+    LongListStore *target = (pendingGarbageCollectionLSN > 0 ? nullptr : longLists);
+    sem_post(&updateSemaphore);
+
+    bool ok = mergeSegments(inputs, count, fileName, POSTING_COMPRESSION, target, LONG_LIST_THRESHOLD, garbage);
+    if (garbage != nullptr)
+        garbage->release();
+    Segment *merged = (ok ? Segment::open(fileName) : nullptr);
+    // 追記したブロックはディレクトリに保存できた場合だけ使う
+    if ((merged != nullptr) && (!longLists->saveDirectory())) {
+        merged->markObsolete();
+        merged->release();
+        merged = nullptr;
+    }
+    if (merged == nullptr) {
+        snprintf(errorMessage, sizeof(errorMessage), "Merge failed: %s", fileName);
+        log(LOG_ERROR, LOG_ID, errorMessage);
+        // 入力のセグメントをそのまま使うので、マージ中の追記はどのビューからも読まれていない
+        longLists->discardAppends(longListSize);
+        unlink(fileName);
+        free(fileName);
+        free(inputs);
+        return false;
+    }
+    if (merged->getTermCount() == 0) {
+        // すべての語がLongListStoreに移された
+        merged->markObsolete();
+        merged->release();
+        merged = nullptr;
+    }
+    free(fileName);
+
+    // マージ中に追加されたセグメントは末尾にあるので、入力の位置は変わっていない
+    sem_wait(&updateSemaphore);
+    assert(segments[first] == inputs[0]);
+    int replacement = (merged == nullptr ? 0 : 1);
+    if (merged != nullptr)
+        segments[first] = merged;
+    memmove(&segments[first + replacement], &segments[first + count],
+            (segmentCount - first - count) * sizeof(Segment*));
+    segmentCount -= count - replacement;
+    // 追記したブロックは、入力のセグメントを外した一覧と一緒にインデックスファイルに記録されて確定する
+    longListSequence = longLists->getAppendSequence();
+    longListSize = longLists->getFileSize();
+    publishView();
+    saveDataToDisk();
+    sem_post(&updateSemaphore);
+
+    // 入力のセグメントは、それを参照する最後のビューが開放された時点で削除される
+    for (int i = 0; i < count; i++) {
+        inputs[i]->markObsolete();
+        inputs[i]->release();
+    }
+    free(inputs);
+    return true;
+}
+
+void Index::runMergeThread() {
+    while (true) {
+        sem_wait(&mergeRequestSemaphore);
+        if (shutDownInitiated)
+            break;
+        while ((!shutDownInitiated) && (performMerge()));
+        if ((!shutDownInitiated) && (garbageCollectionRequested))
+            performGarbageCollection();
+        pthread_mutex_lock(&mergeLock);
+        pendingMergeRequests--;
+        pthread_cond_broadcast(&mergeCondition);
+        pthread_mutex_unlock(&mergeLock);
+    }
+    // 保留中の要求は次回の起動時に処理されるので、待っているスレッドを開放する
+    pthread_mutex_lock(&mergeLock);
+    pendingMergeRequests = 0;
+    pthread_cond_broadcast(&mergeCondition);
+    pthread_mutex_unlock(&mergeLock);
+}
+
+void Index::waitForMerges() {
+    if (!mergeThreadRunning)
+        return;
+    pthread_mutex_lock(&mergeLock);
+    while (pendingMergeRequests > 0)
+        pthread_cond_wait(&mergeCondition, &mergeLock);
+    pthread_mutex_unlock(&mergeLock);
+}
+
+void Index::notifyOfAddressSpaceChange(int signum, offset start, unsigned int length) {
+    if (length == 0)
+        return;
+    sem_wait(&updateSemaphore);
+    if (wal != nullptr) {
+        AddressSpaceChange change = { start, length, signum };
+        wal->append(WAL_ADDRESS_SPACE_CHANGE, &change, sizeof(change));
+    }
+    if (applyAddressSpaceChange(signum, start, length)) {
+        publishView();
+        recordChange(start, start + length - 1, true);
+        if ((!garbageCollectionRequested) && (mergeThreadRunning) && (mustCollectGarbage(garbageThreshold))) {
+            garbageCollectionRequested = true;
+            requestMerge();
+        }
+    }
+    sem_post(&updateSemaphore);
+}
+
+bool Index::applyAddressSpaceChange(int signum, offset start, unsigned int length) {
+    if (signum > 0) {
+        usedAddressSpace += length;
+        return false;
+    }
+    if (start > biggestOffsetSeenSoFar) {
+        // ポスティングが書かれる前に解放された範囲。取り除くべきポスティングは無い
+        usedAddressSpace -= length;
+        return false;
+    }
+    // 公開済みのビューが参照しているので、複製を変更して置き換える
+    ExtentSet *extents = deletedExtents->copy();
+    extents->add(start, start + length - 1);
+    deletedExtents->release();
+    deletedExtents = extents;
+    deletedAddressSpace = deletedExtents->getTotalSize();
+    return true;
+}
+
+void Index::replayLog(const std::vector<WAL_Record> &records) {
+    for (size_t i = 0; i < records.size(); i++) {
+        const WAL_Record &record = records[i];
+        if ((record.type == WAL_ADDRESS_SPACE_CHANGE) && (record.data.size() == sizeof(AddressSpaceChange))) {
+            AddressSpaceChange change;
+            memcpy(&change, record.data.data(), sizeof(change));
+            applyAddressSpaceChange(change.delta, change.startOffset, change.tokenCount);
+        } else if ((record.type == WAL_GARBAGE_COLLECTION) && (!readOnly)) {
+            // LongListStoreの置き換えは完了させたので、取り除いた範囲を忘れる
+            int64_t count = record.data.size() / (2 * sizeof(offset));
+            const offset *garbage = (const offset*)record.data.data();
+            ExtentSet *extents = deletedExtents->copy();
+            for (int64_t k = 0; k < count; k++) {
+                extents->remove(garbage[2 * k], garbage[2 * k + 1]);
+                usedAddressSpace -= garbage[2 * k + 1] - garbage[2 * k] + 1;
+            }
+            deletedExtents->release();
+            deletedExtents = extents;
+            deletedAddressSpace = deletedExtents->getTotalSize();
+        }
+    }
+}
+
+void Index::notifyOfVisibilityChange(offset start, offset end) {
+    if (start > end)
+        return;
+    recordChange(start, end, true);
+    recordChange(start, end, false);
+}
+
+void Index::requestGarbageCollection() {
+    sem_wait(&updateSemaphore);
+    if ((!garbageCollectionRequested) && (mergeThreadRunning)) {
+        garbageCollectionRequested = true;
+        requestMerge();
+    }
+    sem_post(&updateSemaphore);
+}
+
+bool Index::mustCollectGarbage(double threshold) {
+    if ((deletedAddressSpace < MIN_GARBAGE_COLLECTION_THRESHOLD) || (usedAddressSpace <= 0))
+        return false;
+    return (deletedAddressSpace >= threshold * usedAddressSpace);
+}
+
+bool Index::performGarbageCollection() {
+    sem_wait(&updateSemaphore);
+    garbageCollectionRequested = false;
+    if ((deletedExtents->getCount() == 0) || (pendingGarbageCollectionLSN > 0)) {
+        sem_post(&updateSemaphore);
+        return false;
+    }
+    // UpdateList内のポスティングも取り除けるように、先にセグメントとして書き出す
+    flushUpdateListLocked();
+    ExtentSet *garbage = deletedExtents;
+    garbage->addReference();
+    int count = segmentCount;
+    Segment **inputs = typed_malloc(Segment*, count + 1);
+    memcpy(inputs, segments, count * sizeof(Segment*));
+    char *fileName = (count > 0 ? getSegmentFileName(nextSegmentID++) : nullptr);
+    sem_post(&updateSemaphore);
+
+    // すべてのセグメントを一つにマージし、LongListStoreは新しいファイルに書き直す
+    Segment *merged = nullptr;
+    bool ok = true;
+    if (count > 0) {
+        ok = mergeSegments(inputs, count, fileName, POSTING_COMPRESSION, longLists, LONG_LIST_THRESHOLD, garbage);
+        merged = (ok ? Segment::open(fileName) : nullptr);
+        ok = (merged != nullptr);
+        if ((merged != nullptr) && (merged->getTermCount() == 0)) {
+            merged->markObsolete();
+            merged->release();
+            merged = nullptr;
+        }
+    }
+    if (ok)
+        ok = longLists->collectGarbage(garbage, POSTING_COMPRESSION);
+    // マージで追記したブロックは、新しいセグメントの一覧と一緒に記録できるように先に保存する
+    if ((ok) && (!longLists->saveDirectory())) {
+        longLists->abandonGarbageCollection();
+        ok = false;
+    }
+    if (!ok) {
+        snprintf(errorMessage, sizeof(errorMessage), "Garbage collection failed: %s", directory);
+        log(LOG_ERROR, LOG_ID, errorMessage);
+        longLists->discardAppends(longListSize);
+        if (merged != nullptr) {
+            merged->markObsolete();
+            merged->release();
+        } else if (fileName != nullptr)
+            unlink(fileName);
+        free(fileName);
+        free(inputs);
+        garbage->release();
+        return false;
+    }
+    free(fileName);
+
+    sem_wait(&updateSemaphore);
+    // ガベージコレクション中に追加されたセグメントは末尾にある
+    assert((count == 0) || (segments[0] == inputs[0]));
+    int replacement = (merged == nullptr ? 0 : 1);
+    if (merged != nullptr)
+        segments[0] = merged;
+    memmove(&segments[replacement], &segments[count], (segmentCount - count) * sizeof(Segment*));
+    segmentCount -= count - replacement;
+    longListSequence = longLists->getAppendSequence();
+    longListSize = longLists->getFileSize();
+
+    /*
+    新しいセグメントの一覧を保存してから、取り除く範囲をログに記録してLongListStoreを置き換える。
+    置き換えの途中でクラッシュした場合は、起動時にログをもとに完了させる
+    */
+    saveDataToDisk();
+    std::vector<offset> garbageExtents;
+    for (int64_t i = 0; i < garbage->getCount(); i++) {
+        offset start, end;
+        garbage->getExtent(i, &start, &end);
+        garbageExtents.push_back(start);
+        garbageExtents.push_back(end);
+    }
+    int64_t lsn = wal->append(WAL_GARBAGE_COLLECTION, garbageExtents.data(), garbageExtents.size() * sizeof(offset));
+    bool committed = wal->commit(lsn);
+    if (!committed)
+        longLists->abandonGarbageCollection();
+    if ((!committed) || (!longLists->commitGarbageCollection())) {
+        /*
+        古いLongListStoreと削除範囲のまま続ける。レコードがログに残っていれば次回の起動時に
+        置き換えを完了させ、残っていなければ.gcファイルを捨てる。それまではLongListStoreを変更しない
+        */
+        pendingGarbageCollectionLSN = lsn;
+        snprintf(errorMessage, sizeof(errorMessage),
+                "Unable to replace long lists: %s. Garbage collection will be completed on restart.", directory);
+        log(LOG_ERROR, LOG_ID, errorMessage);
+    } else {
+        // 取り除いた範囲だけを忘れる。処理中に削除された範囲は次回に持ち越す
+        ExtentSet *extents = deletedExtents->copy();
+        for (int64_t i = 0; i < garbage->getCount(); i++) {
+            offset start, end;
+            garbage->getExtent(i, &start, &end);
+            extents->remove(start, end);
+        }
+        deletedExtents->release();
+        deletedExtents = extents;
+        usedAddressSpace -= garbage->getTotalSize();
+        deletedAddressSpace = deletedExtents->getTotalSize();
+        longListSize = longLists->getFileSize();
+    }
+    publishView();
+    saveDataToDisk();
+    sem_post(&updateSemaphore);
+
+    for (int i = 0; i < count; i++) {
+        inputs[i]->markObsolete();
+        inputs[i]->release();
+    }
+    free(inputs);
+    garbage->release();
+    return true;
+}
+
+Crawler *Index::createCrawler() {
+    // baseDirectoryが空の場合はすべてのファイルが対象になる
+    return new Crawler(baseDirectory[0] == 0 ? "/" : baseDirectory, MIN_FILE_SIZE, MAX_FILE_SIZE);
+}
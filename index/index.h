@@ -3,7 +3,39 @@
 
 #include "../utils/all.h"
 #include "index_type.h"
+#include "../utils/compression.h"
+#include "stemmer.h"
+#include "writeaheadlog.h"
+#include <pthread.h>
 #include <semaphore.h>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+class Crawler;
+class ExtentSet;
+class FileManager;
+class IndexView;
+class LongListStore;
+class ResultCache;
+class SecurityManager;
+class Segment;
+class UpdateList;
+
+// バイグラムの語を格納するのに必要なバッファの大きさ
+#define MAX_BIGRAM_LENGTH (2 * MAX_STEM_LENGTH)
+
+/*
+インデックスの内容の変更1回分(連続する追加はまとめられる)の記録。
+世代firstGenerationからlastGenerationまでの変更で、[start, end]のポスティングが
+追加された(deletionがfalse)か、その範囲のファイルが削除された(deletionがtrue)ことを表す
+*/
+typedef struct {
+    unsigned int firstGeneration, lastGeneration;
+    offset start, end;
+    bool deletion;
+} IndexChange;
 
 class Index {
 
@@ -32,7 +64,13 @@ public:
     static const int DEFAULT_MAX_SIMULTANEOUS_READERS = 4;
     configurable int MAX_SIMULTANEOUS_READERS;
 
-    // ステミングレベルは０から2の間で設定可能
+    /*
+    ステミングレベルは0から3の間で設定可能
+    0: ステミングしない
+    1: 語幹のみをインデックスに追加する
+    2: 語そのものと語幹の両方を追加する
+    3: 語そのものと、末尾にSTEM_MARKERを付けた語幹を追加する
+    */
     static const int DEFAULT_STEMMING_LEVEL = 0;
     configurable int STEMMING_LEVEL;
 
@@ -51,8 +89,11 @@ public:
     /*
     ドキュメントごとの単語出現頻度を追跡する必要があるかどうかを示す
     0: 追跡しない
-    1: 位置情報とドキュメント情報の療法を取得
+    1: 位置情報とドキュメント情報の両方を取得
     2: ドキュメント情報のみ保持
+    1と2では、<doc>から</doc>までの範囲をドキュメントとし、ドキュメント情報をdoclevel.hの
+    形式のポスティングとして、専用の圧縮方式(COMPRESSION_DOCUMENT)で格納する。
+    2の場合、語の位置情報は保持しないが、タグの位置情報は保持する
     */
     static const int DEFAULT_DOCUMENT_LEVEL_INDEXING = 0;
     configurable int DOCUMENT_LEVEL_INDEXING;
@@ -61,14 +102,55 @@ public:
     XPathサポートを有効にする場合、インデックス作成時に特殊なタグを追加する必要がある。
     ネストレベルNの開始タグに対しては<level!N>、終了タグに対しては</level!N>をインデックス
     に追加する。親子関係の判別のためにネストの深さを把握する。
+    レベルのタグは元のタグと同じ位置に追加される。最も外側の要素のレベルは1。
+    閉じられていない要素は、それを含む要素の終了タグの位置で閉じられたものとみなす
     */
     static const bool DEFAULT_ENABLE_XPATH = false;
     configurable bool ENABLE_XPATH;
 
-    // trueに設定すると、単語単位に加えてバイグラム(2語連続)もインデックスに追加する
+    /*
+    trueに設定すると、単語単位に加えてバイグラム(2語連続)もインデックスに追加する。
+    バイグラムは"語1 語2"という語として、語1の位置に追加される
+    */
     static const bool DEFAULT_BIGRAM_INDEXING = false;
     configurable bool BIGRAM_INDEXING;
 
+    /*
+    BIGRAM_FIRST_WORDSが設定されている場合、その一覧の語で始まるバイグラムだけを追加する。
+    出現頻度の高い語(the, ofなど)に限ることで、インデックスの大きさを抑えつつ、
+    長いリストの位置の照合が必要なフレーズを高速化できる。空の場合はすべての語が対象になる。
+    一覧はインデックスに保存され、既存のインデックスでは保存された一覧が使われる。
+    STEMMING_LEVELが1の場合は語幹で指定すること
+    */
+    std::unordered_set<std::string> bigramFirstWords;
+
+    // セグメントのポスティングブロックに使う圧縮方式(utils/compression.hの方式名で指定する)
+    static const int DEFAULT_POSTING_COMPRESSION = DEFAULT_COMPRESSION_METHOD;
+    configurable int POSTING_COMPRESSION;
+
+    /*
+    セグメントのマージ方針。サイズの比がこの値以内のセグメントは同じ世代とみなされ、
+    同じ世代のセグメントが2つ以上になるとマージされる。
+    2で対数マージ(logarithmic merging)、それより大きい値で幾何マージになる
+    */
+    static const int DEFAULT_MERGE_RATIO = 2;
+    configurable int MERGE_RATIO;
+
+    // マージ後のポスティング数がこの値以上の語はLongListStoreでその場更新される
+    static const int64_t DEFAULT_LONG_LIST_THRESHOLD = 256 * 1024;
+    configurable int64_t LONG_LIST_THRESHOLD;
+
+    // 問い合わせ結果のキャッシュの大きさ(バイト)。0の場合はキャッシュを使わない
+    static const int64_t DEFAULT_RESULT_CACHE_SIZE = 16 * 1024 * 1024;
+    configurable int64_t RESULT_CACHE_SIZE;
+
+    // 結果のキャッシュのシャードの数。シャードごとにロックを持つ
+    static const int DEFAULT_RESULT_CACHE_SHARDS = 16;
+    configurable int RESULT_CACHE_SHARDS;
+
+    // 変更の記録として保持するIndexChangeの最大数
+    static const int MAX_CHANGE_LOG_LENGTH = 4096;
+
     // ファイルのパーミッション管理のために使用。スーパーユーザーはすべてのファイルを読み取れる
     static const uid_t SUPERUSER = (uid_t)0;
 
@@ -84,12 +166,6 @@ public:
     // "Index" (ログ識別子として使われる可能性がある)
     static const char *LOG_ID;
 
-    /*
-    複数のプロセスが同時にインデックスを更新しようとする場合、一方が終了するまで
-    他方は待機する。UPDATE_WAIT_INTERVALはその待機中にポーリングを行う間隔
-    */
-    static const int INDEX_WAIT_INTERVAL = 20;
-
     // 同時に処理可能なクエリの最大数
     static const int MAX_REGISTERED_USERS = 4;
 
@@ -143,27 +219,82 @@ public:
     // Queryインスタンスに一意のユーザーIDを与えるためのカウンター
     int64_t registrationID;
 
-    // コンテンツの更新操作(WRITE UNLINK)が行われた回数をカウントする
+    /*
+    コンテンツの更新操作(ポスティングの追加と削除)が行われた回数をカウントする。
+    インデックスの世代として結果のキャッシュの検証に使われる。changeLockで保護される
+    */
     unsigned int updateOperationsPerformed;
 
-    // 初期値としてMAX_REGISTERED_USERSを設定し、その後PとVを行う
-    sem_t registeredUserSemaphore;
+    /*
+    最近の変更の記録(古い順)。最大MAX_CHANGE_LOG_LENGTH個で、あふれた場合は
+    古いものから捨て、changeLogStartに捨てた変更の最後の世代を記録する
+    */
+    std::vector<IndexChange> changeLog;
+    unsigned int changeLogStart;
 
-    // 同時に実行できる更新操作の数を1に制限するために使用される
-    sem_t updateSemaphore;
+    /*
+    最後の変更の後にgetUpdateGenerationで世代が読まれた場合にtrue。読まれた世代の
+    途中までの変更を区別できるように、次の追加は直前の記録とまとめない
+    */
+    bool lastChangeObserved;
+    pthread_mutex_t changeLock;
+
+    // 問い合わせ結果のキャッシュ。RESULT_CACHE_SIZEが0の場合はnullptr
+    ResultCache *resultCache;
+
+    // インデックスに含まれるファイルとディレクトリの構造と、その所有者とパーミッション
+    FileManager *fileManager;
 
     /*
-    このフラグは、現在更新クエリが処理中かどうかを判定するために使用される
-    もし処理中ならば最初のクエリが終了するまで他の更新クエリの実行は遅延される
+    FileManagerとIndexのメタデータの変更のログ。変更はチェックポイント(saveDataToDisk)より
+    先にログに残し、クラッシュした場合は起動時に最後のチェックポイントより後の変更を再実行する
     */
-    bool indexIsBeingUpdated;
+    WriteAheadLog *wal;
+
+    // 最後に書き出したマスターインデックスファイルに反映されているログの最後のLSN
+    int64_t checkpointLSN;
+
+    /*
+    LongListStoreの置き換えを完了できなかったガベージコレクションのレコードのLSN(無ければ0)。
+    このレコードはログに残し、次回の起動時に置き換えを完了させる。それまではLongListStoreを変更しない
+    */
+    int64_t pendingGarbageCollectionLSN;
+
+    // ユーザーごとの見えるアドレス範囲を求める
+    SecurityManager *securityManager;
+
+    /*
+    同時に実行できる更新操作(ポスティングの追加、セグメントの書き出し、マージ結果の反映)
+    の数を1に制限するために使用される。クエリはこれを使わず、IndexViewを固定して読み取る
+    */
+    sem_t updateSemaphore;
+
+    // UpdateListへの書き込みと、IndexViewからの読み取りを排他する
+    pthread_rwlock_t updateListLock;
+
+    // 現在公開されているビュー。viewLockで保護される
+    IndexView *currentView;
+    pthread_mutex_t viewLock;
+
+    // 最後に公開したビューの番号
+    int64_t viewGeneration;
 
     // ガベージコレクションをトリガーするために使用される
     offset usedAddressSpace, deletedAddressSpace;
 
-    // ガベージコレクションのしきい値
+    /*
+    ガベージコレクションのしきい値。deletedAddressSpace / usedAddressSpaceが
+    onTheFlyGarbageThresholdを超えるとセグメントのマージ中に不要ポスティングを取り除き、
+    garbageThresholdを超えるとインデックス全体を書き直すガベージコレクションを行う
+    */
     double garbageThreshold, onTheFlyGarbageThreshold;
 
+    // 削除されたが、まだインデックスから取り除かれていないポスティングのアドレス範囲
+    ExtentSet *deletedExtents;
+
+    // マージスレッドにガベージコレクションが要求されている場合にtrue
+    volatile bool garbageCollectionRequested;
+
     /*
     これまでに遭遇した最大のオフセット値
     これによりnotifyOfAddressSpaceChangeの操作が実際にポスティングを削除したのか
@@ -172,6 +303,79 @@ public:
     */
     offset biggestOffsetSeenSoFar;
 
+    // まだディスクに書き出されていないポスティングを保持する(最大MAX_UPDATE_SPACEバイト)
+    UpdateList *updateList;
+
+    // セグメントとして書き出し中のUpdateList。書き出しの間もビューから読み取られる
+    UpdateList *frozenUpdateList;
+
+    // ディスク上のセグメント。作成された順(ポスティングの古い順)に並ぶ
+    Segment **segments;
+    int segmentCount, segmentsAllocated;
+
+    // 次に作成するセグメントのID(ファイル名に使われる)
+    int32_t nextSegmentID;
+
+    // その場更新される長いポスティングリスト
+    LongListStore *longLists;
+
+    /*
+    公開するビューから見えるLongListStoreのブロックの最大の追記番号。
+    マージ中に追記されたブロックは、入力のセグメントを外すときに初めて見えるようにする
+    */
+    int64_t longListSequence;
+
+    /*
+    インデックスファイルに記録したLongListStoreのデータファイルのサイズ。
+    これより後ろに追記されたブロックは、セグメントの一覧が保存されるまで確定しない。
+    古いインデックスファイルから読み込んだ場合は-1
+    */
+    int64_t longListSize;
+
+    // 語から語幹への対応表。STEMMING_LEVELが0の場合はnullptr
+    StemCache *stemCache;
+
+    // 直前のaddPostingsで最後に追加された語と位置。呼び出しをまたぐバイグラムを作るために使う
+    char lastBigramWord[MAX_STEM_LENGTH];
+    offset lastBigramPosition;
+    pthread_mutex_t bigramLock;
+
+    /*
+    処理中のドキュメント(<doc>から</doc>まで)の開始位置と語の数、語ごとの出現回数。
+    ドキュメントの外ではdocumentStartが-1。documentLockで保護される
+    */
+    offset documentStart;
+    offset documentLength;
+    std::unordered_map<std::string, int> documentTerms;
+
+    /*
+    これまでに索引付けされたドキュメントの数と長さの合計(BM25の文書長の正規化に使う)。
+    削除されたドキュメントは差し引かない。documentLockで保護される
+    */
+    int64_t documentCount, documentLengthSum;
+    pthread_mutex_t documentLock;
+
+    /*
+    ENABLE_XPATHの場合に、開いている要素のタグ名(外側から順)。要素数がネストの深さになる。
+    呼び出しをまたいで保持され、xpathLockで保護される
+    */
+    std::vector<std::string> openElements;
+    pthread_mutex_t xpathLock;
+
+    // バックグラウンドでセグメントをマージするスレッド
+    pthread_t mergeThread;
+    bool mergeThreadRunning;
+
+    // セグメントが追加されるたびにVされ、マージスレッドを起こす
+    sem_t mergeRequestSemaphore;
+
+    // マージスレッドがまだ処理していない要求の数。mergeLockで保護される
+    int pendingMergeRequests;
+
+    // pendingMergeRequestsが減るたびにシグナルされる
+    pthread_mutex_t mergeLock;
+    pthread_cond_t mergeCondition;
+
 public:
 
     // デフォルトコンストラクタ
@@ -188,6 +392,112 @@ public:
 
     virtual ~Index();
 
+    /*
+    count個の(語, ポスティング)の組をインデックスに追加する。
+    語はSTEMMING_LEVELに従ってステミングされる。
+    UpdateListがいっぱいになった場合は、その内容を新しいセグメントとして書き出す
+    */
+    virtual void addPostings(char **terms, offset *postings, int count);
+
+    /*
+    termのすべてのポスティング(セグメントとUpdateListの両方)を昇順で返す。
+    STEMMING_LEVELが1の場合、termは語幹に変換してから検索する。
+    メモリは呼び出し元で開放しなければいけない
+    */
+    virtual offset *getPostings(const char *term, int64_t *count);
+
+    /*
+    語の並びwordsからなるフレーズの出現位置(最初の語の位置)を昇順で返す。
+    バイグラムがインデックスに含まれる場合は、語の組をバイグラムに置き換えて
+    照合するリストの数と長さを減らす。メモリは呼び出し元で開放しなければいけない
+    */
+    offset *getPhrasePostings(const char **words, int wordCount, int64_t *count);
+
+    /*
+    クエリの語wordをインデックスの語の形に変換してresultに格納する。
+    stemがtrueの場合(クエリで語幹の検索が指定された場合)、STEMMING_LEVELに応じた語幹の語にする。
+    STEMMING_LEVELが1の場合は常に語幹になる。resultには少なくともMAX_STEM_LENGTHバイトが必要
+    */
+    void getQueryTerm(const char *word, bool stem, char *result);
+
+    /*
+    インデックスの語の形に変換したフレーズtermsを、バイグラムを使った語の並びに書き換える。
+    i番目の語rewritten[i]はフレーズの先頭からshifts[i]語目に現れる。
+    rewrittenとshiftsには少なくともtermCount個の要素が必要。書き換えた後の語の数を返す
+    */
+    int rewritePhrase(const char **terms, int termCount, char (*rewritten)[MAX_BIGRAM_LENGTH], int *shifts);
+
+    // 索引付けされたドキュメントの数と長さ(語の数)の合計を返す
+    void getDocumentStatistics(int64_t *count, int64_t *lengthSum);
+
+    // wordで始まるバイグラムがインデックスに含まれるかどうか
+    bool isBigramFirstWord(const char *word);
+
+    // firstとsecondからバイグラムの語を作る。resultには少なくともMAX_BIGRAM_LENGTHバイトが必要
+    static void makeBigram(const char *first, const char *second, char *result);
+
+    /*
+    ネストレベルlevelの開始タグ(<level!N>)または終了タグ(</level!N>)の語を作る。
+    resultには少なくともMAX_STEM_LENGTHバイトが必要
+    */
+    static void makeLevelTag(int level, bool endTag, char *result);
+
+    /*
+    現在のビューを固定して返す。ビューは更新やマージの影響を受けないので、
+    クエリはこれを使って一貫した状態を読み取る。使い終わったらreleaseを呼び出すこと
+    */
+    IndexView *acquireView();
+
+    // 現在のインデックスの世代(更新操作の回数)を返す
+    unsigned int getUpdateGeneration();
+
+    /*
+    世代generationより後の変更をchangesに格納する。
+    変更の記録が既に捨てられている場合はfalseを返す
+    */
+    bool getChangesSince(unsigned int generation, std::vector<IndexChange> *changes);
+
+    // 問い合わせ結果のキャッシュを返す。キャッシュを使わない場合はnullptr
+    ResultCache *getResultCache();
+
+    FileManager *getFileManager();
+
+    SecurityManager *getSecurityManager();
+
+    // UpdateListの内容を新しいセグメントとして書き出し、インデックス情報を保存する
+    virtual void flushUpdateList();
+
+    /*
+    アドレス空間の変化を通知する。signumが正の場合は[start, start + length - 1]が
+    新たに使用され、負の場合はその範囲のファイルが削除(または変更)されたことを表す。
+    削除された範囲のポスティングはクエリの結果から除かれ、しきい値に応じて
+    ガベージコレクションで取り除かれる。
+    変更はログに追加されるだけなので、呼び出し元(FileManager)が自分の変更と合わせてcommitする
+    */
+    virtual void notifyOfAddressSpaceChange(int signum, offset start, unsigned int length);
+
+    /*
+    [start, end]のファイルの属性(所有者やパーミッション)が変わったことを通知する。
+    ユーザーによっては範囲が見えるようになったり見えなくなったりするので、
+    キャッシュされた結果のために、範囲の削除と追加の両方として記録する
+    */
+    void notifyOfVisibilityChange(offset start, offset end);
+
+    // マージスレッドにガベージコレクションを要求する
+    void requestGarbageCollection();
+
+    /*
+    baseDirectory以下のMIN_FILE_SIZE以上MAX_FILE_SIZE以下のファイルを探すCrawlerを作る。
+    インスタンスは呼び出し元でdeleteしなければいけない
+    */
+    Crawler *createCrawler();
+
+    // 実行中および要求済みのマージがすべて終わるまで待つ
+    void waitForMerges();
+
+    // マージスレッドの本体。外部から呼び出してはいけない
+    void runMergeThread();
+
 protected:
 
     // 設定マネージャから構成情報を取得する
@@ -195,6 +505,73 @@ protected:
 
     // マスターインデックスファイルからインデックス情報を読み取る
     void loadDataFromDisk();
+
+    /*
+    インデックス情報(設定値とセグメントの一覧)をマスターインデックスファイルに書き込む。
+    一時ファイルに書き込んでからrenameするので、ファイルは常に完全な状態に保たれる。
+    書き込みが済んだらチェックポイントとして、それまでのログのレコードを取り除く
+    */
+    void saveDataToDisk();
+
+    /*
+    ログのIndexのレコード(アドレス空間の変化とガベージコレクションの完了)を再実行する。
+    LongListStoreを作った後、ビューを公開する前に呼び出すこと
+    */
+    void replayLog(const std::vector<WAL_Record> &records);
+
+    /*
+    notifyOfAddressSpaceChangeの使用中と削除済みのアドレス範囲の更新を行う。
+    削除された範囲をdeletedExtentsに追加した場合はtrueを返す
+    */
+    bool applyAddressSpaceChange(int signum, offset start, unsigned int length);
+
+    // セグメントIDからセグメントファイルの名前を作る。メモリは呼び出し元で開放しなければいけない
+    char *getSegmentFileName(int32_t segmentID);
+
+    // 開いているすべてのセグメントへの参照を開放する
+    void closeSegments();
+
+    /*
+    現在のセグメントの一覧、UpdateList、削除範囲から新しいビューを作って公開する。
+    updateSemaphoreを保持して呼び出すこと
+    */
+    void publishView();
+
+    // マージスレッドを起こす。updateSemaphoreを保持していてもよい
+    void requestMerge();
+
+    // ステミング済みの語をUpdateListに追加する。updateSemaphoreはこの中で取得する
+    void addPostingsToUpdateList(char **terms, offset *postings, int count);
+
+    // 変更を記録し、世代を1つ進める。直前の変更も追加であればまとめる
+    void recordChange(offset start, offset end, bool deletion);
+
+    // updateSemaphoreを保持した状態でflushUpdateListの処理を行う
+    void flushUpdateListLocked();
+
+    // セグメントのサイズから世代を求める
+    int getSegmentLevel(int64_t segmentSize);
+
+    /*
+    マージ方針に従い、マージすべき末尾のセグメント列の先頭位置を返す。
+    マージが不要な場合は-1を返す。updateSemaphoreを保持して呼び出すこと
+    */
+    int chooseMergeRange();
+
+    // 1回分のマージを行う。マージを行わなかった場合はfalseを返す
+    bool performMerge();
+
+    /*
+    不要ポスティングの割合がthresholdを超えていればtrueを返す。
+    updateSemaphoreを保持して呼び出すこと
+    */
+    bool mustCollectGarbage(double threshold);
+
+    /*
+    すべてのセグメントとLongListStoreから削除された範囲のポスティングを取り除く。
+    ガベージコレクションを行わなかった場合はfalseを返す
+    */
+    bool performGarbageCollection();
 };
 
 #endif
\ No newline at end of file
@@ -16,6 +16,15 @@ static const int MAX_INT = 0x7FFFFFFF;
 static const offset ONE = 1;
 static const offset TWO = 2;
 
+// インデックスに格納される語の最大長(バイト)。これより長いトークンは切り詰められる
+static const int MAX_TOKEN_LENGTH = 63;
+
+/*
+バイグラムの2つの語をつなぐ文字。語には空白が含まれないので、単語と衝突しない。
+バイグラムのポスティングは最初の語の位置に置かれ、2語分の位置を占める
+*/
+#define BIGRAM_SEPARATOR ' '
+
 // 初期ファイルの権限(インデックスファイルが作られたときに使う)
 static const mode_t DEFAULT_FILE_PERMISSIONS = S_IWUSR | S_IRUSR | S_IRGRP;
 
@@ -0,0 +1,209 @@
+#include <cassert>
+#include <cstring>
+#include <algorithm>
+#include "indexview.h"
+#include "doclevel.h"
+#include "extentset.h"
+#include "levenshtein.h"
+#include "longliststore.h"
+#include "segment.h"
+#include "termdictionary.h"
+#include "updatelist.h"
+#include "../utils/all.h"
+
+IndexView::IndexView(int64_t generation, Segment **segments, int segmentCount,
+        UpdateList *frozenUpdateList, UpdateList *updateList, LongListStore *longLists,
+        int64_t longListSequence, ExtentSet *deletedExtents, pthread_rwlock_t *updateListLock) {
+    this->generation = generation;
+    this->segments = typed_malloc(Segment*, segmentCount + 1);
+    this->segmentCount = segmentCount;
+    for (int i = 0; i < segmentCount; i++) {
+        this->segments[i] = segments[i];
+        segments[i]->addReference();
+    }
+    updateListCount = 0;
+    if (frozenUpdateList != nullptr)
+        updateLists[updateListCount++] = frozenUpdateList;
+    if (updateList != nullptr)
+        updateLists[updateListCount++] = updateList;
+    for (int i = 0; i < updateListCount; i++)
+        updateLists[i]->addReference();
+    this->longLists = longLists;
+    this->longListSequence = longListSequence;
+    this->deletedExtents = deletedExtents;
+    deletedExtents->addReference();
+    this->updateListLock = updateListLock;
+}
+
+IndexView::~IndexView() {
+    for (int i = 0; i < segmentCount; i++)
+        segments[i]->release();
+    free(segments);
+    for (int i = 0; i < updateListCount; i++)
+        updateLists[i]->release();
+    deletedExtents->release();
+}
+
+offset *IndexView::getPostings(const char *term, int64_t *count) {
+    int64_t total = 0;
+    // 0..segmentCount-1: セグメント、segmentCount: LongListStore
+    offset **lists = typed_malloc(offset*, segmentCount + 1);
+    int64_t *lengths = typed_malloc(int64_t, segmentCount + 1);
+    for (int i = 0; i < segmentCount; i++) {
+        lists[i] = segments[i]->getPostings(term, &lengths[i]);
+        total += lengths[i];
+    }
+    lists[segmentCount] = nullptr;
+    lengths[segmentCount] = 0;
+    if (longLists != nullptr)
+        lists[segmentCount] = longLists->getPostings(term, &lengths[segmentCount], longListSequence);
+    total += lengths[segmentCount];
+
+    offset *result = typed_malloc(offset, total + 1);
+    int64_t pos = 0;
+    for (int i = 0; i <= segmentCount; i++) {
+        if (lists[i] != nullptr)
+            memcpy(&result[pos], lists[i], lengths[i] * sizeof(offset));
+        pos += lengths[i];
+        free(lists[i]);
+    }
+    free(lists);
+    free(lengths);
+
+    int64_t memoryCount;
+    offset *memoryPostings = getUpdateListPostings(term, &memoryCount);
+    if (memoryCount > 0) {
+        typed_realloc(offset, result, total + memoryCount + 1);
+        memcpy(&result[total], memoryPostings, memoryCount * sizeof(offset));
+        total += memoryCount;
+    }
+    free(memoryPostings);
+
+    // 通常はセグメントの順にポスティングが増加するが、念のため整列と重複除去を行う
+    if (!std::is_sorted(result, result + total))
+        std::sort(result, result + total);
+    *count = std::unique(result, result + total) - result;
+    // 削除されたファイルのポスティングはガベージコレクションまで残っている
+    *count = deletedExtents->removeContained(result, *count, getPostingShift(term));
+    if ((strchr(term, BIGRAM_SEPARATOR) != nullptr) && (deletedExtents->getCount() > 0)) {
+        // バイグラムは2語目が削除されている場合も取り除く
+        int64_t n = 0;
+        for (int64_t i = 0; i < *count; i++)
+            if (!deletedExtents->contains(result[i] + 1))
+                result[n++] = result[i];
+        *count = n;
+    }
+    return result;
+}
+
+offset *IndexView::getUpdateListPostings(const char *term, int64_t *count) {
+    offset *result = typed_malloc(offset, 1);
+    int64_t total = 0;
+    // UpdateListは書き込みと並行して読まれるので、読み取りロックを取る
+    pthread_rwlock_rdlock(updateListLock);
+    for (int i = 0; i < updateListCount; i++) {
+        int32_t termID = updateLists[i]->findTerm(term);
+        if (termID < 0)
+            continue;
+        int n = updateLists[i]->getPostingCount(termID);
+        typed_realloc(offset, result, total + n + 1);
+        updateLists[i]->getPostings(termID, &result[total]);
+        total += n;
+    }
+    pthread_rwlock_unlock(updateListLock);
+    // 書き出し中のUpdateListと新しいUpdateListの間でポスティングの順序は保たれる
+    if (!std::is_sorted(result, result + total))
+        std::sort(result, result + total);
+    *count = std::unique(result, result + total) - result;
+    return result;
+}
+
+// 昇順のpostings[0..count-1]に、shiftビット右シフトした値が[start, end]にあるものがあるかどうか
+static bool containsInRange(const offset *postings, int64_t count, int shift, offset start, offset end) {
+    const offset *p = std::lower_bound(postings, postings + count, start << shift);
+    return (p < postings + count) && ((*p >> shift) <= end);
+}
+
+bool IndexView::hasPostingsInRange(const char *term, offset start, offset end) {
+    int shift = getPostingShift(term);
+    offset buffer[SEGMENT_BLOCK_SIZE];
+    for (int i = 0; i < segmentCount; i++) {
+        int64_t termIndex = segments[i]->findTerm(term);
+        if (termIndex < 0)
+            continue;
+        // lastPosting >= startとなる最初のブロックだけを調べればよい
+        int block = segments[i]->findBlock(termIndex, start << shift);
+        if (block >= segments[i]->getTermEntry(termIndex)->blockCount)
+            continue;
+        if ((segments[i]->getSkipEntries(termIndex)[block].firstPosting >> shift) > end)
+            continue;
+        int n = segments[i]->decodeBlock(termIndex, block, buffer);
+        if (containsInRange(buffer, n, shift, start, end))
+            return true;
+    }
+
+    if (longLists != nullptr) {
+        int blockCount;
+        int64_t generation;
+        SegmentSkipEntry *blocks = longLists->getSkipEntries(term, &blockCount, &generation, longListSequence);
+        bool found = false;
+        for (int b = 0; b < blockCount; b++) {
+            if ((blocks[b].lastPosting >> shift) < start)
+                continue;
+            if ((blocks[b].firstPosting >> shift) <= end) {
+                int n = longLists->decodeBlock(&blocks[b], buffer, generation);
+                // ガベージコレクションで置き換えられた場合は、存在するものとみなす
+                found = (n < 0) || (containsInRange(buffer, n, shift, start, end));
+            }
+            break;
+        }
+        free(blocks);
+        if (found)
+            return true;
+    }
+
+    int64_t count;
+    offset *postings = getUpdateListPostings(term, &count);
+    bool found = containsInRange(postings, count, shift, start, end);
+    free(postings);
+    return found;
+}
+
+bool IndexView::expandWildcard(const char *prefix, const char *suffix, int64_t maxTerms,
+        std::vector<std::string> *terms) {
+    terms->clear();
+    // 同じ語が複数のセグメントに現れるので、各部分ではmaxTermsまで集めてから重複を取り除く
+    bool ok = true;
+    for (int i = 0; (i < segmentCount) && (ok); i++)
+        ok = segments[i]->expandWildcard(prefix, suffix, maxTerms, terms);
+    if ((ok) && (longLists != nullptr))
+        ok = longLists->expandWildcard(prefix, suffix, maxTerms, terms);
+    if (ok) {
+        pthread_rwlock_rdlock(updateListLock);
+        for (int i = 0; (i < updateListCount) && (ok); i++)
+            ok = updateLists[i]->expandWildcard(prefix, suffix, maxTerms, terms);
+        pthread_rwlock_unlock(updateListLock);
+    }
+    std::sort(terms->begin(), terms->end());
+    terms->erase(std::unique(terms->begin(), terms->end()), terms->end());
+    return (ok) && ((int64_t)terms->size() <= maxTerms);
+}
+
+bool IndexView::expandFuzzy(const char *word, int maxDistance, int64_t maxTerms, std::vector<std::string> *terms) {
+    terms->clear();
+    LevenshteinAutomaton automaton(word, maxDistance);
+    bool ok = true;
+    for (int i = 0; (i < segmentCount) && (ok); i++)
+        ok = segments[i]->expandFuzzy(&automaton, maxTerms, terms);
+    if ((ok) && (longLists != nullptr))
+        ok = longLists->expandFuzzy(&automaton, maxTerms, terms);
+    if (ok) {
+        pthread_rwlock_rdlock(updateListLock);
+        for (int i = 0; (i < updateListCount) && (ok); i++)
+            ok = updateLists[i]->expandFuzzy(&automaton, maxTerms, terms);
+        pthread_rwlock_unlock(updateListLock);
+    }
+    std::sort(terms->begin(), terms->end());
+    terms->erase(std::unique(terms->begin(), terms->end()), terms->end());
+    return (ok) && ((int64_t)terms->size() <= maxTerms);
+}
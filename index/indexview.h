@@ -0,0 +1,109 @@
+#ifndef __INDEXVIEW_H
+#define __INDEXVIEW_H
+
+/*
+IndexViewはインデックスのある時点でのスナップショット。
+クエリはIndex::acquireViewでその時点のビューを固定(pin)し、処理が終わったら
+releaseで開放する。更新やマージはセグメントの一覧などを変更した後、新しいビューを作って
+アトミックに公開するだけなので、読み取り側が更新の完了を待つことはない。
+
+ビューが参照するセグメント、UpdateList、削除範囲はすべて参照カウントで共有される。
+古いビューを固定しているクエリがある間は、マージで置き換えられたセグメントも
+開いたまま残り、最後のビューが開放された時点でファイルが削除される。
+
+UpdateListだけは書き込み中も読み取られるため、読み取りの際には
+updateListLockの読み取りロックを取る。LongListStoreは全てのビューで共有されるが、
+ビューは公開された時点の追記番号(longListSequence)までのブロックだけを読む。
+マージは入力のセグメントを外すのと同時に追記番号を進めるので、古いビューが
+入力のセグメントとLongListStoreの両方から同じポスティングを読むことはない
+*/
+
+#include "index_type.h"
+#include "../utils/refcounted.h"
+#include <pthread.h>
+#include <string>
+#include <vector>
+
+class ExtentSet;
+class LongListStore;
+class Segment;
+class UpdateList;
+
+class IndexView : public RefCounted {
+
+public:
+
+    // ビューが公開されるたびに増加する番号
+    int64_t generation;
+
+    // ディスク上のセグメント。作成された順(ポスティングの古い順)に並ぶ
+    Segment **segments;
+    int segmentCount;
+
+    /*
+    メモリ上のUpdateList。古い順に並ぶ。
+    ディスクに書き出し中のものと、現在書き込まれているものの最大2つ
+    */
+    UpdateList *updateLists[2];
+    int updateListCount;
+
+    LongListStore *longLists;
+
+    // LongListStoreのうち、このビューから見えるブロックの最大の追記番号
+    int64_t longListSequence;
+
+    // 削除されたが、まだインデックスから取り除かれていないアドレス範囲
+    ExtentSet *deletedExtents;
+
+private:
+
+    // UpdateListの読み書きを保護するロック(Indexが所有する)
+    pthread_rwlock_t *updateListLock;
+
+public:
+
+    /*
+    与えられたオブジェクトへの参照を追加してビューを作成する。
+    frozenUpdateListはnullptrでもよい
+    */
+    IndexView(int64_t generation, Segment **segments, int segmentCount,
+            UpdateList *frozenUpdateList, UpdateList *updateList, LongListStore *longLists,
+            int64_t longListSequence, ExtentSet *deletedExtents, pthread_rwlock_t *updateListLock);
+
+    ~IndexView();
+
+    /*
+    termのすべてのポスティングを昇順で返す。削除された範囲のポスティングは含まれない。
+    メモリは呼び出し元で開放しなければいけない
+    */
+    offset *getPostings(const char *term, int64_t *count);
+
+    /*
+    termのUpdateList内のポスティングだけを昇順で返す。削除された範囲のポスティングも含まれる。
+    メモリは呼び出し元で開放しなければいけない
+    */
+    offset *getUpdateListPostings(const char *term, int64_t *count);
+
+    /*
+    termの位置が[start, end]の範囲にあるポスティングが存在するかどうか。
+    セグメントとLongListStoreでは該当するブロックを1つ展開するだけで判定する。
+    削除された範囲は考慮しない
+    */
+    bool hasPostingsInRange(const char *term, offset start, offset end);
+
+    /*
+    ワイルドカードprefix*suffix(matchesWildcard)に一致するすべての語を辞書順に重複なくtermsに格納する。
+    セグメントでは語辞書から、prefixがあれば接頭辞の範囲を、なければ反転語の辞書で接尾辞の範囲を列挙する。
+    一致する語がmaxTermsを超えた場合はfalseを返す。削除された範囲は考慮しない
+    */
+    bool expandWildcard(const char *prefix, const char *suffix, int64_t maxTerms, std::vector<std::string> *terms);
+
+    /*
+    wordからの編集距離がmaxDistance(LevenshteinAutomaton::MAX_DISTANCE以下)以下のすべての語を
+    辞書順に重複なくtermsに格納する。セグメントではLevenshteinオートマトンと語辞書の共通部分を列挙する。
+    一致する語がmaxTermsを超えた場合はfalseを返す。削除された範囲は考慮しない
+    */
+    bool expandFuzzy(const char *word, int maxDistance, int64_t maxTerms, std::vector<std::string> *terms);
+};
+
+#endif
@@ -0,0 +1,59 @@
+#include <cassert>
+#include <cstring>
+#include "levenshtein.h"
+
+LevenshteinAutomaton::LevenshteinAutomaton(const char *word, int maxDistance) {
+    length = strlen(word);
+    assert(length <= MAX_TOKEN_LENGTH);
+    assert((maxDistance >= 0) && (maxDistance <= MAX_DISTANCE));
+    memcpy(this->word, word, length + 1);
+    this->maxDistance = maxDistance;
+}
+
+int LevenshteinAutomaton::getStateSize() {
+    return length + 1;
+}
+
+void LevenshteinAutomaton::start(byte *state) {
+    for (int i = 0; i <= length; i++)
+        state[i] = (i > maxDistance ? maxDistance + 1 : i);
+}
+
+void LevenshteinAutomaton::step(const byte *state, char c, byte *next) {
+    int limit = maxDistance + 1;
+    int value = state[0] + 1;
+    next[0] = (value > limit ? limit : value);
+    for (int i = 1; i <= length; i++) {
+        // 置換(一致する場合は0)、cの挿入、word[i - 1]の削除
+        value = state[i - 1] + (word[i - 1] != c);
+        if (state[i] + 1 < value)
+            value = state[i] + 1;
+        if (next[i - 1] + 1 < value)
+            value = next[i - 1] + 1;
+        next[i] = (value > limit ? limit : value);
+    }
+}
+
+bool LevenshteinAutomaton::isMatch(const byte *state) {
+    return state[length] <= maxDistance;
+}
+
+bool LevenshteinAutomaton::canMatch(const byte *state) {
+    for (int i = 0; i <= length; i++)
+        if (state[i] <= maxDistance)
+            return true;
+    return false;
+}
+
+bool LevenshteinAutomaton::matches(const char *term) {
+    byte states[2][MAX_TOKEN_LENGTH + 1];
+    start(states[0]);
+    int current = 0;
+    for (int i = 0; term[i] != 0; i++) {
+        step(states[current], term[i], states[1 - current]);
+        current = 1 - current;
+        if (!canMatch(states[current]))
+            return false;
+    }
+    return isMatch(states[current]);
+}
@@ -0,0 +1,55 @@
+#ifndef __LEVENSHTEIN_H
+#define __LEVENSHTEIN_H
+
+/*
+LevenshteinAutomatonは語wからの編集距離(挿入、削除、置換)がmaxDistance以下の文字列を受理するオートマトン。
+状態は、これまでに読んだ文字列とwの各接頭辞との編集距離の行(長さ|w|+1)で、値はmaxDistance + 1で
+打ち切る。値を打ち切るので状態の数は有限になり、行の計算は決定性オートマトンの遷移と同じ働きをする。
+行のすべての値がmaxDistanceを超えた状態(dead)からは受理状態に到達できないので、
+辞書順に並んだ語辞書と組み合わせれば、その接頭辞を持つ語をまとめて読み飛ばせる
+(TermDictionary::expandFuzzy)。
+
+文字はバイト単位で扱うので、UTF-8の複数バイトの文字の誤りは複数の編集として数える
+*/
+
+#include "index_type.h"
+
+class LevenshteinAutomaton {
+
+public:
+
+    // 扱える最大の編集距離
+    static const int MAX_DISTANCE = 2;
+
+private:
+
+    char word[MAX_TOKEN_LENGTH + 1];
+    int length;
+
+    int maxDistance;
+
+public:
+
+    // wordの長さはMAX_TOKEN_LENGTH以下、maxDistanceは0からMAX_DISTANCEまで
+    LevenshteinAutomaton(const char *word, int maxDistance);
+
+    // 状態(行)の大きさ
+    int getStateSize();
+
+    // 空文字列を読んだ状態をstateに格納する
+    void start(byte *state);
+
+    // stateから文字cを読んだ状態をnextに格納する
+    void step(const byte *state, char c, byte *next);
+
+    // stateが受理状態かどうか
+    bool isMatch(const byte *state);
+
+    // stateから受理状態に到達できるかどうか
+    bool canMatch(const byte *state);
+
+    // 文字列全体が受理されるかどうか
+    bool matches(const char *term);
+};
+
+#endif
@@ -0,0 +1,551 @@
+#include <cassert>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "longliststore.h"
+#include "doclevel.h"
+#include "extentset.h"
+#include "levenshtein.h"
+#include "termdictionary.h"
+#include "../utils/all.h"
+
+const char *LongListStore::LOG_ID = "LongListStore";
+
+static char errorMessage[256];
+
+#define LONGLIST_DIRECTORY_MAGIC 0x324C4C4E4F4C5057LL
+
+LongListStore::LongListStore(const char *dataFile, const char *directoryFile, bool create) {
+    dataFileName = duplicateString(dataFile);
+    directoryFileName = duplicateString(directoryFile);
+    postingCount = 0;
+    fileSize = 0;
+    gcDataFile = -1;
+    generation = 0;
+    appendSequence = 0;
+    pthread_rwlock_init(&lock, nullptr);
+
+    int flags = O_RDWR | O_CREAT | O_LARGEFILE | (create ? O_TRUNC : 0);
+    this->dataFile = open(dataFileName, flags, DEFAULT_FILE_PERMISSIONS);
+    if (this->dataFile < 0) {
+        snprintf(errorMessage, sizeof(errorMessage), "Unable to open long list file: %s", dataFileName);
+        log(LOG_ERROR, LOG_ID, errorMessage);
+        return;
+    }
+    if (create)
+        unlink(directoryFileName);
+    else if (!loadDirectory()) {
+        // ディレクトリが無い場合、データファイルの内容は参照されていないので破棄する
+        terms.clear();
+        postingCount = 0;
+        fileSize = 0;
+        if (ftruncate(this->dataFile, 0) != 0)
+            log(LOG_ERROR, LOG_ID, "Unable to truncate long list file");
+    }
+}
+
+LongListStore::~LongListStore() {
+    discardGarbageCollection();
+    for (auto &entry : terms)
+        freeTermList(&entry.second);
+    if (dataFile >= 0)
+        close(dataFile);
+    free(dataFileName);
+    free(directoryFileName);
+    pthread_rwlock_destroy(&lock);
+}
+
+bool LongListStore::contains(const char *term) {
+    pthread_rwlock_rdlock(&lock);
+    bool result = (terms.find(term) != terms.end());
+    pthread_rwlock_unlock(&lock);
+    return result;
+}
+
+bool LongListStore::expandWildcard(const char *prefix, const char *suffix, int64_t maxTerms,
+        std::vector<std::string> *terms) {
+    // 長いリストを持つ語は少ないので、接尾辞だけの場合もすべての語を調べる
+    int prefixLength = strlen(prefix);
+    int64_t added = 0;
+    bool result = true;
+    pthread_rwlock_rdlock(&lock);
+    for (auto it = this->terms.lower_bound(prefix); it != this->terms.end(); ++it) {
+        if (it->first.compare(0, prefixLength, prefix) != 0)
+            break;
+        if (!matchesWildcard(it->first.c_str(), prefix, suffix))
+            continue;
+        if (++added > maxTerms) {
+            result = false;
+            break;
+        }
+        terms->push_back(it->first);
+    }
+    pthread_rwlock_unlock(&lock);
+    return result;
+}
+
+bool LongListStore::expandFuzzy(LevenshteinAutomaton *automaton, int64_t maxTerms,
+        std::vector<std::string> *terms) {
+    int64_t added = 0;
+    bool result = true;
+    pthread_rwlock_rdlock(&lock);
+    for (auto &entry : this->terms) {
+        if ((!isExpandableTerm(entry.first.c_str())) || (!automaton->matches(entry.first.c_str())))
+            continue;
+        if (++added > maxTerms) {
+            result = false;
+            break;
+        }
+        terms->push_back(entry.first);
+    }
+    pthread_rwlock_unlock(&lock);
+    return result;
+}
+
+bool LongListStore::appendPostings(const char *term, const offset *postings, int64_t count, int compressionMethod) {
+    if ((count <= 0) || (dataFile < 0))
+        return (count <= 0);
+    int blockCount = (count + SEGMENT_BLOCK_SIZE - 1) / SEGMENT_BLOCK_SIZE;
+    SegmentSkipEntry *newBlocks = typed_malloc(SegmentSkipEntry, blockCount);
+
+    // 追記は書き込み位置の確保だけをロック内で行い、書き込み自体はロックの外で行う
+    int64_t sizes = 0;
+    byte **compressed = typed_malloc(byte*, blockCount);
+    for (int b = 0; b < blockCount; b++) {
+        int64_t start = (int64_t)b * SEGMENT_BLOCK_SIZE;
+        int n = (count - start < SEGMENT_BLOCK_SIZE ? count - start : SEGMENT_BLOCK_SIZE);
+        int byteLength;
+        compressed[b] = compressList(&postings[start], n, &byteLength,
+                getTermCompressionMethod(term, compressionMethod));
+        newBlocks[b].firstPosting = postings[start];
+        newBlocks[b].lastPosting = postings[start + n - 1];
+        newBlocks[b].byteLength = byteLength;
+        newBlocks[b].postingCount = n;
+        newBlocks[b].filePosition = sizes;
+        computeBlockImpact(term, &postings[start], n, &newBlocks[b]);
+        sizes += byteLength;
+    }
+
+    pthread_rwlock_wrlock(&lock);
+    int64_t position = fileSize;
+    fileSize += sizes;
+    pthread_rwlock_unlock(&lock);
+
+    bool ok = true;
+    for (int b = 0; (b < blockCount) && (ok); b++) {
+        newBlocks[b].filePosition += position;
+        ssize_t written = pwrite(dataFile, compressed[b], newBlocks[b].byteLength, newBlocks[b].filePosition);
+        ok = (written == newBlocks[b].byteLength);
+    }
+    for (int b = 0; b < blockCount; b++)
+        free(compressed[b]);
+    free(compressed);
+    if (!ok) {
+        snprintf(errorMessage, sizeof(errorMessage), "Unable to append to long list: %s", term);
+        log(LOG_ERROR, LOG_ID, errorMessage);
+        free(newBlocks);
+        return false;
+    }
+
+    pthread_rwlock_wrlock(&lock);
+    LL_TermList &list = terms[term];
+    if (list.blocksAllocated == 0) {
+        list.blocks = nullptr;
+        list.sequences = nullptr;
+        list.blockCount = 0;
+        list.postingCount = 0;
+    }
+    if (list.blockCount + blockCount > list.blocksAllocated) {
+        list.blocksAllocated = (list.blockCount + blockCount) * 2;
+        typed_realloc(SegmentSkipEntry, list.blocks, list.blocksAllocated);
+        typed_realloc(int64_t, list.sequences, list.blocksAllocated);
+    }
+    /*
+    新しいブロックをfirstPostingの順になる位置に挿入する。
+    マージの途中でクラッシュした場合、同じポスティングが再び追記されることがある。
+    その場合は範囲が重なるが、getPostingsが重複を取り除く
+    */
+    int insertAt = list.blockCount;
+    while ((insertAt > 0) && (list.blocks[insertAt - 1].firstPosting > postings[0]))
+        insertAt--;
+    memmove(&list.blocks[insertAt + blockCount], &list.blocks[insertAt],
+            (list.blockCount - insertAt) * sizeof(SegmentSkipEntry));
+    memcpy(&list.blocks[insertAt], newBlocks, blockCount * sizeof(SegmentSkipEntry));
+    memmove(&list.sequences[insertAt + blockCount], &list.sequences[insertAt],
+            (list.blockCount - insertAt) * sizeof(int64_t));
+    appendSequence++;
+    for (int b = 0; b < blockCount; b++)
+        list.sequences[insertAt + b] = appendSequence;
+    list.blockCount += blockCount;
+    list.postingCount += count;
+    postingCount += count;
+    pthread_rwlock_unlock(&lock);
+
+    free(newBlocks);
+    return true;
+}
+
+SegmentSkipEntry *LongListStore::getSkipEntries(const char *term, int *blockCount, int64_t *generation,
+        int64_t maxSequence) {
+    SegmentSkipEntry *result = nullptr;
+    *blockCount = 0;
+    pthread_rwlock_rdlock(&lock);
+    *generation = this->generation;
+    auto it = terms.find(term);
+    if (it != terms.end()) {
+        LL_TermList &list = it->second;
+        result = typed_malloc(SegmentSkipEntry, list.blockCount + 1);
+        for (int b = 0; b < list.blockCount; b++)
+            if (list.sequences[b] <= maxSequence)
+                result[(*blockCount)++] = list.blocks[b];
+    }
+    pthread_rwlock_unlock(&lock);
+    return result;
+}
+
+int LongListStore::decodeBlock(const SegmentSkipEntry *block, offset *buffer, int64_t generation) {
+    pthread_rwlock_rdlock(&lock);
+    int result = (generation == this->generation ? decodeBlockLocked(block, buffer) : -1);
+    pthread_rwlock_unlock(&lock);
+    return result;
+}
+
+int LongListStore::decodeBlockLocked(const SegmentSkipEntry *block, offset *buffer) {
+    // PForDeltaの展開はブロック末尾から8バイト先まで読むことがある
+    byte *compressed = typed_malloc(byte, block->byteLength + 8);
+    ssize_t result = pread(dataFile, compressed, block->byteLength, block->filePosition);
+    if (result != block->byteLength) {
+        log(LOG_ERROR, LOG_ID, "Unable to read long list block");
+        free(compressed);
+        return 0;
+    }
+    memset(&compressed[block->byteLength], 0, 8);
+    int count;
+    decompressList(compressed, block->byteLength, &count, buffer);
+    free(compressed);
+    return count;
+}
+
+offset *LongListStore::getPostings(const char *term, int64_t *count, int64_t maxSequence) {
+    *count = 0;
+    // ガベージコレクションによるデータファイルの置き換えと重ならないように、ロックを保持して読み取る
+    pthread_rwlock_rdlock(&lock);
+    auto it = terms.find(term);
+    if (it == terms.end()) {
+        pthread_rwlock_unlock(&lock);
+        return nullptr;
+    }
+    LL_TermList &list = it->second;
+    offset *result = typed_malloc(offset, list.postingCount + SEGMENT_BLOCK_SIZE);
+    for (int b = 0; b < list.blockCount; b++)
+        if (list.sequences[b] <= maxSequence)
+            *count += decodeBlockLocked(&list.blocks[b], &result[*count]);
+    pthread_rwlock_unlock(&lock);
+    if (!std::is_sorted(result, result + *count)) {
+        std::sort(result, result + *count);
+        *count = std::unique(result, result + *count) - result;
+    }
+    return result;
+}
+
+int64_t LongListStore::getAppendSequence() {
+    pthread_rwlock_rdlock(&lock);
+    int64_t result = appendSequence;
+    pthread_rwlock_unlock(&lock);
+    return result;
+}
+
+int64_t LongListStore::getTermCount() {
+    pthread_rwlock_rdlock(&lock);
+    int64_t result = terms.size();
+    pthread_rwlock_unlock(&lock);
+    return result;
+}
+
+int64_t LongListStore::getPostingCount() {
+    return postingCount;
+}
+
+int64_t LongListStore::getFileSize() {
+    return fileSize;
+}
+
+/*
+ディレクトリファイルの形式:
+  [マジックナンバー][データファイルのサイズ][語の数]
+  語ごとに [語の長さ int32][語][ブロック数 int32][ポスティング数 int64][SegmentSkipEntry...]
+*/
+bool LongListStore::saveDirectory() {
+    if (dataFile < 0)
+        return false;
+    if (fdatasync(dataFile) != 0)
+        log(LOG_ERROR, LOG_ID, "Unable to sync long list file");
+    pthread_rwlock_rdlock(&lock);
+    bool ok = writeDirectory(directoryFileName, terms, fileSize);
+    pthread_rwlock_unlock(&lock);
+    return ok;
+}
+
+void LongListStore::discardAppends(int64_t committedSize) {
+    pthread_rwlock_wrlock(&lock);
+    for (auto it = terms.begin(); it != terms.end(); ) {
+        LL_TermList &list = it->second;
+        int kept = 0;
+        for (int b = 0; b < list.blockCount; b++) {
+            if (list.blocks[b].filePosition >= committedSize) {
+                list.postingCount -= list.blocks[b].postingCount;
+                postingCount -= list.blocks[b].postingCount;
+                continue;
+            }
+            list.blocks[kept] = list.blocks[b];
+            list.sequences[kept++] = list.sequences[b];
+        }
+        list.blockCount = kept;
+        if (kept == 0) {
+            freeTermList(&list);
+            it = terms.erase(it);
+        } else
+            ++it;
+    }
+    if (fileSize > committedSize) {
+        fileSize = committedSize;
+        if (ftruncate(dataFile, fileSize) != 0)
+            log(LOG_ERROR, LOG_ID, "Unable to truncate long list file");
+    }
+    pthread_rwlock_unlock(&lock);
+}
+
+bool LongListStore::writeDirectory(const char *fileName, const std::map<std::string, LL_TermList> &terms,
+        int64_t fileSize) {
+    char *tempFileName = concatenateStrings(fileName, ".temp");
+    int fd = open(tempFileName, O_WRONLY | O_CREAT | O_TRUNC | O_LARGEFILE, DEFAULT_FILE_PERMISSIONS);
+    FILE *f = (fd < 0 ? nullptr : fdopen(fd, "w"));
+    if (f == nullptr) {
+        snprintf(errorMessage, sizeof(errorMessage), "Unable to write long list directory: %s", tempFileName);
+        log(LOG_ERROR, LOG_ID, errorMessage);
+        free(tempFileName);
+        return false;
+    }
+    int64_t header[3] = { LONGLIST_DIRECTORY_MAGIC, fileSize, (int64_t)terms.size() };
+    bool ok = (fwrite(header, sizeof(header), 1, f) == 1);
+    for (auto &entry : terms) {
+        int32_t termLength = entry.first.size();
+        ok = ok && (fwrite(&termLength, sizeof(termLength), 1, f) == 1);
+        ok = ok && (fwrite(entry.first.c_str(), 1, termLength, f) == (size_t)termLength);
+        ok = ok && (fwrite(&entry.second.blockCount, sizeof(int32_t), 1, f) == 1);
+        ok = ok && (fwrite(&entry.second.postingCount, sizeof(int64_t), 1, f) == 1);
+        ok = ok && (fwrite(entry.second.blocks, sizeof(SegmentSkipEntry), entry.second.blockCount, f)
+                == (size_t)entry.second.blockCount);
+    }
+    ok = ok && (fflush(f) == 0) && (fsync(fd) == 0);
+    fclose(f);
+    if ((ok) && (rename(tempFileName, fileName) != 0))
+        ok = false;
+    if (!ok) {
+        snprintf(errorMessage, sizeof(errorMessage), "Unable to write long list directory: %s", fileName);
+        log(LOG_ERROR, LOG_ID, errorMessage);
+    }
+    free(tempFileName);
+    return ok;
+}
+
+bool LongListStore::loadDirectory() {
+    FILE *f = fopen(directoryFileName, "r");
+    if (f == nullptr)
+        return false;
+    int64_t header[3];
+    bool ok = (fread(header, sizeof(header), 1, f) == 1) && (header[0] == LONGLIST_DIRECTORY_MAGIC);
+    char term[MAX_TOKEN_LENGTH * 4 + 4];
+    for (int64_t i = 0; (ok) && (i < header[2]); i++) {
+        int32_t termLength;
+        LL_TermList list;
+        ok = (fread(&termLength, sizeof(termLength), 1, f) == 1) &&
+            (termLength >= 0) && (termLength < (int32_t)sizeof(term)) &&
+            (fread(term, 1, termLength, f) == (size_t)termLength) &&
+            (fread(&list.blockCount, sizeof(int32_t), 1, f) == 1) &&
+            (fread(&list.postingCount, sizeof(int64_t), 1, f) == 1);
+        if (!ok)
+            break;
+        term[termLength] = 0;
+        list.blocksAllocated = list.blockCount + 1;
+        list.blocks = typed_malloc(SegmentSkipEntry, list.blocksAllocated);
+        list.sequences = typed_malloc(int64_t, list.blocksAllocated);
+        memset(list.sequences, 0, list.blocksAllocated * sizeof(int64_t));
+        ok = (fread(list.blocks, sizeof(SegmentSkipEntry), list.blockCount, f) == (size_t)list.blockCount);
+        terms[term] = list;
+        postingCount += list.postingCount;
+    }
+    fclose(f);
+    if (!ok) {
+        snprintf(errorMessage, sizeof(errorMessage), "Corrupt long list directory: %s", directoryFileName);
+        log(LOG_ERROR, LOG_ID, errorMessage);
+        for (auto &entry : terms)
+            freeTermList(&entry.second);
+        terms.clear();
+        return false;
+    }
+    // ディレクトリ保存後に追記されたデータは参照されていないので切り捨てる
+    fileSize = header[1];
+    if (ftruncate(dataFile, fileSize) != 0)
+        log(LOG_ERROR, LOG_ID, "Unable to truncate long list file");
+    return true;
+}
+
+bool LongListStore::collectGarbage(ExtentSet *garbage, int compressionMethod) {
+    discardGarbageCollection();
+    if (dataFile < 0)
+        return false;
+    char *gcFileName = concatenateStrings(dataFileName, ".gc");
+    gcDataFile = open(gcFileName, O_RDWR | O_CREAT | O_TRUNC | O_LARGEFILE, DEFAULT_FILE_PERMISSIONS);
+    if (gcDataFile < 0) {
+        snprintf(errorMessage, sizeof(errorMessage), "Unable to create long list file: %s", gcFileName);
+        log(LOG_ERROR, LOG_ID, errorMessage);
+        free(gcFileName);
+        return false;
+    }
+    free(gcFileName);
+    gcFileSize = 0;
+    gcPostingCount = 0;
+
+    offset *buffer = typed_malloc(offset, SEGMENT_BLOCK_SIZE);
+    int rawAllocated = 4096;
+    byte *raw = typed_malloc(byte, rawAllocated);
+    bool ok = true;
+
+    // 語の追加と削除はappendPostingsでしか起こらないので、ロックを取らずに走査してよい
+    for (auto it = terms.begin(); (ok) && (it != terms.end()); ++it) {
+        LL_TermList &list = it->second;
+        LL_TermList newList;
+        newList.blocksAllocated = list.blockCount + 1;
+        newList.blocks = typed_malloc(SegmentSkipEntry, newList.blocksAllocated);
+        newList.sequences = typed_malloc(int64_t, newList.blocksAllocated);
+        newList.blockCount = 0;
+        newList.postingCount = 0;
+        int shift = getPostingShift(it->first.c_str());
+        for (int b = 0; (ok) && (b < list.blockCount); b++) {
+            SegmentSkipEntry block = list.blocks[b];
+            if (!garbage->intersects(block.firstPosting >> shift, block.lastPosting >> shift)) {
+                // 削除された範囲と重ならないブロックはそのまま複写する
+                if (block.byteLength > rawAllocated) {
+                    rawAllocated = block.byteLength * 2;
+                    typed_realloc(byte, raw, rawAllocated);
+                }
+                ok = (pread(dataFile, raw, block.byteLength, block.filePosition) == block.byteLength) &&
+                    (pwrite(gcDataFile, raw, block.byteLength, gcFileSize) == block.byteLength);
+            } else {
+                int n = decodeBlockLocked(&block, buffer);
+                n = garbage->removeContained(buffer, n, shift);
+                if (n == 0)
+                    continue;
+                int byteLength;
+                byte *compressed = compressList(buffer, n, &byteLength,
+                        getTermCompressionMethod(it->first.c_str(), compressionMethod));
+                ok = (pwrite(gcDataFile, compressed, byteLength, gcFileSize) == byteLength);
+                free(compressed);
+                block.firstPosting = buffer[0];
+                block.lastPosting = buffer[n - 1];
+                block.byteLength = byteLength;
+                block.postingCount = n;
+                computeBlockImpact(it->first.c_str(), buffer, n, &block);
+            }
+            block.filePosition = gcFileSize;
+            gcFileSize += block.byteLength;
+            // 固定済みのビューから見えるブロックが変わらないように、追記番号を引き継ぐ
+            newList.sequences[newList.blockCount] = list.sequences[b];
+            newList.blocks[newList.blockCount++] = block;
+            newList.postingCount += block.postingCount;
+        }
+        if (newList.blockCount > 0) {
+            gcTerms[it->first] = newList;
+            gcPostingCount += newList.postingCount;
+        } else
+            freeTermList(&newList);
+    }
+    free(raw);
+    free(buffer);
+    if ((ok) && (fdatasync(gcDataFile) != 0))
+        ok = false;
+    if (ok) {
+        // 新しいディレクトリも先に書いておき、commitGarbageCollectionではrenameだけを行う
+        char *gcDirectoryFileName = concatenateStrings(directoryFileName, ".gc");
+        ok = writeDirectory(gcDirectoryFileName, gcTerms, gcFileSize);
+        free(gcDirectoryFileName);
+    }
+    if (!ok) {
+        log(LOG_ERROR, LOG_ID, "Long list garbage collection failed");
+        discardGarbageCollection();
+    }
+    return ok;
+}
+
+bool LongListStore::commitGarbageCollection() {
+    if (gcDataFile < 0)
+        return false;
+    if (!recoverGarbageCollection(dataFileName, directoryFileName, true)) {
+        abandonGarbageCollection();
+        return false;
+    }
+    pthread_rwlock_wrlock(&lock);
+    close(dataFile);
+    dataFile = gcDataFile;
+    gcDataFile = -1;
+    for (auto &entry : terms)
+        freeTermList(&entry.second);
+    terms.swap(gcTerms);
+    gcTerms.clear();
+    fileSize = gcFileSize;
+    postingCount = gcPostingCount;
+    generation++;
+    pthread_rwlock_unlock(&lock);
+    return true;
+}
+
+bool LongListStore::recoverGarbageCollection(const char *dataFile, const char *directoryFile, bool commit) {
+    char *gcDataFileName = concatenateStrings(dataFile, ".gc");
+    char *gcDirectoryFileName = concatenateStrings(directoryFile, ".gc");
+    bool ok = true;
+    struct stat buf;
+    if (!commit) {
+        unlink(gcDataFileName);
+        unlink(gcDirectoryFileName);
+    } else if (stat(gcDirectoryFileName, &buf) == 0) {
+        // データファイルを先に置き換える。ディレクトリが残っていれば、どちらも済んでいない
+        if ((stat(gcDataFileName, &buf) == 0) && (rename(gcDataFileName, dataFile) != 0))
+            ok = false;
+        if ((ok) && (rename(gcDirectoryFileName, directoryFile) != 0))
+            ok = false;
+        if (!ok) {
+            snprintf(errorMessage, sizeof(errorMessage), "Unable to replace long list file: %s", dataFile);
+            log(LOG_ERROR, LOG_ID, errorMessage);
+        }
+    }
+    free(gcDataFileName);
+    free(gcDirectoryFileName);
+    return ok;
+}
+
+void LongListStore::abandonGarbageCollection() {
+    for (auto &entry : gcTerms)
+        freeTermList(&entry.second);
+    gcTerms.clear();
+    if (gcDataFile >= 0) {
+        close(gcDataFile);
+        gcDataFile = -1;
+    }
+}
+
+void LongListStore::discardGarbageCollection() {
+    bool created = (gcDataFile >= 0);
+    abandonGarbageCollection();
+    if (created)
+        recoverGarbageCollection(dataFileName, directoryFileName, false);
+}
+
+void LongListStore::freeTermList(LL_TermList *list) {
+    free(list->blocks);
+    free(list->sequences);
+}
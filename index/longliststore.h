@@ -0,0 +1,197 @@
+#ifndef __LONGLISTSTORE_H
+#define __LONGLISTSTORE_H
+
+/*
+LongListStoreは長いポスティングリストをその場で(in-place)更新するための格納領域。
+ポスティングが多い語は、セグメントのマージのたびに読み書きするとコストが大きいため、
+マージの対象から外してこのファイルの末尾にブロックを追記していく。
+語ごとのブロック一覧(スキップエントリ)はメモリ上に保持し、saveDirectoryで
+ディレクトリファイルに書き出す。
+
+セグメントはそれぞれ重ならないアドレス範囲を持つため、1回の追記で与えられる
+ポスティングは既存のブロックと範囲が重ならない。ブロックはfirstPostingの順に
+整列した位置に挿入されるので、追記の順序がポスティングの順序と異なってもよい。
+
+ガベージコレクションは新しいデータファイルとディレクトリファイル(.gc)を別に作成し、
+commitGarbageCollectionでrenameして既存のファイルと置き換える。削除された範囲と重ならない
+ブロックは展開せずにそのまま複写する。置き換えの途中でクラッシュした場合は、
+インデックスがログをもとにrecoverGarbageCollectionで置き換えを完了させる
+
+appendPostingsの呼び出しごとに通し番号(追記番号)を振り、ブロックごとに記録する。
+マージは入力のセグメントを外す前にポスティングをここへ追記するので、IndexViewは
+公開された時点の追記番号(maxSequence)までのブロックだけを読む。こうすることで、
+マージ前に固定したビューが入力のセグメントと追記されたブロックの両方から
+同じポスティングを読むことはない。追記番号はメモリ上にしかなく、
+ディレクトリファイルから読み込んだブロックは0になる
+*/
+
+#include <map>
+#include <string>
+#include <vector>
+#include <pthread.h>
+#include "index_type.h"
+#include "segment.h"
+
+class ExtentSet;
+class LevenshteinAutomaton;
+
+typedef struct {
+
+    // firstPostingの昇順に並んだブロックの一覧
+    SegmentSkipEntry *blocks;
+    int32_t blockCount, blocksAllocated;
+
+    // ブロックごとの追記番号(blocksと同じ順)
+    int64_t *sequences;
+
+    int64_t postingCount;
+
+} LL_TermList;
+
+class LongListStore {
+
+public:
+
+    static const char *LOG_ID;
+
+private:
+
+    char *dataFileName, *directoryFileName;
+
+    int dataFile;
+
+    int64_t fileSize;
+
+    int64_t postingCount;
+
+    std::map<std::string, LL_TermList> terms;
+
+    // 語の一覧とデータファイルを保護する。読み取りは並行して行える
+    pthread_rwlock_t lock;
+
+    // ガベージコレクションでデータファイルを置き換えるたびに増加する
+    int64_t generation;
+
+    // 最後にappendPostingsで振った追記番号
+    int64_t appendSequence;
+
+    // collectGarbageで作成中または作成済みの新しいデータファイルと、その内容
+    int gcDataFile;
+    int64_t gcFileSize, gcPostingCount;
+    std::map<std::string, LL_TermList> gcTerms;
+
+public:
+
+    /*
+    dataFileとdirectoryFileを使うLongListStoreを作成する。
+    createがfalseの場合は既存のディレクトリファイルを読み込む
+    */
+    LongListStore(const char *dataFile, const char *directoryFile, bool create);
+
+    ~LongListStore();
+
+    // termがこの格納領域で管理されているかどうか
+    bool contains(const char *term);
+
+    /*
+    ワイルドカードprefix*suffix(matchesWildcard)に一致する語をtermsに追加する。
+    語の一覧は辞書順なので、prefixで始まる範囲だけを調べる。
+    一致する語がmaxTermsを超えた場合はfalseを返す
+    */
+    bool expandWildcard(const char *prefix, const char *suffix, int64_t maxTerms, std::vector<std::string> *terms);
+
+    // automatonが受理する語(isExpandableTerm)をtermsに追加する。語は少ないのですべて調べる
+    bool expandFuzzy(LevenshteinAutomaton *automaton, int64_t maxTerms, std::vector<std::string> *terms);
+
+    /*
+    termのポスティングを追記する。ポスティングは昇順で、既存のブロックと
+    範囲が重なってはいけない。失敗した場合はfalseを返す
+    */
+    bool appendPostings(const char *term, const offset *postings, int64_t count, int compressionMethod);
+
+    /*
+    termのブロックのうち追記番号がmaxSequence以下のものの一覧のコピーを返し、
+    generationにデータファイルの世代を格納する。
+    メモリは呼び出し元で開放しなければいけない。termが存在しない場合はnullptrを返す
+    */
+    SegmentSkipEntry *getSkipEntries(const char *term, int *blockCount, int64_t *generation,
+            int64_t maxSequence = INT64_MAX);
+
+    /*
+    ブロックを展開してbufferに格納し、ポスティング数を返す。
+    bufferには少なくともSEGMENT_BLOCK_SIZE個の要素が必要。
+    ブロック一覧を取得した後にガベージコレクションでデータファイルが置き換えられていた
+    (generationが異なる)場合は-1を返す。呼び出し元はブロック一覧を取得し直すこと
+    */
+    int decodeBlock(const SegmentSkipEntry *block, offset *buffer, int64_t generation);
+
+    // termの追記番号がmaxSequence以下のブロックのポスティングを返す。termが存在しない場合はnullptr
+    offset *getPostings(const char *term, int64_t *count, int64_t maxSequence = INT64_MAX);
+
+    // 最後に振った追記番号。この値までのブロックを読めば、これまでの追記がすべて見える
+    int64_t getAppendSequence();
+
+    int64_t getTermCount();
+
+    int64_t getPostingCount();
+
+    int64_t getFileSize();
+
+    // データファイルを同期し、ディレクトリファイルを書き出す
+    bool saveDirectory();
+
+    /*
+    データファイルのcommittedSizeより後ろに追記したブロックを取り除き、ファイルを切り詰める。
+    追記はデータファイルの末尾に行われるので、失敗したマージの追記や、ディレクトリには
+    保存したがインデックスファイルに記録される前に止まったマージの追記を取り消せる。
+    取り除くブロックはどのビューからも読まれていてはいけない。appendPostingsと並行して実行してはいけない
+    */
+    void discardAppends(int64_t committedSize);
+
+    /*
+    garbageに含まれるポスティングを取り除いた新しいデータファイルを作成する。
+    既存のデータは変更しないので読み取りと並行して実行してよいが、
+    appendPostingsと並行して実行してはいけない。
+    新しいデータはcommitGarbageCollectionを呼び出すまで使われない
+    */
+    bool collectGarbage(ExtentSet *garbage, int compressionMethod);
+
+    /*
+    collectGarbageで作成したデータファイルとディレクトリに切り替える。
+    呼び出し中に他のスレッドがブロックを読み取っていてはいけない。
+    失敗した場合は古いデータのまま.gcファイルを残し、次回の起動時にrecoverGarbageCollectionで完了させる
+    */
+    bool commitGarbageCollection();
+
+    /*
+    collectGarbageで作成したデータを使わないことにするが、.gcファイルは残す。
+    置き換えがログに記録されたかどうか分からない場合に使い、
+    次回の起動時にrecoverGarbageCollectionで完了または破棄する
+    */
+    void abandonGarbageCollection();
+
+    /*
+    commitGarbageCollectionの途中で止まった置き換えを、LongListStoreを作る前に処理する。
+    commitがtrueの場合は残っている.gcファイルで置き換えを完了させ、falseの場合は破棄する
+    */
+    static bool recoverGarbageCollection(const char *dataFile, const char *directoryFile, bool commit);
+
+private:
+
+    // termsの内容をディレクトリファイルfileNameに書き出す(一時ファイルに書いてからrename)
+    static bool writeDirectory(const char *fileName, const std::map<std::string, LL_TermList> &terms,
+            int64_t fileSize);
+
+    bool loadDirectory();
+
+    // ロックを保持した状態でdecodeBlockの処理を行う
+    int decodeBlockLocked(const SegmentSkipEntry *block, offset *buffer);
+
+    // collectGarbageで作成したデータを破棄する
+    void discardGarbageCollection();
+
+    // 語のブロック一覧を開放する
+    static void freeTermList(LL_TermList *list);
+};
+
+#endif
@@ -0,0 +1,254 @@
+#include <cassert>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include "resultcache.h"
+#include "extentset.h"
+#include "index.h"
+#include "indexview.h"
+#include "../utils/all.h"
+
+const char *ResultCache::LOG_ID = "ResultCache";
+
+// エントリ1つあたりの管理用のメモリ(ハッシュ表とLRUリスト)の概算
+static const int64_t ENTRY_OVERHEAD = 128;
+
+ResultCache::ResultCache(Index *index, int64_t capacity, int shardCount) {
+    this->index = index;
+    if (shardCount < 1)
+        shardCount = 1;
+    this->shardCount = shardCount;
+    shardCapacity = capacity / shardCount;
+    shards = new RC_Shard[shardCount];
+    for (int i = 0; i < shardCount; i++) {
+        pthread_mutex_init(&shards[i].lock, nullptr);
+        shards[i].first = shards[i].last = nullptr;
+        shards[i].memoryUsed = 0;
+    }
+    hitCount = missCount = invalidationCount = 0;
+}
+
+ResultCache::~ResultCache() {
+    clear();
+    for (int i = 0; i < shardCount; i++)
+        pthread_mutex_destroy(&shards[i].lock);
+    delete[] shards;
+}
+
+void ResultCache::normalizeQuery(const char *query, std::string *result) {
+    result->clear();
+    bool space = false;
+    for (const char *p = query; *p != 0; p++) {
+        char c = *p;
+        if ((c > 0) && (c <= ' ')) {
+            space = true;
+            continue;
+        }
+        if ((space) && (!result->empty()))
+            result->push_back(' ');
+        space = false;
+        result->push_back((c >= 'A') && (c <= 'Z') ? c + ('a' - 'A') : c);
+    }
+}
+
+// キーは問い合わせとUIDを、問い合わせには現れない'\\0'でつないだもの
+static std::string makeKey(const char *query, uid_t uid) {
+    char suffix[32];
+    snprintf(suffix, sizeof(suffix), "%u", (unsigned int)uid);
+    std::string key(query);
+    key.push_back(0);
+    return key + suffix;
+}
+
+RC_Shard *ResultCache::getShard(const std::string &key) {
+    return &shards[std::hash<std::string>()(key) % shardCount];
+}
+
+void ResultCache::unlink(RC_Shard *shard, RC_Entry *entry) {
+    if (entry->previous != nullptr)
+        entry->previous->next = entry->next;
+    else
+        shard->first = entry->next;
+    if (entry->next != nullptr)
+        entry->next->previous = entry->previous;
+    else
+        shard->last = entry->previous;
+}
+
+void ResultCache::pushFront(RC_Shard *shard, RC_Entry *entry) {
+    entry->previous = nullptr;
+    entry->next = shard->first;
+    if (shard->first != nullptr)
+        shard->first->previous = entry;
+    shard->first = entry;
+    if (shard->last == nullptr)
+        shard->last = entry;
+}
+
+void ResultCache::removeEntry(RC_Shard *shard, RC_Entry *entry) {
+    unlink(shard, entry);
+    shard->entries.erase(entry->key);
+    shard->memoryUsed -= entry->size;
+    if (entry->extents != nullptr)
+        entry->extents->release();
+    delete entry;
+}
+
+bool ResultCache::isStillValid(unsigned int generation, ExtentSet *extents,
+        const std::vector<std::string> &dependencies, bool volatileResults) {
+    std::vector<IndexChange> changes;
+    if (!index->getChangesSince(generation, &changes))
+        return false;
+    if (changes.empty())
+        return true;
+    if (volatileResults)
+        return false;
+    // 追加されたポスティングは記録の後に取得したビューから必ず見える
+    IndexView *view = nullptr;
+    bool valid = true;
+    for (size_t i = 0; (valid) && (i < changes.size()); i++) {
+        if (changes[i].deletion) {
+            valid = (extents == nullptr) || (!extents->intersects(changes[i].start, changes[i].end));
+            continue;
+        }
+        if ((view == nullptr) && (!dependencies.empty())) {
+            view = index->acquireView();
+            if (view == nullptr)
+                return false;
+        }
+        for (size_t d = 0; (valid) && (d < dependencies.size()); d++)
+            valid = !view->hasPostingsInRange(dependencies[d].c_str(), changes[i].start, changes[i].end);
+    }
+    if (view != nullptr)
+        view->release();
+    return valid;
+}
+
+bool ResultCache::lookup(const char *query, uid_t uid, std::string *value) {
+    std::string key = makeKey(query, uid);
+    RC_Shard *shard = getShard(key);
+    unsigned int currentGeneration = index->getUpdateGeneration();
+
+    pthread_mutex_lock(&shard->lock);
+    auto it = shard->entries.find(key);
+    if (it == shard->entries.end()) {
+        pthread_mutex_unlock(&shard->lock);
+        missCount++;
+        return false;
+    }
+    RC_Entry *entry = it->second;
+    if (entry->generation != currentGeneration) {
+        // 検証はインデックスを読むので、シャードのロックの外で行う
+        unsigned int generation = entry->generation;
+        ExtentSet *extents = entry->extents;
+        if (extents != nullptr)
+            extents->addReference();
+        std::vector<std::string> dependencies = entry->dependencies;
+        bool volatileResults = entry->volatileResults;
+        pthread_mutex_unlock(&shard->lock);
+
+        bool valid = isStillValid(generation, extents, dependencies, volatileResults);
+        if (extents != nullptr)
+            extents->release();
+
+        pthread_mutex_lock(&shard->lock);
+        it = shard->entries.find(key);
+        if ((it == shard->entries.end()) || (it->second->generation != generation)) {
+            // 検証中に置き換えられたエントリは、次の参照で改めて調べる
+            pthread_mutex_unlock(&shard->lock);
+            missCount++;
+            return false;
+        }
+        entry = it->second;
+        if (!valid) {
+            removeEntry(shard, entry);
+            pthread_mutex_unlock(&shard->lock);
+            invalidationCount++;
+            missCount++;
+            return false;
+        }
+        entry->generation = currentGeneration;
+    }
+    *value = entry->value;
+    unlink(shard, entry);
+    pushFront(shard, entry);
+    pthread_mutex_unlock(&shard->lock);
+    hitCount++;
+    return true;
+}
+
+void ResultCache::insert(const char *query, uid_t uid, unsigned int generation, const std::string &value,
+        ExtentSet *extents, const std::vector<std::string> &dependencies, bool volatileResults) {
+    std::string key = makeKey(query, uid);
+    int64_t size = ENTRY_OVERHEAD + 2 * key.size() + value.size();
+    if (extents != nullptr)
+        size += extents->getCount() * 2 * sizeof(offset);
+    for (auto &dependency : dependencies)
+        size += dependency.size() + sizeof(std::string);
+    if (size > shardCapacity)
+        return;
+
+    RC_Entry *entry = new RC_Entry;
+    entry->key = key;
+    entry->generation = generation;
+    entry->value = value;
+    entry->extents = extents;
+    if (extents != nullptr)
+        extents->addReference();
+    entry->dependencies = dependencies;
+    entry->volatileResults = volatileResults;
+    entry->size = size;
+
+    RC_Shard *shard = getShard(key);
+    pthread_mutex_lock(&shard->lock);
+    auto it = shard->entries.find(key);
+    if (it != shard->entries.end())
+        removeEntry(shard, it->second);
+    while (shard->memoryUsed + size > shardCapacity)
+        removeEntry(shard, shard->last);
+    shard->entries[key] = entry;
+    pushFront(shard, entry);
+    shard->memoryUsed += size;
+    pthread_mutex_unlock(&shard->lock);
+}
+
+void ResultCache::clear() {
+    for (int i = 0; i < shardCount; i++) {
+        pthread_mutex_lock(&shards[i].lock);
+        while (shards[i].first != nullptr)
+            removeEntry(&shards[i], shards[i].first);
+        pthread_mutex_unlock(&shards[i].lock);
+    }
+}
+
+int64_t ResultCache::getEntryCount() {
+    int64_t result = 0;
+    for (int i = 0; i < shardCount; i++) {
+        pthread_mutex_lock(&shards[i].lock);
+        result += shards[i].entries.size();
+        pthread_mutex_unlock(&shards[i].lock);
+    }
+    return result;
+}
+
+int64_t ResultCache::getMemoryUsed() {
+    int64_t result = 0;
+    for (int i = 0; i < shardCount; i++) {
+        pthread_mutex_lock(&shards[i].lock);
+        result += shards[i].memoryUsed;
+        pthread_mutex_unlock(&shards[i].lock);
+    }
+    return result;
+}
+
+int64_t ResultCache::getHitCount() {
+    return hitCount;
+}
+
+int64_t ResultCache::getMissCount() {
+    return missCount;
+}
+
+int64_t ResultCache::getInvalidationCount() {
+    return invalidationCount;
+}
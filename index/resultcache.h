@@ -0,0 +1,150 @@
+#ifndef __RESULTCACHE_H
+#define __RESULTCACHE_H
+
+/*
+ResultCacheは問い合わせの結果を、正規化した問い合わせ文字列と要求したユーザーのUIDを
+キーとして保持する。キーのハッシュ値で選ばれるシャードごとにロックとLRUリストを持ち、
+シャードごとのメモリ使用量がcapacity / shardCountを超えないように古いエントリを捨てる。
+
+各エントリには、評価を始めた時点のインデックスの世代(Index::getUpdateGeneration)を付ける。
+インデックスが更新されてもエントリはすぐには捨てず、次に参照された時に、その世代以降の
+変更(Index::getChangesSince)がエントリに影響するかどうかを調べる:
+
+    削除    削除された範囲が結果の区間と重なる場合に無効
+    追加    追加された範囲に、エントリが依存する語(dependencies)のポスティングがある場合に無効
+
+追加の判定はIndexViewの指数探索1回で済むので、問い合わせを評価し直すより十分安い。
+影響がなければエントリの世代を現在の世代に進める。統計値に依存する結果(BM25のスコアなど)は
+volatileResultsを指定し、どの変更でも無効にする。変更の記録が古いエントリの世代より前まで
+残っていない場合も無効にする
+*/
+
+#include <atomic>
+#include <pthread.h>
+#include <sys/types.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "index_type.h"
+
+class ExtentSet;
+class Index;
+
+typedef struct RC_Entry {
+
+    std::string key;
+
+    // 結果を計算した(または最後に検証した)時点のインデックスの世代
+    unsigned int generation;
+
+    // 結果(呼び出し元が直列化したもの)
+    std::string value;
+
+    // 結果の区間。削除された範囲と重なればエントリは無効になる
+    ExtentSet *extents;
+
+    // 追加されたポスティングがこれらの語に含まれればエントリは無効になる
+    std::vector<std::string> dependencies;
+
+    // trueの場合、どの変更でもエントリは無効になる
+    bool volatileResults;
+
+    // エントリが使うメモリの概算(バイト)
+    int64_t size;
+
+    // LRUリスト。先頭が最近使われたもの
+    struct RC_Entry *previous, *next;
+
+} RC_Entry;
+
+typedef struct {
+
+    pthread_mutex_t lock;
+
+    std::unordered_map<std::string, RC_Entry*> entries;
+
+    RC_Entry *first, *last;
+
+    int64_t memoryUsed;
+
+} RC_Shard;
+
+class ResultCache {
+
+public:
+
+    static const char *LOG_ID;
+
+private:
+
+    Index *index;
+
+    RC_Shard *shards;
+    int shardCount;
+
+    // シャードごとのメモリの上限
+    int64_t shardCapacity;
+
+    // 統計。シャードのロックの外で更新される
+    std::atomic<int64_t> hitCount, missCount, invalidationCount;
+
+public:
+
+    /*
+    indexの問い合わせ結果を最大capacityバイトまで保持するキャッシュを作る。
+    shardCountは同時にロックを取り合うスレッドの数より十分大きくする
+    */
+    ResultCache(Index *index, int64_t capacity, int shardCount);
+
+    ~ResultCache();
+
+    /*
+    queryの結果を探し、有効なエントリがあればvalueに格納してtrueを返す。
+    queryはnormalizeQueryなどで正規化しておくこと
+    */
+    bool lookup(const char *query, uid_t uid, std::string *value);
+
+    /*
+    queryの結果valueを追加する。generationには評価を始める前に取得した世代を与える。
+    extentsは結果の区間(参照はキャッシュが保持する。nullptrでもよい)
+    */
+    void insert(const char *query, uid_t uid, unsigned int generation, const std::string &value,
+            ExtentSet *extents, const std::vector<std::string> &dependencies, bool volatileResults);
+
+    // すべてのエントリを捨てる
+    void clear();
+
+    int64_t getEntryCount();
+
+    int64_t getMemoryUsed();
+
+    int64_t getHitCount();
+
+    int64_t getMissCount();
+
+    // 検証の結果、無効になったエントリの数
+    int64_t getInvalidationCount();
+
+    /*
+    空白の並びを1つの空白にし、前後の空白を取り除き、ASCIIの大文字を小文字にする。
+    引用符の中の空白も同じように扱う(トークナイザは空白の数を区別しない)
+    */
+    static void normalizeQuery(const char *query, std::string *result);
+
+private:
+
+    RC_Shard *getShard(const std::string &key);
+
+    // entryがgeneration以降の変更の影響を受けないかどうか調べる
+    bool isStillValid(unsigned int generation, ExtentSet *extents,
+            const std::vector<std::string> &dependencies, bool volatileResults);
+
+    // シャードのロックを保持して呼び出すこと
+    void unlink(RC_Shard *shard, RC_Entry *entry);
+
+    void pushFront(RC_Shard *shard, RC_Entry *entry);
+
+    void removeEntry(RC_Shard *shard, RC_Entry *entry);
+};
+
+#endif
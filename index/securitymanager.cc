@@ -0,0 +1,194 @@
+#include <grp.h>
+#include <pwd.h>
+#include <cassert>
+#include <cstring>
+#include <sys/stat.h>
+#include "securitymanager.h"
+#include "extentset.h"
+#include "index.h"
+#include "../extentlist/extentlist.h"
+#include "../filemanager/filemanager.h"
+#include "../utils/all.h"
+
+const char *SecurityManager::LOG_ID = "SecurityManager";
+
+SecurityManager::SecurityManager(Index *index, FileManager *fileManager) {
+    this->index = index;
+    this->fileManager = fileManager;
+    useCounter = 0;
+    pthread_mutex_init(&lock, nullptr);
+}
+
+SecurityManager::~SecurityManager() {
+    for (auto &entry : users)
+        if (entry.second.visible != nullptr)
+            entry.second.visible->release();
+    users.clear();
+    pthread_mutex_destroy(&lock);
+}
+
+bool SecurityManager::isRestricted(uid_t userID) {
+    if (!index->APPLY_SECURITY_RESTRICTIONS)
+        return false;
+    return (userID != Index::SUPERUSER) && (userID != Index::GOD) && (userID != index->indexOwner);
+}
+
+bool SecurityManager::hasPermission(uid_t userID, const std::vector<gid_t> &groups,
+        uid_t owner, gid_t group, mode_t permissions, mode_t mask) {
+    if (userID == owner)
+        return (permissions & (mask << 6)) != 0;
+    for (gid_t g : groups)
+        if (g == group)
+            return (permissions & (mask << 3)) != 0;
+    return (permissions & mask) != 0;
+}
+
+void SecurityManager::getGroups(uid_t userID, std::vector<gid_t> *groups) {
+    groups->clear();
+    struct passwd entry, *result = nullptr;
+    char buffer[4096];
+    if ((getpwuid_r(userID, &entry, buffer, sizeof(buffer), &result) != 0) || (result == nullptr))
+        return;
+    int count = 32;
+    groups->resize(count);
+    if (getgrouplist(result->pw_name, result->pw_gid, groups->data(), &count) < 0) {
+        groups->resize(count);
+        if (getgrouplist(result->pw_name, result->pw_gid, groups->data(), &count) < 0)
+            count = 0;
+    }
+    groups->resize(count);
+}
+
+bool SecurityManager::isSearchable(uid_t userID, const std::vector<gid_t> &groups, int32_t directory,
+        std::vector<signed char> *cache) {
+    // ルートまでたどり、途中のディレクトリの結果もcacheに記録する
+    int32_t path[256];
+    int pathLength = 0;
+    bool result = true;
+    int32_t d = directory;
+    while (true) {
+        if ((cache != nullptr) && ((*cache)[d] >= 0)) {
+            result = ((*cache)[d] == 1);
+            break;
+        }
+        IndexDirectory *entry = &fileManager->directories[d];
+        if (!hasPermission(userID, groups, entry->owner, entry->group, entry->permissions, S_IXOTH)) {
+            result = false;
+            if (pathLength < 256)
+                path[pathLength++] = d;
+            break;
+        }
+        if (pathLength < 256)
+            path[pathLength++] = d;
+        if (d == 0)
+            break;
+        d = entry->parent;
+    }
+    if (cache != nullptr) {
+        /*
+        結果がfalseの場合、拒否したディレクトリより下のディレクトリもすべてfalse。
+        256段より深い場合は記録しきれなかった部分を次回もう一度たどる
+        */
+        for (int i = 0; i < pathLength; i++)
+            (*cache)[path[i]] = (result ? 1 : 0);
+    }
+    return result;
+}
+
+ExtentSet *SecurityManager::computeVisibleExtents(uid_t userID, SM_User *user) {
+    std::vector<signed char> searchable(fileManager->directorySlotsAllocated, -1);
+    ExtentSet *result = new ExtentSet();
+    // INodeはアドレス空間の昇順に並ぶので、区間は常に末尾に追加される
+    for (int32_t i = 0; i <= fileManager->biggestINodeID; i++) {
+        IndexedINode *iNode = &fileManager->iNodes[i];
+        if ((iNode->file < 0) || (iNode->tokenCount == 0))
+            continue;
+        if (!hasPermission(userID, user->groups, iNode->owner, iNode->group, iNode->permissions, S_IROTH))
+            continue;
+        if (!isSearchable(userID, user->groups, fileManager->files[iNode->file].parent, &searchable))
+            continue;
+        result->add(iNode->startOffset, iNode->startOffset + iNode->tokenCount - 1);
+    }
+    user->sequence = fileManager->changeSequence;
+    return result;
+}
+
+bool SecurityManager::updateVisibleExtents(uid_t userID, SM_User *user) {
+    if (user->sequence == fileManager->changeSequence)
+        return true;
+    if (user->sequence < fileManager->changeLogStart)
+        return false;
+    std::vector<FM_Change> &changes = fileManager->changeLog;
+    size_t first = changes.size();
+    while ((first > 0) && (changes[first - 1].sequence > user->sequence))
+        first--;
+    for (size_t i = first; i < changes.size(); i++)
+        if (changes[i].iNode < 0)
+            return false;
+
+    ExtentSet *updated = user->visible->copy();
+    for (size_t i = first; i < changes.size(); i++) {
+        IndexedINode *iNode = &fileManager->iNodes[changes[i].iNode];
+        if (iNode->tokenCount == 0)
+            continue;
+        offset start = iNode->startOffset, end = iNode->startOffset + iNode->tokenCount - 1;
+        updated->remove(start, end);
+        if ((iNode->file >= 0) &&
+                (hasPermission(userID, user->groups, iNode->owner, iNode->group, iNode->permissions, S_IROTH)) &&
+                (isSearchable(userID, user->groups, fileManager->files[iNode->file].parent, nullptr)))
+            updated->add(start, end);
+    }
+    user->visible->release();
+    user->visible = updated;
+    user->sequence = fileManager->changeSequence;
+    return true;
+}
+
+ExtentSet *SecurityManager::getVisibleExtents(uid_t userID) {
+    if (!isRestricted(userID))
+        return nullptr;
+    pthread_mutex_lock(&lock);
+    auto it = users.find(userID);
+    if (it == users.end()) {
+        if (users.size() >= (size_t)MAX_CACHED_USERS) {
+            // 最も長く使われていないユーザーを捨てる
+            auto oldest = users.begin();
+            for (auto u = users.begin(); u != users.end(); ++u)
+                if (u->second.lastUsed < oldest->second.lastUsed)
+                    oldest = u;
+            if (oldest->second.visible != nullptr)
+                oldest->second.visible->release();
+            users.erase(oldest);
+        }
+        SM_User user;
+        user.visible = nullptr;
+        user.sequence = 0;
+        getGroups(userID, &user.groups);
+        it = users.emplace(userID, user).first;
+    }
+    SM_User *user = &it->second;
+    user->lastUsed = ++useCounter;
+
+    pthread_mutex_lock(&fileManager->lock);
+    if ((user->visible == nullptr) || (!updateVisibleExtents(userID, user))) {
+        ExtentSet *visible = computeVisibleExtents(userID, user);
+        if (user->visible != nullptr)
+            user->visible->release();
+        user->visible = visible;
+    }
+    pthread_mutex_unlock(&fileManager->lock);
+
+    ExtentSet *result = user->visible;
+    result->addReference();
+    pthread_mutex_unlock(&lock);
+    return result;
+}
+
+ExtentList *SecurityManager::getVisibleExtentList(uid_t userID) {
+    ExtentSet *visible = getVisibleExtents(userID);
+    if (visible == nullptr)
+        return nullptr;
+    ExtentList *result = new ExtentList_Set(visible);
+    visible->release();
+    return result;
+}
@@ -0,0 +1,116 @@
+#ifndef __SECURITYMANAGER_H
+#define __SECURITYMANAGER_H
+
+/*
+SecurityManagerはAPPLY_SECURITY_RESTRICTIONSが有効な場合に、ユーザーごとに
+読み取りを許されたファイルが占めるアドレス範囲(見える範囲)を求める。ファイルが見えるのは、
+ユーザーがファイルの読み取り権限を持ち、ルートから親ディレクトリまでのすべての
+ディレクトリに実行(検索)権限を持つ場合。インデックスの所有者、スーパーユーザー、GODには
+制限がない。
+
+問い合わせは結果ごとにパーミッションを調べる代わりに、見える範囲をGCLの演算対象
+(ExtentList_Set)として受け取り、包含演算(<)で結果を絞り込む。
+
+見える範囲はユーザーごとにキャッシュされ、FileManagerの変更の記録を使って差分で
+更新される。ファイルの追加、削除、属性の変更はそのファイルの範囲だけを更新し、
+ディレクトリの属性の変更(サブツリー全体に影響する)と、記録が捨てられた場合には
+作り直す。返されるExtentSetは変更されないので、問い合わせの実行中に更新されても
+影響を受けない
+*/
+
+#include <pthread.h>
+#include <sys/types.h>
+#include <unordered_map>
+#include <vector>
+#include "index_type.h"
+
+class ExtentList;
+class ExtentSet;
+class FileManager;
+class Index;
+
+typedef struct {
+
+    // 見える範囲。更新する場合は複製を変更して置き換える
+    ExtentSet *visible;
+
+    // visibleに反映したFileManagerの変更の通し番号
+    int64_t sequence;
+
+    // ユーザーの属するグループ
+    std::vector<gid_t> groups;
+
+    // 最後に使われた時刻(useCounterの値)。キャッシュから捨てるユーザーを選ぶために使う
+    int64_t lastUsed;
+
+} SM_User;
+
+class SecurityManager {
+
+public:
+
+    static const char *LOG_ID;
+
+    // 見える範囲をキャッシュするユーザーの最大数
+    static const int MAX_CACHED_USERS = 64;
+
+private:
+
+    Index *index;
+
+    FileManager *fileManager;
+
+    std::unordered_map<uid_t, SM_User> users;
+
+    int64_t useCounter;
+
+    pthread_mutex_t lock;
+
+public:
+
+    SecurityManager(Index *index, FileManager *fileManager);
+
+    ~SecurityManager();
+
+    // userIDの問い合わせの結果を絞り込む必要があるかどうか
+    bool isRestricted(uid_t userID);
+
+    /*
+    userIDから見えるアドレス範囲を返す。制限がない場合はnullptrを返す。
+    参照は呼び出し元が持つので、使い終わったらreleaseを呼び出すこと
+    */
+    ExtentSet *getVisibleExtents(uid_t userID);
+
+    /*
+    userIDから見えるアドレス範囲をGCLの演算対象として返す。制限がない場合はnullptrを返す。
+    インスタンスは呼び出し元でdeleteしなければいけない
+    */
+    ExtentList *getVisibleExtentList(uid_t userID);
+
+    /*
+    userIDとgroupsのユーザーが、所有者owner、グループgroup、パーミッションpermissionsの
+    オブジェクトに対してmask(S_IROTHまたはS_IXOTH)の権限を持つかどうか
+    */
+    static bool hasPermission(uid_t userID, const std::vector<gid_t> &groups,
+            uid_t owner, gid_t group, mode_t permissions, mode_t mask);
+
+private:
+
+    // userIDの属するグループを求める
+    static void getGroups(uid_t userID, std::vector<gid_t> *groups);
+
+    // userの見える範囲を作り直す。fileManagerのlockを保持して呼び出すこと
+    ExtentSet *computeVisibleExtents(uid_t userID, SM_User *user);
+
+    /*
+    userの見える範囲をsequence以降の変更で更新する。作り直す必要がある場合はfalseを返す。
+    fileManagerのlockを保持して呼び出すこと
+    */
+    bool updateVisibleExtents(uid_t userID, SM_User *user);
+
+    // ディレクトリdirectoryとその祖先のすべてに実行権限があるかどうか
+    bool isSearchable(uid_t userID, const std::vector<gid_t> &groups, int32_t directory,
+            std::vector<signed char> *cache);
+};
+
+#endif
@@ -0,0 +1,393 @@
+#include <cassert>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "segment.h"
+#include "doclevel.h"
+#include "updatelist.h"
+#include "../utils/all.h"
+
+const char *SegmentWriter::LOG_ID = "SegmentWriter";
+const char *Segment::LOG_ID = "Segment";
+
+static char errorMessage[256];
+
+// 各領域を8バイト境界に揃えるために使う
+static const char PADDING[8] = { 0, 0, 0, 0, 0, 0, 0, 0 };
+
+SegmentWriter::SegmentWriter(const char *fileName, int compressionMethod) {
+    this->fileName = duplicateString(fileName);
+    this->compressionMethod = compressionMethod;
+    error = false;
+    filePosition = 0;
+    memset(&footer, 0, sizeof(footer));
+    footer.magic = SEGMENT_MAGIC;
+    footer.version = SEGMENT_VERSION;
+    footer.compressionMethod = compressionMethod;
+    footer.firstPosting = MAX_OFFSET;
+    footer.lastPosting = -1;
+
+    skipEntriesAllocated = 1024;
+    skipEntries = typed_malloc(SegmentSkipEntry, skipEntriesAllocated);
+    termEntriesAllocated = 1024;
+    termEntries = typed_malloc(SegmentTermEntry, termEntriesAllocated);
+
+    int fd = ::open(fileName, O_WRONLY | O_CREAT | O_TRUNC | O_LARGEFILE, DEFAULT_FILE_PERMISSIONS);
+    file = (fd < 0 ? nullptr : fdopen(fd, "w"));
+    if (file == nullptr) {
+        snprintf(errorMessage, sizeof(errorMessage), "Unable to create segment: %s", fileName);
+        log(LOG_ERROR, LOG_ID, errorMessage);
+        error = true;
+    }
+}
+
+SegmentWriter::~SegmentWriter() {
+    if (file != nullptr) {
+        fclose(file);
+        // finishされなかったセグメントは不完全なので削除する
+        unlink(fileName);
+    }
+    free(fileName);
+    free(skipEntries);
+    free(termEntries);
+}
+
+bool SegmentWriter::write(const void *data, int64_t size) {
+    if (error)
+        return false;
+    if (fwrite(data, 1, size, file) != (size_t)size) {
+        snprintf(errorMessage, sizeof(errorMessage), "Unable to write segment data: %s", fileName);
+        log(LOG_ERROR, LOG_ID, errorMessage);
+        error = true;
+        return false;
+    }
+    filePosition += size;
+    return true;
+}
+
+bool SegmentWriter::addTerm(const char *term, const offset *postings, int64_t count) {
+    if ((error) || (count <= 0))
+        return !error;
+    // 辞書順になっていない語と長すぎる語はここで拒否される
+    if (!dictionary.addTerm(term))
+        return false;
+    std::string reversed(term);
+    std::reverse(reversed.begin(), reversed.end());
+    reversedTerms.push_back(reversed);
+
+    if (footer.termCount >= termEntriesAllocated) {
+        termEntriesAllocated *= 2;
+        typed_realloc(SegmentTermEntry, termEntries, termEntriesAllocated);
+    }
+    int blockCount = (count + SEGMENT_BLOCK_SIZE - 1) / SEGMENT_BLOCK_SIZE;
+    while (footer.skipEntryCount + blockCount > skipEntriesAllocated) {
+        skipEntriesAllocated *= 2;
+        typed_realloc(SegmentSkipEntry, skipEntries, skipEntriesAllocated);
+    }
+
+    SegmentTermEntry *entry = &termEntries[footer.termCount];
+    entry->firstSkipEntry = footer.skipEntryCount;
+    entry->postingCount = count;
+    entry->blockCount = blockCount;
+    entry->unused = 0;
+
+    for (int64_t start = 0; start < count; start += SEGMENT_BLOCK_SIZE) {
+        int n = (count - start < SEGMENT_BLOCK_SIZE ? count - start : SEGMENT_BLOCK_SIZE);
+        int byteLength;
+        byte *compressed = compressList(&postings[start], n, &byteLength,
+                getTermCompressionMethod(term, compressionMethod));
+        SegmentSkipEntry *skip = &skipEntries[footer.skipEntryCount++];
+        skip->firstPosting = postings[start];
+        skip->lastPosting = postings[start + n - 1];
+        skip->filePosition = filePosition;
+        skip->byteLength = byteLength;
+        skip->postingCount = n;
+        computeBlockImpact(term, &postings[start], n, skip);
+        bool ok = write(compressed, byteLength);
+        free(compressed);
+        if (!ok)
+            return false;
+    }
+
+    // 文書単位の語は文書の開始位置で範囲を求める
+    int shift = getPostingShift(term);
+    if ((postings[0] >> shift) < footer.firstPosting)
+        footer.firstPosting = postings[0] >> shift;
+    if ((postings[count - 1] >> shift) > footer.lastPosting)
+        footer.lastPosting = postings[count - 1] >> shift;
+    footer.termCount++;
+    footer.postingCount += count;
+    return true;
+}
+
+bool SegmentWriter::finish() {
+    if (error)
+        return false;
+    if (filePosition % 8 != 0)
+        write(PADDING, 8 - filePosition % 8);
+    footer.skipPosition = filePosition;
+    write(skipEntries, footer.skipEntryCount * sizeof(SegmentSkipEntry));
+    footer.dictionaryPosition = filePosition;
+    write(termEntries, footer.termCount * sizeof(SegmentTermEntry));
+
+    std::sort(reversedTerms.begin(), reversedTerms.end());
+    TermDictionaryBuilder reverseDictionary;
+    for (const std::string &reversed : reversedTerms)
+        reverseDictionary.addTerm(reversed.c_str());
+    footer.bucketPosition = filePosition;
+    write(dictionary.getBucketOffsets(), dictionary.getBucketCount() * sizeof(int64_t));
+    footer.reverseBucketPosition = filePosition;
+    write(reverseDictionary.getBucketOffsets(), reverseDictionary.getBucketCount() * sizeof(int64_t));
+    footer.stringPosition = filePosition;
+    footer.stringAreaSize = dictionary.getDataSize();
+    write(dictionary.getData(), footer.stringAreaSize);
+    footer.reverseStringPosition = filePosition;
+    footer.reverseStringAreaSize = reverseDictionary.getDataSize();
+    write(reverseDictionary.getData(), footer.reverseStringAreaSize);
+    if (filePosition % 8 != 0)
+        write(PADDING, 8 - filePosition % 8);
+    write(&footer, sizeof(footer));
+    if (error)
+        return false;
+    if ((fflush(file) != 0) || (fsync(fileno(file)) != 0)) {
+        snprintf(errorMessage, sizeof(errorMessage), "Unable to sync segment: %s", fileName);
+        log(LOG_ERROR, LOG_ID, errorMessage);
+        error = true;
+        return false;
+    }
+    fclose(file);
+    file = nullptr;
+    return true;
+}
+
+
+Segment::Segment() {
+    fileName = nullptr;
+    fd = -1;
+    mapping = nullptr;
+    fileSize = 0;
+    obsolete = false;
+}
+
+Segment *Segment::open(const char *fileName) {
+    int fd = ::open(fileName, O_RDONLY | O_LARGEFILE);
+    if (fd < 0) {
+        snprintf(errorMessage, sizeof(errorMessage), "Unable to open segment: %s", fileName);
+        log(LOG_ERROR, LOG_ID, errorMessage);
+        return nullptr;
+    }
+    struct stat buf;
+    if ((fstat(fd, &buf) != 0) || (buf.st_size < (off_t)sizeof(SegmentFooter))) {
+        snprintf(errorMessage, sizeof(errorMessage), "Segment file too small: %s", fileName);
+        log(LOG_ERROR, LOG_ID, errorMessage);
+        close(fd);
+        return nullptr;
+    }
+    void *mapping = mmap(nullptr, buf.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (mapping == MAP_FAILED) {
+        snprintf(errorMessage, sizeof(errorMessage), "Unable to map segment: %s", fileName);
+        log(LOG_ERROR, LOG_ID, errorMessage);
+        close(fd);
+        return nullptr;
+    }
+    // クエリはブロック単位でランダムにアクセスするので、先読みは無駄になる
+    madvise(mapping, buf.st_size, MADV_RANDOM);
+
+    Segment *result = new Segment();
+    result->fileName = duplicateString(fileName);
+    result->fd = fd;
+    result->mapping = (byte*)mapping;
+    result->fileSize = buf.st_size;
+    result->footer = (const SegmentFooter*)&result->mapping[buf.st_size - sizeof(SegmentFooter)];
+
+    const SegmentFooter *f = result->footer;
+    int64_t bucketCount = TermDictionary::getBucketCount(f->termCount);
+    bool valid = (f->magic == SEGMENT_MAGIC) && (f->version == SEGMENT_VERSION) && (f->termCount >= 0) &&
+        (f->skipPosition >= 0) && (f->skipEntryCount >= 0) &&
+        (f->skipPosition + f->skipEntryCount * (int64_t)sizeof(SegmentSkipEntry) <= f->dictionaryPosition) &&
+        (f->dictionaryPosition + f->termCount * (int64_t)sizeof(SegmentTermEntry) <= f->bucketPosition) &&
+        (f->bucketPosition + bucketCount * (int64_t)sizeof(int64_t) <= f->reverseBucketPosition) &&
+        (f->reverseBucketPosition + bucketCount * (int64_t)sizeof(int64_t) <= f->stringPosition) &&
+        (f->stringPosition + f->stringAreaSize <= f->reverseStringPosition) &&
+        (f->reverseStringPosition + f->reverseStringAreaSize <= buf.st_size - (int64_t)sizeof(SegmentFooter));
+    if (valid) {
+        result->dictionary = TermDictionary((const char*)&result->mapping[f->stringPosition], f->stringAreaSize,
+                (const int64_t*)&result->mapping[f->bucketPosition], f->termCount);
+        result->reverseDictionary = TermDictionary((const char*)&result->mapping[f->reverseStringPosition],
+                f->reverseStringAreaSize, (const int64_t*)&result->mapping[f->reverseBucketPosition], f->termCount);
+        valid = (result->dictionary.isValid()) && (result->reverseDictionary.isValid());
+    }
+    if (!valid) {
+        snprintf(errorMessage, sizeof(errorMessage), "Invalid segment footer: %s", fileName);
+        log(LOG_ERROR, LOG_ID, errorMessage);
+        delete result;
+        return nullptr;
+    }
+    result->skipEntries = (const SegmentSkipEntry*)&result->mapping[f->skipPosition];
+    result->termEntries = (const SegmentTermEntry*)&result->mapping[f->dictionaryPosition];
+
+    // ブロックとスキップエントリの位置も確かめる。壊れていると展開時にファイルの外を読む
+    for (int64_t i = 0; (valid) && (i < f->skipEntryCount); i++) {
+        const SegmentSkipEntry *skip = &result->skipEntries[i];
+        valid = (skip->filePosition >= 0) && (skip->byteLength > 0) &&
+            (skip->filePosition + skip->byteLength <= f->skipPosition);
+    }
+    for (int64_t i = 0; (valid) && (i < f->termCount); i++) {
+        const SegmentTermEntry *term = &result->termEntries[i];
+        valid = (term->firstSkipEntry >= 0) && (term->blockCount >= 0) &&
+            (term->firstSkipEntry + term->blockCount <= f->skipEntryCount);
+    }
+    if (!valid) {
+        snprintf(errorMessage, sizeof(errorMessage), "Invalid segment entries: %s", fileName);
+        log(LOG_ERROR, LOG_ID, errorMessage);
+        delete result;
+        return nullptr;
+    }
+
+    // 語辞書はすべての問い合わせで使うので、ファイルの末尾の語辞書の部分は先読みしておく
+    int64_t pageSize = sysconf(_SC_PAGESIZE);
+    int64_t dictionaryStart = f->dictionaryPosition - f->dictionaryPosition % pageSize;
+    madvise(&result->mapping[dictionaryStart], buf.st_size - dictionaryStart, MADV_WILLNEED);
+    return result;
+}
+
+Segment::~Segment() {
+    if (mapping != nullptr)
+        munmap(mapping, fileSize);
+    if (fd >= 0)
+        close(fd);
+    if (obsolete)
+        unlink(fileName);
+    free(fileName);
+}
+
+void Segment::markObsolete() {
+    obsolete = true;
+}
+
+const char *Segment::getFileName() {
+    return fileName;
+}
+
+int64_t Segment::getFileSize() {
+    return fileSize;
+}
+
+int64_t Segment::getTermCount() {
+    return footer->termCount;
+}
+
+int64_t Segment::getPostingCount() {
+    return footer->postingCount;
+}
+
+offset Segment::getFirstPosting() {
+    return footer->firstPosting;
+}
+
+offset Segment::getLastPosting() {
+    return footer->lastPosting;
+}
+
+int64_t Segment::lowerBound(const char *term) {
+    return dictionary.lowerBound(term, nullptr);
+}
+
+int64_t Segment::findTerm(const char *term) {
+    return dictionary.find(term);
+}
+
+void Segment::getTerm(int64_t termIndex, char *buffer) {
+    dictionary.getTerm(termIndex, buffer);
+}
+
+bool Segment::expandFuzzy(LevenshteinAutomaton *automaton, int64_t maxTerms, std::vector<std::string> *terms) {
+    return dictionary.expandFuzzy(automaton, maxTerms, terms);
+}
+
+bool Segment::expandWildcard(const char *prefix, const char *suffix, int64_t maxTerms,
+        std::vector<std::string> *terms) {
+    if ((prefix[0] != 0) || (suffix[0] == 0))
+        return dictionary.expandWildcard(prefix, prefix, suffix, false, maxTerms, terms);
+    std::string key(suffix);
+    std::reverse(key.begin(), key.end());
+    return reverseDictionary.expandWildcard(key.c_str(), prefix, suffix, true, maxTerms, terms);
+}
+
+const SegmentTermEntry *Segment::getTermEntry(int64_t termIndex) {
+    return &termEntries[termIndex];
+}
+
+const SegmentSkipEntry *Segment::getSkipEntries(int64_t termIndex) {
+    return &skipEntries[termEntries[termIndex].firstSkipEntry];
+}
+
+int Segment::findBlock(int64_t termIndex, offset target) {
+    const SegmentSkipEntry *skip = getSkipEntries(termIndex);
+    int lower = 0, upper = termEntries[termIndex].blockCount;
+    while (lower < upper) {
+        int middle = (lower + upper) >> 1;
+        if (skip[middle].lastPosting < target)
+            lower = middle + 1;
+        else
+            upper = middle;
+    }
+    return lower;
+}
+
+int Segment::decodeBlock(int64_t termIndex, int block, offset *buffer) {
+    const SegmentSkipEntry *skip = &getSkipEntries(termIndex)[block];
+    int count;
+    decompressList(&mapping[skip->filePosition], skip->byteLength, &count, buffer);
+    assert(count == skip->postingCount);
+    return count;
+}
+
+offset *Segment::getPostings(int64_t termIndex, int64_t *count) {
+    const SegmentTermEntry *entry = &termEntries[termIndex];
+    // 最後のブロックを展開するときのためにSEGMENT_BLOCK_SIZE分の余裕を持たせる
+    offset *result = typed_malloc(offset, entry->postingCount + SEGMENT_BLOCK_SIZE);
+    int64_t pos = 0;
+    for (int block = 0; block < entry->blockCount; block++)
+        pos += decodeBlock(termIndex, block, &result[pos]);
+    *count = pos;
+    return result;
+}
+
+offset *Segment::getPostings(const char *term, int64_t *count) {
+    int64_t termIndex = findTerm(term);
+    if (termIndex < 0) {
+        *count = 0;
+        return nullptr;
+    }
+    return getPostings(termIndex, count);
+}
+
+
+bool writeSegment(UpdateList *updateList, const char *fileName, int compressionMethod) {
+    SegmentWriter writer(fileName, compressionMethod);
+    int32_t *sorted = updateList->getSortedTermIDs();
+    int termCount = updateList->getTermCount();
+    int bufferSize = 1024;
+    offset *buffer = typed_malloc(offset, bufferSize);
+    bool ok = true;
+    for (int i = 0; (i < termCount) && (ok); i++) {
+        int count = updateList->getPostingCount(sorted[i]);
+        if (count > bufferSize) {
+            bufferSize = count * 2;
+            typed_realloc(offset, buffer, bufferSize);
+        }
+        updateList->getPostings(sorted[i], buffer);
+        ok = writer.addTerm(updateList->getTerm(sorted[i]), buffer, count);
+    }
+    free(buffer);
+    free(sorted);
+    if (!ok)
+        return false;
+    return writer.finish();
+}
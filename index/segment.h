@@ -0,0 +1,273 @@
+#ifndef __SEGMENT_H
+#define __SEGMENT_H
+
+/*
+セグメントはUpdateListをディスクに書き出した不変(immutable)の転置ファイル。
+ファイルは先頭から次の順に並ぶ:
+
+    [ポスティングブロック]   語ごとにSEGMENT_BLOCK_SIZE個ずつ圧縮したブロック
+    [スキップエントリ]       ブロックごとの先頭/末尾ポスティングとファイル内位置
+    [語辞書]                 辞書順に並んだ固定長のSegmentTermEntry
+    [バケット位置]           前方符号化した語の文字列のバケットの位置(termdictionary.h)
+    [反転語のバケット位置]   反転した語の文字列のバケットの位置
+    [文字列領域]             辞書順に並べて前方符号化した語
+    [反転語の文字列領域]     語の文字列を反転し、辞書順に並べて前方符号化したもの
+    [フッタ]                 SegmentFooter
+
+読み取り側(Segment)はファイル全体をmmapし、フッタから各領域の位置を求める。
+語の検索は前方符号化した語のバケットの2分探索、ブロックの検索はスキップエントリの2分探索で
+行うため、クエリは必要なブロックだけを展開すればよい。語の文字列は辞書順に並んでいるので、
+接頭辞が同じ語(foo*)を列挙でき、反転語の文字列から接尾辞が同じ語(*bar)を列挙できる。
+語辞書の部分はファイルの末尾にまとめ、開く際に先読みしてメモリに置く
+*/
+
+#include <cstdio>
+#include <string>
+#include <vector>
+#include "index_type.h"
+#include "termdictionary.h"
+#include "../utils/compression.h"
+#include "../utils/refcounted.h"
+
+#define SEGMENT_MAGIC 0x31474553444E4957LL
+#define SEGMENT_VERSION 3
+
+// 1ブロックあたりのポスティング数
+#define SEGMENT_BLOCK_SIZE PFORDELTA_BLOCK_SIZE
+
+typedef struct {
+
+    // ブロック内の最初と最後のポスティング
+    offset firstPosting, lastPosting;
+
+    // ファイル先頭からのブロックの位置
+    int64_t filePosition;
+
+    // 圧縮後のブロックのバイト数
+    int32_t byteLength;
+
+    // ブロック内のポスティング数
+    int32_t postingCount;
+
+    /*
+    文書単位のポスティング(doclevel.h)のブロックの場合、ブロック内の最大のtfと最小の文書長の符号。
+    ランキングでブロック内のスコアの上限を求めるために使う。それ以外のブロックでは0
+    */
+    int32_t maxTF, minLengthCode;
+
+} SegmentSkipEntry;
+
+typedef struct {
+
+    // スキップエントリ配列内での、この語の最初のエントリの位置
+    int64_t firstSkipEntry;
+
+    // この語のポスティング数
+    int64_t postingCount;
+
+    // この語のブロック数
+    int32_t blockCount;
+
+    // 8バイト境界に揃えるための未使用領域
+    int32_t unused;
+
+} SegmentTermEntry;
+
+typedef struct {
+
+    int64_t magic;
+
+    int32_t version;
+
+    // ブロックの圧縮に使用した方式(各ブロックの先頭バイトにも含まれる)
+    int32_t compressionMethod;
+
+    int64_t termCount, postingCount;
+
+    // 各領域の先頭位置
+    int64_t skipPosition, dictionaryPosition, bucketPosition, reverseBucketPosition;
+    int64_t stringPosition, reverseStringPosition;
+
+    // スキップエントリの総数と文字列領域のサイズ
+    int64_t skipEntryCount, stringAreaSize, reverseStringAreaSize;
+
+    // セグメント内の最小と最大のポスティング
+    offset firstPosting, lastPosting;
+
+} SegmentFooter;
+
+class UpdateList;
+
+/*
+SegmentWriterは語を辞書順に受け取り、セグメントファイルを作成する。
+ポスティングブロックは受け取った順にファイルへ書き出し、
+スキップエントリと語辞書はfinishで末尾に書き出す。反転語の辞書は
+finishで反転した語を並べ替えて作る
+*/
+class SegmentWriter {
+
+public:
+
+    static const char *LOG_ID;
+
+private:
+
+    char *fileName;
+
+    FILE *file;
+
+    int compressionMethod;
+
+    int64_t filePosition;
+
+    SegmentFooter footer;
+
+    SegmentSkipEntry *skipEntries;
+    int64_t skipEntriesAllocated;
+
+    SegmentTermEntry *termEntries;
+    int64_t termEntriesAllocated;
+
+    // 語の文字列。辞書順の検査も行う
+    TermDictionaryBuilder dictionary;
+
+    // 反転した語。finishで並べ替えて反転語の辞書を作る
+    std::vector<std::string> reversedTerms;
+
+    bool error;
+
+public:
+
+    SegmentWriter(const char *fileName, int compressionMethod);
+
+    ~SegmentWriter();
+
+    /*
+    termのポスティングを追加する。語は辞書順に、ポスティングは昇順に与えなければならない。
+    失敗した場合はfalseを返す
+    */
+    bool addTerm(const char *term, const offset *postings, int64_t count);
+
+    // 残りのデータとフッタを書き出し、ファイルをディスクに同期する
+    bool finish();
+
+private:
+
+    bool write(const void *data, int64_t size);
+};
+
+/*
+Segmentは既存のセグメントファイルをmmapして読み取る。
+インスタンスは不変で、複数のスレッドから同時に読み取ってよい。
+インスタンスはインデックスのスナップショット(IndexView)の間で参照カウントにより共有される
+*/
+class Segment : public RefCounted {
+
+public:
+
+    static const char *LOG_ID;
+
+private:
+
+    char *fileName;
+
+    int fd;
+
+    // ファイル全体のマッピング
+    byte *mapping;
+    int64_t fileSize;
+
+    const SegmentFooter *footer;
+    const SegmentSkipEntry *skipEntries;
+    const SegmentTermEntry *termEntries;
+
+    TermDictionary dictionary, reverseDictionary;
+
+    // trueの場合、破棄する際にファイルを削除する
+    bool obsolete;
+
+    Segment();
+
+public:
+
+    /*
+    fileNameのセグメントを開く。ファイルが存在しない、
+    または形式が正しくない場合はnullptrを返す
+    */
+    static Segment *open(const char *fileName);
+
+    ~Segment();
+
+    /*
+    マージなどで不要になったことを記録する。ファイルは最後の参照が
+    開放された時点で削除される
+    */
+    void markObsolete();
+
+    const char *getFileName();
+
+    int64_t getFileSize();
+
+    int64_t getTermCount();
+
+    int64_t getPostingCount();
+
+    offset getFirstPosting();
+
+    offset getLastPosting();
+
+    // termの語辞書内の位置を返す。存在しない場合は-1
+    int64_t findTerm(const char *term);
+
+    // 語辞書内でterm以上となる最初の位置を返す
+    int64_t lowerBound(const char *term);
+
+    /*
+    termIndex番目の語をbufferに格納する。bufferには少なくとも
+    MAX_DICTIONARY_TERM_LENGTH + 1バイトが必要
+    */
+    void getTerm(int64_t termIndex, char *buffer);
+
+    /*
+    ワイルドカードprefix*suffix(matchesWildcard)に一致する語をtermsに追加する。
+    prefixが空の場合は反転語の辞書でsuffixから探す。
+    一致する語がmaxTermsを超えた場合はfalseを返す(termsには途中までが追加される)
+    */
+    bool expandWildcard(const char *prefix, const char *suffix, int64_t maxTerms, std::vector<std::string> *terms);
+
+    // automatonが受理する語をtermsに辞書順に追加する(TermDictionary::expandFuzzy)
+    bool expandFuzzy(LevenshteinAutomaton *automaton, int64_t maxTerms, std::vector<std::string> *terms);
+
+    const SegmentTermEntry *getTermEntry(int64_t termIndex);
+
+    // 語のスキップエントリの配列を返す。要素数はgetTermEntry(termIndex)->blockCount
+    const SegmentSkipEntry *getSkipEntries(int64_t termIndex);
+
+    /*
+    語のブロックのうち、lastPosting >= targetとなる最初のブロックの番号を返す。
+    そのようなブロックがない場合はblockCountを返す
+    */
+    int findBlock(int64_t termIndex, offset target);
+
+    /*
+    ブロックを展開してbufferに格納し、ポスティング数を返す。
+    bufferには少なくともSEGMENT_BLOCK_SIZE個の要素が必要
+    */
+    int decodeBlock(int64_t termIndex, int block, offset *buffer);
+
+    /*
+    語のすべてのポスティングを返す。メモリは呼び出し元で開放しなければいけない。
+    語が存在しない場合はnullptrを返し、countに0を格納する
+    */
+    offset *getPostings(const char *term, int64_t *count);
+
+    offset *getPostings(int64_t termIndex, int64_t *count);
+};
+
+/*
+UpdateListの内容を新しいセグメントファイルとして書き出す。
+成功した場合はtrueを返す
+*/
+bool writeSegment(UpdateList *updateList, const char *fileName, int compressionMethod);
+
+#endif
@@ -0,0 +1,99 @@
+#include <cassert>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include "segmentmerger.h"
+#include "segment.h"
+#include "doclevel.h"
+#include "longliststore.h"
+#include "extentset.h"
+#include "../utils/all.h"
+
+static const char *LOG_ID = "SegmentMerger";
+
+bool mergeSegments(Segment **segments, int segmentCount, const char *outputFile,
+        int compressionMethod, LongListStore *longLists, int64_t longListThreshold,
+        ExtentSet *garbage) {
+    SegmentWriter writer(outputFile, compressionMethod);
+
+    // 各セグメントの語辞書上の現在位置と、その位置の語
+    int64_t *cursor = typed_malloc(int64_t, segmentCount);
+    int64_t *counts = typed_malloc(int64_t, segmentCount);
+    char (*current)[MAX_DICTIONARY_TERM_LENGTH + 1] = new char[segmentCount][MAX_DICTIONARY_TERM_LENGTH + 1];
+    for (int i = 0; i < segmentCount; i++) {
+        cursor[i] = 0;
+        if (segments[i]->getTermCount() > 0)
+            segments[i]->getTerm(0, current[i]);
+    }
+
+    int64_t bufferSize = 4096;
+    offset *buffer = typed_malloc(offset, bufferSize);
+    bool ok = true;
+    while (ok) {
+        // 最小の語を探す
+        const char *smallest = nullptr;
+        for (int i = 0; i < segmentCount; i++) {
+            if (cursor[i] >= segments[i]->getTermCount())
+                continue;
+            if ((smallest == nullptr) || (strcmp(current[i], smallest) < 0))
+                smallest = current[i];
+        }
+        if (smallest == nullptr)
+            break;
+        // currentはcursorを進めると書き換えられるのでコピーしておく
+        char term[MAX_DICTIONARY_TERM_LENGTH + 1];
+        strcpy(term, smallest);
+
+        int64_t total = 0;
+        for (int i = 0; i < segmentCount; i++) {
+            counts[i] = 0;
+            if ((cursor[i] < segments[i]->getTermCount()) && (strcmp(current[i], term) == 0))
+                counts[i] = segments[i]->getTermEntry(cursor[i])->postingCount;
+            total += counts[i];
+        }
+        if (total + SEGMENT_BLOCK_SIZE > bufferSize) {
+            bufferSize = (total + SEGMENT_BLOCK_SIZE) * 2;
+            typed_realloc(offset, buffer, bufferSize);
+        }
+        int64_t pos = 0;
+        for (int i = 0; i < segmentCount; i++) {
+            if (counts[i] == 0)
+                continue;
+            int blockCount = segments[i]->getTermEntry(cursor[i])->blockCount;
+            for (int block = 0; block < blockCount; block++)
+                pos += segments[i]->decodeBlock(cursor[i], block, &buffer[pos]);
+        }
+        assert(pos == total);
+        if (!std::is_sorted(buffer, buffer + total)) {
+            // アドレス範囲が重なるセグメントが与えられた場合に備える
+            std::sort(buffer, buffer + total);
+            total = std::unique(buffer, buffer + total) - buffer;
+        }
+        if (garbage != nullptr)
+            total = garbage->removeContained(buffer, total, getPostingShift(term));
+
+        if (total == 0)
+            ok = true;
+        else if ((longLists != nullptr) && ((total >= longListThreshold) || (longLists->contains(term))))
+            ok = longLists->appendPostings(term, buffer, total, compressionMethod);
+        else
+            ok = writer.addTerm(term, buffer, total);
+
+        for (int i = 0; i < segmentCount; i++) {
+            if (counts[i] == 0)
+                continue;
+            if (++cursor[i] < segments[i]->getTermCount())
+                segments[i]->getTerm(cursor[i], current[i]);
+        }
+    }
+    delete[] current;
+    free(buffer);
+    free(counts);
+    free(cursor);
+    if (!ok) {
+        log(LOG_ERROR, LOG_ID, "Segment merge failed");
+        return false;
+    }
+    return writer.finish();
+}
@@ -0,0 +1,28 @@
+#ifndef __SEGMENTMERGER_H
+#define __SEGMENTMERGER_H
+
+/*
+複数のセグメントを一つの新しいセグメントにマージする。
+segmentsは古い順(アドレス範囲の昇順)に並んでいなければならない。
+各語のポスティングはセグメントの順に連結されるだけなので、マージは語辞書の
+k-wayマージとブロックの展開・再圧縮だけで済む。
+
+longListsがnullptrでない場合、既にlongListsで管理されている語と、マージ後の
+ポスティング数がlongListThreshold以上になる語は新しいセグメントには書かれず、
+longListsに追記される(ハイブリッド方式のインデックス更新)。
+
+garbageがnullptrでない場合、garbageに含まれるポスティングはマージ中に取り除かれる
+(on-the-flyガベージコレクション)。すべてのポスティングが取り除かれた語は出力されない
+*/
+
+#include "index_type.h"
+
+class Segment;
+class LongListStore;
+class ExtentSet;
+
+bool mergeSegments(Segment **segments, int segmentCount, const char *outputFile,
+        int compressionMethod, LongListStore *longLists, int64_t longListThreshold,
+        ExtentSet *garbage = nullptr);
+
+#endif
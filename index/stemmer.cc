@@ -0,0 +1,349 @@
+#include <cassert>
+#include <cstring>
+#include "stemmer.h"
+
+/*
+Porterのアルゴリズムの作業領域。bに語をコピーし、kは語の末尾の位置、
+jは直前にendsで一致した接尾辞の直前の位置を表す
+*/
+typedef struct {
+    char b[MAX_STEM_LENGTH];
+    int k, j;
+} PorterState;
+
+// b[i]が子音かどうか。yは直前が子音の場合に母音として扱う
+static bool isConsonant(PorterState *s, int i) {
+    switch (s->b[i]) {
+        case 'a': case 'e': case 'i': case 'o': case 'u':
+            return false;
+        case 'y':
+            return (i == 0) ? true : !isConsonant(s, i - 1);
+        default:
+            return true;
+    }
+}
+
+/*
+b[0..j]を[C](VC)^m[V]と表したときのmを返す。
+Cは1個以上の子音の並び、Vは1個以上の母音の並び
+*/
+static int measure(PorterState *s) {
+    int n = 0, i = 0;
+    while (true) {
+        if (i > s->j)
+            return n;
+        if (!isConsonant(s, i))
+            break;
+        i++;
+    }
+    i++;
+    while (true) {
+        while (true) {
+            if (i > s->j)
+                return n;
+            if (isConsonant(s, i))
+                break;
+            i++;
+        }
+        i++;
+        n++;
+        while (true) {
+            if (i > s->j)
+                return n;
+            if (!isConsonant(s, i))
+                break;
+            i++;
+        }
+        i++;
+    }
+}
+
+// b[0..j]が母音を含むかどうか
+static bool containsVowel(PorterState *s) {
+    for (int i = 0; i <= s->j; i++)
+        if (!isConsonant(s, i))
+            return true;
+    return false;
+}
+
+// b[i-1..i]が同じ子音の連続かどうか
+static bool isDoubleConsonant(PorterState *s, int i) {
+    if (i < 1)
+        return false;
+    if (s->b[i] != s->b[i - 1])
+        return false;
+    return isConsonant(s, i);
+}
+
+// b[i-2..i]が子音-母音-子音で、最後の子音がw, x, yでないかどうか
+static bool isCVC(PorterState *s, int i) {
+    if ((i < 2) || !isConsonant(s, i) || isConsonant(s, i - 1) || !isConsonant(s, i - 2))
+        return false;
+    char c = s->b[i];
+    return (c != 'w') && (c != 'x') && (c != 'y');
+}
+
+// b[0..k]がsuffixで終わるかどうか。一致した場合はjを接尾辞の直前に設定する
+static bool endsWith(PorterState *s, const char *suffix) {
+    int length = strlen(suffix);
+    if (length > s->k + 1)
+        return false;
+    if (s->b[s->k] != suffix[length - 1])
+        return false;
+    if (memcmp(&s->b[s->k - length + 1], suffix, length) != 0)
+        return false;
+    s->j = s->k - length;
+    return true;
+}
+
+// b[j+1..k]をreplacementで置き換える
+static void setTo(PorterState *s, const char *replacement) {
+    int length = strlen(replacement);
+    memcpy(&s->b[s->j + 1], replacement, length);
+    s->k = s->j + length;
+}
+
+static void replaceIfMeasured(PorterState *s, const char *replacement) {
+    if (measure(s) > 0)
+        setTo(s, replacement);
+}
+
+// 複数形と-ed, -ingを取り除く
+static void step1ab(PorterState *s) {
+    if (s->b[s->k] == 's') {
+        if (endsWith(s, "sses"))
+            s->k -= 2;
+        else if (endsWith(s, "ies"))
+            setTo(s, "i");
+        else if (s->b[s->k - 1] != 's')
+            s->k--;
+    }
+    if (endsWith(s, "eed")) {
+        if (measure(s) > 0)
+            s->k--;
+    }
+    else if ((endsWith(s, "ed") || endsWith(s, "ing")) && containsVowel(s)) {
+        s->k = s->j;
+        if (endsWith(s, "at"))
+            setTo(s, "ate");
+        else if (endsWith(s, "bl"))
+            setTo(s, "ble");
+        else if (endsWith(s, "iz"))
+            setTo(s, "ize");
+        else if (isDoubleConsonant(s, s->k)) {
+            char c = s->b[s->k];
+            if ((c != 'l') && (c != 's') && (c != 'z'))
+                s->k--;
+        }
+        else {
+            s->j = s->k;
+            if ((measure(s) == 1) && isCVC(s, s->k))
+                setTo(s, "e");
+        }
+    }
+}
+
+// 語幹に母音がある場合、末尾のyをiに置き換える
+static void step1c(PorterState *s) {
+    if (endsWith(s, "y") && containsVowel(s))
+        s->b[s->k] = 'i';
+}
+
+typedef struct {
+    const char *suffix;
+    const char *replacement;
+} PorterRule;
+
+// 最初に一致した規則を、m > 0の場合に適用する。一致する規則があればtrue
+static bool applyRules(PorterState *s, const PorterRule *rules) {
+    for (int i = 0; rules[i].suffix != nullptr; i++)
+        if (endsWith(s, rules[i].suffix)) {
+            replaceIfMeasured(s, rules[i].replacement);
+            return true;
+        }
+    return false;
+}
+
+// 二重の接尾辞を1つにまとめる
+static void step2(PorterState *s) {
+    static const PorterRule rules[] = {
+        { "ational", "ate" }, { "tional", "tion" }, { "enci", "ence" }, { "anci", "ance" },
+        { "izer", "ize" }, { "bli", "ble" }, { "alli", "al" }, { "entli", "ent" },
+        { "eli", "e" }, { "ousli", "ous" }, { "ization", "ize" }, { "ation", "ate" },
+        { "ator", "ate" }, { "alism", "al" }, { "iveness", "ive" }, { "fulness", "ful" },
+        { "ousness", "ous" }, { "aliti", "al" }, { "iviti", "ive" }, { "biliti", "ble" },
+        { "logi", "log" }, { nullptr, nullptr }
+    };
+    applyRules(s, rules);
+}
+
+static void step3(PorterState *s) {
+    static const PorterRule rules[] = {
+        { "icate", "ic" }, { "ative", "" }, { "alize", "al" }, { "iciti", "ic" },
+        { "ical", "ic" }, { "ful", "" }, { "ness", "" }, { nullptr, nullptr }
+    };
+    applyRules(s, rules);
+}
+
+// m > 1の場合に接尾辞を取り除く
+static void step4(PorterState *s) {
+    static const char *suffixes[] = {
+        "al", "ance", "ence", "er", "ic", "able", "ible", "ant", "ement", "ment", "ent",
+        "ion", "ou", "ism", "ate", "iti", "ous", "ive", "ize", nullptr
+    };
+    for (int i = 0; suffixes[i] != nullptr; i++) {
+        if (!endsWith(s, suffixes[i]))
+            continue;
+        if (strcmp(suffixes[i], "ion") == 0)
+            if ((s->j < 0) || ((s->b[s->j] != 's') && (s->b[s->j] != 't')))
+                continue;
+        if (measure(s) > 1)
+            s->k = s->j;
+        return;
+    }
+}
+
+// 末尾のeと、m > 1の場合の-llを取り除く
+static void step5(PorterState *s) {
+    s->j = s->k;
+    if (s->b[s->k] == 'e') {
+        int m = measure(s);
+        if ((m > 1) || ((m == 1) && !isCVC(s, s->k - 1)))
+            s->k--;
+    }
+    if ((s->b[s->k] == 'l') && isDoubleConsonant(s, s->k) && (measure(s) > 1))
+        s->k--;
+}
+
+bool Stemmer::isStemmable(const char *word) {
+    int length = 0;
+    for (; word[length] != 0; length++)
+        if ((word[length] < 'a') || (word[length] > 'z'))
+            return false;
+    return (length > 2) && (length <= MAX_TOKEN_LENGTH);
+}
+
+void Stemmer::stem(const char *word, char *result) {
+    int length = strlen(word);
+    if (!isStemmable(word)) {
+        if (length > MAX_STEM_LENGTH - 1)
+            length = MAX_STEM_LENGTH - 1;
+        memcpy(result, word, length);
+        result[length] = 0;
+        return;
+    }
+
+    PorterState s;
+    memcpy(s.b, word, length);
+    s.k = length - 1;
+    s.j = 0;
+    step1ab(&s);
+    if (s.k > 0) {
+        step1c(&s);
+        step2(&s);
+        step3(&s);
+        step4(&s);
+        step5(&s);
+    }
+    memcpy(result, s.b, s.k + 1);
+    result[s.k + 1] = 0;
+}
+
+StemCache::StemCache() {
+    getConfiguration();
+    maxShardSize = (STEM_CACHE_SIZE + SHARD_COUNT - 1) / SHARD_COUNT;
+    for (int i = 0; i < SHARD_COUNT; i++)
+        pthread_rwlock_init(&shards[i].lock, nullptr);
+}
+
+StemCache::~StemCache() {
+    for (int i = 0; i < SHARD_COUNT; i++)
+        pthread_rwlock_destroy(&shards[i].lock);
+}
+
+void StemCache::getConfiguration() {
+    getConfigurationInt("STEM_CACHE_SIZE", &STEM_CACHE_SIZE, DEFAULT_STEM_CACHE_SIZE);
+    if (STEM_CACHE_SIZE < 0)
+        STEM_CACHE_SIZE = 0;
+}
+
+void StemCache::getStem(const char *word, char *result) {
+    // 数字やタグなどはステミングされないので、キャッシュに入れない
+    if (!Stemmer::isStemmable(word)) {
+        Stemmer::stem(word, result);
+        return;
+    }
+
+    unsigned int hashValue = simpleHashFunction(word);
+    SC_Shard *shard = &shards[(hashValue ^ (hashValue >> 16)) & (SHARD_COUNT - 1)];
+    std::string key(word);
+
+    pthread_rwlock_rdlock(&shard->lock);
+    auto iter = shard->stems.find(key);
+    if (iter != shard->stems.end()) {
+        memcpy(result, iter->second.c_str(), iter->second.length() + 1);
+        pthread_rwlock_unlock(&shard->lock);
+        return;
+    }
+    pthread_rwlock_unlock(&shard->lock);
+
+    // ステミングはロックの外で行う。同じ語を複数のスレッドが同時に処理しても結果は同じ
+    Stemmer::stem(word, result);
+
+    pthread_rwlock_wrlock(&shard->lock);
+    if ((int64_t)shard->stems.size() < maxShardSize)
+        shard->stems.emplace(std::move(key), std::string(result));
+    pthread_rwlock_unlock(&shard->lock);
+}
+
+int64_t StemCache::getSize() {
+    int64_t result = 0;
+    for (int i = 0; i < SHARD_COUNT; i++) {
+        pthread_rwlock_rdlock(&shards[i].lock);
+        result += shards[i].stems.size();
+        pthread_rwlock_unlock(&shards[i].lock);
+    }
+    return result;
+}
+
+void StemCache::clear() {
+    for (int i = 0; i < SHARD_COUNT; i++) {
+        pthread_rwlock_wrlock(&shards[i].lock);
+        shards[i].stems.clear();
+        pthread_rwlock_unlock(&shards[i].lock);
+    }
+}
+
+int StemCache::getIndexTerms(const char *word, int stemmingLevel, char terms[2][MAX_STEM_LENGTH]) {
+    if (stemmingLevel <= 0) {
+        strncpy(terms[0], word, MAX_STEM_LENGTH - 1);
+        terms[0][MAX_STEM_LENGTH - 1] = 0;
+        return 1;
+    }
+
+    getStem(word, terms[0]);
+    if (stemmingLevel == 1)
+        return 1;
+
+    bool different = (strcmp(terms[0], word) != 0);
+    if (stemmingLevel == 2) {
+        if (!different)
+            return 1;
+        strcpy(terms[1], terms[0]);
+        strncpy(terms[0], word, MAX_STEM_LENGTH - 1);
+        terms[0][MAX_STEM_LENGTH - 1] = 0;
+        return 2;
+    }
+
+    // STEMMING_LEVEL 3: 語幹が語と同じ場合にも印を付けた語幹を追加する
+    if (!Stemmer::isStemmable(word))
+        return 1;
+    int length = strlen(terms[0]);
+    assert(length <= MAX_TOKEN_LENGTH);
+    terms[1][length] = STEM_MARKER;
+    terms[1][length + 1] = 0;
+    memcpy(terms[1], terms[0], length);
+    strncpy(terms[0], word, MAX_STEM_LENGTH - 1);
+    terms[0][MAX_STEM_LENGTH - 1] = 0;
+    return 2;
+}
@@ -0,0 +1,100 @@
+#ifndef __STEMMER_H
+#define __STEMMER_H
+
+/*
+Porterのステミングアルゴリズム(M.F. Porter, 1980)の実装と、その結果をメモ化する
+StemCache。ステミングの対象は英小文字だけからなる語で、数字やマルチバイト文字を
+含む語はそのまま返される。
+
+インデックスに追加する語はSTEMMING_LEVELによって次のように決まる:
+  0: 語そのもの
+  1: 語幹のみ
+  2: 語そのものと語幹(語幹が異なる場合)
+  3: 語そのものと、末尾にSTEM_MARKERを付けた語幹。印があるので語幹が
+     実在の語と混ざらず、クエリは両方を区別して検索できる。
+     印を付けた語幹はステミングの対象となる語についてのみ追加される
+*/
+
+#include <pthread.h>
+#include <string>
+#include <unordered_map>
+#include "index_type.h"
+#include "../utils/all.h"
+
+// STEMMING_LEVEL 3で語幹の末尾に付ける印
+#define STEM_MARKER '$'
+
+// ステミング後の語(印を含む)を格納するのに必要なバッファの大きさ
+#define MAX_STEM_LENGTH (MAX_TOKEN_LENGTH + 2)
+
+class Stemmer {
+
+public:
+
+    /*
+    wordの語幹をresultに格納する。resultには少なくともMAX_STEM_LENGTHバイトが必要。
+    ステミングできない語の場合はwordをそのまま格納する
+    */
+    static void stem(const char *word, char *result);
+
+    // wordがステミングの対象(3文字以上の英小文字だけからなる語)かどうか
+    static bool isStemmable(const char *word);
+};
+
+typedef struct {
+
+    pthread_rwlock_t lock;
+
+    std::unordered_map<std::string, std::string> stems;
+
+} SC_Shard;
+
+/*
+StemCacheは語から語幹への対応表で、インデックス作成中に各語のステミングを
+一度だけ行うために使う。表は語のハッシュ値で分割され、各部分は読み書きロックで
+保護されるので、複数のスレッドから同時に使ってよい
+*/
+class StemCache {
+
+public:
+
+    // 表の分割数(2のべき乗)
+    static const int SHARD_COUNT = 64;
+
+    // キャッシュする語の最大数
+    static const int DEFAULT_STEM_CACHE_SIZE = 1024 * 1024;
+    configurable int STEM_CACHE_SIZE;
+
+private:
+
+    SC_Shard shards[SHARD_COUNT];
+
+    // 1つの部分に格納できる語の数。いっぱいになった部分には新しい語を追加しない
+    int64_t maxShardSize;
+
+public:
+
+    StemCache();
+
+    ~StemCache();
+
+    // wordの語幹をresultに格納する。resultには少なくともMAX_STEM_LENGTHバイトが必要
+    void getStem(const char *word, char *result);
+
+    // キャッシュされている語の数
+    int64_t getSize();
+
+    void clear();
+
+    /*
+    STEMMING_LEVELに従って、wordについてインデックスに追加する語をtermsに格納し、
+    その数(1または2)を返す。最初の要素は常にインデックスに追加されるべき主な語になる
+    */
+    int getIndexTerms(const char *word, int stemmingLevel, char terms[2][MAX_STEM_LENGTH]);
+
+private:
+
+    void getConfiguration();
+};
+
+#endif
@@ -0,0 +1,289 @@
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include "termdictionary.h"
+#include "doclevel.h"
+#include "levenshtein.h"
+#include "stemmer.h"
+#include "../utils/all.h"
+
+const char *TermDictionaryBuilder::LOG_ID = "TermDictionaryBuilder";
+
+static char errorMessage[256];
+
+bool isExpandableTerm(const char *term) {
+    if ((term[0] == 0) || (strchr(term, BIGRAM_SEPARATOR) != nullptr) || (isDocumentLevelTerm(term)))
+        return false;
+    return term[strlen(term) - 1] != STEM_MARKER;
+}
+
+bool matchesWildcard(const char *term, const char *prefix, const char *suffix) {
+    int termLength = strlen(term), prefixLength = strlen(prefix), suffixLength = strlen(suffix);
+    if (termLength < prefixLength + suffixLength)
+        return false;
+    if ((strncmp(term, prefix, prefixLength) != 0) || (strcmp(&term[termLength - suffixLength], suffix) != 0))
+        return false;
+    return isExpandableTerm(term);
+}
+
+TermDictionaryBuilder::TermDictionaryBuilder() {
+    dataAllocated = 16384;
+    data = typed_malloc(char, dataAllocated);
+    dataSize = 0;
+    bucketsAllocated = 1024;
+    bucketOffsets = typed_malloc(int64_t, bucketsAllocated);
+    termCount = 0;
+    lastTerm[0] = 0;
+}
+
+TermDictionaryBuilder::~TermDictionaryBuilder() {
+    free(data);
+    free(bucketOffsets);
+}
+
+bool TermDictionaryBuilder::addTerm(const char *term) {
+    int length = strlen(term);
+    if (length > MAX_DICTIONARY_TERM_LENGTH) {
+        snprintf(errorMessage, sizeof(errorMessage), "Term too long: %.64s", term);
+        log(LOG_ERROR, LOG_ID, errorMessage);
+        return false;
+    }
+    if ((termCount > 0) && (strcmp(lastTerm, term) >= 0)) {
+        snprintf(errorMessage, sizeof(errorMessage), "Terms not in lexicographical order: %s", term);
+        log(LOG_ERROR, LOG_ID, errorMessage);
+        return false;
+    }
+
+    int shared = 0;
+    if (termCount % TERM_DICTIONARY_BUCKET_SIZE == 0) {
+        if (termCount / TERM_DICTIONARY_BUCKET_SIZE >= bucketsAllocated) {
+            bucketsAllocated *= 2;
+            typed_realloc(int64_t, bucketOffsets, bucketsAllocated);
+        }
+        bucketOffsets[termCount / TERM_DICTIONARY_BUCKET_SIZE] = dataSize;
+    }
+    else {
+        while ((shared < length) && (lastTerm[shared] == term[shared]))
+            shared++;
+    }
+    while (dataSize + length - shared + 2 > dataAllocated) {
+        dataAllocated *= 2;
+        typed_realloc(char, data, dataAllocated);
+    }
+    data[dataSize++] = (char)(byte)shared;
+    memcpy(&data[dataSize], &term[shared], length - shared + 1);
+    dataSize += length - shared + 1;
+    memcpy(lastTerm, term, length + 1);
+    termCount++;
+    return true;
+}
+
+int64_t TermDictionaryBuilder::getTermCount() {
+    return termCount;
+}
+
+const char *TermDictionaryBuilder::getData() {
+    return data;
+}
+
+int64_t TermDictionaryBuilder::getDataSize() {
+    return dataSize;
+}
+
+const int64_t *TermDictionaryBuilder::getBucketOffsets() {
+    return bucketOffsets;
+}
+
+int64_t TermDictionaryBuilder::getBucketCount() {
+    return TermDictionary::getBucketCount(termCount);
+}
+
+
+TermDictionary::TermDictionary() {
+    data = nullptr;
+    dataSize = 0;
+    bucketOffsets = nullptr;
+    termCount = 0;
+}
+
+TermDictionary::TermDictionary(const char *data, int64_t dataSize, const int64_t *bucketOffsets, int64_t termCount) {
+    this->data = data;
+    this->dataSize = dataSize;
+    this->bucketOffsets = bucketOffsets;
+    this->termCount = termCount;
+}
+
+int64_t TermDictionary::getTermCount() {
+    return termCount;
+}
+
+int64_t TermDictionary::getBucketCount(int64_t termCount) {
+    return (termCount + TERM_DICTIONARY_BUCKET_SIZE - 1) / TERM_DICTIONARY_BUCKET_SIZE;
+}
+
+bool TermDictionary::isValid() {
+    if (termCount == 0)
+        return true;
+    if ((dataSize < 2) || (data[dataSize - 1] != 0))
+        return false;
+    int64_t bucketCount = getBucketCount(termCount);
+    for (int64_t i = 0; i < bucketCount; i++) {
+        if ((bucketOffsets[i] < 0) || (bucketOffsets[i] >= dataSize) || (data[bucketOffsets[i]] != 0))
+            return false;
+        if ((i > 0) && (bucketOffsets[i] <= bucketOffsets[i - 1]))
+            return false;
+    }
+    return true;
+}
+
+int64_t TermDictionary::decodeTerm(int64_t pos, char *buffer) {
+    int shared = (byte)data[pos++];
+    int length = strlen(&data[pos]);
+    memcpy(&buffer[shared], &data[pos], length + 1);
+    return pos + length + 1;
+}
+
+int64_t TermDictionary::findBucket(const char *term) {
+    // バケットの先頭の語は完全な語なので、展開せずに比較できる
+    int64_t lower = 0, upper = getBucketCount(termCount);
+    while (upper - lower > 1) {
+        int64_t middle = (lower + upper) >> 1;
+        if (strcmp(&data[bucketOffsets[middle] + 1], term) <= 0)
+            lower = middle;
+        else
+            upper = middle;
+    }
+    return lower;
+}
+
+void TermDictionary::getTerm(int64_t termIndex, char *buffer) {
+    int64_t index = termIndex - termIndex % TERM_DICTIONARY_BUCKET_SIZE;
+    int64_t pos = bucketOffsets[termIndex / TERM_DICTIONARY_BUCKET_SIZE];
+    for (pos = decodeTerm(pos, buffer); index < termIndex; index++)
+        pos = decodeTerm(pos, buffer);
+}
+
+int64_t TermDictionary::lowerBound(const char *term, char *found) {
+    char buffer[MAX_DICTIONARY_TERM_LENGTH + 1];
+    int64_t next;
+    return seek(term, (found == nullptr ? buffer : found), &next);
+}
+
+int64_t TermDictionary::seek(const char *term, char *found, int64_t *next) {
+    found[0] = 0;
+    *next = dataSize;
+    if (termCount == 0)
+        return 0;
+    int64_t bucket = findBucket(term);
+    int64_t index = bucket * TERM_DICTIONARY_BUCKET_SIZE;
+    int64_t pos = bucketOffsets[bucket];
+    // 次のバケットの先頭の語はtermより大きいので、探索は次のバケットの先頭で必ず終わる
+    for (; index < termCount; index++) {
+        pos = decodeTerm(pos, found);
+        if (strcmp(found, term) >= 0) {
+            *next = pos;
+            return index;
+        }
+    }
+    found[0] = 0;
+    return termCount;
+}
+
+int64_t TermDictionary::find(const char *term) {
+    char found[MAX_DICTIONARY_TERM_LENGTH + 1];
+    int64_t index = lowerBound(term, found);
+    if ((index < termCount) && (strcmp(found, term) == 0))
+        return index;
+    return -1;
+}
+
+bool TermDictionary::expandWildcard(const char *key, const char *prefix, const char *suffix, bool reversed,
+        int64_t maxTerms, std::vector<std::string> *terms) {
+    char term[MAX_DICTIONARY_TERM_LENGTH + 1];
+    int64_t pos;
+    int64_t index = seek(key, term, &pos);
+    if (index >= termCount)
+        return true;
+    int keyLength = strlen(key);
+    int64_t added = 0;
+    while (strncmp(term, key, keyLength) == 0) {
+        std::string candidate(term);
+        if (reversed)
+            std::reverse(candidate.begin(), candidate.end());
+        if (matchesWildcard(candidate.c_str(), prefix, suffix)) {
+            if (++added > maxTerms)
+                return false;
+            terms->push_back(candidate);
+        }
+        if (++index >= termCount)
+            break;
+        // バケットは連続して並んでいるので、次のバケットの先頭もそのまま展開できる
+        pos = decodeTerm(pos, term);
+    }
+    return true;
+}
+
+bool TermDictionary::expandFuzzy(LevenshteinAutomaton *automaton, int64_t maxTerms, std::vector<std::string> *terms) {
+    if (termCount == 0)
+        return true;
+    // states[i]は語の先頭i文字を読んだ状態。previousの先頭validLength文字に対する状態が有効
+    int stateSize = automaton->getStateSize();
+    byte *states = typed_malloc(byte, (MAX_DICTIONARY_TERM_LENGTH + 1) * stateSize);
+    automaton->start(states);
+    char previous[MAX_DICTIONARY_TERM_LENGTH + 1], term[MAX_DICTIONARY_TERM_LENGTH + 1];
+    int validLength = 0;
+    previous[0] = 0;
+
+    int64_t index = 0, pos = bucketOffsets[0], added = 0;
+    pos = decodeTerm(pos, term);
+    bool result = true;
+    while (true) {
+        int shared = 0;
+        while ((shared < validLength) && (previous[shared] == term[shared]))
+            shared++;
+        int length = shared, dead = -1;
+        for (; term[length] != 0; length++) {
+            byte *state = &states[(length + 1) * stateSize];
+            automaton->step(&states[length * stateSize], term[length], state);
+            if (!automaton->canMatch(state)) {
+                dead = length + 1;
+                break;
+            }
+        }
+
+        if (dead < 0) {
+            if ((automaton->isMatch(&states[length * stateSize])) && (isExpandableTerm(term))) {
+                if (++added > maxTerms) {
+                    result = false;
+                    break;
+                }
+                terms->push_back(term);
+            }
+            memcpy(previous, term, length + 1);
+            validLength = length;
+            if (++index >= termCount)
+                break;
+            pos = decodeTerm(pos, term);
+            continue;
+        }
+
+        // 先頭dead文字を接頭辞に持つ語は受理されないので、その次の文字列まで読み飛ばす
+        memcpy(previous, term, dead - 1);
+        previous[dead - 1] = 0;
+        validLength = dead - 1;
+        char key[MAX_DICTIONARY_TERM_LENGTH + 1];
+        int keyLength = dead;
+        memcpy(key, term, keyLength);
+        while ((keyLength > 0) && ((byte)key[keyLength - 1] == 0xFF))
+            keyLength--;
+        if (keyLength == 0)
+            break;
+        key[keyLength - 1] = (char)((byte)key[keyLength - 1] + 1);
+        key[keyLength] = 0;
+        index = seek(key, term, &pos);
+        if (index >= termCount)
+            break;
+    }
+    free(states);
+    return result;
+}
@@ -0,0 +1,158 @@
+#ifndef __TERMDICTIONARY_H
+#define __TERMDICTIONARY_H
+
+/*
+TermDictionaryはセグメントの不変の語辞書。語を辞書順に並べ、TERM_DICTIONARY_BUCKET_SIZE語ごとの
+バケットに分けて前方符号化(front coding)する。各語は
+
+    [直前の語との共通接頭辞の長さ(1バイト)] [残りの文字列] [0]
+
+で表し、バケットの最初の語は共通接頭辞の長さを0とする(完全な語を持つ)。
+バケットの先頭位置の配列で任意のバケットに移動できるので、語の検索はバケットの先頭の語に
+対する2分探索と、バケット内の高々TERM_DICTIONARY_BUCKET_SIZE語の順次展開で行う。
+辞書順に並んでいるので、接頭辞が同じ語は連続した範囲になり、順に列挙できる。
+語を反転して格納した辞書を別に作れば、接尾辞が同じ語も同様に列挙できる。
+
+TermDictionaryBuilderはメモリ上で辞書を作り、TermDictionaryはその内容(通常はmmapされた
+セグメントファイルの一部)を読み取る。TermDictionaryは不変で、複数のスレッドから同時に読み取ってよい
+*/
+
+#include <string>
+#include <vector>
+#include "index_type.h"
+
+#define TERM_DICTIONARY_BUCKET_SIZE 16
+
+// 辞書に格納できる語の最大長(バイト)。共通接頭辞の長さを1バイトで表すため
+#define MAX_DICTIONARY_TERM_LENGTH 255
+
+/*
+termがワイルドカードやあいまい検索の展開の対象になるかどうか。バイグラム、文書単位の語、
+語幹の印が付いた語は索引付けされた語そのものではないので対象にならない
+*/
+bool isExpandableTerm(const char *term);
+
+/*
+ワイルドカード(prefix*suffix)にtermが一致するかどうか。prefixとsuffixは空でもよい。
+isExpandableTermを満たさない語は一致しない
+*/
+bool matchesWildcard(const char *term, const char *prefix, const char *suffix);
+
+class LevenshteinAutomaton;
+
+class TermDictionaryBuilder {
+
+public:
+
+    static const char *LOG_ID;
+
+private:
+
+    char *data;
+    int64_t dataSize, dataAllocated;
+
+    int64_t *bucketOffsets;
+    int64_t bucketsAllocated;
+
+    int64_t termCount;
+
+    char lastTerm[MAX_DICTIONARY_TERM_LENGTH + 1];
+
+public:
+
+    TermDictionaryBuilder();
+
+    ~TermDictionaryBuilder();
+
+    /*
+    語を追加する。語は辞書順に与えなければならない。順序が正しくない場合や
+    語が長すぎる場合はfalseを返す
+    */
+    bool addTerm(const char *term);
+
+    int64_t getTermCount();
+
+    const char *getData();
+
+    int64_t getDataSize();
+
+    // 各バケットの先頭の語のgetData()内での位置
+    const int64_t *getBucketOffsets();
+
+    int64_t getBucketCount();
+};
+
+class TermDictionary {
+
+private:
+
+    const char *data;
+    int64_t dataSize;
+
+    const int64_t *bucketOffsets;
+
+    int64_t termCount;
+
+public:
+
+    // 空の辞書
+    TermDictionary();
+
+    // TermDictionaryBuilderが作った内容を読む。メモリは呼び出し元が保持する
+    TermDictionary(const char *data, int64_t dataSize, const int64_t *bucketOffsets, int64_t termCount);
+
+    int64_t getTermCount();
+
+    // バケットの数。termCountから決まる
+    static int64_t getBucketCount(int64_t termCount);
+
+    /*
+    辞書の内容が正しいかどうかを大まかに検査する(バケットの位置が範囲内にあり、
+    最後の語が0で終わっている)。ファイルを開く際に使う
+    */
+    bool isValid();
+
+    /*
+    termIndex番目の語をbufferに格納する。bufferには少なくとも
+    MAX_DICTIONARY_TERM_LENGTH + 1バイトが必要
+    */
+    void getTerm(int64_t termIndex, char *buffer);
+
+    /*
+    term以上となる最初の語の番号を返す。foundがnullptrでなければ、その語を格納する
+    (存在しなければ空文字列)
+    */
+    int64_t lowerBound(const char *term, char *found);
+
+    // termの番号を返す。存在しない場合は-1
+    int64_t find(const char *term);
+
+    /*
+    keyで始まる語を辞書順に読み、reversedがtrueの場合は文字列を反転してから
+    matchesWildcard(prefix, suffix)を満たす語をtermsに追加する。
+    追加した語がmaxTermsを超えた時点でfalseを返す
+    */
+    bool expandWildcard(const char *key, const char *prefix, const char *suffix, bool reversed,
+            int64_t maxTerms, std::vector<std::string> *terms);
+
+    /*
+    automatonが受理する語(isExpandableTermを満たすもの)をtermsに辞書順に追加する。
+    語を辞書順に読みながらオートマトンの状態を接頭辞ごとに保持し、状態がdeadになった接頭辞を
+    持つ語はlowerBoundでまとめて読み飛ばすので、辞書全体を調べる必要はない。
+    追加した語がmaxTermsを超えた時点でfalseを返す
+    */
+    bool expandFuzzy(LevenshteinAutomaton *automaton, int64_t maxTerms, std::vector<std::string> *terms);
+
+private:
+
+    // 先頭の語がterm以下となる最後のバケット(なければ0)
+    int64_t findBucket(const char *term);
+
+    // lowerBoundと同じ。nextに見つかった語の次の語の位置を格納する
+    int64_t seek(const char *term, char *found, int64_t *next);
+
+    // posの語を直前の語bufferに続けて展開し、次の語の位置を返す
+    int64_t decodeTerm(int64_t pos, char *buffer);
+};
+
+#endif
@@ -0,0 +1,414 @@
+#include <cassert>
+#include <cstring>
+#include "tokenizer.h"
+#include "../utils/all.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define TOKENIZER_X86 1
+#endif
+
+const char *StreamTokenizer::LOG_ID = "StreamTokenizer";
+
+/*
+ニブル単位の分類表。文字cは LOW_NIBBLE_CLASS[c & 15] & HIGH_NIBBLE_CLASS[c >> 4] が
+0でない場合に語を構成する。各ビットは次の文字の範囲を表す:
+  1: '0'-'9'   2: 'A'-'O', 'a'-'o'   4: 'P'-'Z', 'p'-'z'   8: 0x80-0xFF (UTF-8)
+*/
+static const byte LOW_NIBBLE_CLASS[16] = {
+    1 | 4 | 8,     1 | 2 | 4 | 8, 1 | 2 | 4 | 8, 1 | 2 | 4 | 8,
+    1 | 2 | 4 | 8, 1 | 2 | 4 | 8, 1 | 2 | 4 | 8, 1 | 2 | 4 | 8,
+    1 | 2 | 4 | 8, 1 | 2 | 4 | 8, 2 | 4 | 8,     2 | 8,
+    2 | 8,         2 | 8,         2 | 8,         2 | 8
+};
+static const byte HIGH_NIBBLE_CLASS[16] = {
+    0, 0, 0, 1, 2, 4, 2, 4, 8, 8, 8, 8, 8, 8, 8, 8
+};
+
+// スカラー実装で使う256要素の分類表
+static const byte CLASS_WORD = 1;
+static const byte CLASS_UPPER = 2;
+static const byte CLASS_TAG_NAME = 4;
+
+static byte characterClass[256];
+
+// falseの場合はCPUが対応していてもスカラー実装を使う
+static bool simdEnabled = true;
+
+static bool initializeCharacterClasses() {
+    for (int c = 0; c < 256; c++) {
+        byte cls = 0;
+        if ((LOW_NIBBLE_CLASS[c & 15] & HIGH_NIBBLE_CLASS[c >> 4]) != 0)
+            cls |= CLASS_WORD | CLASS_TAG_NAME;
+        if ((c >= 'A') && (c <= 'Z'))
+            cls |= CLASS_UPPER;
+        if ((c == '-') || (c == '_') || (c == ':') || (c == '.'))
+            cls |= CLASS_TAG_NAME;
+        characterClass[c] = cls;
+    }
+    return true;
+}
+
+static bool characterClassesInitialized = initializeCharacterClasses();
+
+static inline bool useAVX2() {
+    return (simdEnabled) && (cpuSupportsAVX2());
+}
+
+#ifdef TOKENIZER_X86
+
+// 32バイト分の「語を構成しない文字」のビットマスクを求める
+__attribute__((target("avx2")))
+static inline uint32_t nonWordMaskAVX2(__m256i v) {
+    const __m256i lowTable = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)LOW_NIBBLE_CLASS));
+    const __m256i highTable = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)HIGH_NIBBLE_CLASS));
+    const __m256i nibbleMask = _mm256_set1_epi8(0x0F);
+    __m256i low = _mm256_shuffle_epi8(lowTable, _mm256_and_si256(v, nibbleMask));
+    __m256i high = _mm256_shuffle_epi8(highTable, _mm256_and_si256(_mm256_srli_epi16(v, 4), nibbleMask));
+    __m256i cls = _mm256_and_si256(low, high);
+    return (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(cls, _mm256_setzero_si256()));
+}
+
+__attribute__((target("avx2")))
+static int64_t findWordEndAVX2(const char *data, int64_t pos, int64_t length) {
+    while (pos + 32 <= length) {
+        uint32_t mask = nonWordMaskAVX2(_mm256_loadu_si256((const __m256i*)&data[pos]));
+        if (mask != 0)
+            return pos + __builtin_ctz(mask);
+        pos += 32;
+    }
+    while ((pos < length) && (characterClass[(byte)data[pos]] & CLASS_WORD))
+        pos++;
+    return pos;
+}
+
+__attribute__((target("avx2")))
+static int64_t findWordStartAVX2(const char *data, int64_t pos, int64_t length, bool markup) {
+    const __m256i lessThan = _mm256_set1_epi8('<');
+    const __m256i ampersand = _mm256_set1_epi8('&');
+    while (pos + 32 <= length) {
+        __m256i v = _mm256_loadu_si256((const __m256i*)&data[pos]);
+        uint32_t mask = ~nonWordMaskAVX2(v);
+        if (markup) {
+            __m256i special = _mm256_or_si256(_mm256_cmpeq_epi8(v, lessThan), _mm256_cmpeq_epi8(v, ampersand));
+            mask |= (uint32_t)_mm256_movemask_epi8(special);
+        }
+        if (mask != 0)
+            return pos + __builtin_ctz(mask);
+        pos += 32;
+    }
+    while (pos < length) {
+        byte c = (byte)data[pos];
+        if ((characterClass[c] & CLASS_WORD) || ((markup) && ((c == '<') || (c == '&'))))
+            break;
+        pos++;
+    }
+    return pos;
+}
+
+#endif
+
+StreamTokenizer::StreamTokenizer(bool markup) {
+    assert(characterClassesInitialized);
+    this->markup = markup;
+    reset(0);
+}
+
+StreamTokenizer::~StreamTokenizer() {
+}
+
+void StreamTokenizer::reset(offset firstPosition) {
+    data = nullptr;
+    length = pos = 0;
+    lastChunk = false;
+    state = STATE_TEXT;
+    nextPosition = firstPosition;
+    termLength = 0;
+    truncated = false;
+    tagLength = 0;
+    closingTag = false;
+    quote = previous = 0;
+    dashCount = declarationLength = entityLength = 0;
+    entityStart = -1;
+    pendingEndTag = false;
+}
+
+void StreamTokenizer::setInput(const char *data, int64_t length, bool lastChunk) {
+    this->data = data;
+    this->length = length;
+    this->lastChunk = lastChunk;
+    pos = 0;
+    // 文字参照の途中でチャンクが切り替わった場合は、巻き戻すことができない
+    entityStart = -1;
+}
+
+offset StreamTokenizer::getNextPosition() {
+    return nextPosition;
+}
+
+void StreamTokenizer::setSIMDEnabled(bool enabled) {
+    simdEnabled = enabled;
+}
+
+bool StreamTokenizer::isSIMDAvailable() {
+    return cpuSupportsAVX2();
+}
+
+bool StreamTokenizer::isWordCharacter(byte c) {
+    return (characterClass[c] & CLASS_WORD) != 0;
+}
+
+int64_t StreamTokenizer::findWordEnd(int64_t from) {
+#ifdef TOKENIZER_X86
+    if (useAVX2())
+        return findWordEndAVX2(data, from, length);
+#endif
+    while ((from < length) && (characterClass[(byte)data[from]] & CLASS_WORD))
+        from++;
+    return from;
+}
+
+int64_t StreamTokenizer::findWordStart(int64_t from) {
+#ifdef TOKENIZER_X86
+    if (useAVX2())
+        return findWordStartAVX2(data, from, length, markup);
+#endif
+    while (from < length) {
+        byte c = (byte)data[from];
+        if ((characterClass[c] & CLASS_WORD) || ((markup) && ((c == '<') || (c == '&'))))
+            break;
+        from++;
+    }
+    return from;
+}
+
+bool StreamTokenizer::containsUpperCase(int64_t start, int64_t end) {
+    for (int64_t i = start; i < end; i++)
+        if (characterClass[(byte)data[i]] & CLASS_UPPER)
+            return true;
+    return false;
+}
+
+void StreamTokenizer::appendToTerm(int64_t start, int64_t end) {
+    for (int64_t i = start; i < end; i++) {
+        byte c = (byte)data[i];
+        if (termLength >= MAX_TOKEN_LENGTH) {
+            // 切り詰めた位置がマルチバイト文字の途中なら、その文字ごと取り除く
+            if ((!truncated) && ((c & 0xC0) == 0x80)) {
+                while ((termLength > 0) && (((byte)termBuffer[termLength - 1] & 0xC0) == 0x80))
+                    termLength--;
+                if ((termLength > 0) && ((byte)termBuffer[termLength - 1] >= 0xC0))
+                    termLength--;
+            }
+            truncated = true;
+            return;
+        }
+        termBuffer[termLength++] = (characterClass[c] & CLASS_UPPER ? c + ('a' - 'A') : c);
+    }
+}
+
+void StreamTokenizer::emitTerm(Token *token) {
+    token->text = std::string_view(termBuffer, termLength);
+    token->position = nextPosition++;
+    token->type = TOKEN_WORD;
+    termLength = 0;
+    truncated = false;
+}
+
+void StreamTokenizer::emitTag(Token *token, bool endTag) {
+    int len = 0;
+    tagToken[len++] = '<';
+    if (endTag)
+        tagToken[len++] = '/';
+    memcpy(&tagToken[len], tagBuffer, tagLength);
+    len += tagLength;
+    tagToken[len++] = '>';
+    token->text = std::string_view(tagToken, len);
+    token->position = nextPosition++;
+    token->type = (endTag ? TOKEN_END_TAG : TOKEN_START_TAG);
+}
+
+bool StreamTokenizer::getNextToken(Token *token) {
+    if (pendingEndTag) {
+        pendingEndTag = false;
+        emitTag(token, true);
+        return true;
+    }
+    while (true) {
+        switch (state) {
+
+            case STATE_TEXT: {
+                pos = findWordStart(pos);
+                if (pos >= length)
+                    return false;
+                char c = data[pos];
+                if ((markup) && (c == '<')) {
+                    state = STATE_TAG_OPEN;
+                    pos++;
+                    break;
+                }
+                if ((markup) && (c == '&')) {
+                    state = STATE_ENTITY;
+                    entityStart = pos;
+                    entityLength = 0;
+                    pos++;
+                    break;
+                }
+                int64_t end = findWordEnd(pos);
+                if ((end >= length) && (!lastChunk)) {
+                    // 語が次のチャンクに続く可能性がある
+                    appendToTerm(pos, end);
+                    pos = end;
+                    state = STATE_WORD;
+                    return false;
+                }
+                if ((end - pos <= MAX_TOKEN_LENGTH) && (!containsUpperCase(pos, end))) {
+                    // 入力バッファを直接指す
+                    token->text = std::string_view(&data[pos], end - pos);
+                    token->position = nextPosition++;
+                    token->type = TOKEN_WORD;
+                    pos = end;
+                    return true;
+                }
+                appendToTerm(pos, end);
+                pos = end;
+                emitTerm(token);
+                return true;
+            }
+
+            case STATE_WORD: {
+                int64_t end = findWordEnd(pos);
+                appendToTerm(pos, end);
+                pos = end;
+                if ((end >= length) && (!lastChunk))
+                    return false;
+                state = STATE_TEXT;
+                emitTerm(token);
+                return true;
+            }
+
+            case STATE_TAG_OPEN: {
+                if (pos >= length)
+                    return false;
+                char c = data[pos];
+                tagLength = 0;
+                closingTag = false;
+                quote = previous = 0;
+                if (c == '/') {
+                    closingTag = true;
+                    state = STATE_TAG_NAME;
+                    pos++;
+                } else if ((c == '!') || (c == '?')) {
+                    // "<?"の後はコメントとして扱わないように、既に2文字読んだことにする
+                    declarationLength = (c == '!' ? 0 : 2);
+                    dashCount = 0;
+                    state = STATE_DECLARATION;
+                    pos++;
+                } else if (characterClass[(byte)c] & CLASS_TAG_NAME)
+                    state = STATE_TAG_NAME;
+                else {
+                    // "a < b"のような、タグではない'<'
+                    state = STATE_TEXT;
+                }
+                break;
+            }
+
+            case STATE_TAG_NAME: {
+                while ((pos < length) && (characterClass[(byte)data[pos]] & CLASS_TAG_NAME)) {
+                    byte c = (byte)data[pos++];
+                    if (tagLength < MAX_TOKEN_LENGTH)
+                        tagBuffer[tagLength++] = (characterClass[c] & CLASS_UPPER ? c + ('a' - 'A') : c);
+                }
+                if (pos >= length)
+                    return false;
+                state = STATE_TAG_REST;
+                break;
+            }
+
+            case STATE_TAG_REST: {
+                while (pos < length) {
+                    char c = data[pos++];
+                    if (quote != 0) {
+                        if (c == quote)
+                            quote = 0;
+                    } else if ((c == '"') || (c == '\'')) {
+                        quote = c;
+                    } else if (c == '>') {
+                        state = STATE_TEXT;
+                        if (tagLength == 0)
+                            break;
+                        bool selfClosing = ((previous == '/') && (!closingTag));
+                        emitTag(token, closingTag);
+                        pendingEndTag = selfClosing;
+                        return true;
+                    }
+                    previous = c;
+                }
+                if (pos >= length)
+                    return false;
+                break;
+            }
+
+            case STATE_DECLARATION: {
+                while (pos < length) {
+                    char c = data[pos++];
+                    if ((declarationLength < 2) && (c == '-') && (dashCount == declarationLength)) {
+                        dashCount++;
+                        declarationLength++;
+                        if (dashCount == 2) {
+                            dashCount = 0;
+                            state = STATE_COMMENT;
+                            break;
+                        }
+                        continue;
+                    }
+                    declarationLength++;
+                    if (c == '>') {
+                        state = STATE_TEXT;
+                        break;
+                    }
+                }
+                if ((pos >= length) && (state == STATE_DECLARATION))
+                    return false;
+                break;
+            }
+
+            case STATE_COMMENT: {
+                while (pos < length) {
+                    char c = data[pos++];
+                    if (c == '-')
+                        dashCount++;
+                    else if ((c == '>') && (dashCount >= 2)) {
+                        state = STATE_TEXT;
+                        break;
+                    } else
+                        dashCount = 0;
+                }
+                if ((pos >= length) && (state == STATE_COMMENT))
+                    return false;
+                break;
+            }
+
+            case STATE_ENTITY: {
+                while ((pos < length) && (entityLength < MAX_ENTITY_LENGTH)) {
+                    byte c = (byte)data[pos];
+                    if ((!(characterClass[c] & CLASS_WORD)) && (c != '#'))
+                        break;
+                    pos++;
+                    entityLength++;
+                }
+                if ((pos >= length) && (!lastChunk) && (entityLength < MAX_ENTITY_LENGTH))
+                    return false;
+                if ((pos < length) && (data[pos] == ';'))
+                    pos++;
+                else if (entityStart >= 0) {
+                    // 文字参照ではなかったので、'&'の次から語として読み直す
+                    pos = entityStart + 1;
+                }
+                entityStart = -1;
+                state = STATE_TEXT;
+                break;
+            }
+        }
+    }
+}
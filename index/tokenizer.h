@@ -0,0 +1,152 @@
+#ifndef __TOKENIZER_H
+#define __TOKENIZER_H
+
+/*
+StreamTokenizerはインデックス作成用のストリーミングトークナイザ。
+入力はmmapしたファイルや読み込んだチャンクをそのまま与え、コピーせずに走査する。
+各バイトは表引きで「語を構成する文字」かどうかに分類され、AVX2が使える場合は
+pshufbによるニブル単位の表引きで32バイトずつまとめて分類する。
+
+語は英数字とUTF-8のマルチバイト文字の連続で、ASCIIの大文字は小文字に変換される。
+変換が不要な語は入力バッファ内を直接指すstring_viewとして返されるので、
+トークンの取得でメモリ確保は起こらない。変換が必要な語、MAX_TOKEN_LENGTHを
+超えて切り詰められた語、チャンクの境界をまたぐ語は内部のバッファにコピーされる。
+
+markupを有効にすると、<tag ...>と</tag>をそれぞれ"<tag>"と"</tag>"というトークン
+として返し(属性は読み飛ばす)、<tag/>は開始タグと終了タグの2つになる。
+コメント、<!...>、<?...?>、文字参照(&amp;など)は区切り文字として扱う。
+語とタグはどちらも1つずつ位置(ポスティング)を消費する
+*/
+
+#include <string_view>
+#include "index_type.h"
+
+typedef struct {
+
+    // トークンの文字列。次にgetNextTokenを呼び出すまで有効
+    std::string_view text;
+
+    // インデックスのアドレス空間上の位置
+    offset position;
+
+    // TOKEN_WORD, TOKEN_START_TAG, TOKEN_END_TAGのいずれか
+    int type;
+
+} Token;
+
+class StreamTokenizer {
+
+public:
+
+    static const int TOKEN_WORD = 0;
+    static const int TOKEN_START_TAG = 1;
+    static const int TOKEN_END_TAG = 2;
+
+    // 文字参照とみなす"&"以降の最大の長さ
+    static const int MAX_ENTITY_LENGTH = 10;
+
+    static const char *LOG_ID;
+
+private:
+
+    // 入力の状態
+    enum {
+        STATE_TEXT, STATE_WORD, STATE_TAG_OPEN, STATE_TAG_NAME, STATE_TAG_REST,
+        STATE_COMMENT, STATE_DECLARATION, STATE_ENTITY
+    };
+
+    bool markup;
+
+    // 現在のチャンク
+    const char *data;
+    int64_t length, pos;
+
+    // 現在のチャンクが最後のものかどうか
+    bool lastChunk;
+
+    int state;
+
+    // 次のトークンの位置
+    offset nextPosition;
+
+    // 小文字化、切り詰め、チャンク境界をまたぐ語のためのバッファ
+    char termBuffer[MAX_TOKEN_LENGTH + 4];
+    int termLength;
+
+    // 語がMAX_TOKEN_LENGTHを超えたので切り詰められた
+    bool truncated;
+
+    // 読み取り中のタグ名と、それが終了タグかどうか
+    char tagBuffer[MAX_TOKEN_LENGTH + 4];
+    int tagLength;
+    bool closingTag;
+
+    // タグの属性の引用符(0は引用符の外)、直前の文字
+    char quote, previous;
+
+    // コメント内で連続した'-'の数、<!以降に読んだ文字数、文字参照の長さ
+    int dashCount, declarationLength, entityLength;
+
+    // 現在のチャンク内での文字参照の開始位置。チャンクをまたいだ場合は-1
+    int64_t entityStart;
+
+    // <tag/>の開始タグを返した後、終了タグを返す必要がある
+    bool pendingEndTag;
+
+    // 出力用のタグ文字列("<" + 名前 + ">")
+    char tagToken[MAX_TOKEN_LENGTH + 8];
+
+public:
+
+    // markupがtrueの場合、タグと文字参照を解釈する
+    StreamTokenizer(bool markup);
+
+    ~StreamTokenizer();
+
+    // 状態を初期化し、最初のトークンの位置をfirstPositionにする
+    void reset(offset firstPosition);
+
+    /*
+    次のチャンクを与える。チャンクはgetNextTokenがfalseを返すまで有効でなければならない。
+    lastChunkがtrueの場合、チャンクの終わりを入力の終わりとみなす
+    */
+    void setInput(const char *data, int64_t length, bool lastChunk);
+
+    /*
+    次のトークンを取得する。現在のチャンクを使い切った場合はfalseを返すので、
+    次のチャンクをsetInputで与える。最後のチャンクでfalseが返れば入力は終わり
+    */
+    bool getNextToken(Token *token);
+
+    // 次のトークンに割り当てられる位置
+    offset getNextPosition();
+
+    // SIMDによる文字分類を使うかどうか(CPUが対応している場合のみ有効)
+    static void setSIMDEnabled(bool enabled);
+
+    static bool isSIMDAvailable();
+
+    // 語を構成する文字ならtrue
+    static bool isWordCharacter(byte c);
+
+private:
+
+    // 語の終わり(語を構成しない最初の文字)を探す
+    int64_t findWordEnd(int64_t from);
+
+    // 語の始まり、またはmarkupの場合の'<'と'&'を探す
+    int64_t findWordStart(int64_t from);
+
+    // [start, end)に大文字が含まれていればtrue
+    bool containsUpperCase(int64_t start, int64_t end);
+
+    // [start, end)をtermBufferに追加する。小文字化とMAX_TOKEN_LENGTHでの切り詰めを行う
+    void appendToTerm(int64_t start, int64_t end);
+
+    // termBufferの内容を語のトークンとして返す
+    void emitTerm(Token *token);
+
+    void emitTag(Token *token, bool endTag);
+};
+
+#endif
@@ -0,0 +1,292 @@
+#include <cassert>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include "updatelist.h"
+#include "levenshtein.h"
+#include "termdictionary.h"
+#include "../utils/all.h"
+#include "../utils/compression.h"
+
+const char *UpdateList::LOG_ID = "UpdateList";
+
+/*
+各チャンクの先頭に置かれるヘッダ。usedは次のチャンクに移るときに書き込まれる
+(書き込み中のチャンクの使用量は語記述子が持っている)
+*/
+typedef struct {
+    byte *next;
+    int32_t used;
+    int32_t size;
+} UL_ChunkHeader;
+
+// vByteで符号化された差分1個の最大バイト数
+static const int MAX_GAP_LENGTH = 10;
+
+static inline uint32_t hashTerm(const char *term, int *length) {
+    // FNV-1a
+    uint32_t result = 2166136261U;
+    int len = 0;
+    while (term[len] != 0) {
+        result = (result ^ (byte)term[len]) * 16777619U;
+        len++;
+    }
+    *length = len;
+    return result;
+}
+
+UpdateList::UpdateList(int64_t maxMemory) {
+    this->maxMemory = maxMemory;
+    arena = new MemoryArena(ARENA_BLOCK_SIZE);
+    hashTableSize = INITIAL_HASHTABLE_SIZE;
+    hashTable = typed_malloc(int32_t, hashTableSize);
+    for (int i = 0; i < hashTableSize; i++)
+        hashTable[i] = -1;
+    termsAllocated = INITIAL_HASHTABLE_SIZE / 2;
+    terms = typed_malloc(UL_TermDescriptor, termsAllocated);
+    termCount = 0;
+    postingCount = 0;
+    full = false;
+    assert(getMemoryConsumption() <= maxMemory);
+}
+
+UpdateList::~UpdateList() {
+    delete arena;
+    free(hashTable);
+    free(terms);
+}
+
+int64_t UpdateList::getMemoryConsumption() {
+    return arena->getBytesAllocated()
+        + ((int64_t)hashTableSize) * sizeof(int32_t)
+        + ((int64_t)termsAllocated) * sizeof(UL_TermDescriptor);
+}
+
+int64_t UpdateList::getMaxMemory() {
+    return maxMemory;
+}
+
+bool UpdateList::isFull() {
+    if (full)
+        return true;
+    if (getMemoryConsumption() + arena->getBlockSize() <= maxMemory)
+        return false;
+    return !arena->fitsInCurrentBlock(MAX_CHUNK_SIZE);
+}
+
+int UpdateList::getTermCount() {
+    return termCount;
+}
+
+int64_t UpdateList::getPostingCount() {
+    return postingCount;
+}
+
+bool UpdateList::growHashTable() {
+    int32_t newSize = hashTableSize * 2;
+    // 再配置の間は新旧両方のハッシュ表が存在する
+    if (getMemoryConsumption() + ((int64_t)newSize) * (int64_t)sizeof(int32_t) > maxMemory)
+        return false;
+    int32_t *newTable = typed_malloc(int32_t, newSize);
+    for (int i = 0; i < newSize; i++)
+        newTable[i] = -1;
+    uint32_t mask = newSize - 1;
+    for (int32_t id = 0; id < termCount; id++) {
+        uint32_t slot = terms[id].hashValue & mask;
+        while (newTable[slot] >= 0)
+            slot = (slot + 1) & mask;
+        newTable[slot] = id;
+    }
+    free(hashTable);
+    hashTable = newTable;
+    hashTableSize = newSize;
+    return true;
+}
+
+bool UpdateList::growTermArray() {
+    int32_t newSize = termsAllocated * 2;
+    if (getMemoryConsumption() + ((int64_t)newSize) * (int64_t)sizeof(UL_TermDescriptor) > maxMemory)
+        return false;
+    typed_realloc(UL_TermDescriptor, terms, newSize);
+    termsAllocated = newSize;
+    return true;
+}
+
+bool UpdateList::addChunk(UL_TermDescriptor *desc) {
+    int32_t size = MIN_CHUNK_SIZE;
+    if (desc->currentChunk != nullptr)
+        size = std::min(desc->chunkSize * 2, (int32_t)MAX_CHUNK_SIZE);
+    int64_t arenaLimit = maxMemory
+        - ((int64_t)hashTableSize) * sizeof(int32_t)
+        - ((int64_t)termsAllocated) * sizeof(UL_TermDescriptor);
+    byte *chunk = (byte*)arena->allocate(size, arenaLimit);
+    if (chunk == nullptr)
+        return false;
+    UL_ChunkHeader *header = (UL_ChunkHeader*)chunk;
+    header->next = nullptr;
+    header->used = sizeof(UL_ChunkHeader);
+    header->size = size;
+    if (desc->currentChunk == nullptr)
+        desc->firstChunk = chunk;
+    else {
+        UL_ChunkHeader *previous = (UL_ChunkHeader*)desc->currentChunk;
+        previous->used = desc->chunkUsed;
+        previous->next = chunk;
+    }
+    desc->currentChunk = chunk;
+    desc->chunkSize = size;
+    desc->chunkUsed = sizeof(UL_ChunkHeader);
+    return true;
+}
+
+bool UpdateList::addPosting(const char *term, offset posting) {
+    int length;
+    uint32_t hashValue = hashTerm(term, &length);
+    uint32_t mask = hashTableSize - 1;
+    uint32_t slot = hashValue & mask;
+    while (hashTable[slot] >= 0) {
+        UL_TermDescriptor *desc = &terms[hashTable[slot]];
+        if ((desc->hashValue == hashValue) && (desc->termLength == length) &&
+                (memcmp(desc->term, term, length) == 0)) {
+            if (posting <= desc->lastPosting)
+                return true;
+            if (desc->chunkSize - desc->chunkUsed < MAX_GAP_LENGTH)
+                if (!addChunk(desc)) {
+                    full = true;
+                    return false;
+                }
+            desc->chunkUsed += encodeVByte64(
+                    (uint64_t)(posting - desc->lastPosting), &desc->currentChunk[desc->chunkUsed]);
+            desc->lastPosting = posting;
+            desc->postingCount++;
+            postingCount++;
+            return true;
+        }
+        slot = (slot + 1) & mask;
+    }
+
+    // 新しい語: 必要なメモリをすべて確保できることを確認してから登録する
+    if (termCount >= termsAllocated) {
+        if (!growTermArray()) {
+            full = true;
+            return false;
+        }
+    }
+    if ((termCount + 1) * 2 > hashTableSize) {
+        if (!growHashTable()) {
+            full = true;
+            return false;
+        }
+        mask = hashTableSize - 1;
+        slot = hashValue & mask;
+        while (hashTable[slot] >= 0)
+            slot = (slot + 1) & mask;
+    }
+    int64_t arenaLimit = maxMemory
+        - ((int64_t)hashTableSize) * sizeof(int32_t)
+        - ((int64_t)termsAllocated) * sizeof(UL_TermDescriptor);
+    char *internedTerm = (char*)arena->allocate(length + 1, arenaLimit);
+    if (internedTerm == nullptr) {
+        full = true;
+        return false;
+    }
+    memcpy(internedTerm, term, length + 1);
+
+    UL_TermDescriptor *desc = &terms[termCount];
+    desc->hashValue = hashValue;
+    desc->termLength = length;
+    desc->term = internedTerm;
+    desc->postingCount = 1;
+    desc->chunkSize = 0;
+    desc->chunkUsed = 0;
+    desc->firstPosting = desc->lastPosting = posting;
+    desc->firstChunk = desc->currentChunk = nullptr;
+    hashTable[slot] = termCount++;
+    postingCount++;
+    return true;
+}
+
+int32_t UpdateList::findTerm(const char *term) {
+    int length;
+    uint32_t hashValue = hashTerm(term, &length);
+    uint32_t mask = hashTableSize - 1;
+    for (uint32_t slot = hashValue & mask; hashTable[slot] >= 0; slot = (slot + 1) & mask) {
+        UL_TermDescriptor *desc = &terms[hashTable[slot]];
+        if ((desc->hashValue == hashValue) && (strcmp(desc->term, term) == 0))
+            return hashTable[slot];
+    }
+    return -1;
+}
+
+bool UpdateList::expandWildcard(const char *prefix, const char *suffix, int64_t maxTerms,
+        std::vector<std::string> *terms) {
+    int64_t added = 0;
+    for (int32_t i = 0; i < termCount; i++) {
+        if (!matchesWildcard(this->terms[i].term, prefix, suffix))
+            continue;
+        if (++added > maxTerms)
+            return false;
+        terms->push_back(this->terms[i].term);
+    }
+    return true;
+}
+
+bool UpdateList::expandFuzzy(LevenshteinAutomaton *automaton, int64_t maxTerms, std::vector<std::string> *terms) {
+    int64_t added = 0;
+    for (int32_t i = 0; i < termCount; i++) {
+        if ((!isExpandableTerm(this->terms[i].term)) || (!automaton->matches(this->terms[i].term)))
+            continue;
+        if (++added > maxTerms)
+            return false;
+        terms->push_back(this->terms[i].term);
+    }
+    return true;
+}
+
+int32_t *UpdateList::getSortedTermIDs() {
+    int32_t *result = typed_malloc(int32_t, termCount + 1);
+    for (int32_t i = 0; i < termCount; i++)
+        result[i] = i;
+    UL_TermDescriptor *t = terms;
+    std::sort(result, result + termCount, [t](int32_t a, int32_t b) {
+        return strcmp(t[a].term, t[b].term) < 0;
+    });
+    return result;
+}
+
+const char *UpdateList::getTerm(int32_t termID) {
+    assert((termID >= 0) && (termID < termCount));
+    return terms[termID].term;
+}
+
+int UpdateList::getPostingCount(int32_t termID) {
+    assert((termID >= 0) && (termID < termCount));
+    return terms[termID].postingCount;
+}
+
+void UpdateList::getPostings(int32_t termID, offset *buffer) {
+    assert((termID >= 0) && (termID < termCount));
+    UL_TermDescriptor *desc = &terms[termID];
+    buffer[0] = desc->firstPosting;
+    int outPos = 1;
+    offset last = desc->firstPosting;
+    for (byte *chunk = desc->firstChunk; chunk != nullptr; chunk = ((UL_ChunkHeader*)chunk)->next) {
+        int used = (chunk == desc->currentChunk ? desc->chunkUsed : ((UL_ChunkHeader*)chunk)->used);
+        int pos = sizeof(UL_ChunkHeader);
+        while (pos < used) {
+            uint64_t delta;
+            pos += decodeVByte64(&chunk[pos], &delta);
+            last = buffer[outPos++] = last + (offset)delta;
+        }
+    }
+    assert(outPos == desc->postingCount);
+}
+
+void UpdateList::clear() {
+    arena->clear();
+    for (int i = 0; i < hashTableSize; i++)
+        hashTable[i] = -1;
+    termCount = 0;
+    postingCount = 0;
+    full = false;
+}
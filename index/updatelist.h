@@ -0,0 +1,155 @@
+#ifndef __UPDATELIST_H
+#define __UPDATELIST_H
+
+/*
+UpdateListはインデックス作成中のポスティングをメモリ上に蓄積するためのバッファ。
+語はハッシュ表(オープンアドレス法)で管理し、語の文字列とポスティングの格納領域は
+すべてMemoryArenaから切り出す。ポスティングは語ごとに連結されたチャンクに
+vByte形式の差分として追記される。チャンクのサイズは語の出現数に応じて倍々に大きくなる。
+
+使用メモリ(アリーナのブロック、語記述子の配列、ハッシュ表)の合計は
+コンストラクタに与えた上限を決して超えない。上限に達した場合、addPostingはfalseを返し、
+呼び出し元はUpdateListをディスクに書き出してからclearを呼び出す必要がある。
+
+addPostingと読み取りの排他制御は呼び出し元が行う。インデックスはいっぱいになった
+UpdateListを書き出す間もスナップショットから読み取れるように、参照カウントで共有する
+*/
+
+#include <string>
+#include <vector>
+#include "index_type.h"
+#include "../utils/arena.h"
+#include "../utils/refcounted.h"
+
+class LevenshteinAutomaton;
+
+typedef struct {
+
+    // 語のハッシュ値
+    uint32_t hashValue;
+
+    // 語の長さ
+    int32_t termLength;
+
+    // アリーナ内にインターンされた語の文字列(0終端)
+    char *term;
+
+    // この語のポスティング数
+    int32_t postingCount;
+
+    // 現在書き込み中のチャンクのサイズと使用済みバイト数
+    int32_t chunkSize, chunkUsed;
+
+    // 最初と最後のポスティング。2番目以降は直前との差分としてチャンクに格納される
+    offset firstPosting, lastPosting;
+
+    // 最初のチャンクと現在書き込み中のチャンク
+    byte *firstChunk, *currentChunk;
+
+} UL_TermDescriptor;
+
+class UpdateList : public RefCounted {
+
+public:
+
+    // アリーナのブロックサイズ
+    static const int ARENA_BLOCK_SIZE = 256 * 1024;
+
+    // ハッシュ表の初期スロット数(2のべき乗)
+    static const int INITIAL_HASHTABLE_SIZE = 4096;
+
+    // チャンクの最小サイズと最大サイズ(ヘッダを含む)
+    static const int MIN_CHUNK_SIZE = 32;
+    static const int MAX_CHUNK_SIZE = 4096;
+
+    static const char *LOG_ID;
+
+private:
+
+    // メモリ使用量の上限(バイト)
+    int64_t maxMemory;
+
+    MemoryArena *arena;
+
+    // 語記述子の配列。ハッシュ表からは配列内の位置で参照する
+    UL_TermDescriptor *terms;
+    int32_t termCount, termsAllocated;
+
+    // ハッシュ表。空きスロットは-1
+    int32_t *hashTable;
+    int32_t hashTableSize;
+
+    int64_t postingCount;
+
+    // addPostingがメモリ不足で失敗した後、clearが呼ばれるまでtrue
+    bool full;
+
+public:
+
+    UpdateList(int64_t maxMemory);
+
+    ~UpdateList();
+
+    /*
+    termのポスティングを追加する。ポスティングは語ごとに昇順で与えなければならない。
+    同じ語に既存のもの以下のポスティングが与えられた場合は無視される。
+    メモリの上限のために追加できなかった場合はfalseを返す
+    */
+    bool addPosting(const char *term, offset posting);
+
+    // メモリ上限に達し、これ以上ポスティングを追加できない可能性が高い場合にtrue
+    bool isFull();
+
+    // 現在のメモリ使用量(バイト)。常にmaxMemory以下になる
+    int64_t getMemoryConsumption();
+
+    int64_t getMaxMemory();
+
+    int getTermCount();
+
+    int64_t getPostingCount();
+
+    // 語IDを語の辞書順に並べた配列を返す。メモリは呼び出し元で開放しなければいけない
+    int32_t *getSortedTermIDs();
+
+    // 語IDに対応する語を返す
+    const char *getTerm(int32_t termID);
+
+    // 語IDに対応するポスティング数を返す
+    int getPostingCount(int32_t termID);
+
+    /*
+    語IDに対応するすべてのポスティングをbufferに展開する。
+    bufferには少なくともgetPostingCount(termID)個の要素が必要
+    */
+    void getPostings(int32_t termID, offset *buffer);
+
+    // termの語IDを返す。存在しない場合は-1
+    int32_t findTerm(const char *term);
+
+    /*
+    ワイルドカードprefix*suffix(matchesWildcard)に一致する語をtermsに追加する。
+    ハッシュ表は順序を持たないので、すべての語を調べる。
+    一致する語がmaxTermsを超えた場合はfalseを返す
+    */
+    bool expandWildcard(const char *prefix, const char *suffix, int64_t maxTerms, std::vector<std::string> *terms);
+
+    // automatonが受理する語(isExpandableTerm)をtermsに追加する。すべての語を調べる
+    bool expandFuzzy(LevenshteinAutomaton *automaton, int64_t maxTerms, std::vector<std::string> *terms);
+
+    // すべての語とポスティングを破棄する。確保済みのメモリは再利用のために保持される
+    void clear();
+
+private:
+
+    // ハッシュ表を2倍に拡張する。メモリ上限を超える場合はfalseを返す
+    bool growHashTable();
+
+    // 語記述子の配列を拡張する。メモリ上限を超える場合はfalseを返す
+    bool growTermArray();
+
+    // 新しいチャンクを確保してdescにつなげる。メモリ上限を超える場合はfalseを返す
+    bool addChunk(UL_TermDescriptor *desc);
+};
+
+#endif
@@ -0,0 +1,331 @@
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "writeaheadlog.h"
+#include "../utils/all.h"
+
+const char *WriteAheadLog::LOG_ID = "WriteAheadLog";
+
+static char errorMessage[256];
+
+// CRC-32(多項式0xEDB88320)
+static uint32_t updateChecksum(uint32_t crc, const void *data, size_t length) {
+    static uint32_t table[256];
+    static bool tableInitialized = [] {
+        for (uint32_t i = 0; i < 256; i++) {
+            uint32_t c = i;
+            for (int k = 0; k < 8; k++)
+                c = (c & 1 ? 0xEDB88320 ^ (c >> 1) : c >> 1);
+            table[i] = c;
+        }
+        return true;
+    }();
+    (void)tableInitialized;
+    const byte *p = (const byte*)data;
+    crc = ~crc;
+    for (size_t i = 0; i < length; i++)
+        crc = table[(crc ^ p[i]) & 0xFF] ^ (crc >> 8);
+    return ~crc;
+}
+
+static uint32_t computeChecksum(WAL_RecordHeader header, const void *data) {
+    header.checksum = 0;
+    header.padding = 0;
+    uint32_t crc = updateChecksum(0, &header, sizeof(header));
+    return updateChecksum(crc, data, header.length);
+}
+
+// レコードを直列化してoutの末尾に追加する
+static void serializeRecord(std::string *out, int64_t lsn, int32_t type, const void *data, int32_t length) {
+    WAL_RecordHeader header;
+    header.lsn = lsn;
+    header.type = type;
+    header.length = length;
+    header.padding = 0;
+    header.checksum = computeChecksum(header, data);
+    out->append((const char*)&header, sizeof(header));
+    out->append((const char*)data, length);
+}
+
+WriteAheadLog::WriteAheadLog(const char *fileName, int64_t checkpointLSN, bool readOnly) {
+    this->fileName = duplicateString(fileName);
+    this->readOnly = readOnly;
+    pthread_mutex_init(&lock, nullptr);
+    pthread_cond_init(&flushed, nullptr);
+    flushing = false;
+    failed = false;
+    syncCount = 0;
+    closedCleanly = true;
+    lastLSN = durableLSN = checkpointLSN;
+    firstLSN = checkpointLSN + 1;
+    fileSize = WAL_HEADER_SIZE;
+
+    fd = open(fileName, (readOnly ? O_RDONLY : O_RDWR | O_CREAT) | O_LARGEFILE, DEFAULT_FILE_PERMISSIONS);
+    WAL_FileHeader header;
+    struct stat buf;
+    bool valid = (fd >= 0) && (pread(fd, &header, sizeof(header), 0) == sizeof(header)) &&
+        (header.magic == WAL_MAGIC) && (header.version == WAL_VERSION) && (header.firstLSN > 0);
+    if (!valid) {
+        if ((fd >= 0) && (fstat(fd, &buf) == 0) && (buf.st_size > 0)) {
+            snprintf(errorMessage, sizeof(errorMessage), "Corrupt log file: %s. Starting empty.", fileName);
+            log(LOG_ERROR, LOG_ID, errorMessage);
+        }
+        if (readOnly) {
+            if (fd >= 0)
+                ::close(fd);
+            fd = -1;
+        } else if (!initialize(checkpointLSN + 1))
+            failed = true;
+        return;
+    }
+
+    closedCleanly = (header.clean == 1);
+    firstLSN = header.firstLSN;
+    int64_t last = firstLSN - 1;
+    fileSize = scan(0, nullptr, &last);
+    if (last > lastLSN)
+        lastLSN = durableLSN = last;
+    if (readOnly)
+        return;
+    // 書き込み中にクラッシュした末尾のレコードを切り捨て、次に閉じるまでcleanを下ろしておく
+    if ((fstat(fd, &buf) == 0) && (buf.st_size > fileSize) && (ftruncate(fd, fileSize) != 0))
+        failed = true;
+    if (!writeHeader(fd, 0, firstLSN))
+        failed = true;
+}
+
+WriteAheadLog::~WriteAheadLog() {
+    if ((!readOnly) && (fd >= 0) && (!failed) && (!buffer.empty())) {
+        if ((writeFully(fd, buffer, fileSize)) && (fdatasync(fd) == 0))
+            fileSize += buffer.size();
+    }
+    if (fd >= 0)
+        ::close(fd);
+    free(fileName);
+    pthread_cond_destroy(&flushed);
+    pthread_mutex_destroy(&lock);
+}
+
+bool WriteAheadLog::initialize(int64_t nextLSN) {
+    if (fd < 0)
+        fd = open(fileName, O_RDWR | O_CREAT | O_LARGEFILE, DEFAULT_FILE_PERMISSIONS);
+    if ((fd < 0) || (ftruncate(fd, 0) != 0) || (!writeHeader(fd, 0, nextLSN))) {
+        snprintf(errorMessage, sizeof(errorMessage), "Unable to create log file: %s", fileName);
+        log(LOG_ERROR, LOG_ID, errorMessage);
+        return false;
+    }
+    firstLSN = nextLSN;
+    fileSize = WAL_HEADER_SIZE;
+    return true;
+}
+
+bool WriteAheadLog::writeHeader(int fd, int32_t clean, int64_t firstLSN) {
+    char data[WAL_HEADER_SIZE];
+    memset(data, 0, sizeof(data));
+    WAL_FileHeader *header = (WAL_FileHeader*)data;
+    header->magic = WAL_MAGIC;
+    header->version = WAL_VERSION;
+    header->clean = clean;
+    header->firstLSN = firstLSN;
+    return (pwrite(fd, data, sizeof(data), 0) == sizeof(data)) && (fdatasync(fd) == 0);
+}
+
+bool WriteAheadLog::writeFully(int fd, const std::string &data, int64_t position) {
+    size_t done = 0;
+    while (done < data.size()) {
+        ssize_t result = pwrite(fd, data.data() + done, data.size() - done, position + done);
+        if (result <= 0)
+            return false;
+        done += result;
+    }
+    return true;
+}
+
+int64_t WriteAheadLog::scan(int64_t afterLSN, std::vector<WAL_Record> *records, int64_t *lastLSN) {
+    int64_t position = WAL_HEADER_SIZE;
+    int64_t previous = *lastLSN;
+    std::string data;
+    while (true) {
+        WAL_RecordHeader header;
+        if (pread(fd, &header, sizeof(header), position) != sizeof(header))
+            break;
+        if ((header.lsn <= previous) || (header.length < 0) || (header.length > MAX_RECORD_LENGTH))
+            break;
+        data.resize(header.length);
+        if (pread(fd, &data[0], header.length, position + sizeof(header)) != header.length)
+            break;
+        if (computeChecksum(header, data.data()) != header.checksum)
+            break;
+        if ((records != nullptr) && (header.lsn > afterLSN))
+            records->push_back({ header.lsn, header.type, data });
+        previous = header.lsn;
+        position += sizeof(header) + header.length;
+    }
+    *lastLSN = previous;
+    return position;
+}
+
+bool WriteAheadLog::wasClosedCleanly() {
+    return closedCleanly;
+}
+
+bool WriteAheadLog::read(int64_t afterLSN, std::vector<WAL_Record> *records) {
+    if (fd < 0)
+        return false;
+    pthread_mutex_lock(&lock);
+    while (flushing)
+        pthread_cond_wait(&flushed, &lock);
+    int64_t last = firstLSN - 1;
+    scan(afterLSN, records, &last);
+    pthread_mutex_unlock(&lock);
+    return true;
+}
+
+int64_t WriteAheadLog::append(int32_t type, const void *data, int32_t length) {
+    pthread_mutex_lock(&lock);
+    int64_t lsn = ++lastLSN;
+    if (!readOnly)
+        serializeRecord(&buffer, lsn, type, data, length);
+    pthread_mutex_unlock(&lock);
+    return lsn;
+}
+
+bool WriteAheadLog::commit(int64_t lsn) {
+    if (readOnly)
+        return true;
+    pthread_mutex_lock(&lock);
+    while ((durableLSN < lsn) && (!failed)) {
+        if (flushing) {
+            // 他のスレッドが書き込み中。その書き込みに含まれていなければ次の回で書き込む
+            pthread_cond_wait(&flushed, &lock);
+            continue;
+        }
+        flushing = true;
+        std::string batch;
+        batch.swap(buffer);
+        int64_t batchLSN = lastLSN;
+        int64_t position = fileSize;
+        pthread_mutex_unlock(&lock);
+
+        bool ok = (writeFully(fd, batch, position)) && (fdatasync(fd) == 0);
+
+        pthread_mutex_lock(&lock);
+        flushing = false;
+        if (ok) {
+            fileSize = position + batch.size();
+            durableLSN = batchLSN;
+            syncCount++;
+        } else {
+            snprintf(errorMessage, sizeof(errorMessage), "Unable to write log file: %s", fileName);
+            log(LOG_ERROR, LOG_ID, errorMessage);
+            failed = true;
+        }
+        pthread_cond_broadcast(&flushed);
+    }
+    bool result = (durableLSN >= lsn);
+    pthread_mutex_unlock(&lock);
+    return result;
+}
+
+int64_t WriteAheadLog::getLastLSN() {
+    pthread_mutex_lock(&lock);
+    int64_t result = lastLSN;
+    pthread_mutex_unlock(&lock);
+    return result;
+}
+
+void WriteAheadLog::checkpoint(int64_t lsn) {
+    if ((readOnly) || (fd < 0))
+        return;
+    pthread_mutex_lock(&lock);
+    while (flushing)
+        pthread_cond_wait(&flushed, &lock);
+    if ((failed) || (lsn < firstLSN)) {
+        pthread_mutex_unlock(&lock);
+        return;
+    }
+    if (lsn >= lastLSN) {
+        // 書き出していないものも含めて、すべてのレコードが反映済み
+        buffer.clear();
+        if ((ftruncate(fd, WAL_HEADER_SIZE) != 0) || (!writeHeader(fd, 0, lastLSN + 1)))
+            failed = true;
+        firstLSN = lastLSN + 1;
+        fileSize = WAL_HEADER_SIZE;
+        durableLSN = lastLSN;
+        pthread_cond_broadcast(&flushed);
+        pthread_mutex_unlock(&lock);
+        return;
+    }
+
+    /*
+    チェックポイントより後のレコードが残っている。バッファを書き出してから、
+    それらのレコードだけを持つファイルを作って置き換える
+    */
+    flushing = true;
+    std::vector<WAL_Record> records;
+    bool ok = (writeFully(fd, buffer, fileSize)) && (fdatasync(fd) == 0);
+    if (ok) {
+        fileSize += buffer.size();
+        buffer.clear();
+        durableLSN = lastLSN;
+        int64_t last = firstLSN - 1;
+        ok = (scan(lsn, &records, &last) == fileSize);
+    }
+    std::string contents;
+    for (size_t i = 0; i < records.size(); i++)
+        serializeRecord(&contents, records[i].lsn, records[i].type, records[i].data.data(), records[i].data.size());
+    int64_t newFirstLSN = (records.empty() ? lastLSN + 1 : records[0].lsn);
+    char *tempFileName = concatenateStrings(fileName, ".temp");
+    int newFile = (ok ? open(tempFileName, O_RDWR | O_CREAT | O_TRUNC | O_LARGEFILE, DEFAULT_FILE_PERMISSIONS) : -1);
+    ok = (newFile >= 0) && (writeHeader(newFile, 0, newFirstLSN)) &&
+        (writeFully(newFile, contents, WAL_HEADER_SIZE)) && (fdatasync(newFile) == 0) &&
+        (rename(tempFileName, fileName) == 0);
+    if (ok) {
+        ::close(fd);
+        fd = newFile;
+        firstLSN = newFirstLSN;
+        fileSize = WAL_HEADER_SIZE + contents.size();
+    } else {
+        // 古いファイルはそのまま使える。チェックポイントより前のレコードは読み込み時に読み飛ばされる
+        if (newFile >= 0) {
+            ::close(newFile);
+            unlink(tempFileName);
+        }
+        snprintf(errorMessage, sizeof(errorMessage), "Unable to truncate log file: %s", fileName);
+        log(LOG_ERROR, LOG_ID, errorMessage);
+    }
+    free(tempFileName);
+    flushing = false;
+    pthread_cond_broadcast(&flushed);
+    pthread_mutex_unlock(&lock);
+}
+
+void WriteAheadLog::close() {
+    if ((readOnly) || (fd < 0))
+        return;
+    pthread_mutex_lock(&lock);
+    while (flushing)
+        pthread_cond_wait(&flushed, &lock);
+    if (!failed) {
+        if (!buffer.empty()) {
+            if ((writeFully(fd, buffer, fileSize)) && (fdatasync(fd) == 0)) {
+                fileSize += buffer.size();
+                durableLSN = lastLSN;
+            } else
+                failed = true;
+            buffer.clear();
+        }
+        if ((!failed) && (!writeHeader(fd, 1, firstLSN)))
+            failed = true;
+    }
+    pthread_mutex_unlock(&lock);
+}
+
+int64_t WriteAheadLog::getSyncCount() {
+    pthread_mutex_lock(&lock);
+    int64_t result = syncCount;
+    pthread_mutex_unlock(&lock);
+    return result;
+}
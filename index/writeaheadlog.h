@@ -0,0 +1,171 @@
+#ifndef __WRITEAHEADLOG_H
+#define __WRITEAHEADLOG_H
+
+/*
+WriteAheadLogはFileManagerとIndexのメタデータ(表のスロット、使用中と削除済みの
+アドレス範囲、ガベージコレクションの完了)の変更を、チェックポイント(Index::saveDataToDisk)
+より先にディスクに残すための追記専用のログ。
+
+ファイルの形式:
+  [WAL_FileHeader](WAL_HEADER_SIZEバイト)
+  レコードの並び: [WAL_RecordHeader][内容(lengthバイト)]
+レコードにはLSN(ログ内の通し番号。ログを切り詰めても連続する)が付き、チェックサムは
+レコードヘッダと内容の両方にかかる。書き込み中にクラッシュした末尾のレコードは、
+開く時にチェックサムで検出して切り捨てる。
+
+appendはレコードをメモリ上のバッファに追加するだけで、commitでディスクに書き出す。
+commitを同時に呼び出したスレッドのうち1つ(リーダー)がバッファ全体をまとめて書き込んで
+1回だけfdatasyncし、ほかのスレッドはその完了を待つ(group commit)。
+
+checkpoint(lsn)は、LSNがlsn以下のレコードがすべて保存済みの状態に反映されたことを示す。
+それらのレコードはファイルから取り除かれる。ヘッダのcleanは正常に閉じた場合にだけ立ち、
+開いた時点で立っていなければ前回はクラッシュしたので、呼び出し元はreadで得た
+チェックポイントより後のレコードを再実行する
+*/
+
+#include <pthread.h>
+#include <string>
+#include <vector>
+#include "index_type.h"
+
+// ログファイルの先頭を示すマジックナンバーと、形式の版
+#define WAL_MAGIC 0x4c415757
+#define WAL_VERSION 1
+
+// ファイルヘッダの領域の大きさ。最初のレコードはこの位置から始まる
+#define WAL_HEADER_SIZE 64
+
+// レコードの種類
+#define WAL_ADDRESS_SPACE_CHANGE 1
+#define WAL_GARBAGE_COLLECTION 2
+#define WAL_FILE_MANAGER 3
+
+typedef struct {
+    int32_t magic;
+    int32_t version;
+
+    // 前回正常に閉じられた場合に1
+    int32_t clean;
+    int32_t padding;
+
+    // ファイル内の最初のレコードのLSN(レコードが無ければ次に付けるLSN)
+    int64_t firstLSN;
+} WAL_FileHeader;
+
+typedef struct {
+    int64_t lsn;
+    int32_t type;
+    int32_t length;
+
+    // checksumを0とした場合のレコードヘッダと内容のCRC-32
+    uint32_t checksum;
+    uint32_t padding;
+} WAL_RecordHeader;
+
+typedef struct {
+    int64_t lsn;
+    int32_t type;
+    std::string data;
+} WAL_Record;
+
+class WriteAheadLog {
+
+public:
+
+    // これより長いレコードは壊れているとみなす
+    static const int32_t MAX_RECORD_LENGTH = 64 * 1024 * 1024;
+
+    static const char *LOG_ID;
+
+private:
+
+    char *fileName;
+
+    int fd;
+
+    bool readOnly;
+
+    // 前回正常に閉じられたかどうか(開いた時点のヘッダの値)
+    bool closedCleanly;
+
+    // appendとcommitとcheckpointを排他する
+    pthread_mutex_t lock;
+
+    // リーダーの書き込みが終わるたびに通知される
+    pthread_cond_t flushed;
+
+    // まだ書き出していないレコード
+    std::string buffer;
+
+    // 最後に追加したレコードのLSNと、ディスクに書き込み済みの最後のLSN
+    int64_t lastLSN, durableLSN;
+
+    // ファイル内の最初のレコードのLSN
+    int64_t firstLSN;
+
+    // 書き込み済みの部分の大きさ(ヘッダを含む)
+    int64_t fileSize;
+
+    // リーダーが書き込み中、またはcheckpointがファイルを置き換え中の場合にtrue
+    bool flushing;
+
+    // 書き込みに失敗した場合にtrue。以降のcommitはすべて失敗する
+    bool failed;
+
+    // fdatasyncを行った回数
+    int64_t syncCount;
+
+public:
+
+    /*
+    fileNameのログを開く。ファイルが無い場合や壊れている場合は、LSNがcheckpointLSN + 1から
+    始まる空のログを作る。readOnlyの場合はファイルを変更しない
+    */
+    WriteAheadLog(const char *fileName, int64_t checkpointLSN, bool readOnly);
+
+    // 書き出していないレコードを書き出してから閉じる。cleanは立てない(closeを使う)
+    ~WriteAheadLog();
+
+    // 前回正常に閉じられた(closeが呼ばれた)場合にtrue
+    bool wasClosedCleanly();
+
+    // LSNがafterLSNより大きいレコードをLSNの順にrecordsに追加する
+    bool read(int64_t afterLSN, std::vector<WAL_Record> *records);
+
+    // レコードをバッファに追加し、そのLSNを返す
+    int64_t append(int32_t type, const void *data, int32_t length);
+
+    // LSNがlsn以下のすべてのレコードがディスクに書き込まれるまで待つ。失敗した場合はfalse
+    bool commit(int64_t lsn);
+
+    // 最後に追加したレコードのLSN
+    int64_t getLastLSN();
+
+    // LSNがlsn以下のレコードはすべて保存済みの状態に反映されたので、ログから取り除く
+    void checkpoint(int64_t lsn);
+
+    // ヘッダのcleanを立てる。以降にレコードを追加してはいけない
+    void close();
+
+    // これまでにfdatasyncを行った回数
+    int64_t getSyncCount();
+
+private:
+
+    // 空のログを作る
+    bool initialize(int64_t nextLSN);
+
+    /*
+    ファイルの先頭からレコードを順に検証し、正しいレコードが続く部分の大きさを返す。
+    recordsがnullptrでなければ、LSNがafterLSNより大きいレコードを追加する
+    */
+    int64_t scan(int64_t afterLSN, std::vector<WAL_Record> *records, int64_t *lastLSN);
+
+    // ヘッダを書き込んで同期する
+    bool writeHeader(int fd, int32_t clean, int64_t firstLSN);
+
+    // dataをファイルのpositionの位置に書き込む
+    static bool writeFully(int fd, const std::string &data, int64_t position);
+};
+
+#endif
@@ -0,0 +1,420 @@
+#include <cassert>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include "bm25query.h"
+#include "../index/doclevel.h"
+#include "../index/index.h"
+#include "../index/indexview.h"
+#include "../index/extentset.h"
+#include "../index/resultcache.h"
+#include "../index/securitymanager.h"
+#include "../index/tokenizer.h"
+#include "../utils/all.h"
+
+const char *BM25Query::LOG_ID = "BM25Query";
+
+BM25Query::BM25Query(Index *index, const char *queryString, int k) {
+    initialize(index, queryString, k, index->indexOwner);
+}
+
+BM25Query::BM25Query(Index *index, const char *queryString, int k, uid_t userID) {
+    initialize(index, queryString, k, userID);
+}
+
+void BM25Query::initialize(Index *index, const char *queryString, int k, uid_t userID) {
+    this->index = index;
+    this->userID = userID;
+    visible = nullptr;
+    visibleIndex = 0;
+    this->queryString = duplicateString(queryString);
+    this->k = (k < 1 ? 1 : k);
+    // ビューより前に世代を読むので、その世代までの変更はすべてビューに含まれる
+    generation = (index->getResultCache() != nullptr ? index->getUpdateGeneration() : 0);
+    view = index->acquireView();
+    termCount = 0;
+    cursors = nullptr;
+    cursorCount = 0;
+    results = typed_malloc(ScoredDocument, this->k);
+    resultCount = 0;
+    scoredDocumentCount = 0;
+    errorMessage[0] = 0;
+    getConfiguration();
+}
+
+BM25Query::~BM25Query() {
+    closeCursors();
+    free(results);
+    if (view != nullptr)
+        view->release();
+    free(queryString);
+}
+
+void BM25Query::getConfiguration() {
+    getConfigurationDouble("BM25_K1", &BM25_K1, DEFAULT_BM25_K1);
+    getConfigurationDouble("BM25_B", &BM25_B, DEFAULT_BM25_B);
+    if ((BM25_B < 0) || (BM25_B > 1))
+        BM25_B = DEFAULT_BM25_B;
+}
+
+bool BM25Query::parse() {
+    termCount = 0;
+    errorMessage[0] = 0;
+    if (view == nullptr) {
+        snprintf(errorMessage, sizeof(errorMessage), "Index is not available");
+        return false;
+    }
+    StreamTokenizer tokenizer(false);
+    tokenizer.reset(0);
+    tokenizer.setInput(queryString, strlen(queryString), true);
+    Token token;
+    char term[MAX_STEM_LENGTH];
+    while (tokenizer.getNextToken(&token)) {
+        std::string word(token.text);
+        index->getQueryTerm(word.c_str(), false, term);
+        // 同じ語は1つにまとめ、出現回数を重みにする
+        int i = 0;
+        while ((i < termCount) && (strcmp(terms[i], term) != 0))
+            i++;
+        if (i < termCount) {
+            termFrequencies[i]++;
+            continue;
+        }
+        if (termCount >= MAX_QUERY_TERMS) {
+            snprintf(errorMessage, sizeof(errorMessage), "Too many query terms: %s", queryString);
+            log(LOG_DEBUG, LOG_ID, errorMessage);
+            return false;
+        }
+        strcpy(terms[termCount], term);
+        termFrequencies[termCount++] = 1;
+    }
+    if (termCount == 0) {
+        snprintf(errorMessage, sizeof(errorMessage), "Empty query: %s", queryString);
+        log(LOG_DEBUG, LOG_ID, errorMessage);
+        return false;
+    }
+    return true;
+}
+
+const char *BM25Query::getErrorMessage() {
+    return errorMessage;
+}
+
+const ScoredDocument *BM25Query::getResults() {
+    return results;
+}
+
+int64_t BM25Query::getScoredDocumentCount() {
+    return scoredDocumentCount;
+}
+
+double BM25Query::getImpact(int maxTF, int minLengthCode, void *query) {
+    BM25Query *q = (BM25Query*)query;
+    return maxTF * (q->BM25_K1 + 1) / (maxTF + q->lengthNormalization[minLengthCode]);
+}
+
+double BM25Query::getScore(BM25_Cursor *cursor) {
+    return cursor->weight * getImpact(cursor->tf, cursor->lengthCode, this);
+}
+
+void BM25Query::openCursors() {
+    closeCursors();
+    int64_t documentCount, documentLengthSum;
+    index->getDocumentStatistics(&documentCount, &documentLengthSum);
+    if (documentCount == 0)
+        return;
+    double averageLength = (double)documentLengthSum / documentCount;
+    if (averageLength <= 0)
+        averageLength = 1;
+    for (int c = 0; c <= DOC_LEVEL_MAX_LENGTH_CODE; c++)
+        lengthNormalization[c] = BM25_K1 * (1 - BM25_B + BM25_B * decodeDocumentLength(c) / averageLength);
+
+    cursors = typed_malloc(BM25_Cursor, termCount);
+    char term[DOC_LEVEL_PREFIX_LENGTH + MAX_STEM_LENGTH];
+    for (int i = 0; i < termCount; i++) {
+        snprintf(term, sizeof(term), "%s%s", DOC_LEVEL_PREFIX, terms[i]);
+        PostingList *list = new PostingList(view, term);
+        int64_t df = list->getLength();
+        if (df == 0) {
+            delete list;
+            continue;
+        }
+        BM25_Cursor *cursor = &cursors[cursorCount++];
+        cursor->list = list;
+        // 文書頻度は削除された文書を含むので、文書数を超える場合がある
+        if (df > documentCount)
+            df = documentCount;
+        cursor->weight = termFrequencies[i] * log(1 + (documentCount - df + 0.5) / (df + 0.5));
+        cursor->maxScore = cursor->weight * list->getMaxImpact(getImpact, this);
+        cursor->document = -1;
+        cursor->blockFirstDocument = 0;
+        cursor->blockLastDocument = -1;
+        advance(cursor, 0);
+    }
+}
+
+void BM25Query::closeCursors() {
+    for (int i = 0; i < cursorCount; i++)
+        delete cursors[i].list;
+    free(cursors);
+    cursors = nullptr;
+    cursorCount = 0;
+}
+
+void BM25Query::advance(BM25_Cursor *cursor, offset document) {
+    if (cursor->document >= document)
+        return;
+    if (document >= MAX_OFFSET) {
+        cursor->document = MAX_OFFSET;
+        return;
+    }
+    offset start, end;
+    if (cursor->list->getFirstStartBiggerEq(document << DOC_LEVEL_SHIFT, &start, &end)) {
+        cursor->document = getDocumentStart(start);
+        cursor->tf = getDocumentTF(start);
+        cursor->lengthCode = getDocumentLengthCode(start);
+    }
+    else
+        cursor->document = MAX_OFFSET;
+}
+
+double BM25Query::getBlockMaxScore(BM25_Cursor *cursor, offset document) {
+    if ((document >= cursor->blockFirstDocument) && (document <= cursor->blockLastDocument))
+        return cursor->blockMaxScore;
+    int maxTF, minLengthCode;
+    offset lastPosting;
+    cursor->blockFirstDocument = document;
+    if (cursor->list->getImpactBound(document << DOC_LEVEL_SHIFT, &maxTF, &minLengthCode, &lastPosting)) {
+        cursor->blockLastDocument = getDocumentStart(lastPosting);
+        cursor->blockMaxScore = cursor->weight * getImpact(maxTF, minLengthCode, this);
+    }
+    else {
+        cursor->blockLastDocument = MAX_OFFSET;
+        cursor->blockMaxScore = 0;
+    }
+    return cursor->blockMaxScore;
+}
+
+int BM25Query::evaluate(int method) {
+    resultCount = 0;
+    scoredDocumentCount = 0;
+    if (termCount == 0)
+        return 0;
+
+    /*
+    スコアは文書数や平均文書長に依存するので、結果はどの変更でも無効になる。
+    キーには語の順序によらない形(語の昇順)を使う
+    */
+    ResultCache *cache = index->getResultCache();
+    std::string key;
+    if (cache != nullptr) {
+        std::vector<std::string> sortedTerms;
+        for (int i = 0; i < termCount; i++)
+            sortedTerms.push_back(std::string(terms[i]) + "^" + std::to_string(termFrequencies[i]));
+        std::sort(sortedTerms.begin(), sortedTerms.end());
+        key = "bm25 " + std::to_string(method) + " " + std::to_string(k);
+        for (auto &term : sortedTerms)
+            key += " " + term;
+        std::string value;
+        if (cache->lookup(key.c_str(), userID, &value)) {
+            resultCount = value.size() / sizeof(ScoredDocument);
+            memcpy(results, value.data(), resultCount * sizeof(ScoredDocument));
+            return resultCount;
+        }
+    }
+
+    if (index->getSecurityManager() != nullptr)
+        visible = index->getSecurityManager()->getVisibleExtents(userID);
+    visibleIndex = 0;
+    openCursors();
+    TopKCollector collector(k);
+    switch (method) {
+        case METHOD_EXHAUSTIVE:
+            evaluateExhaustive(&collector);
+            break;
+        case METHOD_MAXSCORE:
+            evaluateMaxScore(&collector);
+            break;
+        default:
+            evaluateBlockMaxWAND(&collector);
+            break;
+    }
+    closeCursors();
+    if (visible != nullptr) {
+        visible->release();
+        visible = nullptr;
+    }
+    resultCount = collector.getResults(results);
+    if (cache != nullptr) {
+        std::string value((char*)results, resultCount * sizeof(ScoredDocument));
+        cache->insert(key.c_str(), userID, generation, value, nullptr, std::vector<std::string>(), true);
+    }
+    return resultCount;
+}
+
+bool BM25Query::isVisible(offset document) {
+    if (visible == nullptr)
+        return true;
+    int64_t count = visible->getCount();
+    offset start, end;
+    while (visibleIndex < count) {
+        visible->getExtent(visibleIndex, &start, &end);
+        if (end >= document)
+            return (start <= document);
+        visibleIndex++;
+    }
+    return false;
+}
+
+void BM25Query::evaluateExhaustive(TopKCollector *collector) {
+    while (true) {
+        offset document = MAX_OFFSET;
+        for (int i = 0; i < cursorCount; i++)
+            if (cursors[i].document < document)
+                document = cursors[i].document;
+        if (document == MAX_OFFSET)
+            break;
+        double score = 0;
+        for (int i = 0; i < cursorCount; i++)
+            if (cursors[i].document == document) {
+                score += getScore(&cursors[i]);
+                advance(&cursors[i], document + 1);
+            }
+        scoredDocumentCount++;
+        if (isVisible(document))
+            collector->add(document, score);
+    }
+}
+
+void BM25Query::evaluateMaxScore(TopKCollector *collector) {
+    // スコアの上限の昇順に並べ、upperBound[i]に0..i番目の上限の和を求める
+    BM25_Cursor *order[MAX_QUERY_TERMS];
+    double upperBound[MAX_QUERY_TERMS];
+    for (int i = 0; i < cursorCount; i++) {
+        int j = i;
+        while ((j > 0) && (order[j - 1]->maxScore > cursors[i].maxScore)) {
+            order[j] = order[j - 1];
+            j--;
+        }
+        order[j] = &cursors[i];
+    }
+    for (int i = 0; i < cursorCount; i++)
+        upperBound[i] = order[i]->maxScore + (i > 0 ? upperBound[i - 1] : 0);
+
+    // firstEssentialより前の語だけを含む文書は上位k件に入らない
+    int firstEssential = 0;
+    while (true) {
+        double threshold = collector->getThreshold();
+        while ((firstEssential < cursorCount) && (upperBound[firstEssential] <= threshold))
+            firstEssential++;
+        if (firstEssential >= cursorCount)
+            break;
+        offset document = MAX_OFFSET;
+        for (int i = firstEssential; i < cursorCount; i++)
+            if (order[i]->document < document)
+                document = order[i]->document;
+        if (document == MAX_OFFSET)
+            break;
+
+        double score = 0;
+        for (int i = firstEssential; i < cursorCount; i++)
+            if (order[i]->document == document) {
+                score += getScore(order[i]);
+                advance(order[i], document + 1);
+            }
+        bool pruned = false;
+        for (int i = firstEssential - 1; i >= 0; i--) {
+            if (score + upperBound[i] <= threshold) {
+                pruned = true;
+                break;
+            }
+            advance(order[i], document);
+            if (order[i]->document == document)
+                score += getScore(order[i]);
+        }
+        if (!pruned) {
+            scoredDocumentCount++;
+            if (isVisible(document))
+                collector->add(document, score);
+        }
+    }
+}
+
+void BM25Query::evaluateBlockMaxWAND(TopKCollector *collector) {
+    BM25_Cursor *order[MAX_QUERY_TERMS];
+    for (int i = 0; i < cursorCount; i++)
+        order[i] = &cursors[i];
+    while (true) {
+        // 現在の文書の昇順に並べる(語の数は少なく、ほとんど整列済みなので挿入ソートでよい)
+        for (int i = 1; i < cursorCount; i++) {
+            BM25_Cursor *cursor = order[i];
+            int j = i;
+            while ((j > 0) && (order[j - 1]->document > cursor->document)) {
+                order[j] = order[j - 1];
+                j--;
+            }
+            order[j] = cursor;
+        }
+
+        // スコアの上限の和が初めてしきい値を超える語(ピボット)を探す
+        double threshold = collector->getThreshold();
+        double sum = 0;
+        int pivot = -1;
+        for (int i = 0; (i < cursorCount) && (order[i]->document < MAX_OFFSET); i++) {
+            sum += order[i]->maxScore;
+            if (sum > threshold) {
+                pivot = i;
+                break;
+            }
+        }
+        if (pivot < 0)
+            break;
+        offset pivotDocument = order[pivot]->document;
+        while ((pivot + 1 < cursorCount) && (order[pivot + 1]->document == pivotDocument))
+            pivot++;
+
+        double blockSum = 0;
+        for (int i = 0; i <= pivot; i++)
+            blockSum += getBlockMaxScore(order[i], pivotDocument);
+
+        if (blockSum > threshold) {
+            if (order[0]->document == pivotDocument) {
+                double score = 0;
+                for (int i = 0; i <= pivot; i++) {
+                    score += getScore(order[i]);
+                    advance(order[i], pivotDocument + 1);
+                }
+                scoredDocumentCount++;
+                if (isVisible(pivotDocument))
+                    collector->add(pivotDocument, score);
+            }
+            else {
+                // ピボットより前の語のうち、上限の最も大きいものをピボットの文書まで進める
+                int best = 0;
+                for (int i = 1; (i < pivot) && (order[i]->document < pivotDocument); i++)
+                    if (order[i]->maxScore > order[best]->maxScore)
+                        best = i;
+                advance(order[best], pivotDocument);
+            }
+        }
+        else {
+            /*
+            ピボットまでの語のブロックの上限の和がしきい値以下なので、いずれかのブロックが
+            終わるか、ピボットより後の語の文書に達するまでの文書は上位k件に入らない
+            */
+            offset next = (pivot + 1 < cursorCount ? order[pivot + 1]->document : MAX_OFFSET);
+            for (int i = 0; i <= pivot; i++)
+                if ((order[i]->blockLastDocument < MAX_OFFSET) && (order[i]->blockLastDocument + 1 < next))
+                    next = order[i]->blockLastDocument + 1;
+            int best = 0;
+            for (int i = 1; i <= pivot; i++)
+                if (order[i]->maxScore > order[best]->maxScore)
+                    best = i;
+            advance(order[best], next);
+        }
+    }
+}
@@ -0,0 +1,177 @@
+#ifndef __BM25QUERY_H
+#define __BM25QUERY_H
+
+/*
+BM25Queryは語の集合(bag-of-words)の問い合わせに対して、BM25のスコアが上位k件の
+ドキュメントを返す。スコアの計算には文書単位のポスティング(doclevel.h)を使うので、
+DOCUMENT_LEVEL_INDEXINGが1または2のインデックスでのみ結果が得られる。
+
+すべての文書のスコアを計算する代わりに、次のいずれかの方法で上位k件に入らない文書の
+評価を省略する。いずれの方法でも結果は全件評価(METHOD_EXHAUSTIVE)と同じになる:
+
+    METHOD_MAXSCORE         語をスコアの上限の昇順に並べ、上限の和がk番目のスコア以下の
+                            語(非必須の語)だけを含む文書を読み飛ばす(Turtle and Flood, 1995)
+    METHOD_BLOCK_MAX_WAND   WANDのピボット選択に加えて、スキップエントリに格納された
+                            ブロックごとのスコアの上限を使い、ブロック単位で読み飛ばす
+                            (Ding and Suel, 2011)
+
+スコアの上限は、ブロック内のtfの最大値と文書長の最小値から問い合わせ時に計算するので、
+平均文書長が変わっても上限は正しく保たれる。
+文書数と平均文書長にはIndex::getDocumentStatisticsの値を、文書頻度にはリストの長さを使う
+(どちらも削除された文書を含む)。
+結果はIndexのResultCacheに保持され、インデックスが変更されるまで再利用される。
+ユーザーを指定した場合、そのユーザーから見える範囲(SecurityManager)で始まる文書だけを返す。
+見えない文書は上位k件のしきい値に影響しないので、枝刈りは見える文書だけで行われる。
+インスタンスは1つのスレッドからのみ使うこと
+*/
+
+#include "topkcollector.h"
+#include "../extentlist/extentlist.h"
+#include "../index/stemmer.h"
+
+class ExtentSet;
+class Index;
+class IndexView;
+
+typedef struct {
+
+    PostingList *list;
+
+    // 語の重み(idf × 問い合わせ中の出現回数)
+    double weight;
+
+    // リスト全体でのスコアの上限
+    double maxScore;
+
+    // 現在の文書の開始位置とそのtf、文書長の符号。リストの終端ではMAX_OFFSET
+    offset document;
+    int tf, lengthCode;
+
+    // 直前に求めたブロックのスコアの上限と、その上限が成り立つ文書の範囲
+    double blockMaxScore;
+    offset blockFirstDocument, blockLastDocument;
+
+} BM25_Cursor;
+
+class BM25Query {
+
+public:
+
+    static const char *LOG_ID;
+
+    static const int METHOD_EXHAUSTIVE = 0;
+    static const int METHOD_MAXSCORE = 1;
+    static const int METHOD_BLOCK_MAX_WAND = 2;
+
+    // 1つの問い合わせに含められる語の最大数
+    static const int MAX_QUERY_TERMS = 32;
+
+    // BM25のパラメータ
+    static constexpr double DEFAULT_BM25_K1 = 1.2;
+    configurable double BM25_K1;
+
+    static constexpr double DEFAULT_BM25_B = 0.75;
+    configurable double BM25_B;
+
+private:
+
+    Index *index;
+
+    IndexView *view;
+
+    // 問い合わせを行うユーザー
+    uid_t userID;
+
+    // userIDから見える範囲(制限がない場合はnullptr)と、次に調べる区間の番号
+    ExtentSet *visible;
+    int64_t visibleIndex;
+
+    // viewを取得した時点のインデックスの世代(結果のキャッシュに使う)
+    unsigned int generation;
+
+    char *queryString;
+
+    // 返す文書の最大数
+    int k;
+
+    // 問い合わせの語(インデックスの語の形)と出現回数
+    char terms[MAX_QUERY_TERMS][MAX_STEM_LENGTH];
+    int termFrequencies[MAX_QUERY_TERMS];
+    int termCount;
+
+    BM25_Cursor *cursors;
+    int cursorCount;
+
+    // 文書長の符号ごとのk1 * (1 - b + b * 文書長 / 平均文書長)
+    double lengthNormalization[256];
+
+    ScoredDocument *results;
+    int resultCount;
+
+    // 直前のevaluateでスコアを計算した文書の数
+    int64_t scoredDocumentCount;
+
+    char errorMessage[256];
+
+public:
+
+    // インデックスの所有者として(制限なしで)評価する
+    BM25Query(Index *index, const char *queryString, int k);
+
+    // ユーザーuserIDとして評価する
+    BM25Query(Index *index, const char *queryString, int k, uid_t userID);
+
+    ~BM25Query();
+
+    // 問い合わせを語に分割する。語が1つもない場合はfalseを返す
+    bool parse();
+
+    const char *getErrorMessage();
+
+    /*
+    指定された方法で問い合わせを評価し、結果の数を返す。
+    結果はスコアの降順(同じスコアの場合は文書の昇順)に並ぶ
+    */
+    int evaluate(int method);
+
+    // evaluateの結果。インスタンスはBM25Queryが所有する
+    const ScoredDocument *getResults();
+
+    int64_t getScoredDocumentCount();
+
+private:
+
+    void getConfiguration();
+
+    void initialize(Index *index, const char *queryString, int k, uid_t userID);
+
+    /*
+    documentがuserIDから見えるかどうか。文書は昇順に調べられるので、
+    visibleIndexを前に進めるだけでよい
+    */
+    bool isVisible(offset document);
+
+    // 各語のリストを開き、重みとスコアの上限を求める
+    void openCursors();
+
+    void closeCursors();
+
+    double getScore(BM25_Cursor *cursor);
+
+    // tfと文書長の符号の組のスコアの上限(getMaxImpactの引数として使う)
+    static double getImpact(int maxTF, int minLengthCode, void *query);
+
+    // cursorを開始位置がdocument以上の最初の文書に進める
+    void advance(BM25_Cursor *cursor, offset document);
+
+    // cursorのdocumentを含むブロックのスコアの上限を求める
+    double getBlockMaxScore(BM25_Cursor *cursor, offset document);
+
+    void evaluateExhaustive(TopKCollector *collector);
+
+    void evaluateMaxScore(TopKCollector *collector);
+
+    void evaluateBlockMaxWAND(TopKCollector *collector);
+};
+
+#endif
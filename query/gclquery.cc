@@ -0,0 +1,400 @@
+#include <cassert>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include "gclquery.h"
+#include "../index/index.h"
+#include "../index/indexview.h"
+#include "../index/levenshtein.h"
+#include "../index/extentset.h"
+#include "../index/securitymanager.h"
+#include "../index/termdictionary.h"
+#include "../index/tokenizer.h"
+#include "../utils/all.h"
+
+const char *GCLQuery::LOG_ID = "GCLQuery";
+
+// 演算子の種類
+enum {
+    OP_CONTAINED_IN,
+    OP_CONTAINING,
+    OP_NOT_CONTAINED_IN,
+    OP_NOT_CONTAINING,
+    OP_OR,
+    OP_AND,
+    OP_FOLLOWED_BY
+};
+
+static int getPrecedence(int op) {
+    switch (op) {
+        case OP_OR:
+            return 1;
+        case OP_AND:
+            return 2;
+        case OP_FOLLOWED_BY:
+            return 3;
+        default:
+            return 0;
+    }
+}
+
+// 引用符なしの語を終わらせる文字
+static bool isSpecialCharacter(char c) {
+    return (c <= ' ') || (strchr("()\"<>/+^.", c) != nullptr);
+}
+
+static ExtentList *combine(int op, ExtentList *left, ExtentList *right) {
+    ExtentList **elements;
+    switch (op) {
+        case OP_CONTAINED_IN:
+            return new ExtentList_Containment(right, left, false, false);
+        case OP_CONTAINING:
+            return new ExtentList_Containment(left, right, true, false);
+        case OP_NOT_CONTAINED_IN:
+            return new ExtentList_Containment(right, left, false, true);
+        case OP_NOT_CONTAINING:
+            return new ExtentList_Containment(left, right, true, true);
+        case OP_OR:
+        case OP_AND:
+            elements = typed_malloc(ExtentList*, 2);
+            elements[0] = left;
+            elements[1] = right;
+            if (op == OP_OR)
+                return new ExtentList_OR(elements, 2);
+            return new ExtentList_AND(elements, 2);
+        case OP_FOLLOWED_BY:
+            return new ExtentList_FollowedBy(left, right);
+    }
+    assert(false);
+    return nullptr;
+}
+
+GCLQuery::GCLQuery(Index *index, const char *queryString) {
+    // initializeがビューの参照を追加するので、固定した分は開放する
+    IndexView *view = index->acquireView();
+    initialize(index, view, queryString, index->indexOwner, nullptr);
+    view->release();
+}
+
+GCLQuery::GCLQuery(Index *index, const char *queryString, uid_t userID) {
+    IndexView *view = index->acquireView();
+    initialize(index, view, queryString, userID, nullptr);
+    view->release();
+}
+
+GCLQuery::GCLQuery(Index *index, IndexView *view, const char *queryString) {
+    initialize(index, view, queryString, index->indexOwner, nullptr);
+}
+
+GCLQuery::GCLQuery(Index *index, IndexView *view, const char *queryString, uid_t userID,
+        PostingBlockCache *blockCache) {
+    initialize(index, view, queryString, userID, blockCache);
+}
+
+void GCLQuery::initialize(Index *index, IndexView *view, const char *queryString, uid_t userID,
+        PostingBlockCache *blockCache) {
+    this->index = index;
+    this->queryString = duplicateString(queryString);
+    this->userID = userID;
+    this->blockCache = blockCache;
+    this->view = view;
+    if (view != nullptr)
+        view->addReference();
+    position = 0;
+    result = nullptr;
+    errorMessage[0] = 0;
+    getConfiguration();
+}
+
+void GCLQuery::getConfiguration() {
+    getConfigurationInt64("MAX_WILDCARD_EXPANSION", &MAX_WILDCARD_EXPANSION, DEFAULT_MAX_WILDCARD_EXPANSION);
+    if (MAX_WILDCARD_EXPANSION < 1)
+        MAX_WILDCARD_EXPANSION = DEFAULT_MAX_WILDCARD_EXPANSION;
+}
+
+GCLQuery::~GCLQuery() {
+    delete result;
+    if (view != nullptr)
+        view->release();
+    free(queryString);
+}
+
+bool GCLQuery::parse() {
+    delete result;
+    result = nullptr;
+    errorMessage[0] = 0;
+    position = 0;
+    if (view == nullptr) {
+        setError("Index is not available");
+        return false;
+    }
+    result = parseExpression(0);
+    if (result != nullptr) {
+        skipWhitespace();
+        if (queryString[position] != 0) {
+            setError("Unexpected character");
+            delete result;
+            result = nullptr;
+        }
+    }
+    if ((result != nullptr) && (index->getSecurityManager() != nullptr)) {
+        ExtentList *visible = index->getSecurityManager()->getVisibleExtentList(userID);
+        if (visible != nullptr)
+            result = new ExtentList_Containment(visible, result, false, false);
+    }
+    return (result != nullptr);
+}
+
+const char *GCLQuery::getErrorMessage() {
+    return errorMessage;
+}
+
+ExtentList *GCLQuery::getResult() {
+    return result;
+}
+
+void GCLQuery::setError(const char *message) {
+    if (errorMessage[0] != 0)
+        return;
+    snprintf(errorMessage, sizeof(errorMessage), "%s at position %d: %s", message, position, queryString);
+    log(LOG_DEBUG, LOG_ID, errorMessage);
+}
+
+void GCLQuery::skipWhitespace() {
+    while ((queryString[position] != 0) && (queryString[position] <= ' '))
+        position++;
+}
+
+int GCLQuery::peekOperator(int *operatorLength) {
+    skipWhitespace();
+    const char *s = &queryString[position];
+    *operatorLength = 2;
+    if (strncmp(s, "/<", 2) == 0)
+        return OP_NOT_CONTAINED_IN;
+    if (strncmp(s, "/>", 2) == 0)
+        return OP_NOT_CONTAINING;
+    if (strncmp(s, "..", 2) == 0)
+        return OP_FOLLOWED_BY;
+    *operatorLength = 1;
+    switch (s[0]) {
+        case '<':
+            return OP_CONTAINED_IN;
+        case '>':
+            return OP_CONTAINING;
+        case '+':
+            return OP_OR;
+        case '^':
+            return OP_AND;
+    }
+    return -1;
+}
+
+ExtentList *GCLQuery::parseExpression(int minPrecedence) {
+    ExtentList *left = parsePrimary();
+    if (left == nullptr)
+        return nullptr;
+    while (true) {
+        int operatorLength;
+        int op = peekOperator(&operatorLength);
+        if ((op < 0) || (getPrecedence(op) < minPrecedence))
+            break;
+        position += operatorLength;
+        ExtentList *right = parseExpression(getPrecedence(op) + 1);
+        if (right == nullptr) {
+            delete left;
+            return nullptr;
+        }
+        left = combine(op, left, right);
+    }
+    return left;
+}
+
+ExtentList *GCLQuery::parsePrimary() {
+    skipWhitespace();
+    char c = queryString[position];
+    if (c == '(') {
+        position++;
+        ExtentList *expression = parseExpression(0);
+        if (expression == nullptr)
+            return nullptr;
+        skipWhitespace();
+        if (queryString[position] != ')') {
+            setError("Missing closing parenthesis");
+            delete expression;
+            return nullptr;
+        }
+        position++;
+        return expression;
+    }
+    if (c == '"') {
+        int start = ++position;
+        while ((queryString[position] != 0) && (queryString[position] != '"'))
+            position++;
+        if (queryString[position] != '"') {
+            setError("Missing closing quotation mark");
+            return nullptr;
+        }
+        position++;
+        return createTermList(&queryString[start], position - start - 1);
+    }
+    int start = position;
+    if (queryString[position] == '$')
+        position++;
+    while (!isSpecialCharacter(queryString[position]))
+        position++;
+    if (position == start) {
+        setError((c == 0) ? "Unexpected end of query" : "Unexpected character");
+        return nullptr;
+    }
+    return createTermList(&queryString[start], position - start);
+}
+
+ExtentList *GCLQuery::createTermList(const char *text, int length) {
+    bool stem = false;
+    if ((length > 0) && (text[0] == '$')) {
+        stem = true;
+        text++;
+        length--;
+    }
+    if (memchr(text, '*', length) != nullptr) {
+        if (stem) {
+            setError("Wildcards cannot be stemmed");
+            return nullptr;
+        }
+        return createWildcardList(text, length);
+    }
+    if (memchr(text, '~', length) != nullptr) {
+        if (stem) {
+            setError("Fuzzy terms cannot be stemmed");
+            return nullptr;
+        }
+        return createFuzzyList(text, length);
+    }
+
+    // 引用符の中は索引付けと同じトークナイザで語とタグに分割する
+    char (*terms)[MAX_STEM_LENGTH] = new char[MAX_PHRASE_LENGTH][MAX_STEM_LENGTH];
+    const char *termPointers[MAX_PHRASE_LENGTH];
+    int termCount = 0;
+    StreamTokenizer tokenizer(true);
+    tokenizer.reset(0);
+    tokenizer.setInput(text, length, true);
+    Token token;
+    while (tokenizer.getNextToken(&token)) {
+        if (termCount >= MAX_PHRASE_LENGTH) {
+            setError("Phrase too long");
+            delete[] terms;
+            return nullptr;
+        }
+        std::string word(token.text);
+        index->getQueryTerm(word.c_str(), (stem) && (token.type == StreamTokenizer::TOKEN_WORD), terms[termCount]);
+        termPointers[termCount] = terms[termCount];
+        termCount++;
+    }
+    if (termCount == 0) {
+        setError("Empty term");
+        delete[] terms;
+        return nullptr;
+    }
+
+    ExtentList *list;
+    if (termCount == 1)
+        list = new PostingList(view, terms[0], blockCache);
+    else {
+        char (*rewritten)[MAX_BIGRAM_LENGTH] = new char[termCount][MAX_BIGRAM_LENGTH];
+        int shifts[MAX_PHRASE_LENGTH];
+        int elementCount = index->rewritePhrase(termPointers, termCount, rewritten, shifts);
+        ExtentList **elements = typed_malloc(ExtentList*, elementCount);
+        for (int i = 0; i < elementCount; i++)
+            elements[i] = new PostingList(view, rewritten[i], blockCache);
+        list = new ExtentList_Phrase(elements, shifts, elementCount, termCount);
+        delete[] rewritten;
+    }
+    delete[] terms;
+    return list;
+}
+
+bool GCLQuery::normalizeWord(const char *text, int length, char *result) {
+    result[0] = 0;
+    if (length == 0)
+        return true;
+    StreamTokenizer tokenizer(true);
+    tokenizer.reset(0);
+    tokenizer.setInput(text, length, true);
+    Token token;
+    // 区切り文字を含む場合(foo-*など)は、語の一部として扱えないので拒否する
+    if ((!tokenizer.getNextToken(&token)) || (token.type != StreamTokenizer::TOKEN_WORD) ||
+            ((int)token.text.size() != length))
+        return false;
+    memcpy(result, token.text.data(), length);
+    result[length] = 0;
+    return !tokenizer.getNextToken(&token);
+}
+
+ExtentList *GCLQuery::createWildcardList(const char *text, int length) {
+    const char *star = (const char*)memchr(text, '*', length);
+    int prefixLength = star - text, suffixLength = length - prefixLength - 1;
+    if (memchr(star + 1, '*', suffixLength) != nullptr) {
+        setError("Only one wildcard is allowed per term");
+        return nullptr;
+    }
+    char prefix[MAX_TOKEN_LENGTH + 1], suffix[MAX_TOKEN_LENGTH + 1];
+    if ((prefixLength > MAX_TOKEN_LENGTH) || (suffixLength > MAX_TOKEN_LENGTH) ||
+            (!normalizeWord(text, prefixLength, prefix)) ||
+            (!normalizeWord(star + 1, suffixLength, suffix))) {
+        setError("Invalid wildcard");
+        return nullptr;
+    }
+    if (prefixLength + suffixLength == 0) {
+        setError("Wildcard must contain at least one character");
+        return nullptr;
+    }
+
+    std::vector<std::string> terms;
+    if (!view->expandWildcard(prefix, suffix, MAX_WILDCARD_EXPANSION, &terms)) {
+        setError("Too many terms match the wildcard");
+        return nullptr;
+    }
+    return createExpandedList(terms);
+}
+
+ExtentList *GCLQuery::createFuzzyList(const char *text, int length) {
+    const char *tilde = (const char*)memchr(text, '~', length);
+    int wordLength = tilde - text, distance = LevenshteinAutomaton::MAX_DISTANCE;
+    if (tilde + 1 < text + length) {
+        if ((tilde + 2 != text + length) || (tilde[1] < '1') || (tilde[1] > '0' + LevenshteinAutomaton::MAX_DISTANCE)) {
+            setError("Invalid edit distance");
+            return nullptr;
+        }
+        distance = tilde[1] - '0';
+    }
+    char word[MAX_TOKEN_LENGTH + 1];
+    if ((wordLength == 0) || (wordLength > MAX_TOKEN_LENGTH) || (!normalizeWord(text, wordLength, word))) {
+        setError("Invalid fuzzy term");
+        return nullptr;
+    }
+
+    std::vector<std::string> terms;
+    if (!view->expandFuzzy(word, distance, MAX_WILDCARD_EXPANSION, &terms)) {
+        setError("Too many terms match the fuzzy term");
+        return nullptr;
+    }
+    return createExpandedList(terms);
+}
+
+ExtentList *GCLQuery::createExpandedList(const std::vector<std::string> &terms) {
+    if (terms.empty()) {
+        // 一致する語がなければ結果は空
+        ExtentSet *empty = new ExtentSet();
+        ExtentList *list = new ExtentList_Set(empty);
+        empty->release();
+        return list;
+    }
+    if (terms.size() == 1)
+        return new PostingList(view, terms[0].c_str(), blockCache);
+    ExtentList **elements = typed_malloc(ExtentList*, terms.size());
+    for (size_t i = 0; i < terms.size(); i++)
+        elements[i] = new PostingList(view, terms[i].c_str(), blockCache);
+    return new ExtentList_OR(elements, terms.size());
+}
@@ -0,0 +1,140 @@
+#ifndef __GCLQUERY_H
+#define __GCLQUERY_H
+
+/*
+GCLQueryはGCLの問い合わせ式を構文解析し、ExtentListの木を作る。
+式の構文は次の通りで、演算子は左結合。下の行ほど優先順位が高い:
+
+    A < B,  A > B,  A /< B,  A /> B    包含(Bに含まれるA、Bを含むA、およびその否定)
+    A + B                              いずれか(OR)
+    A ^ B                              両方(AND)
+    A .. B                             Aの後にBが続く
+    ( A )                              括弧
+    "語"、"語 語 ..."、語              語、フレーズ(引用符の中はトークナイザで分割する)
+
+引用符の中では"<doc>"のようにタグも指定できる。引用符の直後に$を付けると
+("$walking")、語幹で検索する。
+
+語は1つの*を含むワイルドカード(foo*、*bar、f*o)でもよい。ワイルドカードは
+IndexView::expandWildcardで一致する語に展開され、それらの語のリストのORになる。
+一致する語がMAX_WILDCARD_EXPANSIONを超える場合は構文エラーと同様に失敗する。
+語の後に~Nを付けると(walkng~1)、編集距離がN(1または2、省略すると2)以下の語のORになる
+(IndexView::expandFuzzy)。展開できる語の数の上限はワイルドカードと同じ。
+ワイルドカードとあいまい検索はフレーズの中や語幹での検索には使えない。
+
+問い合わせはIndexViewを固定した状態で評価されるので、実行中の更新の影響を受けない。
+ユーザーを指定した場合、結果はSecurityManagerが求めたそのユーザーの見える範囲に
+含まれる区間(結果 < 見える範囲)に絞り込まれる。
+フレーズはIndex::rewritePhraseでバイグラムを使う形に書き換えられる
+*/
+
+#include <string>
+#include <vector>
+#include "../extentlist/extentlist.h"
+#include "../utils/all.h"
+
+class Index;
+class IndexView;
+class PostingBlockCache;
+
+class GCLQuery {
+
+public:
+
+    static const char *LOG_ID;
+
+    // 1つの問い合わせに含められるフレーズの最大語数
+    static const int MAX_PHRASE_LENGTH = 64;
+
+    // 1つのワイルドカードを展開してできる語の最大数
+    static const int64_t DEFAULT_MAX_WILDCARD_EXPANSION = 256;
+    configurable int64_t MAX_WILDCARD_EXPANSION;
+
+private:
+
+    Index *index;
+
+    IndexView *view;
+
+    // 問い合わせを行うユーザー
+    uid_t userID;
+
+    // 語のリストが展開済みのブロックを共有するキャッシュ(nullptrの場合は共有しない)
+    PostingBlockCache *blockCache;
+
+    char *queryString;
+
+    // 構文解析中の位置
+    int position;
+
+    ExtentList *result;
+
+    char errorMessage[256];
+
+public:
+
+    // インデックスの所有者として(制限なしで)評価する
+    GCLQuery(Index *index, const char *queryString);
+
+    // ユーザーuserIDとして評価する
+    GCLQuery(Index *index, const char *queryString, uid_t userID);
+
+    // 既に固定されたビューviewに対して評価する(他の問い合わせと同じ状態を読む場合に使う)
+    GCLQuery(Index *index, IndexView *view, const char *queryString);
+
+    /*
+    viewに対してユーザーuserIDとして評価し、語のリストのブロックをblockCacheで共有する
+    (QueryBatchが複数の問い合わせをまとめて評価する場合に使う)
+    */
+    GCLQuery(Index *index, IndexView *view, const char *queryString, uid_t userID,
+            PostingBlockCache *blockCache);
+
+    ~GCLQuery();
+
+    // 問い合わせを構文解析する。構文エラーの場合はfalseを返す
+    bool parse();
+
+    const char *getErrorMessage();
+
+    // 問い合わせの結果のリスト。インスタンスはGCLQueryが所有する
+    ExtentList *getResult();
+
+private:
+
+    void initialize(Index *index, IndexView *view, const char *queryString, uid_t userID,
+            PostingBlockCache *blockCache);
+
+    // 優先順位がminPrecedence以上の演算子からなる式を解析する
+    ExtentList *parseExpression(int minPrecedence);
+
+    ExtentList *parsePrimary();
+
+    // 語またはフレーズのリストを作る
+    ExtentList *createTermList(const char *text, int length);
+
+    // ワイルドカードを展開した語のリストのORを作る
+    ExtentList *createWildcardList(const char *text, int length);
+
+    // 語~Nを、編集距離N以下の語のリストのORにする
+    ExtentList *createFuzzyList(const char *text, int length);
+
+    // 展開した語のリストのORを作る。語がなければ空のリスト
+    ExtentList *createExpandedList(const std::vector<std::string> &terms);
+
+    /*
+    ワイルドカードの*の前または後の部分や、あいまい検索の語をトークナイザで正規化して
+    resultに格納する。1つの語にならない場合はfalseを返す
+    */
+    bool normalizeWord(const char *text, int length, char *result);
+
+    // 次の演算子を読み、その種類を返す。演算子がなければ-1
+    int peekOperator(int *operatorLength);
+
+    void skipWhitespace();
+
+    void setError(const char *message);
+
+    void getConfiguration();
+};
+
+#endif
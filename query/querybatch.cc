@@ -0,0 +1,145 @@
+#include <cassert>
+#include <functional>
+#include <queue>
+#include <string>
+#include <utility>
+#include "querybatch.h"
+#include "gclquery.h"
+#include "../extentlist/postingblockcache.h"
+#include "../index/index.h"
+#include "../index/indexview.h"
+#include "../index/resultcache.h"
+#include "../utils/all.h"
+
+const char *QueryBatch::LOG_ID = "QueryBatch";
+
+QueryBatch::QueryBatch(Index *index, int maxResults) {
+    initialize(index, maxResults, index->indexOwner);
+}
+
+QueryBatch::QueryBatch(Index *index, int maxResults, uid_t userID) {
+    initialize(index, maxResults, userID);
+}
+
+void QueryBatch::initialize(Index *index, int maxResults, uid_t userID) {
+    this->index = index;
+    this->maxResults = (maxResults < 1 ? 1 : maxResults);
+    this->userID = userID;
+    executed = false;
+    getConfiguration();
+    view = index->acquireView();
+    blockCache = new PostingBlockCache(QUERY_BATCH_CACHE_SIZE);
+}
+
+QueryBatch::~QueryBatch() {
+    // 語のリストはキャッシュを参照するので、先に問い合わせを破棄する
+    for (QB_Evaluation &evaluation : evaluations)
+        delete evaluation.query;
+    delete blockCache;
+    if (view != nullptr)
+        view->release();
+}
+
+void QueryBatch::getConfiguration() {
+    getConfigurationInt64("QUERY_BATCH_CACHE_SIZE", &QUERY_BATCH_CACHE_SIZE, DEFAULT_QUERY_BATCH_CACHE_SIZE);
+    if (QUERY_BATCH_CACHE_SIZE < 0)
+        QUERY_BATCH_CACHE_SIZE = DEFAULT_QUERY_BATCH_CACHE_SIZE;
+}
+
+int QueryBatch::addQuery(const char *queryString) {
+    std::string key;
+    ResultCache::normalizeQuery(queryString, &key);
+    auto it = evaluationIDs.find(key);
+    if (it != evaluationIDs.end()) {
+        queries.push_back(it->second);
+        return queries.size() - 1;
+    }
+    QB_Evaluation evaluation;
+    evaluation.query = new GCLQuery(index, view, queryString, userID, blockCache);
+    evaluation.valid = ((view != nullptr) && (evaluation.query->parse()));
+    evaluation.truncated = false;
+    evaluations.push_back(evaluation);
+    evaluationIDs[key] = evaluations.size() - 1;
+    queries.push_back(evaluations.size() - 1);
+    return queries.size() - 1;
+}
+
+int QueryBatch::getQueryCount() {
+    return queries.size();
+}
+
+void QueryBatch::execute() {
+    if (executed)
+        return;
+    executed = true;
+
+    // (次の結果の開始位置, 評価の番号)の最小ヒープ
+    typedef std::pair<offset, int> HeapEntry;
+    std::priority_queue<HeapEntry, std::vector<HeapEntry>, std::greater<HeapEntry>> heap;
+    std::vector<offset> nextEnds(evaluations.size());
+    offset start, end;
+    for (size_t i = 0; i < evaluations.size(); i++) {
+        if (!evaluations[i].valid)
+            continue;
+        if (evaluations[i].query->getResult()->getFirstStartBiggerEq(0, &start, &end)) {
+            nextEnds[i] = end;
+            heap.push(HeapEntry(start, i));
+        }
+    }
+    while (!heap.empty()) {
+        HeapEntry top = heap.top();
+        heap.pop();
+        blockCache->setSweepPosition(top.first);
+        QB_Evaluation *evaluation = &evaluations[top.second];
+        ExtentList *list = evaluation->query->getResult();
+        bool found = list->getFirstStartBiggerEq(top.first + 1, &start, &end);
+        evaluation->starts.push_back(top.first);
+        evaluation->ends.push_back(nextEnds[top.second]);
+        if ((int)evaluation->starts.size() >= maxResults) {
+            evaluation->truncated = found;
+            continue;
+        }
+        if (found) {
+            nextEnds[top.second] = end;
+            heap.push(HeapEntry(start, top.second));
+        }
+    }
+}
+
+bool QueryBatch::isValid(int query) {
+    assert((query >= 0) && (query < (int)queries.size()));
+    return evaluations[queries[query]].valid;
+}
+
+const char *QueryBatch::getErrorMessage(int query) {
+    assert((query >= 0) && (query < (int)queries.size()));
+    return evaluations[queries[query]].query->getErrorMessage();
+}
+
+int QueryBatch::getResultCount(int query) {
+    assert((query >= 0) && (query < (int)queries.size()));
+    return evaluations[queries[query]].starts.size();
+}
+
+const offset *QueryBatch::getStarts(int query) {
+    assert((query >= 0) && (query < (int)queries.size()));
+    return evaluations[queries[query]].starts.data();
+}
+
+const offset *QueryBatch::getEnds(int query) {
+    assert((query >= 0) && (query < (int)queries.size()));
+    return evaluations[queries[query]].ends.data();
+}
+
+bool QueryBatch::isTruncated(int query) {
+    assert((query >= 0) && (query < (int)queries.size()));
+    return evaluations[queries[query]].truncated;
+}
+
+int64_t QueryBatch::getDecodedBlockCount() {
+    return blockCache->getDecodedBlockCount();
+}
+
+int64_t QueryBatch::getSharedBlockCount() {
+    return blockCache->getSharedBlockCount();
+}
@@ -0,0 +1,127 @@
+#ifndef __QUERYBATCH_H
+#define __QUERYBATCH_H
+
+/*
+QueryBatchは多数のGCL問い合わせをまとめて評価する。すべての問い合わせは
+1つのIndexViewに対して評価され、語のリストは1つのPostingBlockCacheを共有するので、
+複数の問い合わせに現れる語のブロックは1回だけ読み込んで展開する。
+正規化すると同じになる問い合わせは1回だけ評価する。
+
+評価では、各問い合わせの次の結果の開始位置をヒープに入れ、アドレス空間の前から順に
+すべての問い合わせを少しずつ進める。そのため、ある位置のブロックを必要とする
+問い合わせは近い時間にまとまり、キャッシュに置くブロックは現在の位置の付近のものだけで
+済む(位置より前で終わるブロックはメモリが足りなくなった時に捨てる)。
+
+定期的に実行する多数の登録済みの問い合わせ(アラートなど)を、問い合わせごとに
+別々に評価する代わりに使う。インスタンスは1つのスレッドからのみ使うこと
+*/
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "../extentlist/extentlist.h"
+#include "../utils/all.h"
+
+class GCLQuery;
+class Index;
+class IndexView;
+class PostingBlockCache;
+
+typedef struct {
+
+    GCLQuery *query;
+
+    // 構文解析に成功したかどうか
+    bool valid;
+
+    // 結果の区間
+    std::vector<offset> starts, ends;
+
+    // maxResultsを超える結果があった場合にtrue
+    bool truncated;
+
+} QB_Evaluation;
+
+class QueryBatch {
+
+public:
+
+    static const char *LOG_ID;
+
+    // 共有するブロックのキャッシュの大きさ(バイト)
+    static const int64_t DEFAULT_QUERY_BATCH_CACHE_SIZE = 64 * 1024 * 1024;
+    configurable int64_t QUERY_BATCH_CACHE_SIZE;
+
+private:
+
+    Index *index;
+
+    IndexView *view;
+
+    PostingBlockCache *blockCache;
+
+    // 問い合わせを行うユーザー
+    uid_t userID;
+
+    // 1つの問い合わせについて保持する結果の最大数
+    int maxResults;
+
+    // 追加された問い合わせごとの、評価(evaluations)の番号
+    std::vector<int> queries;
+
+    std::vector<QB_Evaluation> evaluations;
+
+    // 正規化した問い合わせから評価の番号への対応
+    std::unordered_map<std::string, int> evaluationIDs;
+
+    bool executed;
+
+public:
+
+    // インデックスの所有者として(制限なしで)評価する
+    QueryBatch(Index *index, int maxResults);
+
+    // ユーザーuserIDとして評価する
+    QueryBatch(Index *index, int maxResults, uid_t userID);
+
+    ~QueryBatch();
+
+    /*
+    問い合わせを追加して構文解析し、その番号を返す。構文エラーの場合も番号を返し、
+    isValidがfalseになる
+    */
+    int addQuery(const char *queryString);
+
+    int getQueryCount();
+
+    // 追加されたすべての問い合わせを評価する。2回目以降の呼び出しは何もしない
+    void execute();
+
+    bool isValid(int query);
+
+    const char *getErrorMessage(int query);
+
+    // 問い合わせの結果の数(最大maxResults)
+    int getResultCount(int query);
+
+    // 問い合わせの結果の区間。開始位置の昇順に並ぶ
+    const offset *getStarts(int query);
+
+    const offset *getEnds(int query);
+
+    // maxResultsを超える結果があったかどうか
+    bool isTruncated(int query);
+
+    // 実際に展開したブロックの数と、キャッシュにあったので展開を省略したブロックの数
+    int64_t getDecodedBlockCount();
+
+    int64_t getSharedBlockCount();
+
+private:
+
+    void initialize(Index *index, int maxResults, uid_t userID);
+
+    void getConfiguration();
+};
+
+#endif
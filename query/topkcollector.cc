@@ -0,0 +1,76 @@
+#include <cassert>
+#include <algorithm>
+#include "topkcollector.h"
+#include "../utils/all.h"
+
+TopKCollector::TopKCollector(int k) {
+    assert(k > 0);
+    capacity = k;
+    count = 0;
+    heap = typed_malloc(ScoredDocument, k);
+}
+
+TopKCollector::~TopKCollector() {
+    free(heap);
+}
+
+bool TopKCollector::isWorse(const ScoredDocument &a, const ScoredDocument &b) {
+    // 同じスコアの文書は後の文書から取り除く
+    return (a.score < b.score) || ((a.score == b.score) && (a.document > b.document));
+}
+
+void TopKCollector::siftUp(int i) {
+    while (i > 0) {
+        int parent = (i - 1) / 2;
+        if (!isWorse(heap[i], heap[parent]))
+            break;
+        std::swap(heap[i], heap[parent]);
+        i = parent;
+    }
+}
+
+void TopKCollector::siftDown(int i) {
+    while (true) {
+        int worst = i, left = 2 * i + 1, right = 2 * i + 2;
+        if ((left < count) && (isWorse(heap[left], heap[worst])))
+            worst = left;
+        if ((right < count) && (isWorse(heap[right], heap[worst])))
+            worst = right;
+        if (worst == i)
+            break;
+        std::swap(heap[i], heap[worst]);
+        i = worst;
+    }
+}
+
+bool TopKCollector::add(offset document, double score) {
+    if (count < capacity) {
+        heap[count].document = document;
+        heap[count].score = score;
+        siftUp(count++);
+        return true;
+    }
+    if (score <= heap[0].score)
+        return false;
+    heap[0].document = document;
+    heap[0].score = score;
+    siftDown(0);
+    return true;
+}
+
+double TopKCollector::getThreshold() {
+    return (count < capacity ? 0 : heap[0].score);
+}
+
+int TopKCollector::getCount() {
+    return count;
+}
+
+int TopKCollector::getResults(ScoredDocument *results) {
+    for (int i = 0; i < count; i++)
+        results[i] = heap[i];
+    std::sort(results, results + count, [](const ScoredDocument &a, const ScoredDocument &b) {
+        return isWorse(b, a);
+    });
+    return count;
+}
@@ -0,0 +1,65 @@
+#ifndef __TOPKCOLLECTOR_H
+#define __TOPKCOLLECTOR_H
+
+/*
+TopKCollectorはスコアの高い上位k件の文書を保持する。
+内部は最小ヒープで、先頭に上位k件のうち最もスコアの低い文書がある。
+ヒープがいっぱいになった後は、そのスコア(getThreshold)を超える文書だけが追加されるので、
+MaxScoreやBlock-Max WANDはこの値を超えられない文書の評価を省略できる
+*/
+
+#include "../index/index_type.h"
+
+typedef struct {
+
+    // 文書(文書の開始位置)
+    offset document;
+
+    double score;
+
+} ScoredDocument;
+
+class TopKCollector {
+
+private:
+
+    ScoredDocument *heap;
+    int count, capacity;
+
+public:
+
+    TopKCollector(int k);
+
+    ~TopKCollector();
+
+    /*
+    文書を追加する。ヒープがいっぱいの場合、スコアがgetThresholdより大きい場合にだけ
+    最もスコアの低い文書と入れ替える。追加された場合はtrueを返す
+    */
+    bool add(offset document, double score);
+
+    /*
+    追加される文書が超えなければならないスコア。
+    ヒープがいっぱいになるまでは0(スコアが正の文書はすべて追加される)
+    */
+    double getThreshold();
+
+    int getCount();
+
+    /*
+    保持している文書をスコアの降順(同じスコアの場合は文書の昇順)に整列してresultsに格納し、
+    その数を返す。resultsには少なくともk個の要素が必要
+    */
+    int getResults(ScoredDocument *results);
+
+private:
+
+    // aがbより先にヒープから取り除かれるべきかどうか
+    static bool isWorse(const ScoredDocument &a, const ScoredDocument &b);
+
+    void siftDown(int i);
+
+    void siftUp(int i);
+};
+
+#endif
@@ -0,0 +1,421 @@
+#include <cassert>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <string>
+#include "xpathquery.h"
+#include "gclquery.h"
+#include "../index/extentset.h"
+#include "../index/index.h"
+#include "../index/indexview.h"
+#include "../index/resultcache.h"
+#include "../index/securitymanager.h"
+#include "../index/tokenizer.h"
+#include "../utils/all.h"
+
+const char *XPathQuery::LOG_ID = "XPathQuery";
+
+// タグ名を構成する文字(トークナイザのタグ名と同じ)
+static bool isNameCharacter(char c) {
+    return (StreamTokenizer::isWordCharacter((byte)c)) || ((c != 0) && (strchr("-_:.", c) != nullptr));
+}
+
+static bool startsBefore(const XPathElement &a, const XPathElement &b) {
+    return a.start < b.start;
+}
+
+XPathQuery::XPathQuery(Index *index, const char *queryString) {
+    initialize(index, queryString, index->indexOwner);
+}
+
+XPathQuery::XPathQuery(Index *index, const char *queryString, uid_t userID) {
+    initialize(index, queryString, userID);
+}
+
+void XPathQuery::initialize(Index *index, const char *queryString, uid_t userID) {
+    this->index = index;
+    this->userID = userID;
+    this->queryString = duplicateString(queryString);
+    // ビューより前に世代を読むので、その世代までの変更はすべてビューに含まれる
+    generation = (index->getResultCache() != nullptr ? index->getUpdateGeneration() : 0);
+    view = index->acquireView();
+    position = 0;
+    stepCount = 0;
+    maxLevel = 0;
+    openElementSeen = false;
+    errorMessage[0] = 0;
+}
+
+XPathQuery::~XPathQuery() {
+    clearSteps();
+    for (PostingList *list : levelStarts)
+        delete list;
+    for (PostingList *list : levelEnds)
+        delete list;
+    if (view != nullptr)
+        view->release();
+    free(queryString);
+}
+
+void XPathQuery::clearSteps() {
+    for (int i = 0; i < stepCount; i++) {
+        for (XPathPredicate &predicate : steps[i].predicates)
+            delete predicate.phrase;
+        steps[i].predicates.clear();
+    }
+    stepCount = 0;
+}
+
+bool XPathQuery::parse() {
+    clearSteps();
+    errorMessage[0] = 0;
+    position = 0;
+    if (view == nullptr) {
+        setError("Index is not available");
+        return false;
+    }
+    skipWhitespace();
+    if (queryString[position] != '/') {
+        setError("Path must start with /");
+        return false;
+    }
+    while (queryString[position] == '/') {
+        if (stepCount >= MAX_XPATH_STEPS) {
+            setError("Too many steps");
+            clearSteps();
+            return false;
+        }
+        XPathStep *step = &steps[stepCount++];
+        step->descendant = (queryString[position + 1] == '/');
+        position += (step->descendant ? 2 : 1);
+        if (!parseStep(step)) {
+            clearSteps();
+            return false;
+        }
+        skipWhitespace();
+    }
+    if (queryString[position] != 0) {
+        setError("Unexpected character");
+        clearSteps();
+        return false;
+    }
+    return true;
+}
+
+bool XPathQuery::parseStep(XPathStep *step) {
+    skipWhitespace();
+    int length = 0;
+    if (queryString[position] == '*')
+        position++;
+    else {
+        while (isNameCharacter(queryString[position])) {
+            char c = queryString[position++];
+            if (length < MAX_TOKEN_LENGTH)
+                step->name[length++] = ((c >= 'A') && (c <= 'Z') ? c + ('a' - 'A') : c);
+        }
+        if (length == 0) {
+            setError((queryString[position] == 0) ? "Unexpected end of query" : "Missing name test");
+            return false;
+        }
+    }
+    step->name[length] = 0;
+    while (consume("["))
+        if (!parsePredicate(step))
+            return false;
+    return true;
+}
+
+bool XPathQuery::parsePredicate(XPathStep *step) {
+    if ((!consume("contains")) || (!consume("("))) {
+        setError("Unsupported predicate");
+        return false;
+    }
+    XPathPredicate predicate;
+    if (consume("text()"))
+        predicate.directText = true;
+    else if (consume("."))
+        predicate.directText = false;
+    else {
+        setError("Expected . or text()");
+        return false;
+    }
+    int start, length;
+    if (!consume(",")) {
+        setError("Missing ,");
+        return false;
+    }
+    if (!parseString(&start, &length))
+        return false;
+    if ((!consume(")")) || (!consume("]"))) {
+        setError("Missing closing bracket");
+        return false;
+    }
+
+    // フレーズはGCLの引用符付きの語として評価する
+    std::string phrase = "\"" + std::string(&queryString[start], length) + "\"";
+    predicate.phrase = new GCLQuery(index, view, phrase.c_str());
+    if (!predicate.phrase->parse()) {
+        setError("Invalid phrase");
+        delete predicate.phrase;
+        return false;
+    }
+    step->predicates.push_back(predicate);
+    return true;
+}
+
+bool XPathQuery::parseString(int *start, int *length) {
+    skipWhitespace();
+    char quote = queryString[position];
+    if ((quote != '"') && (quote != '\'')) {
+        setError("Expected string");
+        return false;
+    }
+    *start = ++position;
+    while ((queryString[position] != 0) && (queryString[position] != quote))
+        position++;
+    if (queryString[position] != quote) {
+        setError("Missing closing quotation mark");
+        return false;
+    }
+    *length = position - *start;
+    position++;
+    return true;
+}
+
+bool XPathQuery::consume(const char *s) {
+    skipWhitespace();
+    int length = strlen(s);
+    if (strncmp(&queryString[position], s, length) != 0)
+        return false;
+    position += length;
+    return true;
+}
+
+void XPathQuery::skipWhitespace() {
+    while ((queryString[position] != 0) && (queryString[position] <= ' '))
+        position++;
+}
+
+const char *XPathQuery::getErrorMessage() {
+    return errorMessage;
+}
+
+const XPathElement *XPathQuery::getResults() {
+    return results.data();
+}
+
+void XPathQuery::setError(const char *message) {
+    if (errorMessage[0] != 0)
+        return;
+    snprintf(errorMessage, sizeof(errorMessage), "%s at position %d: %s", message, position, queryString);
+    log(LOG_DEBUG, LOG_ID, errorMessage);
+}
+
+PostingList *XPathQuery::getLevelList(int level, bool endTag) {
+    std::vector<PostingList*> &lists = (endTag ? levelEnds : levelStarts);
+    if ((int)lists.size() <= level)
+        lists.resize(level + 1, nullptr);
+    if (lists[level] == nullptr) {
+        char tag[MAX_STEM_LENGTH];
+        Index::makeLevelTag(level, endTag, tag);
+        lists[level] = new PostingList(view, tag);
+    }
+    return lists[level];
+}
+
+void XPathQuery::getElements(const char *name, int minLevel, int maxLevel, std::vector<XPathElement> *elements) {
+    elements->clear();
+    PostingList *tags = nullptr;
+    if (name[0] != 0) {
+        char tag[MAX_TOKEN_LENGTH + 4];
+        snprintf(tag, sizeof(tag), "<%s>", name);
+        tags = new PostingList(view, tag);
+    }
+    for (int level = minLevel; level <= maxLevel; level++) {
+        PostingList *starts = getLevelList(level, false);
+        PostingList *ends = getLevelList(level, true);
+        offset position = 0, start, end, dummy;
+        while (starts->getFirstStartBiggerEq(position, &start, &dummy)) {
+            if (tags != nullptr) {
+                // 名前のタグとレベルのタグの両方に現れる位置まで交互に読み飛ばす
+                offset tagStart;
+                if (!tags->getFirstStartBiggerEq(start, &tagStart, &dummy))
+                    break;
+                if (tagStart != start) {
+                    position = tagStart;
+                    continue;
+                }
+            }
+            // 同じレベルの要素は重ならないので、開始位置以降の最初の終了タグが対応する
+            if (!ends->getFirstStartBiggerEq(start, &end, &dummy)) {
+                end = MAX_OFFSET;
+                openElementSeen = true;
+            }
+            elements->push_back({ start, end, level });
+            position = start + 1;
+        }
+    }
+    delete tags;
+    if (minLevel < maxLevel)
+        std::sort(elements->begin(), elements->end(), startsBefore);
+}
+
+void XPathQuery::structuralJoin(const std::vector<XPathElement> &ancestors,
+        const std::vector<XPathElement> &descendants, bool child, std::vector<XPathElement> *result) {
+    result->clear();
+    // 現在の位置を含む祖先の候補。下から順に入れ子になっている
+    std::vector<XPathElement> stack;
+    size_t a = 0;
+    for (size_t d = 0; d < descendants.size(); d++) {
+        const XPathElement &descendant = descendants[d];
+        while ((a < ancestors.size()) && (ancestors[a].start < descendant.start)) {
+            while ((!stack.empty()) && (stack.back().end < ancestors[a].start))
+                stack.pop_back();
+            stack.push_back(ancestors[a++]);
+        }
+        while ((!stack.empty()) && (stack.back().end < descendant.start))
+            stack.pop_back();
+        if (stack.empty())
+            continue;
+        if (!child) {
+            result->push_back(descendant);
+            continue;
+        }
+        // スタックの要素はレベルの昇順なので、親になりうるのは上の方の要素だけ
+        for (int i = (int)stack.size() - 1; (i >= 0) && (stack[i].level >= descendant.level - 1); i--)
+            if (stack[i].level == descendant.level - 1) {
+                result->push_back(descendant);
+                break;
+            }
+    }
+}
+
+bool XPathQuery::matchesPredicate(const XPathElement &element, const XPathPredicate &predicate) {
+    ExtentList *list = predicate.phrase->getResult();
+    offset from = element.start, start, end;
+    while (list->getFirstStartBiggerEq(from, &start, &end)) {
+        if (end > element.end)
+            return false;
+        if (!predicate.directText)
+            return true;
+        // 出現位置を含む子要素があれば、その子要素の後から探し直す
+        offset childStart, childEnd, dummy;
+        if ((getLevelList(element.level + 1, false)->getLastStartSmallerEq(start, &childStart, &dummy)) &&
+                (childStart > element.start)) {
+            if (!getLevelList(element.level + 1, true)->getFirstStartBiggerEq(childStart, &childEnd, &dummy))
+                return false;
+            if (childEnd >= start) {
+                from = childEnd + 1;
+                continue;
+            }
+        }
+        return true;
+    }
+    return false;
+}
+
+int XPathQuery::evaluate() {
+    results.clear();
+    if (stepCount == 0)
+        return 0;
+
+    ResultCache *cache = index->getResultCache();
+    std::string key;
+    if (cache != nullptr) {
+        ResultCache::normalizeQuery(queryString, &key);
+        key = "xpath " + key;
+        std::string value;
+        if (cache->lookup(key.c_str(), userID, &value)) {
+            results.resize(value.size() / sizeof(XPathElement));
+            memcpy(results.data(), value.data(), value.size());
+            return results.size();
+        }
+    }
+
+    if (maxLevel == 0)
+        while (getLevelList(maxLevel + 1, false)->getLength() > 0)
+            maxLevel++;
+    openElementSeen = false;
+
+    std::vector<XPathElement> context, candidates, joined;
+    int contextMinLevel = 0, contextMaxLevel = 0;
+    for (int i = 0; i < stepCount; i++) {
+        XPathStep *step = &steps[i];
+        // 前のステップの要素のレベルから、このステップの要素が取りうるレベルを絞り込む
+        int minLevel = contextMinLevel + 1;
+        int maxLevel = (step->descendant ? this->maxLevel : contextMaxLevel + 1);
+        if (maxLevel > this->maxLevel)
+            maxLevel = this->maxLevel;
+        if (minLevel > maxLevel) {
+            context.clear();
+            break;
+        }
+        getElements(step->name, minLevel, maxLevel, &candidates);
+        if (i > 0) {
+            structuralJoin(context, candidates, !step->descendant, &joined);
+            candidates.swap(joined);
+        }
+        context.clear();
+        contextMinLevel = this->maxLevel;
+        contextMaxLevel = 0;
+        for (const XPathElement &element : candidates) {
+            bool matches = true;
+            for (size_t p = 0; (matches) && (p < step->predicates.size()); p++)
+                matches = matchesPredicate(element, step->predicates[p]);
+            if (!matches)
+                continue;
+            context.push_back(element);
+            contextMinLevel = std::min(contextMinLevel, element.level);
+            contextMaxLevel = std::max(contextMaxLevel, element.level);
+        }
+        if (context.empty())
+            break;
+    }
+    results.swap(context);
+    removeInvisibleResults();
+    if (cache != nullptr)
+        addToCache(cache, key);
+    return results.size();
+}
+
+void XPathQuery::removeInvisibleResults() {
+    SecurityManager *securityManager = index->getSecurityManager();
+    if ((securityManager == nullptr) || (results.empty()))
+        return;
+    ExtentSet *visible = securityManager->getVisibleExtents(userID);
+    if (visible == nullptr)
+        return;
+    size_t count = 0;
+    offset start, end;
+    for (const XPathElement &element : results)
+        if ((visible->findContaining(element.start, &start, &end)) && (element.end <= end))
+            results[count++] = element;
+    results.resize(count);
+    visible->release();
+}
+
+void XPathQuery::addToCache(ResultCache *cache, const std::string &key) {
+    /*
+    閉じた要素の中に後から語やタグが追加されることはないので、新しい結果が現れるのは
+    最後のステップの名前のタグ(*の場合は新しい要素の開始タグ)が追加された場合だけ。
+    閉じていない要素が候補にあった場合は、その中に追加された語で述語の結果が変わりうる
+    */
+    std::vector<std::string> dependencies;
+    const char *name = steps[stepCount - 1].name;
+    if (name[0] != 0)
+        dependencies.push_back("<" + std::string(name) + ">");
+    else {
+        char tag[MAX_STEM_LENGTH];
+        for (int level = 1; level <= maxLevel + 1; level++) {
+            Index::makeLevelTag(level, false, tag);
+            dependencies.push_back(tag);
+        }
+    }
+    ExtentSet *extents = new ExtentSet();
+    for (const XPathElement &element : results)
+        extents->add(element.start, element.end);
+    std::string value((const char*)results.data(), results.size() * sizeof(XPathElement));
+    cache->insert(key.c_str(), userID, generation, value, extents, dependencies, openElementSeen);
+    extents->release();
+}
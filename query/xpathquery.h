@@ -0,0 +1,175 @@
+#ifndef __XPATHQUERY_H
+#define __XPATHQUERY_H
+
+/*
+XPathQueryはXPathの部分集合を評価し、条件を満たす要素の範囲を返す。
+インデックスはENABLE_XPATHを有効にして作成されていなければならない。
+対応する構文:
+
+    /a/b        子の軸(ルートからのパスの最初の/は最も外側の要素を表す)
+    //a         子孫の軸
+    *           任意の名前の要素
+    a[contains(., "語 語")]       要素の中(子孫を含む)にフレーズが現れる
+    a[contains(text(), "語")]     要素の直下のテキスト(子要素の外)にフレーズが現れる
+
+述語は複数並べることができ、すべてを満たす要素が選ばれる。
+
+要素の範囲とネストレベルは<level!N>と</level!N>のポスティングから求める。同じレベルの
+要素は重ならないので、レベルNのi番目の開始タグはi番目の終了タグに対応する。名前の
+付いた要素は<name>と<level!N>の両方に現れる開始位置として求める。ステップごとに
+取りうるレベルの範囲を絞り込み(子の軸だけからなるパスではレベルは1つに決まる)、
+前のステップの要素と開始位置の順にスタックを使って構造結合(Stack-Tree-Desc,
+Al-Khalifa et al., 2002)することで、文書全体を読まずに親子・祖先子孫の関係を判定する。
+
+問い合わせはIndexViewを固定した状態で評価されるので、実行中の更新の影響を受けない。
+結果はIndexのResultCacheに保持され、結果に影響する変更があるまで再利用される。
+ユーザーを指定した場合、そのユーザーから見える範囲(SecurityManager)に含まれる要素だけを返す。
+インスタンスは1つのスレッドからのみ使うこと
+*/
+
+#include <string>
+#include <vector>
+#include "../extentlist/extentlist.h"
+
+class GCLQuery;
+class Index;
+class IndexView;
+class ResultCache;
+
+typedef struct {
+
+    // 開始タグと終了タグの位置
+    offset start, end;
+
+    // ネストレベル(最も外側の要素が1)
+    int level;
+
+} XPathElement;
+
+typedef struct {
+
+    // trueの場合はtext()(要素の直下のテキスト)、falseの場合は.(要素全体)
+    bool directText;
+
+    // フレーズのリスト。GCLQueryが所有する
+    GCLQuery *phrase;
+
+} XPathPredicate;
+
+typedef struct {
+
+    // 子孫の軸(//)かどうか
+    bool descendant;
+
+    // タグ名。任意の名前(*)の場合は空文字列
+    char name[MAX_TOKEN_LENGTH + 1];
+
+    std::vector<XPathPredicate> predicates;
+
+} XPathStep;
+
+class XPathQuery {
+
+public:
+
+    static const char *LOG_ID;
+
+    // 1つのパスに含められるステップの最大数
+    static const int MAX_XPATH_STEPS = 32;
+
+private:
+
+    Index *index;
+
+    IndexView *view;
+
+    // 問い合わせを行うユーザー
+    uid_t userID;
+
+    // viewを取得した時点のインデックスの世代(結果のキャッシュに使う)
+    unsigned int generation;
+
+    char *queryString;
+
+    // 構文解析中の位置
+    int position;
+
+    XPathStep steps[MAX_XPATH_STEPS];
+    int stepCount;
+
+    // インデックスに含まれる最も深いネストレベル
+    int maxLevel;
+
+    // レベルごとの<level!N>と</level!N>のリスト。必要になった時に作る
+    std::vector<PostingList*> levelStarts, levelEnds;
+
+    std::vector<XPathElement> results;
+
+    // 直前のevaluateで、終了タグのない(閉じていない)要素が候補になった場合にtrue
+    bool openElementSeen;
+
+    char errorMessage[256];
+
+public:
+
+    // インデックスの所有者として(制限なしで)評価する
+    XPathQuery(Index *index, const char *queryString);
+
+    // ユーザーuserIDとして評価する
+    XPathQuery(Index *index, const char *queryString, uid_t userID);
+
+    ~XPathQuery();
+
+    // 問い合わせを構文解析する。構文エラーの場合はfalseを返す
+    bool parse();
+
+    const char *getErrorMessage();
+
+    // 問い合わせを評価し、結果の要素の数を返す
+    int evaluate();
+
+    // evaluateの結果。開始位置の昇順に並ぶ
+    const XPathElement *getResults();
+
+private:
+
+    void initialize(Index *index, const char *queryString, uid_t userID);
+
+    // userIDから見えない範囲にかかる要素をresultsから取り除く
+    void removeInvisibleResults();
+
+    bool parseStep(XPathStep *step);
+
+    bool parsePredicate(XPathStep *step);
+
+    // 引用符で囲まれた文字列を読み、その範囲を返す
+    bool parseString(int *start, int *length);
+
+    // 次の空白以外の文字がsであれば読み飛ばしてtrueを返す
+    bool consume(const char *s);
+
+    void skipWhitespace();
+
+    void setError(const char *message);
+
+    void clearSteps();
+
+    PostingList *getLevelList(int level, bool endTag);
+
+    // レベルがminLevelからmaxLevelまでの、名前がnameの要素を開始位置の順に返す
+    void getElements(const char *name, int minLevel, int maxLevel, std::vector<XPathElement> *elements);
+
+    /*
+    descendantsのうち、ancestorsのいずれかの子(childがtrueの場合)または子孫である
+    要素だけをresultに格納する。どちらのリストも開始位置の順に並んでいること
+    */
+    static void structuralJoin(const std::vector<XPathElement> &ancestors,
+            const std::vector<XPathElement> &descendants, bool child, std::vector<XPathElement> *result);
+
+    bool matchesPredicate(const XPathElement &element, const XPathPredicate &predicate);
+
+    // evaluateの結果を、それが依存する語とともにキャッシュに追加する
+    void addToCache(ResultCache *cache, const std::string &key);
+};
+
+#endif
@@ -0,0 +1,127 @@
+#include <iostream>
+#include <cassert>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include "../../index/index.h"
+#include "../../utils/all.h"
+
+static const char *TEST_DIR = "/tmp/test_bigram";
+
+static void cleanup() {
+    std::string command = "rm -rf " + std::string(TEST_DIR);
+    system(command.c_str());
+}
+
+static const char *VOCABULARY[] = { "the", "of", "cat", "sat", "on", "mat", "dog", "<p>" };
+static const int VOCABULARY_SIZE = 8;
+
+static int64_t countPostings(Index *index, const char *term) {
+    int64_t count;
+    offset *postings = index->getPostings(term, &count);
+    free(postings);
+    return count;
+}
+
+// textの語を位置firstから順にインデックスに追加する。chunkSize語ずつaddPostingsを呼び出す
+static void addText(Index *index, const std::vector<const char*> &text, offset first, int chunkSize) {
+    for (size_t start = 0; start < text.size(); start += chunkSize) {
+        std::vector<char*> terms;
+        std::vector<offset> postings;
+        for (size_t i = start; (i < start + chunkSize) && (i < text.size()); i++) {
+            terms.push_back((char*)text[i]);
+            postings.push_back(first + i);
+        }
+        index->addPostings(terms.data(), postings.data(), terms.size());
+    }
+}
+
+// フレーズの出現位置を先頭から数えて求める
+static std::vector<offset> findPhrase(const std::vector<const char*> &text, offset first,
+        const std::vector<const char*> &phrase) {
+    std::vector<offset> result;
+    for (size_t i = 0; i + phrase.size() <= text.size(); i++) {
+        bool match = true;
+        for (size_t k = 0; (k < phrase.size()) && (match); k++)
+            match = (strcmp(text[i + k], phrase[k]) == 0);
+        if (match)
+            result.push_back(first + i);
+    }
+    return result;
+}
+
+void test_bigram_postings() {
+    cleanup();
+    {
+        Index index(TEST_DIR, false);
+        assert(index.BIGRAM_INDEXING);
+        std::vector<const char*> text = { "the", "cat", "sat", "on", "the", "mat", "<p>", "the", "dog" };
+        addText(&index, text, 100, 2);
+
+        // 呼び出しをまたぐ組もバイグラムになる
+        assert(countPostings(&index, "the cat") == 1);
+        assert(countPostings(&index, "the mat") == 1);
+        assert(countPostings(&index, "the dog") == 1);
+        // 一覧にない語で始まる組とタグを含む組は追加されない
+        assert(countPostings(&index, "cat sat") == 0);
+        assert(countPostings(&index, "mat <p>") == 0);
+        assert(countPostings(&index, "the") == 3);
+
+        int64_t count;
+        offset *postings = index.getPostings("the mat", &count);
+        assert((count == 1) && (postings[0] == 104));
+        free(postings);
+    }
+    {
+        // 対象の語の一覧はインデックスから読み込まれる
+        Index index(TEST_DIR, false);
+        assert(index.isBigramFirstWord("the"));
+        assert(index.isBigramFirstWord("of"));
+        assert(!index.isBigramFirstWord("cat"));
+    }
+    cleanup();
+    std::cout << "test_bigram_postings passed.\n";
+}
+
+void test_phrase_queries() {
+    cleanup();
+    {
+        Index index(TEST_DIR, false);
+        srand(11);
+        std::vector<const char*> text;
+        for (int i = 0; i < 20000; i++)
+            text.push_back(VOCABULARY[rand() % VOCABULARY_SIZE]);
+        addText(&index, text, 1000, 333);
+        index.flushUpdateList();
+
+        for (int length = 1; length <= 5; length++) {
+            for (int n = 0; n < 50; n++) {
+                std::vector<const char*> phrase;
+                for (int k = 0; k < length; k++)
+                    phrase.push_back(VOCABULARY[rand() % VOCABULARY_SIZE]);
+                std::vector<offset> expected = findPhrase(text, 1000, phrase);
+                int64_t count;
+                offset *result = index.getPhrasePostings(phrase.data(), length, &count);
+                assert(count == (int64_t)expected.size());
+                for (int64_t k = 0; k < count; k++)
+                    assert(result[k] == expected[k]);
+                free(result);
+            }
+        }
+    }
+    cleanup();
+    std::cout << "test_phrase_queries passed.\n";
+}
+
+int main() {
+    const char *argv[] = { "bigram_test", "--BIGRAM_INDEXING=true", "--BIGRAM_FIRST_WORDS=\"the\" \"of\"" };
+    initializeConfiguratorFromCommandLineParameters(3, argv);
+    setLogLevel(LOG_ERROR + 1);
+
+    test_bigram_postings();
+    test_phrase_queries();
+
+    std::cout << "All bigram tests passed.\n";
+}
@@ -0,0 +1,116 @@
+#include <iostream>
+#include <cassert>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <set>
+#include <string>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "../../index/crawler.h"
+#include "../../utils/all.h"
+
+static const char *TEST_DIR = "/tmp/test_crawler";
+
+static void cleanup() {
+    std::string command = "rm -rf " + std::string(TEST_DIR);
+    system(command.c_str());
+}
+
+static void createFile(const std::string &path, int size) {
+    FILE *f = fopen(path.c_str(), "w");
+    assert(f != nullptr);
+    for (int i = 0; i < size; i++)
+        fputc('a', f);
+    fclose(f);
+}
+
+// 期待されるファイルの集合を返す
+static std::set<std::string> createTree() {
+    cleanup();
+    std::set<std::string> expected;
+    std::string base = TEST_DIR;
+    mkdir(TEST_DIR, 0700);
+    for (int i = 0; i < 8; i++) {
+        std::string dir = base + "/d" + std::to_string(i);
+        mkdir(dir.c_str(), 0700);
+        for (int j = 0; j < 4; j++) {
+            std::string sub = dir + "/s" + std::to_string(j);
+            mkdir(sub.c_str(), 0700);
+            for (int k = 0; k < 10; k++) {
+                std::string file = sub + "/f" + std::to_string(k);
+                createFile(file, 16);
+                expected.insert(file);
+            }
+        }
+    }
+    // 小さすぎるファイルと大きすぎるファイル
+    createFile(base + "/tiny", 2);
+    createFile(base + "/huge", 5000);
+    createFile(base + "/ok", 100);
+    expected.insert(base + "/ok");
+
+    // .index_disallowを含むディレクトリは部分木ごと除外される
+    std::string hidden = base + "/hidden";
+    mkdir(hidden.c_str(), 0700);
+    mkdir((hidden + "/sub").c_str(), 0700);
+    createFile(hidden + "/secret", 100);
+    createFile(hidden + "/sub/secret", 100);
+    createFile(hidden + "/.index_disallow", 0);
+
+    // シンボリックリンクはたどらない
+    symlink((base + "/d0").c_str(), (base + "/link").c_str());
+    symlink((base + "/ok").c_str(), (base + "/filelink").c_str());
+    return expected;
+}
+
+static void crawl(const std::set<std::string> &expected) {
+    Crawler crawler(TEST_DIR, 8, 4096);
+    crawler.start();
+    std::set<std::string> found;
+    CrawledFile file;
+    while (crawler.getNextFile(&file)) {
+        assert(found.find(file.path) == found.end());
+        found.insert(file.path);
+        assert((file.fileSize >= 8) && (file.fileSize <= 4096));
+        free(file.path);
+    }
+    assert(found == expected);
+    assert(crawler.getFileCount() == (int64_t)expected.size());
+    assert(crawler.getDirectoryCount() == 1 + 8 + 8 * 4 + 1);
+    assert(crawler.getSkippedCount() == 1);
+}
+
+void test_crawl_tree() {
+    std::set<std::string> expected = createTree();
+    crawl(expected);
+    cleanup();
+    std::cout << "test_crawl_tree passed.\n";
+}
+
+void test_stop_while_queue_full() {
+    createTree();
+    {
+        // 取り出さずに中止しても、ワーカーは待ち状態から抜けて終了する
+        Crawler crawler(TEST_DIR, 8, 4096);
+        crawler.start();
+        CrawledFile file;
+        assert(crawler.getNextFile(&file));
+        free(file.path);
+        crawler.stop();
+        assert(!crawler.getNextFile(&file));
+    }
+    cleanup();
+    std::cout << "test_stop_while_queue_full passed.\n";
+}
+
+int main() {
+    const char *argv[] = { "crawler_test", "--CRAWLER_THREADS=4", "--CRAWLER_QUEUE_SIZE=3" };
+    initializeConfiguratorFromCommandLineParameters(3, argv);
+    setLogLevel(LOG_ERROR + 1);
+
+    test_crawl_tree();
+    test_stop_while_queue_full();
+
+    std::cout << "All crawler tests passed.\n";
+}
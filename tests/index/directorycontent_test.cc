@@ -0,0 +1,67 @@
+#include <iostream>
+#include <cassert>
+#include <cstdlib>
+#include <map>
+#include "../../filemanager/directorycontent.h"
+#include "../../utils/all.h"
+
+// ハッシュ表の内容を、同じ操作を行ったmultimapと比較する
+void test_directory_content() {
+    DicrectoryContent dc;
+    initializeDirectoryContent(&dc);
+    std::multimap<int32_t, int32_t> expected;
+    int32_t ids[64];
+    srand(5);
+    for (int i = 0; i < 200000; i++) {
+        // 衝突が起きるように、ハッシュ値の範囲を狭くする
+        int32_t hashValue = rand() % 50000 - 25000;
+        if ((rand() % 3 != 0) || (expected.empty())) {
+            int32_t id = (i % 2 == 0 ? makeFileEntry(i) : makeDirectoryEntry(i));
+            addChild(&dc, hashValue, id);
+            expected.insert({ hashValue, id });
+        }
+        else {
+            auto it = expected.lower_bound(hashValue);
+            if (it == expected.end())
+                it = expected.begin();
+            assert(removeChild(&dc, it->first, it->second));
+            assert(!removeChild(&dc, it->first, it->second));
+            expected.erase(it);
+        }
+        if (i % 1000 == 0) {
+            int n = getChildrenByHash(&dc, hashValue, ids, 64);
+            assert(n == (int)expected.count(hashValue));
+            for (int k = 0; k < n; k++) {
+                bool found = false;
+                for (auto range = expected.equal_range(hashValue); range.first != range.second; ++range.first)
+                    found |= (range.first->second == ids[k]);
+                assert(found);
+            }
+        }
+        assert(dc.count == (int32_t)expected.size());
+        assert(dc.count * 10 <= dc.slotCount * 9);
+    }
+    for (auto it = expected.begin(); it != expected.end(); ++it) {
+        int n = getChildrenByHash(&dc, it->first, ids, 64);
+        bool found = false;
+        for (int k = 0; k < n; k++)
+            found |= (ids[k] == it->second);
+        assert(found);
+    }
+    for (auto it = expected.begin(); it != expected.end(); ++it)
+        assert(removeChild(&dc, it->first, it->second));
+    assert(dc.count == 0);
+    assert(getChildrenByHash(&dc, 0, ids, 64) == 0);
+    freeDirectoryContent(&dc);
+    std::cout << "test_directory_content passed.\n";
+}
+
+int main() {
+    const char *argv[] = { "directorycontent_test" };
+    initializeConfiguratorFromCommandLineParameters(1, argv);
+    setLogLevel(LOG_ERROR + 1);
+
+    test_directory_content();
+
+    std::cout << "All directory content tests passed.\n";
+}
@@ -0,0 +1,105 @@
+#include <iostream>
+#include <cassert>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <sys/stat.h>
+#include "../../filemanager/filemanager.h"
+#include "../../index/extentset.h"
+#include "../../index/index.h"
+#include "../../index/securitymanager.h"
+#include "../../utils/all.h"
+
+static const char *TEST_DIR = "/tmp/test_filemanager";
+
+// インデックスの所有者でもスーパーユーザーでもないユーザー
+static const uid_t USER = 12345;
+static const gid_t GROUP = 4321;
+
+static void cleanup() {
+    std::string command = "rm -rf " + std::string(TEST_DIR);
+    system(command.c_str());
+}
+
+// 見える範囲を区間の列として返す
+static std::vector<std::pair<offset, offset>> getVisible(Index *index, uid_t userID) {
+    std::vector<std::pair<offset, offset>> result;
+    ExtentSet *visible = index->getSecurityManager()->getVisibleExtents(userID);
+    assert(visible != nullptr);
+    for (int64_t i = 0; i < visible->getCount(); i++) {
+        offset start, end;
+        visible->getExtent(i, &start, &end);
+        result.push_back({ start, end });
+    }
+    visible->release();
+    return result;
+}
+
+// 表はヘッダと固定の配置の要素の配列としてそのまま保存され、版が異なる場合は読み込まれない
+void test_file_manager_tables() {
+    cleanup();
+    std::string directoryFile = std::string(TEST_DIR) + "/index.directories";
+    std::string iNodeFile = std::string(TEST_DIR) + "/index.inodes";
+    int32_t file;
+    {
+        Index index(TEST_DIR, false);
+        FileManager *fm = index.getFileManager();
+        int32_t dir = fm->createDirectory(0, "data", USER, GROUP, 0750);
+        char name[32];
+        for (int i = 0; i < 2000; i++) {
+            snprintf(name, sizeof(name), "f%d", i);
+            assert(fm->addFile(dir, name, USER, GROUP, 0640, 1 + 5 * i, 5) >= 0);
+        }
+        file = fm->getFileID("/data/f1234");
+        assert(file >= 0);
+    }
+    struct stat buf;
+    assert(stat(iNodeFile.c_str(), &buf) == 0);
+    assert(buf.st_size >= (off_t)(FM_TABLE_HEADER_SIZE + 2000 * sizeof(IndexedINode)));
+    assert((buf.st_size - FM_TABLE_HEADER_SIZE) % sizeof(IndexedINode) == 0);
+    {
+        // 名前を引く前でも、IDによる参照とセキュリティの計算はmmapした表だけで行える
+        Index index(TEST_DIR, false);
+        FileManager *fm = index.getFileManager();
+        IndexedINode iNode;
+        assert(fm->getFileAttributes(file, &iNode));
+        assert(iNode.startOffset == 1 + 5 * 1234);
+        std::vector<std::pair<offset, offset>> visible = getVisible(&index, USER);
+        assert(visible.size() == 1);
+        assert(visible[0].first == 1 && visible[0].second == 10000);
+        assert(fm->getFileID("/data/f1234") == file);
+        assert(fm->getFileCount() == 2000);
+    }
+    {
+        FILE *f = fopen(directoryFile.c_str(), "r+b");
+        assert(f != nullptr);
+        FM_TableHeader header;
+        assert(fread(&header, sizeof(header), 1, f) == 1);
+        assert(header.magic == FM_TABLE_MAGIC);
+        assert(header.count == 2);
+        header.version = FM_TABLE_VERSION + 1;
+        fseek(f, 0, SEEK_SET);
+        fwrite(&header, sizeof(header), 1, f);
+        fclose(f);
+    }
+    {
+        Index index(TEST_DIR, false);
+        FileManager *fm = index.getFileManager();
+        assert(fm->getFileCount() == 0);
+        assert(fm->getDirectoryCount() == 1);
+        assert(fm->getDirectoryID("/data") < 0);
+    }
+    cleanup();
+    std::cout << "test_file_manager_tables passed.\n";
+}
+
+int main() {
+    const char *argv[] = { "filemanager_test" };
+    initializeConfiguratorFromCommandLineParameters(1, argv);
+    setLogLevel(LOG_ERROR + 1);
+
+    test_file_manager_tables();
+
+    std::cout << "All file manager tests passed.\n";
+}
@@ -0,0 +1,192 @@
+#include <iostream>
+#include <cassert>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include "../../index/index.h"
+#include "../../index/extentset.h"
+#include "../../index/longliststore.h"
+#include "../../index/segment.h"
+#include "../../utils/all.h"
+
+static const char *TEST_DIR = "/tmp/test_garbage";
+
+static void cleanup() {
+    std::string command = "rm -rf " + std::string(TEST_DIR);
+    system(command.c_str());
+}
+
+void test_extent_set() {
+    ExtentSet set;
+    set.add(10, 19);
+    set.add(30, 39);
+    set.add(20, 25);
+    assert(set.getCount() == 2);
+    assert(set.getTotalSize() == 26);
+    set.add(26, 29);
+    assert((set.getCount() == 1) && (set.getTotalSize() == 30));
+    set.remove(15, 17);
+    assert((set.getCount() == 2) && (set.getTotalSize() == 27));
+    assert(set.contains(14) && !set.contains(15) && !set.contains(17) && set.contains(18));
+    assert(set.intersects(0, 10) && !set.intersects(15, 17) && !set.intersects(40, 50));
+
+    offset postings[] = { 1, 10, 14, 15, 16, 18, 39, 40 };
+    int64_t count = set.removeContained(postings, 8);
+    assert(count == 4);
+    assert((postings[0] == 1) && (postings[1] == 15) && (postings[2] == 16) && (postings[3] == 40));
+
+    set.remove(0, 100);
+    assert((set.getCount() == 0) && (set.getTotalSize() == 0));
+    std::cout << "test_extent_set passed.\n";
+}
+
+// 語"common"と"t<i % 4>"をオフセットi * 100とi * 100 + 1に追加する
+static void addPostings(Index *index, int from, int to) {
+    for (int i = from; i < to; i++) {
+        char term[16];
+        snprintf(term, sizeof(term), "t%d", i % 4);
+        char *terms[2] = { (char*)"common", term };
+        offset postings[2] = { (offset)i * 100, (offset)i * 100 + 1 };
+        index->addPostings(terms, postings, 2);
+        if ((i + 1) % 500 == 0) {
+            index->flushUpdateList();
+            index->waitForMerges();
+        }
+    }
+}
+
+static int64_t getSegmentPostingCount(Index *index) {
+    int64_t result = 0;
+    for (int i = 0; i < index->segmentCount; i++)
+        result += index->segments[i]->getPostingCount();
+    return result;
+}
+
+void test_garbage_collection() {
+    cleanup();
+    {
+        Index index(TEST_DIR, false);
+        index.notifyOfAddressSpaceChange(1, 0, 400000);
+        addPostings(&index, 0, 2000);
+        assert(index.segmentCount == 1);
+        assert(getSegmentPostingCount(&index) == 2000);
+        assert(index.longLists->getPostingCount() == 2000);
+
+        // 使われる前に解放された範囲は不要ポスティングとして数えない
+        index.notifyOfAddressSpaceChange(-1, 300000, 100000);
+        assert((index.usedAddressSpace == 300000) && (index.deletedAddressSpace == 0));
+
+        // 不要ポスティングの割合が0.30になり、マージ時のガベージコレクションだけが有効になる
+        index.notifyOfAddressSpaceChange(-1, 0, 90000);
+        assert(index.deletedAddressSpace == 90000);
+        assert(!index.garbageCollectionRequested);
+        int64_t count;
+        offset *postings = index.getPostings("common", &count);
+        assert((count == 2000 - 900) && (postings[0] == 90000));
+        free(postings);
+    }
+    {
+        // 削除された範囲は再起動後も有効
+        Index index(TEST_DIR, false);
+        assert((index.usedAddressSpace == 300000) && (index.deletedAddressSpace == 90000));
+        int64_t count;
+        offset *postings = index.getPostings("t1", &count);
+        assert((count == 500 - 225) && (postings[0] == 90101));
+        free(postings);
+
+        // マージで不要ポスティングが取り除かれる。LongListStoreの既存部分はそのまま残る
+        addPostings(&index, 2000, 2500);
+        assert(index.segmentCount == 1);
+        assert(getSegmentPostingCount(&index) == 2000 - 900 + 500);
+        assert(index.longLists->getPostingCount() == 2500);
+        postings = index.getPostings("common", &count);
+        assert(count == 1600);
+        free(postings);
+
+        // 割合が0.40を超えるとインデックス全体のガベージコレクションが行われる
+        index.notifyOfAddressSpaceChange(-1, 90000, 30000);
+        index.waitForMerges();
+        assert((index.deletedExtents->getCount() == 0) && (index.deletedAddressSpace == 0));
+        assert(index.usedAddressSpace == 180000);
+        assert(getSegmentPostingCount(&index) == 1300);
+        assert(index.longLists->getPostingCount() == 1300);
+        postings = index.getPostings("common", &count);
+        assert((count == 1300) && (postings[0] == 120000) && (postings[count - 1] == 2499 * 100));
+        free(postings);
+    }
+    {
+        Index index(TEST_DIR, false);
+        assert((index.usedAddressSpace == 180000) && (index.deletedAddressSpace == 0));
+        int64_t count;
+        offset *postings = index.getPostings("common", &count);
+        assert((count == 1300) && (postings[0] == 120000));
+        free(postings);
+        assert(index.longLists->getPostingCount() == 1300);
+    }
+    cleanup();
+    std::cout << "test_garbage_collection passed.\n";
+}
+
+void test_failed_garbage_collection() {
+    cleanup();
+    std::string dataFile = std::string(TEST_DIR) + "/index.longlists";
+    {
+        Index index(TEST_DIR, false);
+        index.notifyOfAddressSpaceChange(1, 0, 400000);
+        addPostings(&index, 0, 2000);
+        assert(index.longLists->getPostingCount() == 2000);
+
+        /*
+        データファイルを置き換えられないようにして、LongListStoreの置き換えを失敗させる。
+        開いているデータファイルへの追記とディレクトリの保存はそのまま行える
+        */
+        std::string command = "rm " + dataFile + " && mkdir " + dataFile + " && touch " + dataFile + "/x";
+        system(command.c_str());
+        index.notifyOfAddressSpaceChange(-1, 0, 160000);
+        index.waitForMerges();
+        assert(index.pendingGarbageCollectionLSN > 0);
+        assert(index.isConsistent);
+
+        // 古いLongListStoreと削除範囲のまま続ける
+        assert(index.longLists->getPostingCount() == 2000);
+        assert(getSegmentPostingCount(&index) == 400);
+        assert(index.deletedAddressSpace == 160000);
+        int64_t count;
+        offset *postings = index.getPostings("common", &count);
+        assert((count == 400) && (postings[0] == 160000));
+        free(postings);
+        command = "rm -rf " + dataFile;
+        system(command.c_str());
+    }
+    {
+        // 再起動時にログをもとに置き換えを完了させる
+        Index index(TEST_DIR, false);
+        assert(index.pendingGarbageCollectionLSN == 0);
+        assert((index.usedAddressSpace == 240000) && (index.deletedAddressSpace == 0));
+        assert(index.longLists->getPostingCount() == 400);
+        int64_t count;
+        offset *postings = index.getPostings("common", &count);
+        assert((count == 400) && (postings[0] == 160000) && (postings[count - 1] == 1999 * 100));
+        free(postings);
+    }
+    {
+        Index index(TEST_DIR, false);
+        assert((index.usedAddressSpace == 240000) && (index.deletedAddressSpace == 0));
+        assert(index.longLists->getPostingCount() == 400);
+    }
+    cleanup();
+    std::cout << "test_failed_garbage_collection passed.\n";
+}
+
+int main() {
+    const char *argv[] = { "garbage_test", "--LONG_LIST_THRESHOLD=1000",
+        "--GARBAGE_COLLECTION_THRESHOLD=0.40", "--ONTHEFLY_GARBAGE_COLLECTION_THRESHOLD=0.25" };
+    initializeConfiguratorFromCommandLineParameters(4, argv);
+    setLogLevel(LOG_ERROR + 1);
+
+    test_extent_set();
+    test_garbage_collection();
+    test_failed_garbage_collection();
+
+    std::cout << "All garbage collection tests passed.\n";
+}
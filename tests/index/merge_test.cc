@@ -0,0 +1,163 @@
+#include <iostream>
+#include <cassert>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include "../../extentlist/extentlist.h"
+#include "../../index/index.h"
+#include "../../index/indexview.h"
+#include "../../index/longliststore.h"
+#include "../../utils/all.h"
+
+static const char *TEST_DIR = "/tmp/test_merge";
+
+static void cleanup() {
+    std::string command = "rm -rf " + std::string(TEST_DIR);
+    system(command.c_str());
+}
+
+// 1回の更新で"common"と、その回だけに現れる語を追加する
+static void addBatch(Index *index, int batch, offset *nextOffset) {
+    char unique[32];
+    snprintf(unique, sizeof(unique), "u%d", batch);
+    char *terms[2] = { (char*)"common", unique };
+    for (int i = 0; i < 400; i++) {
+        offset postings[2] = { *nextOffset, *nextOffset + 1 };
+        index->addPostings(terms, postings, 2);
+        *nextOffset += 2;
+    }
+}
+
+void test_merging_bounds_segment_count() {
+    cleanup();
+    offset nextOffset = 0;
+    {
+        Index index(TEST_DIR, false);
+        for (int batch = 0; batch < 12; batch++) {
+            addBatch(&index, batch, &nextOffset);
+            index.flushUpdateList();
+            index.waitForMerges();
+            // 小さなセグメントはすべて同じ世代なので、マージ後は常に1個になる
+            assert(index.segmentCount <= 1);
+        }
+        // "common"はLONG_LIST_THRESHOLDを超えたのでLongListStoreに移される
+        assert(index.longLists->contains("common"));
+        assert(!index.longLists->contains("u3"));
+
+        int64_t count;
+        offset *postings = index.getPostings("common", &count);
+        assert(count == 12 * 400);
+        for (int i = 0; i < count; i++)
+            assert(postings[i] == 2 * i);
+        free(postings);
+        postings = index.getPostings("u5", &count);
+        assert((count == 400) && (postings[0] == 5 * 800 + 1));
+        free(postings);
+    }
+    {
+        // 再起動後もLongListStoreとセグメントが読み込まれる
+        Index index(TEST_DIR, false);
+        int64_t count;
+        offset *postings = index.getPostings("common", &count);
+        assert(count == 12 * 400);
+        free(postings);
+        addBatch(&index, 12, &nextOffset);
+        postings = index.getPostings("common", &count);
+        assert((count == 13 * 400) && (postings[count - 1] == 2 * (count - 1)));
+        free(postings);
+    }
+    cleanup();
+    std::cout << "test_merging_bounds_segment_count passed.\n";
+}
+
+void test_view_pinned_across_merge() {
+    cleanup();
+    offset nextOffset = 0;
+    {
+        Index index(TEST_DIR, false);
+        for (int batch = 0; batch < 2; batch++) {
+            addBatch(&index, batch, &nextOffset);
+            index.flushUpdateList();
+            index.waitForMerges();
+        }
+        addBatch(&index, 2, &nextOffset);
+        assert(!index.longLists->contains("common"));
+
+        // マージ前のビューを固定したまま、"common"をLongListStoreに移す
+        IndexView *view = index.acquireView();
+        index.flushUpdateList();
+        index.waitForMerges();
+        assert(index.longLists->contains("common"));
+
+        // 固定したビューからは、LongListStoreに追記されたブロックは見えない
+        PostingList list(view, "common");
+        assert(list.getLength() == 3 * 400);
+        offset starts[4000], ends[4000];
+        int n = list.getNextN(0, MAX_OFFSET, 4000, starts, ends);
+        assert(n == 3 * 400);
+        for (int i = 0; i < n; i++)
+            assert(starts[i] == 2 * i);
+        view->release();
+
+        // 新しいビューではLongListStoreから読まれる
+        view = index.acquireView();
+        PostingList newList(view, "common");
+        assert(newList.getLength() == 3 * 400);
+        n = newList.getNextN(0, MAX_OFFSET, 4000, starts, ends);
+        assert((n == 3 * 400) && (starts[n - 1] == 2 * (n - 1)));
+        view->release();
+    }
+    cleanup();
+    std::cout << "test_view_pinned_across_merge passed.\n";
+}
+
+void test_uncommitted_long_list_append() {
+    cleanup();
+    std::string base = std::string(TEST_DIR) + ".base";
+    system(("rm -rf " + base).c_str());
+    offset nextOffset = 0;
+    {
+        Index index(TEST_DIR, false);
+        for (int batch = 0; batch < 2; batch++) {
+            addBatch(&index, batch, &nextOffset);
+            index.flushUpdateList();
+            index.waitForMerges();
+        }
+        // マージ前のセグメントの一覧
+        system(("cp -a " + std::string(TEST_DIR) + " " + base).c_str());
+        addBatch(&index, 2, &nextOffset);
+        index.flushUpdateList();
+        index.waitForMerges();
+        assert(index.longLists->contains("common"));
+    }
+    // LongListStoreのディレクトリを保存した後、インデックスファイルを保存する前にクラッシュした状態
+    std::string command = "cp " + std::string(TEST_DIR) + "/index.longlists " + TEST_DIR + "/index.longlists.dir " + base;
+    system(command.c_str());
+    {
+        // 入力のセグメントが使われるので、追記されたブロックは取り除かれる
+        Index index(base.c_str(), false);
+        assert(!index.longLists->contains("common"));
+        assert(index.longLists->getFileSize() == 0);
+        int64_t count;
+        offset *postings = index.getPostings("common", &count);
+        assert(count == 2 * 400);
+        for (int i = 0; i < count; i++)
+            assert(postings[i] == 2 * i);
+        free(postings);
+    }
+    system(("rm -rf " + base).c_str());
+    cleanup();
+    std::cout << "test_uncommitted_long_list_append passed.\n";
+}
+
+int main() {
+    const char *argv[] = { "merge_test", "--LONG_LIST_THRESHOLD=1000", "--MERGE_RATIO=2" };
+    initializeConfiguratorFromCommandLineParameters(3, argv);
+    setLogLevel(LOG_ERROR + 1);
+
+    test_merging_bounds_segment_count();
+    test_view_pinned_across_merge();
+    test_uncommitted_long_list_append();
+
+    std::cout << "All merge tests passed.\n";
+}
@@ -0,0 +1,152 @@
+#include <iostream>
+#include <cassert>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <pthread.h>
+#include "../../filemanager/filemanager.h"
+#include "../../filemanager/pathcache.h"
+#include "../../index/extentset.h"
+#include "../../index/index.h"
+#include "../../index/securitymanager.h"
+#include "../../utils/all.h"
+
+static const char *TEST_DIR = "/tmp/test_pathcache";
+
+// インデックスの所有者でもスーパーユーザーでもないユーザー
+static const uid_t USER = 12345;
+static const uid_t OTHER_USER = 23456;
+
+static void cleanup() {
+    std::string command = "rm -rf " + std::string(TEST_DIR);
+    system(command.c_str());
+}
+
+// 見える範囲を区間の列として返す
+static std::vector<std::pair<offset, offset>> getVisible(Index *index, uid_t userID) {
+    std::vector<std::pair<offset, offset>> result;
+    ExtentSet *visible = index->getSecurityManager()->getVisibleExtents(userID);
+    assert(visible != nullptr);
+    for (int64_t i = 0; i < visible->getCount(); i++) {
+        offset start, end;
+        visible->getExtent(i, &start, &end);
+        result.push_back({ start, end });
+    }
+    visible->release();
+    return result;
+}
+
+static void *resolvePaths(void *data) {
+    FileManager *fm = (FileManager*)data;
+    char path[64];
+    for (int round = 0; round < 20; round++)
+        for (int i = 0; i < 500; i++) {
+            snprintf(path, sizeof(path), "/spool/mail/m%d", i);
+            if (fm->getFileID(path) < 0)
+                return (void*)1;
+        }
+    return nullptr;
+}
+
+// 名前の解決結果のキャッシュは、削除と名前の変更で古い結果を返さない
+void test_path_cache() {
+    {
+        PathCache cache(4, 1);
+        for (int i = 0; i < 5; i++)
+            cache.insert("/d" + std::to_string(i), i);
+        int32_t value;
+        assert(!cache.lookup("/d0", &value));
+        assert(cache.lookup("/d1", &value) && value == 1);
+        cache.insert("/d5", 5);
+        // /d1は直前に参照したので、/d2が捨てられる
+        assert(cache.lookup("/d1", &value));
+        assert(!cache.lookup("/d2", &value));
+        cache.remove("/d1");
+        assert(!cache.lookup("/d1", &value));
+        assert(cache.getEntryCount() == 3);
+    }
+    cleanup();
+    {
+        Index index(TEST_DIR, false);
+        FileManager *fm = index.getFileManager();
+        int32_t spool = fm->createDirectory(0, "spool", 0, 0, 0755);
+        int32_t mail = fm->createDirectory(spool, "mail", 0, 0, 0755);
+        int32_t priv = fm->createDirectory(0, "private", OTHER_USER, 0, 0700);
+        char name[32];
+        for (int i = 0; i < 500; i++) {
+            snprintf(name, sizeof(name), "m%d", i);
+            assert(fm->addFile(mail, name, USER, 0, 0644, 1 + 10 * i, 10) >= 0);
+        }
+        int32_t file = fm->getFileID("/spool/mail/m7");
+        int64_t hits = fm->getPathCacheHitCount();
+        assert(fm->getFileID("//spool//mail/m7") == file);
+        assert(fm->getDirectoryID("/spool/mail/") == mail);
+        assert(fm->getPathCacheHitCount() > hits);
+
+        // 複数のスレッドから同時に引く
+        pthread_t threads[4];
+        for (int i = 0; i < 4; i++)
+            assert(pthread_create(&threads[i], nullptr, resolvePaths, fm) == 0);
+        for (int i = 0; i < 4; i++) {
+            void *failed;
+            pthread_join(threads[i], &failed);
+            assert(failed == nullptr);
+        }
+
+        // ファイルの名前の変更と移動
+        assert(fm->renameFile(file, mail, "renamed"));
+        assert(fm->getFileID("/spool/mail/m7") < 0);
+        assert(fm->getFileID("/spool/mail/renamed") == file);
+        assert(!fm->renameFile(file, mail, "m8"));
+        assert(getVisible(&index, USER).size() == 1);
+        assert(fm->renameFile(file, priv, "m7"));
+        assert(fm->getFileID("/spool/mail/renamed") < 0);
+        assert(fm->getFileID("/private/m7") == file);
+        assert(getVisible(&index, USER).size() == 2);
+
+        // ディレクトリの名前の変更は、その下のすべてのパスに影響する
+        assert(fm->getFileID("/spool/mail/m9") >= 0);
+        assert(fm->renameDirectory(spool, 0, "var"));
+        assert(fm->getDirectoryID("/spool/mail") < 0);
+        assert(fm->getFileID("/spool/mail/m9") < 0);
+        assert(fm->getDirectoryID("/var/mail") == mail);
+        assert(fm->getFileID("/var/mail/m9") >= 0);
+        assert(!fm->renameDirectory(spool, mail, "loop"));
+        assert(!fm->renameDirectory(0, spool, "root"));
+
+        // 削除されたIDが別の場所で再利用されても、古いパスでは見つからない
+        int32_t removed = fm->getFileID("/var/mail/m9");
+        assert(fm->removeFile(removed));
+        int32_t other = fm->createDirectory(0, "other", 0, 0, 0755);
+        assert(fm->addFile(other, "m9", 0, 0, 0644, 100000, 5) == removed);
+        assert(fm->getFileID("/var/mail/m9") < 0);
+        assert(fm->getFileID("/other/m9") == removed);
+        int32_t empty = fm->createDirectory(other, "empty", 0, 0, 0755);
+        assert(fm->getDirectoryID("/other/empty") == empty);
+        assert(fm->removeDirectory(empty));
+        assert(fm->createDirectory(priv, "reused", 0, 0, 0755) == empty);
+        assert(fm->getDirectoryID("/other/empty") < 0);
+        assert(fm->getDirectoryID("/private/reused") == empty);
+    }
+    {
+        // 名前の変更は再起動後も保たれる
+        Index index(TEST_DIR, false);
+        FileManager *fm = index.getFileManager();
+        assert(fm->getFileID("/private/m7") >= 0);
+        assert(fm->getFileID("/var/mail/m10") >= 0);
+        assert(fm->getDirectoryID("/spool") < 0);
+    }
+    cleanup();
+    std::cout << "test_path_cache passed.\n";
+}
+
+int main() {
+    const char *argv[] = { "pathcache_test" };
+    initializeConfiguratorFromCommandLineParameters(1, argv);
+    setLogLevel(LOG_ERROR + 1);
+
+    test_path_cache();
+
+    std::cout << "All path cache tests passed.\n";
+}
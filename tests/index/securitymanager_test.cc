@@ -0,0 +1,209 @@
+#include <iostream>
+#include <cassert>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <sys/stat.h>
+#include "../../extentlist/extentlist.h"
+#include "../../filemanager/filemanager.h"
+#include "../../index/extentset.h"
+#include "../../index/index.h"
+#include "../../index/securitymanager.h"
+#include "../../utils/all.h"
+
+static const char *TEST_DIR = "/tmp/test_securitymanager";
+
+// インデックスの所有者でもスーパーユーザーでもないユーザー
+static const uid_t USER = 12345;
+static const uid_t OTHER_USER = 23456;
+static const gid_t GROUP = 4321;
+
+static void cleanup() {
+    std::string command = "rm -rf " + std::string(TEST_DIR);
+    system(command.c_str());
+}
+
+// 見える範囲を区間の列として返す
+static std::vector<std::pair<offset, offset>> getVisible(Index *index, uid_t userID) {
+    std::vector<std::pair<offset, offset>> result;
+    ExtentSet *visible = index->getSecurityManager()->getVisibleExtents(userID);
+    assert(visible != nullptr);
+    for (int64_t i = 0; i < visible->getCount(); i++) {
+        offset start, end;
+        visible->getExtent(i, &start, &end);
+        result.push_back({ start, end });
+    }
+    visible->release();
+    return result;
+}
+
+void test_permissions() {
+    std::vector<gid_t> groups = { GROUP };
+    assert(SecurityManager::hasPermission(USER, groups, USER, 0, 0400, S_IROTH));
+    assert(!SecurityManager::hasPermission(USER, groups, USER, GROUP, 0044, S_IROTH));
+    assert(SecurityManager::hasPermission(USER, groups, OTHER_USER, GROUP, 0040, S_IROTH));
+    assert(!SecurityManager::hasPermission(USER, groups, OTHER_USER, GROUP, 0004, S_IROTH));
+    assert(SecurityManager::hasPermission(USER, groups, OTHER_USER, 1, 0004, S_IROTH));
+    assert(SecurityManager::hasPermission(USER, groups, OTHER_USER, 1, 0001, S_IXOTH));
+    assert(!SecurityManager::hasPermission(USER, groups, OTHER_USER, 1, 0770, S_IXOTH));
+    std::cout << "test_permissions passed.\n";
+}
+
+void test_file_manager() {
+    cleanup();
+    {
+        Index index(TEST_DIR, false);
+        FileManager *fm = index.getFileManager();
+        assert(fm != nullptr);
+        assert(fm->getDirectoryID("/") == 0);
+        int32_t home = fm->createDirectory(0, "home", 0, 0, 0755);
+        int32_t user = fm->createDirectory(home, "user", USER, GROUP, 0700);
+        assert(home > 0 && user > 0);
+        assert(fm->createDirectory(home, "user", 0, 0, 0755) < 0);
+        assert(fm->createDirectory(home, "a/b", 0, 0, 0755) < 0);
+        assert(fm->getDirectoryID("/home/user") == user);
+        assert(fm->getDirectoryID("/home/user/") == user);
+        assert(fm->getDirectoryID("/home/nobody") < 0);
+
+        // 同じディレクトリに多数のファイルを追加し、名前で引けることを確かめる
+        char name[32];
+        for (int i = 0; i < 3000; i++) {
+            snprintf(name, sizeof(name), "file%d.txt", i);
+            assert(fm->addFile(user, name, USER, GROUP, 0600, 1 + 10 * i, 10) >= 0);
+        }
+        assert(fm->addFile(user, "file0.txt", USER, GROUP, 0600, 50000, 10) < 0);
+        // 範囲は追加された順に並ばなければならない
+        assert(fm->addFile(user, "late.txt", USER, GROUP, 0600, 5, 10) < 0);
+        assert(fm->getFileCount() == 3000);
+        assert(fm->getDirectoryCount() == 3);
+
+        for (int i = 0; i < 3000; i += 2) {
+            snprintf(name, sizeof(name), "/home/user/file%d.txt", i);
+            int32_t file = fm->getFileID(name);
+            assert(file >= 0);
+            assert(fm->removeFile(file));
+            assert(fm->getFileID(name) < 0);
+        }
+        assert(!fm->removeDirectory(user));
+        assert(fm->getFileCount() == 1500);
+    }
+    {
+        // 再起動しても内容が保たれる
+        Index index(TEST_DIR, false);
+        FileManager *fm = index.getFileManager();
+        assert(fm->getFileCount() == 1500);
+        assert(fm->getDirectoryCount() == 3);
+        assert(fm->getFileID("/home/user/file0.txt") < 0);
+        int32_t file = fm->getFileID("/home/user/file2999.txt");
+        assert(file >= 0);
+        IndexedINode iNode;
+        assert(fm->getFileAttributes(file, &iNode));
+        assert(iNode.startOffset == 1 + 10 * 2999);
+        assert(iNode.tokenCount == 10);
+        assert(iNode.owner == USER);
+        assert(iNode.group == GROUP);
+        assert(iNode.permissions == 0600);
+
+        // 削除したファイルのIDは再利用される
+        int32_t added = fm->addFile(fm->getDirectoryID("/home"), "new.txt", 0, 0, 0644, 100000, 5);
+        assert(added >= 0);
+        assert(fm->getFileCount() == 1501);
+        int32_t empty = fm->createDirectory(0, "tmp", 0, 0, 01777);
+        assert(fm->removeDirectory(empty));
+        assert(fm->getDirectoryID("/tmp") < 0);
+    }
+    cleanup();
+    std::cout << "test_file_manager passed.\n";
+}
+
+void test_visible_extents() {
+    cleanup();
+    {
+        Index index(TEST_DIR, false);
+        FileManager *fm = index.getFileManager();
+        SecurityManager *sm = index.getSecurityManager();
+        assert(!sm->isRestricted(index.indexOwner));
+        assert(!sm->isRestricted(Index::GOD));
+        assert(sm->isRestricted(USER));
+        assert(sm->getVisibleExtents(index.indexOwner) == nullptr);
+
+        int32_t pub = fm->createDirectory(0, "pub", 0, 0, 0755);
+        int32_t priv = fm->createDirectory(0, "priv", OTHER_USER, 0, 0700);
+        int32_t a = fm->addFile(pub, "a", 0, 0, 0644, 1, 10);
+        int32_t b = fm->addFile(pub, "b", OTHER_USER, 0, 0600, 11, 10);
+        int32_t c = fm->addFile(priv, "c", OTHER_USER, 0, 0644, 21, 10);
+        int32_t d = fm->addFile(pub, "d", USER, 0, 0400, 31, 10);
+        assert(a >= 0 && b >= 0 && c >= 0 && d >= 0);
+
+        std::vector<std::pair<offset, offset>> visible = getVisible(&index, USER);
+        assert(visible.size() == 2);
+        assert(visible[0] == std::make_pair((offset)1, (offset)10));
+        assert(visible[1] == std::make_pair((offset)31, (offset)40));
+        visible = getVisible(&index, OTHER_USER);
+        assert(visible.size() == 1);
+        assert(visible[0] == std::make_pair((offset)1, (offset)30));
+
+        // ファイルの変更は差分で反映される
+        assert(fm->changeFileAttributes(b, OTHER_USER, 0, 0644));
+        int32_t e = fm->addFile(pub, "e", 0, 0, 0644, 41, 10);
+        assert(fm->removeFile(a));
+        visible = getVisible(&index, USER);
+        assert(visible.size() == 2);
+        assert(visible[0] == std::make_pair((offset)11, (offset)20));
+        assert(visible[1] == std::make_pair((offset)31, (offset)50));
+        assert(fm->changeFileAttributes(e, 0, 0, 0640));
+        visible = getVisible(&index, USER);
+        assert(visible.size() == 2);
+        assert(visible[1] == std::make_pair((offset)31, (offset)40));
+
+        // ディレクトリの変更はサブツリー全体に影響する
+        assert(fm->changeDirectoryAttributes(priv, OTHER_USER, 0, 0711));
+        visible = getVisible(&index, USER);
+        assert(visible.size() == 1);
+        assert(visible[0] == std::make_pair((offset)11, (offset)40));
+        assert(fm->changeDirectoryAttributes(pub, 0, 0, 0700));
+        visible = getVisible(&index, USER);
+        assert(visible.size() == 1);
+        assert(visible[0] == std::make_pair((offset)21, (offset)30));
+
+        // GCLの演算対象としての見える範囲
+        ExtentList *list = sm->getVisibleExtentList(USER);
+        assert(list != nullptr);
+        assert(list->getLength() == 1);
+        offset start, end;
+        assert(list->getFirstStartBiggerEq(5, &start, &end));
+        assert(start == 21 && end == 30);
+        assert(!list->getFirstEndBiggerEq(31, &start, &end));
+        delete list;
+    }
+    cleanup();
+    std::cout << "test_visible_extents passed.\n";
+}
+
+// 制限を無効にした場合はすべてのユーザーに制限がない
+void test_restrictions_disabled() {
+    cleanup();
+    {
+        Index index(TEST_DIR, false);
+        index.APPLY_SECURITY_RESTRICTIONS = false;
+        assert(!index.getSecurityManager()->isRestricted(USER));
+        assert(index.getSecurityManager()->getVisibleExtentList(USER) == nullptr);
+    }
+    cleanup();
+    std::cout << "test_restrictions_disabled passed.\n";
+}
+
+int main() {
+    const char *argv[] = { "securitymanager_test" };
+    initializeConfiguratorFromCommandLineParameters(1, argv);
+    setLogLevel(LOG_ERROR + 1);
+
+    test_permissions();
+    test_file_manager();
+    test_visible_extents();
+    test_restrictions_disabled();
+
+    std::cout << "All security manager tests passed.\n";
+}
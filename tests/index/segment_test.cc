@@ -0,0 +1,375 @@
+#include <iostream>
+#include <cassert>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <set>
+#include <string>
+#include <vector>
+#include "../../index/index.h"
+#include "../../index/levenshtein.h"
+#include "../../index/segment.h"
+#include "../../index/updatelist.h"
+#include "../../utils/all.h"
+
+static const char *TEST_DIR = "/tmp/test_segment";
+
+static void cleanup() {
+    std::string command = "rm -rf " + std::string(TEST_DIR);
+    system(command.c_str());
+}
+
+void test_write_and_read_segment() {
+    cleanup();
+    mkdir(TEST_DIR, 0700);
+    UpdateList list(16 * 1024 * 1024);
+    char term[32];
+    for (int i = 0; i < 100000; i++) {
+        snprintf(term, sizeof(term), "w%03d", i % 300);
+        assert(list.addPosting(term, (offset)i * 2));
+    }
+    assert(list.addPosting("rare", 5));
+
+    std::string fileName = std::string(TEST_DIR) + "/segment";
+    for (int method = 0; method < COMPRESSION_METHOD_COUNT; method++) {
+        assert(writeSegment(&list, fileName.c_str(), method));
+        Segment *segment = Segment::open(fileName.c_str());
+        assert(segment != nullptr);
+        assert(segment->getTermCount() == 301);
+        assert(segment->getPostingCount() == 100001);
+        assert(segment->getFirstPosting() == 0);
+        assert(segment->getLastPosting() == 199998);
+
+        char previous[MAX_DICTIONARY_TERM_LENGTH + 1], current[MAX_DICTIONARY_TERM_LENGTH + 1];
+        segment->getTerm(0, previous);
+        for (int64_t i = 1; i < segment->getTermCount(); i++) {
+            segment->getTerm(i, current);
+            assert(strcmp(previous, current) < 0);
+            assert(segment->findTerm(current) == i);
+            strcpy(previous, current);
+        }
+
+        int64_t count;
+        offset *postings = segment->getPostings("w007", &count);
+        assert(count == 334);
+        for (int k = 0; k < count; k++)
+            assert(postings[k] == (offset)(7 + k * 300) * 2);
+        free(postings);
+
+        // スキップエントリを使って目的のブロックだけを展開する
+        int64_t termIndex = segment->findTerm("w007");
+        int block = segment->findBlock(termIndex, (offset)(7 + 200 * 300) * 2);
+        assert(block == 1);
+        offset buffer[SEGMENT_BLOCK_SIZE];
+        int n = segment->decodeBlock(termIndex, block, buffer);
+        assert(n == SEGMENT_BLOCK_SIZE);
+        assert(buffer[0] == (offset)(7 + 128 * 300) * 2);
+        assert(segment->findBlock(termIndex, MAX_OFFSET) == segment->getTermEntry(termIndex)->blockCount);
+
+        assert(segment->getPostings("missing", &count) == nullptr);
+        assert(count == 0);
+        delete segment;
+    }
+    cleanup();
+    std::cout << "test_write_and_read_segment passed.\n";
+}
+
+// fileNameのpositionにsizeバイトのdataを書き込む
+static void overwrite(const std::string &fileName, int64_t position, const void *data, size_t size) {
+    FILE *f = fopen(fileName.c_str(), "r+");
+    assert(f != nullptr);
+    fseek(f, position, SEEK_SET);
+    assert(fwrite(data, size, 1, f) == 1);
+    fclose(f);
+}
+
+void test_corrupt_entries() {
+    cleanup();
+    mkdir(TEST_DIR, 0700);
+    UpdateList list(1024 * 1024);
+    char term[32];
+    for (int i = 0; i < 1000; i++) {
+        snprintf(term, sizeof(term), "w%d", i % 3);
+        assert(list.addPosting(term, (offset)i));
+    }
+    std::string fileName = std::string(TEST_DIR) + "/segment";
+    assert(writeSegment(&list, fileName.c_str(), COMPRESSION_VBYTE));
+    SegmentFooter footer;
+    SegmentSkipEntry skip;
+    SegmentTermEntry entry;
+    FILE *f = fopen(fileName.c_str(), "r");
+    fseek(f, -(long)sizeof(footer), SEEK_END);
+    assert(fread(&footer, sizeof(footer), 1, f) == 1);
+    fseek(f, footer.skipPosition, SEEK_SET);
+    assert(fread(&skip, sizeof(skip), 1, f) == 1);
+    fseek(f, footer.dictionaryPosition + sizeof(entry), SEEK_SET);
+    assert(fread(&entry, sizeof(entry), 1, f) == 1);
+    fclose(f);
+
+    // ブロックがスキップエントリの領域にはみ出している
+    SegmentSkipEntry badSkip = skip;
+    badSkip.filePosition = footer.skipPosition - 1;
+    overwrite(fileName, footer.skipPosition, &badSkip, sizeof(badSkip));
+    assert(Segment::open(fileName.c_str()) == nullptr);
+    overwrite(fileName, footer.skipPosition, &skip, sizeof(skip));
+    Segment *segment = Segment::open(fileName.c_str());
+    assert(segment != nullptr);
+    delete segment;
+
+    // 語のブロックがスキップエントリの数を超えている
+    SegmentTermEntry badEntry = entry;
+    badEntry.blockCount = footer.skipEntryCount;
+    overwrite(fileName, footer.dictionaryPosition + sizeof(entry), &badEntry, sizeof(badEntry));
+    assert(Segment::open(fileName.c_str()) == nullptr);
+    cleanup();
+    std::cout << "test_corrupt_entries passed.\n";
+}
+
+void test_index_flush_and_reload() {
+    cleanup();
+    {
+        Index index(TEST_DIR, false);
+        char *terms[3] = { (char*)"alpha", (char*)"beta", (char*)"alpha" };
+        offset postings[3] = { 1, 2, 3 };
+        index.addPostings(terms, postings, 3);
+        index.flushUpdateList();
+        offset more[3] = { 10, 11, 12 };
+        index.addPostings(terms, more, 3);
+
+        int64_t count;
+        offset *result = index.getPostings("alpha", &count);
+        assert(count == 4);
+        assert((result[0] == 1) && (result[1] == 3) && (result[2] == 10) && (result[3] == 12));
+        free(result);
+    }
+    {
+        // デストラクタでUpdateListが書き出され、再起動時にセグメントが読み込まれる
+        Index index(TEST_DIR, false);
+        assert(index.segmentCount == 2);
+        int64_t count;
+        offset *result = index.getPostings("beta", &count);
+        assert((count == 2) && (result[0] == 2) && (result[1] == 11));
+        free(result);
+    }
+    cleanup();
+    std::cout << "test_index_flush_and_reload passed.\n";
+}
+
+void test_long_terms() {
+    cleanup();
+    {
+        // 語辞書に入らない長さの語は、問い合わせの語と同じ長さに切り詰めて追加される
+        Index index(TEST_DIR, false);
+        std::string longTerm(300, 'a');
+        char *terms[2] = { (char*)longTerm.c_str(), (char*)"short" };
+        offset postings[2] = { 1, 2 };
+        index.addPostings(terms, postings, 2);
+        index.flushUpdateList();
+        assert(index.segmentCount == 1);
+        int64_t count;
+        offset *result = index.getPostings(longTerm.substr(0, MAX_STEM_LENGTH - 1).c_str(), &count);
+        assert((count == 1) && (result[0] == 1));
+        free(result);
+        result = index.getPostings("short", &count);
+        assert((count == 1) && (result[0] == 2));
+        free(result);
+    }
+    cleanup();
+    std::cout << "test_long_terms passed.\n";
+}
+
+void test_inconsistent_index_is_recreated() {
+    cleanup();
+    char *terms[1] = { (char*)"alpha" };
+    {
+        Index index(TEST_DIR, false);
+        offset postings[1] = { 1 };
+        index.addPostings(terms, postings, 1);
+    }
+    // 削除範囲のファイルが壊れたインデックスは作り直される
+    std::string extentsFile = std::string(TEST_DIR) + "/index.deleted";
+    FILE *f = fopen(extentsFile.c_str(), "w");
+    fputs("xyz", f);
+    fclose(f);
+    {
+        Index index(TEST_DIR, false);
+        assert(index.segmentCount == 0);
+        int64_t count;
+        offset *result = index.getPostings("alpha", &count);
+        assert(count == 0);
+        free(result);
+        offset postings[1] = { 5 };
+        index.addPostings(terms, postings, 1);
+    }
+    {
+        // 作り直したインデックスは次の起動時にそのまま読み込まれる
+        Index index(TEST_DIR, false);
+        assert(index.isConsistent);
+        assert(index.segmentCount == 1);
+        int64_t count;
+        offset *result = index.getPostings("alpha", &count);
+        assert((count == 1) && (result[0] == 5));
+        free(result);
+    }
+    cleanup();
+    std::cout << "test_inconsistent_index_is_recreated passed.\n";
+}
+
+// prefix*suffixに一致する語を全件走査で求める
+static std::vector<std::string> matchAll(const std::set<std::string> &terms, const char *prefix, const char *suffix) {
+    std::vector<std::string> result;
+    for (const std::string &term : terms)
+        if (matchesWildcard(term.c_str(), prefix, suffix))
+            result.push_back(term);
+    return result;
+}
+
+void test_dictionary() {
+    cleanup();
+    mkdir(TEST_DIR, 0700);
+    srand(7);
+    std::set<std::string> terms;
+    char term[64];
+    while (terms.size() < 5000) {
+        int length = 1 + rand() % 8;
+        for (int k = 0; k < length; k++)
+            term[k] = "abcdefg"[rand() % 7];
+        term[length] = 0;
+        terms.insert(term);
+    }
+    // 展開の対象にならない語
+    terms.insert("abc def");
+    terms.insert("<!>abc");
+    terms.insert("abcd$");
+
+    UpdateList list(16 * 1024 * 1024);
+    offset position = 0;
+    for (const std::string &t : terms)
+        assert(list.addPosting(t.c_str(), position++));
+    std::string fileName = std::string(TEST_DIR) + "/segment";
+    assert(writeSegment(&list, fileName.c_str(), COMPRESSION_VBYTE));
+    Segment *segment = Segment::open(fileName.c_str());
+    assert(segment != nullptr);
+    assert(segment->getTermCount() == (int64_t)terms.size());
+
+    // 語の番号と、存在しない語の位置
+    std::vector<std::string> sorted(terms.begin(), terms.end());
+    char buffer[MAX_DICTIONARY_TERM_LENGTH + 1];
+    for (size_t i = 0; i < sorted.size(); i += 3) {
+        segment->getTerm(i, buffer);
+        assert(sorted[i] == buffer);
+        assert(segment->findTerm(sorted[i].c_str()) == (int64_t)i);
+        std::string missing = sorted[i] + "z";
+        int64_t expected = std::lower_bound(sorted.begin(), sorted.end(), missing) - sorted.begin();
+        assert(segment->findTerm(missing.c_str()) == -1);
+        assert(segment->lowerBound(missing.c_str()) == expected);
+    }
+    assert(segment->lowerBound("") == 0);
+    assert(segment->lowerBound("zzz") == (int64_t)terms.size());
+
+    const char *patterns[][2] = {
+        { "abc", "" }, { "g", "" }, { "", "fe" }, { "", "a" }, { "ab", "ba" }, { "d", "d" },
+        { "abcdefga", "" }, { "", "zz" }, { "a", "aa" }, { nullptr, nullptr }
+    };
+    for (int i = 0; patterns[i][0] != nullptr; i++) {
+        std::vector<std::string> expected = matchAll(terms, patterns[i][0], patterns[i][1]);
+        std::vector<std::string> found;
+        assert(segment->expandWildcard(patterns[i][0], patterns[i][1], 100000, &found));
+        std::sort(found.begin(), found.end());
+        assert(found == expected);
+        // 上限を超える場合は失敗する
+        if (expected.size() > 1) {
+            found.clear();
+            assert(!segment->expandWildcard(patterns[i][0], patterns[i][1], expected.size() - 1, &found));
+        }
+    }
+    std::vector<std::string> found;
+    assert(segment->expandWildcard("abc", "", 100000, &found));
+    assert(std::find(found.begin(), found.end(), "abc def") == found.end());
+    assert(std::find(found.begin(), found.end(), "abcd$") == found.end());
+    delete segment;
+    cleanup();
+    std::cout << "test_dictionary passed.\n";
+}
+
+// 編集距離(挿入、削除、置換)
+static int editDistance(const std::string &a, const std::string &b) {
+    std::vector<int> row(b.size() + 1);
+    for (size_t j = 0; j <= b.size(); j++)
+        row[j] = j;
+    for (size_t i = 1; i <= a.size(); i++) {
+        int diagonal = row[0];
+        row[0] = i;
+        for (size_t j = 1; j <= b.size(); j++) {
+            int value = std::min(std::min(row[j], row[j - 1]) + 1, diagonal + (a[i - 1] != b[j - 1]));
+            diagonal = row[j];
+            row[j] = value;
+        }
+    }
+    return row[b.size()];
+}
+
+void test_fuzzy() {
+    cleanup();
+    mkdir(TEST_DIR, 0700);
+    srand(13);
+    std::set<std::string> terms;
+    char term[64];
+    while (terms.size() < 20000) {
+        int length = 1 + rand() % 10;
+        for (int k = 0; k < length; k++)
+            term[k] = "abcdefghij"[rand() % 10];
+        term[length] = 0;
+        terms.insert(term);
+    }
+    terms.insert("abcd efg");
+    terms.insert("<!>abcd");
+
+    UpdateList list(16 * 1024 * 1024);
+    offset position = 0;
+    for (const std::string &t : terms)
+        assert(list.addPosting(t.c_str(), position++));
+    std::string fileName = std::string(TEST_DIR) + "/segment";
+    assert(writeSegment(&list, fileName.c_str(), COMPRESSION_VBYTE));
+    Segment *segment = Segment::open(fileName.c_str());
+    assert(segment != nullptr);
+
+    const char *words[] = { "abcd", "a", "jihgfedcba", "hello", "bbbbbb", "abcdefghij", "", nullptr };
+    for (int i = 0; words[i] != nullptr; i++) {
+        for (int distance = 0; distance <= LevenshteinAutomaton::MAX_DISTANCE; distance++) {
+            std::vector<std::string> expected;
+            for (const std::string &t : terms)
+                if ((isExpandableTerm(t.c_str())) && (editDistance(words[i], t) <= distance))
+                    expected.push_back(t);
+            LevenshteinAutomaton automaton(words[i], distance);
+            for (const std::string &t : terms)
+                assert(automaton.matches(t.c_str()) == (editDistance(words[i], t) <= distance));
+            std::vector<std::string> found;
+            assert(segment->expandFuzzy(&automaton, 100000, &found));
+            assert(found == expected);
+            if (expected.size() > 1) {
+                found.clear();
+                assert(!segment->expandFuzzy(&automaton, expected.size() - 1, &found));
+            }
+        }
+    }
+    delete segment;
+    cleanup();
+    std::cout << "test_fuzzy passed.\n";
+}
+
+int main() {
+    initializeConfigurator();
+    setLogLevel(LOG_ERROR + 1);
+
+    test_write_and_read_segment();
+    test_corrupt_entries();
+    test_index_flush_and_reload();
+    test_long_terms();
+    test_inconsistent_index_is_recreated();
+    test_dictionary();
+    test_fuzzy();
+
+    std::cout << "All segment tests passed.\n";
+}
@@ -0,0 +1,259 @@
+#include <iostream>
+#include <cassert>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <sys/stat.h>
+#include "../../filemanager/filemanager.h"
+#include "../../filemanager/slotallocator.h"
+#include "../../index/extentset.h"
+#include "../../index/index.h"
+#include "../../index/securitymanager.h"
+#include "../../utils/all.h"
+
+static const char *TEST_DIR = "/tmp/test_slotallocator";
+
+// インデックスの所有者でもスーパーユーザーでもないユーザー
+static const uid_t USER = 12345;
+static const gid_t GROUP = 4321;
+
+static void cleanup() {
+    std::string command = "rm -rf " + std::string(TEST_DIR);
+    system(command.c_str());
+}
+
+// 見える範囲を区間の列として返す
+static std::vector<std::pair<offset, offset>> getVisible(Index *index, uid_t userID) {
+    std::vector<std::pair<offset, offset>> result;
+    ExtentSet *visible = index->getSecurityManager()->getVisibleExtents(userID);
+    assert(visible != nullptr);
+    for (int64_t i = 0; i < visible->getCount(); i++) {
+        offset start, end;
+        visible->getExtent(i, &start, &end);
+        result.push_back({ start, end });
+    }
+    visible->release();
+    return result;
+}
+
+void test_slot_allocator() {
+    SlotAllocator allocator;
+    allocator.reset(100);
+    for (int32_t i = 0; i < 10; i++)
+        assert(allocator.allocate() == i);
+    allocator.release(3);
+    allocator.release(5);
+    assert(allocator.allocate() == 3);
+    assert((allocator.getUsedCount() == 9) && (allocator.getSlotsUsed() == 10));
+
+    // 末尾のスロットを先頭の空きに移すと、古いIDは新しいIDに転送される
+    assert(allocator.move(9) == 5);
+    assert((allocator.resolve(9) == 5) && (allocator.getSlotsUsed() == 9));
+    assert(allocator.move(8) == -1);
+    allocator.release(2);
+    assert(allocator.move(8) == 2);
+    assert(allocator.resolve(8) == 2);
+
+    // 移したスロットをさらに移しても、古いIDは最終的なIDを指す
+    allocator.release(6);
+    allocator.release(1);
+    assert(allocator.move(7) == 1);
+    assert(allocator.getSlotsUsed() == 6);
+    allocator.release(0);
+    assert(allocator.move(5) == 0);
+    assert((allocator.resolve(9) == 0) && (allocator.resolve(5) == 0));
+    assert(allocator.getForwardingCount() == 4);
+
+    // 古いIDが再び割り当てられた場合と、転送先が開放された場合は転送しない
+    assert(allocator.allocate() == 5);
+    assert(allocator.resolve(5) == 5);
+    allocator.release(0);
+    assert(allocator.resolve(9) == 9);
+    assert(allocator.getForwardingCount() == 2);
+
+    // 空いている末尾は取り除ける
+    allocator.setCapacity(64);
+    assert(allocator.getCapacity() == 64);
+    for (int32_t i = 0; i < 64 - 5; i++)
+        assert(allocator.allocate() >= 0);
+    assert(allocator.allocate() == -1);
+    std::cout << "test_slot_allocator passed.\n";
+}
+
+// 疎になった表は更新操作ごとに少しずつ詰められ、古いIDも使い続けられる
+void test_slot_repacking() {
+    cleanup();
+    static const int FILES = 3000, DIRECTORIES = 1500;
+    std::vector<int32_t> files(FILES), directories(DIRECTORIES), children(DIRECTORIES);
+    char path[64];
+    {
+        Index index(TEST_DIR, false);
+        FileManager *fm = index.getFileManager();
+        int32_t data = fm->createDirectory(0, "data", USER, GROUP, 0755);
+        for (int i = 0; i < FILES; i++) {
+            snprintf(path, sizeof(path), "f%d", i);
+            files[i] = fm->addFile(data, path, USER, GROUP, 0640, 1 + 5 * i, 5);
+            assert(files[i] >= 0);
+        }
+        for (int i = 0; i < DIRECTORIES; i++) {
+            snprintf(path, sizeof(path), "d%d", i);
+            directories[i] = fm->createDirectory(0, path, USER, GROUP, 0755);
+            assert(directories[i] >= 0);
+            if (i % 10 == 0)
+                children[i] = fm->addFile(directories[i], "x", USER, GROUP, 0640, 20000 + 10 * i, 5);
+        }
+
+        // 10個に1個を残して削除する。リパックはまだ行わない
+        fm->REPACK_SLOTS_PER_UPDATE = 0;
+        for (int i = 0; i < FILES; i++)
+            if (i % 10 != 0)
+                assert(fm->removeFile(files[i]));
+        for (int i = 0; i < DIRECTORIES; i++)
+            if (i % 10 != 0)
+                assert(fm->removeDirectory(directories[i]));
+        int32_t keptFiles = FILES / 10 + DIRECTORIES / 10, keptDirectories = DIRECTORIES / 10 + 2;
+        assert((fm->getFileCount() == keptFiles) && (fm->getDirectoryCount() == keptDirectories));
+        int32_t directoryAllocated, directoryUsed, fileAllocated, fileUsed;
+        fm->getSlotUsage(&directoryAllocated, &directoryUsed, &fileAllocated, &fileUsed);
+        assert((fileUsed == FILES + DIRECTORIES / 10) && (directoryUsed == directories[DIRECTORIES - 10] + 1));
+        std::vector<std::pair<offset, offset>> visible = getVisible(&index, USER);
+        assert((int)visible.size() == keptFiles);
+
+        // 1回の更新では上限の数のスロットだけを移す
+        fm->REPACK_SLOTS_PER_UPDATE = 8;
+        int32_t marker = fm->createDirectory(0, "marker", 0, 0, 0755);
+        assert(marker >= 0);
+        keptDirectories++;
+        int moved = 0;
+        for (int i = 0; i < FILES; i += 10) {
+            snprintf(path, sizeof(path), "/data/f%d", i);
+            if (fm->getFileID(path) != files[i])
+                moved++;
+        }
+        for (int i = 0; i < DIRECTORIES; i += 10) {
+            snprintf(path, sizeof(path), "/d%d/x", i);
+            if (fm->getFileID(path) != children[i])
+                moved++;
+        }
+        assert(moved == 8);
+
+        // 詰め終わるまで更新を続ける
+        for (int round = 0; round < 1000; round++) {
+            fm->getSlotUsage(&directoryAllocated, &directoryUsed, &fileAllocated, &fileUsed);
+            if ((fileUsed == keptFiles) && (directoryUsed == keptDirectories))
+                break;
+            assert(fm->renameDirectory(marker, 0, (round % 2 == 0 ? "marker2" : "marker")));
+        }
+        assert((fileUsed == keptFiles) && (directoryUsed == keptDirectories));
+
+        // 呼び出し元が持っていた古いIDとパスは、移動先のスロットを指す
+        IndexedINode iNode;
+        for (int i = 0; i < FILES; i += 10) {
+            assert(fm->getFileAttributes(files[i], &iNode));
+            assert(iNode.startOffset == 1 + 5 * i);
+            snprintf(path, sizeof(path), "/data/f%d", i);
+            int32_t id = fm->getFileID(path);
+            assert((id >= 0) && (id < keptFiles));
+            assert(fm->getFileAttributes(id, &iNode));
+            assert(iNode.startOffset == 1 + 5 * i);
+        }
+        for (int i = 0; i < DIRECTORIES; i += 10) {
+            snprintf(path, sizeof(path), "/d%d", i);
+            int32_t id = fm->getDirectoryID(path);
+            assert((id > 0) && (id < keptDirectories));
+            snprintf(path, sizeof(path), "/d%d/x", i);
+            assert(fm->getFileAttributes(fm->getFileID(path), &iNode));
+            assert(iNode.startOffset == 20000 + 10 * i);
+        }
+        assert(fm->changeDirectoryAttributes(directories[DIRECTORIES - 10], USER, GROUP, 0700));
+        assert(fm->removeFile(files[FILES - 10]));
+        snprintf(path, sizeof(path), "/data/f%d", FILES - 10);
+        assert(fm->getFileID(path) < 0);
+        keptFiles--;
+
+        // 移動は見え方を変えない
+        visible = getVisible(&index, USER);
+        assert((int)visible.size() == keptFiles);
+    }
+    {
+        // 詰め終わった表は保存の時点で小さくなり、再起動後もパスで引ける
+        Index index(TEST_DIR, false);
+        FileManager *fm = index.getFileManager();
+        int32_t directoryAllocated, directoryUsed, fileAllocated, fileUsed;
+        fm->getSlotUsage(&directoryAllocated, &directoryUsed, &fileAllocated, &fileUsed);
+        assert((fileAllocated == FileManager::MINIMUM_SLOT_COUNT) &&
+                (directoryAllocated == FileManager::MINIMUM_SLOT_COUNT));
+        struct stat buf;
+        std::string fileTable = std::string(TEST_DIR) + "/index.file";
+        assert(stat(fileTable.c_str(), &buf) == 0);
+        assert(buf.st_size == (off_t)(FM_TABLE_HEADER_SIZE + FileManager::MINIMUM_SLOT_COUNT * sizeof(IndexedFile)));
+        assert(fm->getFileCount() == FILES / 10 + DIRECTORIES / 10 - 1);
+        assert(fm->getFileID("/data/f1230") >= 0);
+        assert(fm->getFileID("/d1230/x") >= 0);
+        // 新しいファイルは空きのうち最も小さいIDに入るので、表は詰まったまま
+        int32_t added = fm->addFile(0, "new", 0, 0, 0644, 100000, 5);
+        assert((added >= 0) && (added < fm->getFileCount()));
+        fm->getSlotUsage(&directoryAllocated, &directoryUsed, &fileAllocated, &fileUsed);
+        assert(fileUsed == fm->getFileCount());
+    }
+    cleanup();
+    std::cout << "test_slot_repacking passed.\n";
+}
+
+void test_repacking_large_directory() {
+    cleanup();
+    {
+        Index index(TEST_DIR, false);
+        FileManager *fm = index.getFileManager();
+        char path[64];
+        std::vector<int32_t> directories;
+        for (int i = 0; i < 1500; i++) {
+            snprintf(path, sizeof(path), "d%d", i);
+            directories.push_back(fm->createDirectory(0, path, USER, GROUP, 0755));
+        }
+        // 最大のIDのディレクトリに、1回分の予算より多くの子を作る
+        int32_t big = fm->createDirectory(0, "big", USER, GROUP, 0755);
+        for (int i = 0; i < 50; i++) {
+            snprintf(path, sizeof(path), "f%d", i);
+            assert(fm->addFile(big, path, USER, GROUP, 0640, 1 + 5 * i, 5) >= 0);
+        }
+        fm->REPACK_SLOTS_PER_UPDATE = 0;
+        for (int i = 0; i < 1500; i++)
+            assert(fm->removeDirectory(directories[i]));
+
+        // 子の親をすべて書き換えることになるので、予算を超えるディレクトリは移さない
+        fm->REPACK_SLOTS_PER_UPDATE = 8;
+        int32_t marker = fm->createDirectory(0, "marker", 0, 0, 0755);
+        for (int round = 0; round < 10; round++)
+            assert(fm->renameDirectory(marker, 0, (round % 2 == 0 ? "marker2" : "marker")));
+        int32_t directoryAllocated, directoryUsed, fileAllocated, fileUsed;
+        fm->getSlotUsage(&directoryAllocated, &directoryUsed, &fileAllocated, &fileUsed);
+        assert((fm->getDirectoryID("/big") == big) && (directoryUsed == big + 1));
+
+        // 予算に収まれば1回の更新で移す
+        fm->REPACK_SLOTS_PER_UPDATE = 64;
+        assert(fm->renameDirectory(marker, 0, "marker3"));
+        fm->getSlotUsage(&directoryAllocated, &directoryUsed, &fileAllocated, &fileUsed);
+        assert(directoryUsed == fm->getDirectoryCount());
+        int32_t id = fm->getDirectoryID("/big");
+        assert((id > 0) && (id < big));
+        IndexedINode iNode;
+        assert(fm->getFileAttributes(fm->getFileID("/big/f49"), &iNode));
+        assert(iNode.startOffset == 1 + 5 * 49);
+    }
+    cleanup();
+    std::cout << "test_repacking_large_directory passed.\n";
+}
+
+int main() {
+    const char *argv[] = { "slotallocator_test" };
+    initializeConfiguratorFromCommandLineParameters(1, argv);
+    setLogLevel(LOG_ERROR + 1);
+
+    test_slot_allocator();
+    test_slot_repacking();
+    test_repacking_large_directory();
+
+    std::cout << "All slot allocator tests passed.\n";
+}
@@ -0,0 +1,126 @@
+#include <iostream>
+#include <cassert>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <atomic>
+#include <pthread.h>
+#include <unistd.h>
+#include "../../index/index.h"
+#include "../../index/indexview.h"
+#include "../../index/segment.h"
+#include "../../utils/all.h"
+
+static const char *TEST_DIR = "/tmp/test_snapshot";
+
+static void cleanup() {
+    std::string command = "rm -rf " + std::string(TEST_DIR);
+    system(command.c_str());
+}
+
+static void addPostings(Index *index, offset from, offset to) {
+    char *terms[1] = { (char*)"term" };
+    for (offset p = from; p < to; p++)
+        index->addPostings(terms, &p, 1);
+}
+
+void test_view_is_isolated_from_updates() {
+    cleanup();
+    {
+        Index index(TEST_DIR, false);
+        addPostings(&index, 0, 1000);
+        index.flushUpdateList();
+        addPostings(&index, 1000, 1500);
+
+        // UpdateListの内容もビューに含まれる
+        IndexView *view = index.acquireView();
+        int64_t count;
+        offset *postings = view->getPostings("term", &count);
+        assert(count == 1500);
+        free(postings);
+
+        // 書き出しとマージの後も、固定したビューの内容は変わらない
+        index.flushUpdateList();
+        index.waitForMerges();
+        addPostings(&index, 1500, 1700);
+        assert(index.segmentCount == 1);
+        assert(view->segmentCount == 1);
+        char *oldFile = duplicateString(view->segments[0]->getFileName());
+        assert(strcmp(oldFile, index.segments[0]->getFileName()) != 0);
+        postings = view->getPostings("term", &count);
+        assert((count == 1500) && (postings[1499] == 1499));
+        free(postings);
+
+        // 新しいビューには最新の内容が見える
+        IndexView *newView = index.acquireView();
+        assert(newView->generation > view->generation);
+        postings = newView->getPostings("term", &count);
+        assert((count == 1700) && (postings[1699] == 1699));
+        free(postings);
+        newView->release();
+
+        // マージの入力は古いビューが開放されるまで削除されない
+        assert(access(oldFile, F_OK) == 0);
+        view->release();
+        assert(access(oldFile, F_OK) != 0);
+        free(oldFile);
+    }
+    cleanup();
+    std::cout << "test_view_is_isolated_from_updates passed.\n";
+}
+
+static Index *sharedIndex;
+static std::atomic<bool> writerDone;
+
+static void *readerThread(void *) {
+    int64_t lastCount = 0;
+    while (!writerDone) {
+        IndexView *view = sharedIndex->acquireView();
+        int64_t count;
+        offset *postings = view->getPostings("term", &count);
+        view->release();
+        // ポスティングは0から順に追加されるので、常に先頭から連続した列が見える
+        assert(count >= lastCount);
+        for (int64_t i = 0; i < count; i++)
+            assert(postings[i] == i);
+        free(postings);
+        lastCount = count;
+    }
+    return nullptr;
+}
+
+void test_concurrent_readers() {
+    cleanup();
+    {
+        Index index(TEST_DIR, false);
+        sharedIndex = &index;
+        writerDone = false;
+        pthread_t readers[4];
+        for (int i = 0; i < 4; i++)
+            pthread_create(&readers[i], nullptr, readerThread, nullptr);
+        for (int batch = 0; batch < 20; batch++) {
+            addPostings(&index, batch * 500, (batch + 1) * 500);
+            index.flushUpdateList();
+        }
+        index.waitForMerges();
+        writerDone = true;
+        for (int i = 0; i < 4; i++)
+            pthread_join(readers[i], nullptr);
+        int64_t count;
+        offset *postings = index.getPostings("term", &count);
+        assert(count == 20 * 500);
+        free(postings);
+    }
+    cleanup();
+    std::cout << "test_concurrent_readers passed.\n";
+}
+
+int main() {
+    initializeConfigurator();
+    setLogLevel(LOG_ERROR + 1);
+
+    test_view_is_isolated_from_updates();
+    test_concurrent_readers();
+
+    std::cout << "All snapshot tests passed.\n";
+}
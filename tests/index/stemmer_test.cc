@@ -0,0 +1,177 @@
+#include <iostream>
+#include <cassert>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <pthread.h>
+#include "../../index/index.h"
+#include "../../index/stemmer.h"
+#include "../../utils/all.h"
+
+static const char *TEST_DIR = "/tmp/test_stemmer";
+
+static void cleanup() {
+    std::string command = "rm -rf " + std::string(TEST_DIR);
+    system(command.c_str());
+}
+
+static std::string stem(const char *word) {
+    char result[MAX_STEM_LENGTH];
+    Stemmer::stem(word, result);
+    return result;
+}
+
+// Porterの論文と参照実装の例
+static const char *EXAMPLES[][2] = {
+    { "caresses", "caress" }, { "ponies", "poni" }, { "ties", "ti" }, { "caress", "caress" },
+    { "cats", "cat" }, { "feed", "feed" }, { "agreed", "agre" }, { "plastered", "plaster" },
+    { "bled", "bled" }, { "motoring", "motor" }, { "sing", "sing" }, { "conflated", "conflat" },
+    { "troubled", "troubl" }, { "sized", "size" }, { "hopping", "hop" }, { "tanned", "tan" },
+    { "falling", "fall" }, { "hissing", "hiss" }, { "fizzed", "fizz" }, { "failing", "fail" },
+    { "filing", "file" }, { "happy", "happi" }, { "sky", "sky" }, { "relational", "relat" },
+    { "conditional", "condit" }, { "rational", "ration" }, { "digitizer", "digit" },
+    { "differentli", "differ" }, { "vietnamization", "vietnam" }, { "predication", "predic" },
+    { "operator", "oper" }, { "feudalism", "feudal" }, { "decisiveness", "decis" },
+    { "hopefulness", "hope" }, { "callousness", "callous" }, { "formaliti", "formal" },
+    { "sensitiviti", "sensit" }, { "sensibiliti", "sensibl" }, { "triplicate", "triplic" },
+    { "formative", "form" }, { "formalize", "formal" }, { "electriciti", "electr" },
+    { "electrical", "electr" }, { "hopeful", "hope" }, { "goodness", "good" },
+    { "revival", "reviv" }, { "allowance", "allow" }, { "inference", "infer" },
+    { "airliner", "airlin" }, { "gyroscopic", "gyroscop" }, { "adjustable", "adjust" },
+    { "defensible", "defens" }, { "irritant", "irrit" }, { "replacement", "replac" },
+    { "adjustment", "adjust" }, { "dependent", "depend" }, { "adoption", "adopt" },
+    { "communism", "commun" }, { "activate", "activ" }, { "angulariti", "angular" },
+    { "homologous", "homolog" }, { "effective", "effect" }, { "bowdlerize", "bowdler" },
+    { "probate", "probat" }, { "rate", "rate" }, { "cease", "ceas" }, { "controll", "control" },
+    { "roll", "roll" }, { "generalizations", "gener" }, { "oscillators", "oscil" },
+    { nullptr, nullptr }
+};
+
+void test_porter() {
+    for (int i = 0; EXAMPLES[i][0] != nullptr; i++) {
+        if (stem(EXAMPLES[i][0]) != EXAMPLES[i][1]) {
+            std::cout << EXAMPLES[i][0] << ": " << stem(EXAMPLES[i][0]) << "\n";
+            assert(false);
+        }
+    }
+
+    // ステミングの対象にならない語はそのまま
+    assert(stem("is") == "is");
+    assert(stem("2024") == "2024");
+    assert(stem("mp3s") == "mp3s");
+    assert(stem("<doc>") == "<doc>");
+    assert(stem("caf\xc3\xa9s") == "caf\xc3\xa9s");
+    std::cout << "test_porter passed.\n";
+}
+
+void test_index_terms() {
+    StemCache cache;
+    char terms[2][MAX_STEM_LENGTH];
+
+    assert(cache.getIndexTerms("walking", 0, terms) == 1);
+    assert(strcmp(terms[0], "walking") == 0);
+
+    assert(cache.getIndexTerms("walking", 1, terms) == 1);
+    assert(strcmp(terms[0], "walk") == 0);
+
+    assert(cache.getIndexTerms("walking", 2, terms) == 2);
+    assert((strcmp(terms[0], "walking") == 0) && (strcmp(terms[1], "walk") == 0));
+    assert(cache.getIndexTerms("walk", 2, terms) == 1);
+    assert(strcmp(terms[0], "walk") == 0);
+
+    assert(cache.getIndexTerms("walking", 3, terms) == 2);
+    assert((strcmp(terms[0], "walking") == 0) && (strcmp(terms[1], "walk$") == 0));
+    assert(cache.getIndexTerms("walk", 3, terms) == 2);
+    assert((strcmp(terms[0], "walk") == 0) && (strcmp(terms[1], "walk$") == 0));
+    assert(cache.getIndexTerms("<doc>", 3, terms) == 1);
+    assert(strcmp(terms[0], "<doc>") == 0);
+
+    // ステミングの対象になる語だけがキャッシュされる
+    assert(cache.getSize() == 2);
+    cache.clear();
+    assert(cache.getSize() == 0);
+    std::cout << "test_index_terms passed.\n";
+}
+
+static const int THREAD_COUNT = 8;
+
+static void *stemmingThread(void *data) {
+    StemCache *cache = (StemCache*)data;
+    char result[MAX_STEM_LENGTH];
+    for (int round = 0; round < 100; round++)
+        for (int i = 0; EXAMPLES[i][0] != nullptr; i++) {
+            cache->getStem(EXAMPLES[i][0], result);
+            assert(strcmp(result, EXAMPLES[i][1]) == 0);
+        }
+    return nullptr;
+}
+
+void test_concurrent_cache() {
+    StemCache cache;
+    pthread_t threads[THREAD_COUNT];
+    for (int i = 0; i < THREAD_COUNT; i++)
+        pthread_create(&threads[i], nullptr, stemmingThread, &cache);
+    for (int i = 0; i < THREAD_COUNT; i++)
+        pthread_join(threads[i], nullptr);
+
+    int exampleCount = 0;
+    while (EXAMPLES[exampleCount][0] != nullptr)
+        exampleCount++;
+    assert(cache.getSize() == exampleCount);
+    std::cout << "test_concurrent_cache passed.\n";
+}
+
+void test_stemmed_index() {
+    cleanup();
+    {
+        Index index(TEST_DIR, false);
+        assert(index.STEMMING_LEVEL == 3);
+        char *terms[4] = { (char*)"walking", (char*)"walks", (char*)"walk", (char*)"12" };
+        offset postings[4] = { 10, 20, 30, 40 };
+        index.addPostings(terms, postings, 4);
+
+        int64_t count;
+        offset *result = index.getPostings("walk$", &count);
+        assert((count == 3) && (result[0] == 10) && (result[1] == 20) && (result[2] == 30));
+        free(result);
+        result = index.getPostings("walking", &count);
+        assert((count == 1) && (result[0] == 10));
+        free(result);
+        result = index.getPostings("12", &count);
+        assert((count == 1) && (result[0] == 40));
+        free(result);
+        result = index.getPostings("12$", &count);
+        assert(count == 0);
+        free(result);
+
+        index.flushUpdateList();
+        result = index.getPostings("walk$", &count);
+        assert(count == 3);
+        free(result);
+    }
+    {
+        // ステミングレベルは既存のインデックスから読み込まれる
+        Index index(TEST_DIR, false);
+        assert(index.STEMMING_LEVEL == 3);
+        int64_t count;
+        offset *result = index.getPostings("walk$", &count);
+        assert(count == 3);
+        free(result);
+    }
+    cleanup();
+    std::cout << "test_stemmed_index passed.\n";
+}
+
+int main() {
+    const char *argv[] = { "stemmer_test", "--STEMMING_LEVEL=3" };
+    initializeConfiguratorFromCommandLineParameters(2, argv);
+    setLogLevel(LOG_ERROR + 1);
+
+    test_porter();
+    test_index_terms();
+    test_concurrent_cache();
+    test_stemmed_index();
+
+    std::cout << "All stemmer tests passed.\n";
+}
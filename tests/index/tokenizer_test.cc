@@ -0,0 +1,145 @@
+#include <iostream>
+#include <cassert>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include "../../index/tokenizer.h"
+#include "../../utils/all.h"
+
+typedef struct {
+    std::string text;
+    offset position;
+    int type;
+} TestToken;
+
+// inputをchunkSizeバイトずつ与えてトークンを集める。chunkSizeが0なら一度に与える
+static std::vector<TestToken> tokenize(const std::string &input, bool markup, int chunkSize) {
+    std::vector<TestToken> result;
+    StreamTokenizer tokenizer(markup);
+    tokenizer.reset(100);
+    int64_t size = input.size();
+    int64_t step = (chunkSize == 0 ? size : chunkSize);
+    int64_t start = 0;
+    do {
+        int64_t n = (start + step > size ? size - start : step);
+        tokenizer.setInput(&input[start], n, start + n >= size);
+        Token token;
+        while (tokenizer.getNextToken(&token))
+            result.push_back({ std::string(token.text), token.position, token.type });
+        start += n;
+    } while (start < size);
+    return result;
+}
+
+static std::string join(const std::vector<TestToken> &tokens) {
+    std::string result;
+    for (size_t i = 0; i < tokens.size(); i++)
+        result += (i == 0 ? "" : " ") + tokens[i].text;
+    return result;
+}
+
+void test_words() {
+    std::vector<TestToken> tokens = tokenize("The quick, BROWN fox's 42nd  jump!", false, 0);
+    assert(join(tokens) == "the quick brown fox s 42nd jump");
+    for (size_t i = 0; i < tokens.size(); i++) {
+        assert(tokens[i].position == (offset)(100 + i));
+        assert(tokens[i].type == StreamTokenizer::TOKEN_WORD);
+    }
+
+    // 小文字だけの語は入力バッファを直接指す
+    const char *input = "zero copy Words";
+    StreamTokenizer tokenizer(false);
+    tokenizer.setInput(input, strlen(input), true);
+    Token token;
+    assert(tokenizer.getNextToken(&token) && (token.text.data() == input));
+    assert(tokenizer.getNextToken(&token) && (token.text.data() == input + 5));
+    assert(tokenizer.getNextToken(&token) && (token.text == "words") && (token.text.data() != input + 10));
+    assert(!tokenizer.getNextToken(&token));
+    assert(tokenizer.getNextPosition() == 3);
+    std::cout << "test_words passed.\n";
+}
+
+void test_long_and_utf8_words() {
+    std::string longWord(100, 'a');
+    std::vector<TestToken> tokens = tokenize(longWord + " b", false, 0);
+    assert((tokens.size() == 2) && (tokens[0].text == std::string(MAX_TOKEN_LENGTH, 'a')));
+
+    // UTF-8のマルチバイト文字は語の一部になり、文字の途中で切り詰められることはない
+    tokens = tokenize("caf\xC3\xA9 na\xC3\xAFve", false, 0);
+    assert(join(tokens) == "caf\xC3\xA9 na\xC3\xAFve");
+    std::string wide = std::string(MAX_TOKEN_LENGTH - 1, 'x') + "\xC3\xA9" + "yz";
+    tokens = tokenize(wide, false, 0);
+    assert((tokens.size() == 1) && (tokens[0].text == std::string(MAX_TOKEN_LENGTH - 1, 'x')));
+    std::cout << "test_long_and_utf8_words passed.\n";
+}
+
+void test_markup() {
+    std::string input =
+        "<?xml version=\"1.0\"?><!DOCTYPE doc><DOC id='a>b'>Hello <!-- not -- indexed -->"
+        "W&ouml;rld &#169; AT&T a < b<br/></Doc >";
+    std::vector<TestToken> tokens = tokenize(input, true, 0);
+    assert(join(tokens) == "<doc> hello w rld at t a b <br> </br> </doc>");
+    assert(tokens[0].type == StreamTokenizer::TOKEN_START_TAG);
+    assert(tokens[tokens.size() - 1].type == StreamTokenizer::TOKEN_END_TAG);
+
+    // markupを無効にするとタグも語として扱われる
+    tokens = tokenize("<b>bold</b>", false, 0);
+    assert(join(tokens) == "b bold b");
+    std::cout << "test_markup passed.\n";
+}
+
+void test_chunk_boundaries() {
+    std::string input;
+    for (int i = 0; i < 200; i++) {
+        input += "<Section n=\"" + std::to_string(i) + "\">Word" + std::to_string(i * 7919) +
+            " caf\xC3\xA9&amp;lait <!-- c" + std::to_string(i) + " --> " + std::string(i % 80, 'q') + "</section>\n";
+    }
+    std::vector<TestToken> expected = tokenize(input, true, 0);
+    int chunkSizes[] = { 1, 2, 3, 7, 31, 64, 1000 };
+    for (int chunkSize : chunkSizes) {
+        std::vector<TestToken> tokens = tokenize(input, true, chunkSize);
+        assert(tokens.size() == expected.size());
+        for (size_t i = 0; i < tokens.size(); i++) {
+            assert(tokens[i].text == expected[i].text);
+            assert(tokens[i].position == expected[i].position);
+            assert(tokens[i].type == expected[i].type);
+        }
+    }
+    std::cout << "test_chunk_boundaries passed.\n";
+}
+
+void test_simd_matches_scalar() {
+    if (!StreamTokenizer::isSIMDAvailable()) {
+        std::cout << "test_simd_matches_scalar skipped.\n";
+        return;
+    }
+    srand(7);
+    std::string input;
+    for (int i = 0; i < 100000; i++)
+        input += (char)(rand() % 4 == 0 ? ' ' : rand() % 256);
+    for (int markup = 0; markup <= 1; markup++) {
+        StreamTokenizer::setSIMDEnabled(false);
+        std::vector<TestToken> scalar = tokenize(input, markup, 4096);
+        StreamTokenizer::setSIMDEnabled(true);
+        std::vector<TestToken> simd = tokenize(input, markup, 4096);
+        assert(scalar.size() == simd.size());
+        for (size_t i = 0; i < simd.size(); i++)
+            assert((scalar[i].text == simd[i].text) && (scalar[i].type == simd[i].type));
+    }
+    std::cout << "test_simd_matches_scalar passed.\n";
+}
+
+int main() {
+    initializeConfigurator();
+    setLogLevel(LOG_ERROR + 1);
+
+    test_words();
+    test_long_and_utf8_words();
+    test_markup();
+    test_chunk_boundaries();
+    test_simd_matches_scalar();
+
+    std::cout << "All tokenizer tests passed.\n";
+}
@@ -0,0 +1,93 @@
+#include <iostream>
+#include <cassert>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include "../../index/updatelist.h"
+#include "../../utils/all.h"
+
+void test_add_and_read_postings() {
+    UpdateList list(16 * 1024 * 1024);
+    const char *words[] = { "the", "quick", "brown", "fox", "the", "lazy", "dog", "the" };
+    for (int i = 0; i < 8; i++)
+        assert(list.addPosting(words[i], i * 100));
+    assert(list.getTermCount() == 6);
+    assert(list.getPostingCount() == 8);
+
+    int32_t id = list.findTerm("the");
+    assert(id >= 0);
+    assert(list.getPostingCount(id) == 3);
+    offset buffer[3];
+    list.getPostings(id, buffer);
+    assert((buffer[0] == 0) && (buffer[1] == 400) && (buffer[2] == 700));
+    assert(list.findTerm("cat") == -1);
+
+    // 既存のポスティング以下の値は無視される
+    assert(list.addPosting("the", 700));
+    assert(list.getPostingCount(id) == 3);
+
+    int32_t *sorted = list.getSortedTermIDs();
+    for (int i = 1; i < list.getTermCount(); i++)
+        assert(strcmp(list.getTerm(sorted[i - 1]), list.getTerm(sorted[i])) < 0);
+    free(sorted);
+
+    std::cout << "test_add_and_read_postings passed.\n";
+}
+
+void test_many_terms_and_chunks() {
+    UpdateList list(16 * 1024 * 1024);
+    char term[32];
+    for (int i = 0; i < 200000; i++) {
+        snprintf(term, sizeof(term), "t%d", i % 5000);
+        assert(list.addPosting(term, (offset)i * 3));
+    }
+    assert(list.getTermCount() == 5000);
+    offset *buffer = typed_malloc(offset, 40);
+    for (int t = 0; t < 5000; t += 499) {
+        snprintf(term, sizeof(term), "t%d", t);
+        int32_t id = list.findTerm(term);
+        assert(list.getPostingCount(id) == 40);
+        list.getPostings(id, buffer);
+        for (int k = 0; k < 40; k++)
+            assert(buffer[k] == (offset)(t + k * 5000) * 3);
+    }
+    free(buffer);
+
+    list.clear();
+    assert(list.getTermCount() == 0);
+    assert(list.findTerm("t0") == -1);
+    std::cout << "test_many_terms_and_chunks passed.\n";
+}
+
+void test_memory_limit() {
+    const int64_t limit = 1024 * 1024;
+    UpdateList list(limit);
+    char term[32];
+    int64_t added = 0;
+    for (int i = 0; ; i++) {
+        snprintf(term, sizeof(term), "term%d", i % 20000);
+        if (!list.addPosting(term, (offset)i))
+            break;
+        assert(list.getMemoryConsumption() <= limit);
+        added++;
+    }
+    assert(list.getMemoryConsumption() <= limit);
+    assert(list.getPostingCount() == added);
+    assert(list.isFull());
+
+    // clear後は確保済みのメモリを再利用する
+    int64_t before = list.getMemoryConsumption();
+    list.clear();
+    assert(!list.isFull() || list.getMemoryConsumption() == before);
+    assert(list.addPosting("again", 1));
+    assert(list.getMemoryConsumption() == before);
+    std::cout << "test_memory_limit passed.\n";
+}
+
+int main() {
+    test_add_and_read_postings();
+    test_many_terms_and_chunks();
+    test_memory_limit();
+
+    std::cout << "All UpdateList tests passed.\n";
+}
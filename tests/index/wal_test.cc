@@ -0,0 +1,273 @@
+#include <iostream>
+#include <cassert>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+#include "../../filemanager/filemanager.h"
+#include "../../index/extentset.h"
+#include "../../index/index.h"
+#include "../../index/longliststore.h"
+#include "../../index/writeaheadlog.h"
+#include "../../utils/all.h"
+
+static const char *TEST_DIR = "/tmp/test_wal";
+
+static void cleanup() {
+    std::string command = "rm -rf " + std::string(TEST_DIR) + " " + TEST_DIR + ".base " + TEST_DIR + ".full";
+    system(command.c_str());
+}
+
+static std::string readRecord(const WAL_Record &record) {
+    return std::string(record.data.data(), record.data.size());
+}
+
+void test_log_records() {
+    cleanup();
+    mkdir(TEST_DIR, 0700);
+    std::string fileName = std::string(TEST_DIR) + "/log";
+
+    WriteAheadLog *wal = new WriteAheadLog(fileName.c_str(), 10, false);
+    assert(wal->wasClosedCleanly());
+    assert(wal->append(1, "first", 5) == 11);
+    assert(wal->append(2, "second", 6) == 12);
+    assert(wal->commit(12));
+    assert(wal->append(3, "third", 5) == 13);
+    assert(wal->commit(13));
+    std::vector<WAL_Record> records;
+    assert(wal->read(11, &records));
+    assert((records.size() == 2) && (records[0].lsn == 12) && (records[0].type == 2));
+    assert((readRecord(records[0]) == "second") && (readRecord(records[1]) == "third"));
+    // closeを呼ばずに破棄した場合はクラッシュとみなされる
+    delete wal;
+
+    // 書き込み途中のレコードを末尾に付け足す
+    int fd = open(fileName.c_str(), O_WRONLY | O_APPEND);
+    WAL_RecordHeader torn = { 14, 1, 100, 0, 0 };
+    assert(write(fd, &torn, sizeof(torn)) == sizeof(torn));
+    assert(write(fd, "partial", 7) == 7);
+    close(fd);
+
+    wal = new WriteAheadLog(fileName.c_str(), 10, false);
+    assert(!wal->wasClosedCleanly());
+    assert(wal->getLastLSN() == 13);
+    records.clear();
+    wal->read(10, &records);
+    assert(records.size() == 3);
+    assert(wal->append(4, "fourth", 6) == 14);
+    assert(wal->commit(14));
+    records.clear();
+    wal->read(10, &records);
+    assert((records.size() == 4) && (readRecord(records[3]) == "fourth"));
+
+    // チェックポイントより前のレコードは取り除かれ、後のレコードは残る
+    wal->checkpoint(12);
+    records.clear();
+    wal->read(0, &records);
+    assert((records.size() == 2) && (records[0].lsn == 13) && (records[1].lsn == 14));
+    wal->append(5, "fifth", 5);
+    wal->checkpoint(15);
+    records.clear();
+    wal->read(0, &records);
+    assert(records.empty());
+    wal->close();
+    delete wal;
+
+    // LSNは切り詰めた後も続く
+    wal = new WriteAheadLog(fileName.c_str(), 0, false);
+    assert(wal->wasClosedCleanly());
+    assert(wal->append(1, "sixth", 5) == 16);
+    wal->close();
+    delete wal;
+
+    // 読み取り専用では変更しない
+    wal = new WriteAheadLog(fileName.c_str(), 0, true);
+    records.clear();
+    wal->read(0, &records);
+    assert((records.size() == 1) && (records[0].lsn == 16));
+    delete wal;
+    std::cout << "test_log_records passed.\n";
+}
+
+static const int COMMIT_THREADS = 8;
+static const int COMMITS_PER_THREAD = 200;
+
+static void *commitThread(void *data) {
+    WriteAheadLog *wal = (WriteAheadLog*)data;
+    for (int i = 0; i < COMMITS_PER_THREAD; i++) {
+        int64_t lsn = wal->append(1, &i, sizeof(i));
+        if (!wal->commit(lsn))
+            return (void*)1;
+    }
+    return nullptr;
+}
+
+void test_group_commit() {
+    cleanup();
+    mkdir(TEST_DIR, 0700);
+    std::string fileName = std::string(TEST_DIR) + "/log";
+    WriteAheadLog *wal = new WriteAheadLog(fileName.c_str(), 0, false);
+    pthread_t threads[COMMIT_THREADS];
+    for (int t = 0; t < COMMIT_THREADS; t++)
+        pthread_create(&threads[t], nullptr, commitThread, wal);
+    for (int t = 0; t < COMMIT_THREADS; t++) {
+        void *result;
+        pthread_join(threads[t], &result);
+        assert(result == nullptr);
+    }
+    // 同時にcommitしたレコードは1回の同期にまとめられる
+    int total = COMMIT_THREADS * COMMITS_PER_THREAD;
+    assert((wal->getSyncCount() > 0) && (wal->getSyncCount() <= total));
+    std::vector<WAL_Record> records;
+    wal->read(0, &records);
+    assert((int)records.size() == total);
+    for (int i = 0; i < total; i++)
+        assert(records[i].lsn == i + 1);
+    // すでに書き込まれたレコードのcommitは同期しない
+    int64_t syncs = wal->getSyncCount();
+    assert(wal->commit(total));
+    assert(wal->getSyncCount() == syncs);
+    wal->close();
+    delete wal;
+    std::cout << "test_group_commit passed.\n";
+}
+
+// 復旧したインデックスが、クラッシュ前の変更をすべて含んでいることを確かめる
+static void checkRecoveredIndex(const char *directory) {
+    Index *index = new Index(directory, false);
+    FileManager *fm = index->getFileManager();
+    assert(fm->getFileCount() == 2);
+    assert(fm->getDirectoryCount() == 2);
+    int32_t a = fm->getFileID("/docs/a");
+    assert((a >= 0) && (fm->getFileID("/docs/b") < 0) && (fm->getFileID("/c") < 0));
+    assert(fm->getFileID("/docs/d") >= 0);
+    IndexedINode attributes;
+    assert(fm->getFileAttributes(a, &attributes));
+    assert((attributes.owner == 1000) && (attributes.permissions == 0600));
+    assert((attributes.startOffset == 0) && (attributes.tokenCount == 100));
+
+    // 削除されたファイルの範囲はクエリの結果から除かれる
+    assert(index->deletedExtents->getCount() == 1);
+    offset start, end;
+    index->deletedExtents->getExtent(0, &start, &end);
+    assert((start == 100) && (end == 199));
+    assert((index->usedAddressSpace == 300) && (index->deletedAddressSpace == 100));
+
+    // 新しいファイルは既存の範囲の後にしか追加できない
+    assert(fm->addFile(0, "e", 0, 0, 0644, 250, 10) < 0);
+    assert(fm->addFile(0, "e", 0, 0, 0644, 300, 10) >= 0);
+    delete index;
+
+    // 正常に終了した後はログを再実行しない
+    index = new Index(directory, false);
+    assert(index->wal->wasClosedCleanly());
+    assert(index->getFileManager()->getFileCount() == 3);
+    assert(index->usedAddressSpace == 310);
+    delete index;
+}
+
+void test_crash_recovery() {
+    cleanup();
+    Index *index = new Index(TEST_DIR, false);
+    for (int i = 0; i < 300; i++) {
+        char *terms[1] = { (char*)"word" };
+        offset postings[1] = { (offset)i };
+        index->addPostings(terms, postings, 1);
+    }
+    index->flushUpdateList();
+    index->waitForMerges();
+    // チェックポイントの時点の表(変更が1ページも書き戻されなかった場合)
+    std::string command = "cp -a " + std::string(TEST_DIR) + " " + TEST_DIR + ".base";
+    system(command.c_str());
+
+    FileManager *fm = index->getFileManager();
+    int32_t docs = fm->createDirectory(0, "docs", 0, 0, 0755);
+    assert(docs > 0);
+    assert(fm->addFile(docs, "a", 0, 0, 0644, 0, 100) >= 0);
+    int32_t b = fm->addFile(docs, "b", 0, 0, 0644, 100, 100);
+    int32_t c = fm->addFile(0, "c", 0, 0, 0644, 200, 100);
+    assert((b >= 0) && (c >= 0));
+    assert(fm->removeFile(b));
+    assert(fm->renameFile(c, docs, "d"));
+    assert(fm->changeFileAttributes(fm->getFileID("/docs/a"), 1000, 0, 0600));
+    assert((index->usedAddressSpace == 300) && (index->deletedAddressSpace == 100));
+
+    // クラッシュした時点のログと、すべてのページが書き戻された表
+    command = "cp " + std::string(TEST_DIR) + "/index.wal " + TEST_DIR + ".base/index.wal";
+    system(command.c_str());
+    command = "cp -a " + std::string(TEST_DIR) + " " + TEST_DIR + ".full";
+    system(command.c_str());
+    delete index;
+
+    checkRecoveredIndex((std::string(TEST_DIR) + ".base").c_str());
+    checkRecoveredIndex((std::string(TEST_DIR) + ".full").c_str());
+    cleanup();
+    std::cout << "test_crash_recovery passed.\n";
+}
+
+void test_garbage_collection_recovery() {
+    cleanup();
+    mkdir(TEST_DIR, 0700);
+    std::string dataFile = std::string(TEST_DIR) + "/longlists";
+    std::string directoryFile = std::string(TEST_DIR) + "/longlists.dir";
+    LongListStore *store = new LongListStore(dataFile.c_str(), directoryFile.c_str(), true);
+    std::vector<offset> postings;
+    for (offset i = 0; i < 1000; i++)
+        postings.push_back(i * 2);
+    assert(store->appendPostings("term", postings.data(), postings.size(), COMPRESSION_VBYTE));
+    assert(store->saveDirectory());
+    ExtentSet garbage;
+    garbage.add(0, 999);
+    assert(store->collectGarbage(&garbage, COMPRESSION_VBYTE));
+
+    // 置き換えを始める前にクラッシュした場合を再現するため、.gcファイルを退避しておく
+    std::string command = "cp " + dataFile + ".gc " + dataFile + ".saved && cp " +
+        directoryFile + ".gc " + directoryFile + ".saved";
+    system(command.c_str());
+    delete store;
+    command = "mv " + dataFile + ".saved " + dataFile + ".gc && mv " +
+        directoryFile + ".saved " + directoryFile + ".gc";
+    system(command.c_str());
+
+    // ログに置き換えが記録されていなければ、古いデータのまま
+    command = "cp " + dataFile + ".gc " + dataFile + ".saved && cp " +
+        directoryFile + ".gc " + directoryFile + ".saved";
+    system(command.c_str());
+    assert(LongListStore::recoverGarbageCollection(dataFile.c_str(), directoryFile.c_str(), false));
+    store = new LongListStore(dataFile.c_str(), directoryFile.c_str(), false);
+    assert(store->getPostingCount() == 1000);
+    delete store;
+
+    // 記録されていれば、置き換えを完了させる
+    command = "mv " + dataFile + ".saved " + dataFile + ".gc && mv " +
+        directoryFile + ".saved " + directoryFile + ".gc";
+    system(command.c_str());
+    assert(LongListStore::recoverGarbageCollection(dataFile.c_str(), directoryFile.c_str(), true));
+    store = new LongListStore(dataFile.c_str(), directoryFile.c_str(), false);
+    int64_t count;
+    offset *result = store->getPostings("term", &count);
+    assert((result != nullptr) && (count == 500) && (result[0] == 1000) && (result[499] == 1998));
+    free(result);
+    delete store;
+    // 完了済みであれば何もしない
+    assert(LongListStore::recoverGarbageCollection(dataFile.c_str(), directoryFile.c_str(), true));
+    cleanup();
+    std::cout << "test_garbage_collection_recovery passed.\n";
+}
+
+int main() {
+    const char *argv[] = { "wal_test" };
+    initializeConfiguratorFromCommandLineParameters(1, argv);
+    setLogLevel(LOG_ERROR + 1);
+
+    test_log_records();
+    test_group_commit();
+    test_crash_recovery();
+    test_garbage_collection_recovery();
+
+    std::cout << "All write-ahead log tests passed.\n";
+}
@@ -0,0 +1,306 @@
+#include <iostream>
+#include <cassert>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <map>
+#include <string>
+#include <vector>
+#include "../../index/doclevel.h"
+#include "../../index/index.h"
+#include "../../index/longliststore.h"
+#include "../../query/bm25query.h"
+#include "../../utils/all.h"
+
+static const char *TEST_DIR = "/tmp/test_bm25";
+
+static void cleanup() {
+    std::string command = "rm -rf " + std::string(TEST_DIR);
+    system(command.c_str());
+}
+
+typedef struct {
+    offset start;
+    std::vector<std::string> words;
+    bool deleted;
+} Document;
+
+static std::vector<Document> documents;
+
+static const int VOCABULARY_SIZE = 200;
+
+static std::string getWord(int i) {
+    return "w" + std::to_string(i);
+}
+
+// 出現頻度が語の順位に反比例する(Zipf分布)語を選ぶ
+static std::string randomWord() {
+    static std::vector<double> cumulative;
+    if (cumulative.empty()) {
+        double sum = 0;
+        for (int i = 0; i < VOCABULARY_SIZE; i++)
+            cumulative.push_back(sum += 1.0 / (i + 1));
+    }
+    double r = cumulative.back() * (rand() / (RAND_MAX + 1.0));
+    return getWord(std::lower_bound(cumulative.begin(), cumulative.end(), r) - cumulative.begin());
+}
+
+static void generateDocuments(int count) {
+    documents.clear();
+    srand(11);
+    offset position = 1000;
+    for (int d = 0; d < count; d++) {
+        Document document;
+        document.start = position;
+        document.deleted = false;
+        int length = 5 + rand() % 200;
+        for (int i = 0; i < length; i++)
+            document.words.push_back(randomWord());
+        // <doc>と</doc>の分だけ位置を進める
+        position += length + 2;
+        documents.push_back(document);
+    }
+}
+
+static void addDocuments(Index *index, size_t from, size_t to) {
+    std::vector<std::string> terms;
+    std::vector<offset> postings;
+    for (size_t d = from; d < to; d++) {
+        offset position = documents[d].start;
+        terms.push_back("<doc>");
+        postings.push_back(position++);
+        for (auto &word : documents[d].words) {
+            terms.push_back(word);
+            postings.push_back(position++);
+        }
+        terms.push_back("</doc>");
+        postings.push_back(position++);
+    }
+    std::vector<char*> pointers;
+    for (auto &term : terms)
+        pointers.push_back((char*)term.c_str());
+    // ドキュメントが呼び出しをまたぐように、半端な大きさに分けて追加する
+    for (size_t i = 0; i < pointers.size(); i += 777) {
+        int n = std::min((size_t)777, pointers.size() - i);
+        index->addPostings(&pointers[i], &postings[i], n);
+    }
+}
+
+// ガベージコレクションの後は、削除された文書のポスティングが文書頻度に含まれない
+static bool garbageCollected = false;
+
+// referenceRankingの文書頻度をどのgarbageCollectedの値で求めたか(-1: 未計算)
+static int referenceComputedFor = -1;
+
+// 索引と同じ量子化を行うBM25の参照実装。文書数と平均文書長は削除された文書を含む
+static std::vector<ScoredDocument> referenceRanking(const std::vector<std::string> &query) {
+    double k1 = BM25Query::DEFAULT_BM25_K1, b = BM25Query::DEFAULT_BM25_B;
+    static std::map<std::string, int> df;
+    static double averageLength;
+    if (referenceComputedFor != (int)garbageCollected) {
+        referenceComputedFor = garbageCollected;
+        df.clear();
+        double lengthSum = 0;
+        for (auto &document : documents) {
+            lengthSum += document.words.size();
+            if ((garbageCollected) && (document.deleted))
+                continue;
+            std::vector<std::string> unique = document.words;
+            std::sort(unique.begin(), unique.end());
+            unique.erase(std::unique(unique.begin(), unique.end()), unique.end());
+            for (auto &word : unique)
+                df[word]++;
+        }
+        averageLength = lengthSum / documents.size();
+    }
+    double n = documents.size();
+    std::map<std::string, int> queryTerms;
+    for (auto &term : query)
+        queryTerms[term]++;
+
+    std::vector<ScoredDocument> scores;
+    for (auto &document : documents) {
+        if (document.deleted)
+            continue;
+        double score = 0;
+        bool matches = false;
+        double length = decodeDocumentLength(encodeDocumentLength(document.words.size()));
+        for (auto &term : queryTerms) {
+            int tf = std::count(document.words.begin(), document.words.end(), term.first);
+            if (tf == 0)
+                continue;
+            tf = std::min(tf, DOC_LEVEL_MAX_TF);
+            matches = true;
+            double idf = log(1 + (n - df[term.first] + 0.5) / (df[term.first] + 0.5));
+            score += term.second * idf * tf * (k1 + 1) / (tf + k1 * (1 - b + b * length / averageLength));
+        }
+        if (matches)
+            scores.push_back({ document.start, score });
+    }
+    std::sort(scores.begin(), scores.end(), [](const ScoredDocument &x, const ScoredDocument &y) {
+        return (x.score > y.score) || ((x.score == y.score) && (x.document < y.document));
+    });
+    return scores;
+}
+
+/*
+queryをすべての方法で評価し、参照実装と比較する。同じスコアの文書の順序は
+加算の順序による誤差で変わりうるので、スコアの列と各文書のスコアを比較する
+*/
+static void checkRanking(Index *index, const std::vector<std::string> &query, int k, int64_t *scored) {
+    std::string queryString;
+    for (auto &term : query)
+        queryString += term + " ";
+    std::vector<ScoredDocument> all = referenceRanking(query);
+    std::map<offset, double> referenceScores;
+    for (auto &result : all)
+        referenceScores[result.document] = result.score;
+    std::vector<ScoredDocument> expected(all.begin(), all.begin() + std::min((size_t)k, all.size()));
+    int methods[] = {
+        BM25Query::METHOD_EXHAUSTIVE, BM25Query::METHOD_MAXSCORE, BM25Query::METHOD_BLOCK_MAX_WAND
+    };
+    for (int m = 0; m < 3; m++) {
+        BM25Query q(index, queryString.c_str(), k);
+        assert(q.parse());
+        int count = q.evaluate(methods[m]);
+        if (count != (int)expected.size()) {
+            std::cout << queryString << "method " << m << ": " << count << " results, expected " << expected.size() << "\n";
+            assert(false);
+        }
+        const ScoredDocument *results = q.getResults();
+        for (int i = 0; i < count; i++) {
+            assert(fabs(results[i].score - expected[i].score) < 1e-9);
+            assert(referenceScores.count(results[i].document) == 1);
+            assert(fabs(referenceScores[results[i].document] - results[i].score) < 1e-9);
+        }
+        scored[m] = q.getScoredDocumentCount();
+    }
+}
+
+static void checkAllRankings(Index *index) {
+    int64_t scored[3];
+    std::vector<std::vector<std::string>> queries = {
+        { "w0" }, { "w150" }, { "w0", "w1" }, { "w2", "w40", "w120" }, { "w3", "w3", "w7" },
+        { "w0", "w1", "w2", "w3", "w4", "w5" }, { "w10", "nonexistent" }
+    };
+    for (auto &query : queries)
+        for (int k : { 1, 10, 100 })
+            checkRanking(index, query, k, scored);
+
+    // 頻出語と稀な語の組み合わせでは、上位10件のために全文書を評価する必要はない
+    checkRanking(index, { "w0", "w1", "w150", "w170" }, 10, scored);
+    assert(scored[1] < scored[0]);
+    assert(scored[2] < scored[0]);
+}
+
+void test_document_length_encoding() {
+    for (offset length = 0; length < 600000; length += 1 + length / 100) {
+        int code = encodeDocumentLength(length);
+        assert((code >= 0) && (code <= DOC_LEVEL_MAX_LENGTH_CODE));
+        if (length < (1 << 19)) {
+            // 符号は切り捨てなので、元の長さ以下で誤差は1/16以下
+            assert(decodeDocumentLength(code) <= length);
+            assert(decodeDocumentLength(code) * 17 / 16 + 1 >= length);
+        }
+        if (length > 0)
+            assert(code >= encodeDocumentLength(length - 1));
+    }
+    offset posting = encodeDocumentPosting(123456789, 1000, 57);
+    assert(getDocumentStart(posting) == 123456789);
+    assert(getDocumentTF(posting) == DOC_LEVEL_MAX_TF);
+    assert(getDocumentLengthCode(posting) == encodeDocumentLength(57));
+    std::cout << "test_document_length_encoding passed.\n";
+}
+
+// modeはDOCUMENT_LEVEL_INDEXINGの値
+void test_ranking(int mode) {
+    cleanup();
+    generateDocuments(3000);
+    garbageCollected = false;
+    referenceComputedFor = -1;
+    {
+        Index index(TEST_DIR, false);
+        // 一部をセグメントに書き出してマージし、残りはUpdateListに置く
+        size_t chunk = documents.size() / 4;
+        for (int i = 0; i < 3; i++) {
+            addDocuments(&index, i * chunk, (i + 1) * chunk);
+            index.flushUpdateList();
+            index.waitForMerges();
+        }
+        addDocuments(&index, 3 * chunk, documents.size());
+
+        int64_t documentCount, lengthSum;
+        index.getDocumentStatistics(&documentCount, &lengthSum);
+        assert(documentCount == (int64_t)documents.size());
+        assert(index.longLists->contains(DOC_LEVEL_PREFIX "w0"));
+        // DOCUMENT_LEVEL_INDEXINGが2の場合、語の位置は索引付けされない
+        int64_t count, occurrences = 0;
+        for (auto &document : documents)
+            occurrences += std::count(document.words.begin(), document.words.end(), "w0");
+        free(index.getPostings("w0", &count));
+        assert(count == (mode == 1 ? occurrences : 0));
+        free(index.getPostings("<doc>", &count));
+        assert(count == (int64_t)documents.size());
+        checkAllRankings(&index);
+
+        // 削除された文書は結果に現れない
+        offset end = documents.back().start + documents.back().words.size() + 2;
+        index.notifyOfAddressSpaceChange(1, documents[0].start, end - documents[0].start);
+        for (size_t d = 100; d < 400; d++)
+            documents[d].deleted = true;
+        index.notifyOfAddressSpaceChange(-1, documents[100].start, documents[400].start - documents[100].start);
+        checkAllRankings(&index);
+
+        // ガベージコレクションで書き直したブロックにも上限が格納される
+        index.flushUpdateList();
+        index.requestGarbageCollection();
+        index.waitForMerges();
+        garbageCollected = true;
+        checkAllRankings(&index);
+    }
+    {
+        // 文書の統計とスキップエントリの上限は再起動後も使われる
+        Index index(TEST_DIR, false);
+        checkAllRankings(&index);
+    }
+    cleanup();
+    std::cout << "test_ranking(" << mode << ") passed.\n";
+}
+
+void test_empty_query() {
+    cleanup();
+    {
+        Index index(TEST_DIR, false);
+        BM25Query q(&index, " ... ", 10);
+        assert(!q.parse());
+        assert(q.getErrorMessage()[0] != 0);
+        BM25Query q2(&index, "w1", 10);
+        assert(q2.parse());
+        assert(q2.evaluate(BM25Query::METHOD_BLOCK_MAX_WAND) == 0);
+    }
+    cleanup();
+    std::cout << "test_empty_query passed.\n";
+}
+
+int main() {
+    const char *argv[] = {
+        "bm25_test", "--LONG_LIST_THRESHOLD=500", "--DOCUMENT_LEVEL_INDEXING=2", "--RESULT_CACHE_SIZE=0"
+    };
+    // 各方法で実際に評価した文書の数を比べるので、結果のキャッシュは使わない
+    initializeConfiguratorFromCommandLineParameters(4, argv);
+    setLogLevel(LOG_ERROR + 1);
+
+    test_document_length_encoding();
+    test_ranking(2);
+    test_empty_query();
+
+    // 位置のポスティングも索引付けする場合も、同じ結果になる
+    argv[2] = "--DOCUMENT_LEVEL_INDEXING=1";
+    initializeConfiguratorFromCommandLineParameters(4, argv);
+    setLogLevel(LOG_ERROR + 1);
+    test_ranking(1);
+
+    std::cout << "All BM25 tests passed.\n";
+}
@@ -0,0 +1,382 @@
+#include <iostream>
+#include <cassert>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <string>
+#include <utility>
+#include <vector>
+#include "../../index/index.h"
+#include "../../index/longliststore.h"
+#include "../../query/gclquery.h"
+#include "../../utils/all.h"
+
+static const char *TEST_DIR = "/tmp/test_gcl";
+
+static void cleanup() {
+    std::string command = "rm -rf " + std::string(TEST_DIR);
+    system(command.c_str());
+}
+
+typedef std::vector<std::pair<offset, offset>> Extents;
+
+// テキストの先頭の位置
+static const offset FIRST_POSITION = 1000;
+
+// 位置FIRST_POSITION + iのトークン。削除された位置は空文字列
+static std::vector<std::string> text;
+
+static const char *WORDS[] = { "a", "b", "c", "d", "e", "f" };
+
+// <doc>の中に<p>が並び、<p>の中に語が並ぶテキストを作る
+static void generateText(int documentCount) {
+    srand(5);
+    for (int d = 0; d < documentCount; d++) {
+        text.push_back("<doc>");
+        int paragraphs = 1 + rand() % 3;
+        for (int p = 0; p < paragraphs; p++) {
+            text.push_back("<p>");
+            int words = 1 + rand() % 12;
+            for (int w = 0; w < words; w++)
+                text.push_back(WORDS[rand() % 6]);
+            text.push_back("</p>");
+        }
+        text.push_back("</doc>");
+    }
+}
+
+// 入れ子になる区間を取り除き、GCリストにする
+static Extents minimize(Extents extents) {
+    std::sort(extents.begin(), extents.end(), [](const std::pair<offset, offset> &x, const std::pair<offset, offset> &y) {
+        return (x.second < y.second) || ((x.second == y.second) && (x.first > y.first));
+    });
+    Extents result;
+    offset lastStart = -1;
+    for (auto &extent : extents)
+        if (extent.first > lastStart) {
+            result.push_back(extent);
+            lastStart = extent.first;
+        }
+    return result;
+}
+
+static Extents phrase(const std::vector<std::string> &words) {
+    Extents result;
+    for (size_t i = 0; i + words.size() <= text.size(); i++) {
+        bool match = true;
+        for (size_t k = 0; (k < words.size()) && (match); k++)
+            match = (text[i + k] == words[k]);
+        if (match)
+            result.push_back({ FIRST_POSITION + i, FIRST_POSITION + i + words.size() - 1 });
+    }
+    return result;
+}
+
+static Extents term(const char *word) {
+    return phrase({ word });
+}
+
+static Extents both(const Extents &x, const Extents &y) {
+    Extents result;
+    for (auto &a : x)
+        for (auto &b : y)
+            result.push_back({ std::min(a.first, b.first), std::max(a.second, b.second) });
+    return minimize(result);
+}
+
+static Extents either(const Extents &x, const Extents &y) {
+    Extents result = x;
+    result.insert(result.end(), y.begin(), y.end());
+    return minimize(result);
+}
+
+static Extents followedBy(const Extents &x, const Extents &y) {
+    Extents result;
+    for (auto &a : x)
+        for (auto &b : y)
+            if (a.second < b.first)
+                result.push_back({ a.first, b.second });
+    return minimize(result);
+}
+
+static bool isContained(const std::pair<offset, offset> &extent, const Extents &containers) {
+    for (auto &c : containers)
+        if ((c.first <= extent.first) && (c.second >= extent.second))
+            return true;
+    return false;
+}
+
+static bool isContaining(const std::pair<offset, offset> &extent, const Extents &containees) {
+    for (auto &c : containees)
+        if ((extent.first <= c.first) && (extent.second >= c.second))
+            return true;
+    return false;
+}
+
+static Extents containedIn(const Extents &x, const Extents &y, bool inverted) {
+    Extents result;
+    for (auto &a : x)
+        if (isContained(a, y) != inverted)
+            result.push_back(a);
+    return result;
+}
+
+static Extents containing(const Extents &x, const Extents &y, bool inverted) {
+    Extents result;
+    for (auto &a : x)
+        if (isContaining(a, y) != inverted)
+            result.push_back(a);
+    return result;
+}
+
+// 前方と後方の両方向からqueryの結果を取り出し、expectedと比較する
+static void checkQuery(Index *index, const char *query, const Extents &expected) {
+    GCLQuery q(index, query);
+    if (!q.parse()) {
+        std::cout << q.getErrorMessage() << "\n";
+        assert(false);
+    }
+    ExtentList *list = q.getResult();
+    Extents forward;
+    offset start, end, position = 0;
+    while (list->getFirstStartBiggerEq(position, &start, &end)) {
+        forward.push_back({ start, end });
+        position = start + 1;
+    }
+    if (forward != expected) {
+        std::cout << query << ": " << forward.size() << " extents, expected " << expected.size() << "\n";
+        assert(false);
+    }
+
+    Extents backward;
+    position = MAX_OFFSET;
+    while (list->getLastEndSmallerEq(position, &start, &end)) {
+        backward.push_back({ start, end });
+        position = end - 1;
+    }
+    std::reverse(backward.begin(), backward.end());
+    assert(backward == expected);
+
+    // getFirstEndBiggerEqとgetLastStartSmallerEqは既知の区間の端で確認する
+    for (size_t i = 0; i < expected.size(); i += 7) {
+        assert(list->getFirstEndBiggerEq(expected[i].second, &start, &end));
+        assert((start == expected[i].first) && (end == expected[i].second));
+        assert(list->getLastStartSmallerEq(expected[i].first, &start, &end));
+        assert((start == expected[i].first) && (end == expected[i].second));
+    }
+
+    offset starts[16], ends[16];
+    int n = list->getNextN(0, MAX_OFFSET, 16, starts, ends);
+    assert(n == (int)std::min(expected.size(), (size_t)16));
+    for (int i = 0; i < n; i++)
+        assert((starts[i] == expected[i].first) && (ends[i] == expected[i].second));
+}
+
+static void addText(Index *index, size_t from, size_t to) {
+    std::vector<char*> terms;
+    std::vector<offset> postings;
+    for (size_t i = from; i < to; i++) {
+        terms.push_back((char*)text[i].c_str());
+        postings.push_back(FIRST_POSITION + i);
+    }
+    index->addPostings(terms.data(), postings.data(), terms.size());
+}
+
+static void checkAllQueries(Index *index) {
+    Extents docs = followedBy(term("<doc>"), term("</doc>"));
+    Extents paragraphs = followedBy(term("<p>"), term("</p>"));
+    checkQuery(index, "\"a\"", term("a"));
+    checkQuery(index, "a", term("a"));
+    checkQuery(index, "\"a b\"", phrase({ "a", "b" }));
+    checkQuery(index, "\"c a b\"", phrase({ "c", "a", "b" }));
+    checkQuery(index, "\"a b a c d\"", phrase({ "a", "b", "a", "c", "d" }));
+    checkQuery(index, "\"</p> <p>\"", phrase({ "</p>", "<p>" }));
+    checkQuery(index, "a ^ b", both(term("a"), term("b")));
+    checkQuery(index, "a + b", either(term("a"), term("b")));
+    checkQuery(index, "a + \"a b\"", either(term("a"), phrase({ "a", "b" })));
+    checkQuery(index, "a .. b", followedBy(term("a"), term("b")));
+    checkQuery(index, "\"<doc>\"..\"</doc>\"", docs);
+    checkQuery(index, "(\"<doc>\"..\"</doc>\") > (a ^ f)", containing(docs, both(term("a"), term("f")), false));
+    checkQuery(index, "(\"<doc>\"..\"</doc>\") /> \"a b\"", containing(docs, phrase({ "a", "b" }), true));
+    checkQuery(index, "(\"<p>\"..\"</p>\") > \"d d\"", containing(paragraphs, phrase({ "d", "d" }), false));
+    checkQuery(index, "e < (\"<p>\"..\"</p>\")", containedIn(term("e"), paragraphs, false));
+    checkQuery(index, "\"<p>\" /< (\"<doc>\"..\"</doc>\")", containedIn(term("<p>"), docs, true));
+    checkQuery(index, "(a ^ c) < (\"<p>\"..\"</p>\")", containedIn(both(term("a"), term("c")), paragraphs, false));
+    checkQuery(index, "(a ^ c) /< (\"<p>\"..\"</p>\")", containedIn(both(term("a"), term("c")), paragraphs, true));
+    checkQuery(index, "(b + c) ^ \"d e\"", both(either(term("b"), term("c")), phrase({ "d", "e" })));
+}
+
+void test_queries() {
+    cleanup();
+    generateText(400);
+    {
+        Index index(TEST_DIR, false);
+        // 一部をセグメントに書き出してマージし、残りはUpdateListに置く
+        size_t chunk = text.size() / 5;
+        for (int i = 0; i < 4; i++) {
+            addText(&index, i * chunk, (i + 1) * chunk);
+            index.flushUpdateList();
+            index.waitForMerges();
+        }
+        addText(&index, 4 * chunk, text.size());
+        assert(index.longLists->contains("a"));
+        checkAllQueries(&index);
+
+        // 削除された範囲の語は結果に現れない
+        index.notifyOfAddressSpaceChange(1, FIRST_POSITION, text.size());
+        index.notifyOfAddressSpaceChange(-1, FIRST_POSITION + 500, 300);
+        for (size_t i = 500; i < 800; i++)
+            text[i] = "";
+        checkAllQueries(&index);
+    }
+    cleanup();
+    std::cout << "test_queries passed.\n";
+}
+
+void test_phrase_batches() {
+    cleanup();
+    text.clear();
+    for (int i = 0; i < 20; i++) {
+        text.push_back("x");
+        text.push_back("y");
+    }
+    {
+        Index index(TEST_DIR, false);
+        // 同じ語のポスティングがセグメントとUpdateListに分かれ、さらに一部が削除されている
+        addText(&index, 0, 20);
+        index.flushUpdateList();
+        addText(&index, 20, text.size());
+        index.notifyOfAddressSpaceChange(1, FIRST_POSITION, text.size());
+        index.notifyOfAddressSpaceChange(-1, FIRST_POSITION, 2);
+        text[0] = text[1] = "";
+        assert(term("x").size() == 19);
+        checkQuery(&index, "x", term("x"));
+        checkQuery(&index, "\"x y\"", phrase({ "x", "y" }));
+        checkQuery(&index, "\"y x\"", phrase({ "y", "x" }));
+    }
+    cleanup();
+    std::cout << "test_phrase_batches passed.\n";
+}
+
+void test_syntax_errors() {
+    cleanup();
+    {
+        Index index(TEST_DIR, false);
+        const char *invalid[] = { "", "(a ^ b", "\"a", "a ^", "a b", "\"\"", "a )", nullptr };
+        for (int i = 0; invalid[i] != nullptr; i++) {
+            GCLQuery q(&index, invalid[i]);
+            assert(!q.parse());
+            assert(q.getErrorMessage()[0] != 0);
+            assert(q.getResult() == nullptr);
+        }
+        // 語が存在しなければ結果は空
+        GCLQuery q(&index, "\"x y\" + z");
+        assert(q.parse());
+        offset start, end;
+        assert(!q.getResult()->getFirstStartBiggerEq(0, &start, &end));
+    }
+    cleanup();
+    std::cout << "test_syntax_errors passed.\n";
+}
+
+void test_wildcards() {
+    cleanup();
+    static const char *VOCABULARY[] = {
+        "walk", "walking", "walked", "talking", "talk", "stalk", "a", "apple", "apply", "ding", "dingo", "king"
+    };
+    text.clear();
+    srand(11);
+    for (int i = 0; i < 9000; i++)
+        text.push_back(VOCABULARY[rand() % 12]);
+    {
+        Index index(TEST_DIR, false);
+        // セグメント、LongListStore、UpdateListのすべてに語があるようにする
+        for (int i = 0; i < 4; i++) {
+            addText(&index, i * 2000, (i + 1) * 2000);
+            index.flushUpdateList();
+            index.waitForMerges();
+        }
+        addText(&index, 8000, text.size());
+        assert(index.longLists->contains("walk"));
+
+        checkQuery(&index, "walk*", either(either(term("walk"), term("walking")), term("walked")));
+        checkQuery(&index, "\"walk*\"", either(either(term("walk"), term("walking")), term("walked")));
+        checkQuery(&index, "*alk", either(either(term("walk"), term("talk")), term("stalk")));
+        checkQuery(&index, "*ing", either(either(term("walking"), term("talking")), either(term("ding"), term("king"))));
+        checkQuery(&index, "WAL*ED", term("walked"));
+        checkQuery(&index, "t*g", term("talking"));
+        // バイグラム("a apple"など)は展開されない
+        checkQuery(&index, "a*", either(either(term("a"), term("apple")), term("apply")));
+        checkQuery(&index, "appl* ^ king", both(either(term("apple"), term("apply")), term("king")));
+        checkQuery(&index, "zz*", Extents());
+
+        const char *invalid[] = { "*", "a*b*", "\"walk* talk\"", "$walk*", "wa-*", nullptr };
+        for (int i = 0; invalid[i] != nullptr; i++) {
+            GCLQuery q(&index, invalid[i]);
+            assert(!q.parse());
+        }
+    }
+    {
+        // 展開の上限を超える場合は失敗する
+        const char *argv[] = { "gcl_test", "--MAX_WILDCARD_EXPANSION=2" };
+        initializeConfiguratorFromCommandLineParameters(2, argv);
+        Index index(TEST_DIR, false);
+        GCLQuery q(&index, "walk*");
+        assert(!q.parse());
+        GCLQuery q2(&index, "appl*");
+        assert(q2.parse());
+    }
+    const char *defaultArgv[] = { "gcl_test", "--LONG_LIST_THRESHOLD=500", "--MAX_WILDCARD_EXPANSION=256" };
+    initializeConfiguratorFromCommandLineParameters(3, defaultArgv);
+    cleanup();
+    std::cout << "test_wildcards passed.\n";
+}
+
+void test_fuzzy_terms() {
+    cleanup();
+    static const char *VOCABULARY[] = { "walk", "walking", "walked", "talk", "stalk", "wall", "a", "apple" };
+    text.clear();
+    srand(17);
+    for (int i = 0; i < 2000; i++)
+        text.push_back(VOCABULARY[rand() % 8]);
+    {
+        Index index(TEST_DIR, false);
+        addText(&index, 0, 1000);
+        index.flushUpdateList();
+        addText(&index, 1000, text.size());
+
+        checkQuery(&index, "walk~1", either(either(term("walk"), term("talk")), term("wall")));
+        checkQuery(&index, "\"walkng~1\"", term("walking"));
+        checkQuery(&index, "walk~2", either(either(either(term("walk"), term("talk")), term("wall")),
+            either(term("stalk"), term("walked"))));
+        checkQuery(&index, "WALK~", either(either(either(term("walk"), term("talk")), term("wall")),
+            either(term("stalk"), term("walked"))));
+        checkQuery(&index, "aple~1 ^ stalk", both(term("apple"), term("stalk")));
+        checkQuery(&index, "xyzzy~2", Extents());
+
+        const char *invalid[] = { "~1", "walk~3", "walk~0", "walk~12", "$walk~1", "wa-lk~1", nullptr };
+        for (int i = 0; invalid[i] != nullptr; i++) {
+            GCLQuery q(&index, invalid[i]);
+            assert(!q.parse());
+        }
+    }
+    cleanup();
+    std::cout << "test_fuzzy_terms passed.\n";
+}
+
+int main() {
+    const char *argv[] = {
+        "gcl_test", "--LONG_LIST_THRESHOLD=500", "--BIGRAM_INDEXING=true", "--BIGRAM_FIRST_WORDS=\"a\" \"d\""
+    };
+    initializeConfiguratorFromCommandLineParameters(4, argv);
+    setLogLevel(LOG_ERROR + 1);
+
+    test_queries();
+    test_phrase_batches();
+    test_syntax_errors();
+    test_wildcards();
+    test_fuzzy_terms();
+
+    std::cout << "All GCL query tests passed.\n";
+}
@@ -0,0 +1,221 @@
+#include <iostream>
+#include <cassert>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <set>
+#include <string>
+#include <vector>
+#include "../../extentlist/extentlist.h"
+#include "../../extentlist/intersection.h"
+#include "../../index/index.h"
+#include "../../index/indexview.h"
+#include "../../query/gclquery.h"
+#include "../../utils/all.h"
+
+static const char *TEST_DIR = "/tmp/test_intersection";
+
+static void cleanup() {
+    std::string command = "rm -rf " + std::string(TEST_DIR);
+    system(command.c_str());
+}
+
+// 0..range-1からcount個を選んで昇順に並べる
+static std::vector<offset> randomPostings(int count, offset range) {
+    std::set<offset> values;
+    while ((int)values.size() < count)
+        values.insert(rand() % range);
+    return std::vector<offset>(values.begin(), values.end());
+}
+
+typedef int64_t (*Kernel)(const offset*, int64_t, const offset*, int64_t, offset, offset*);
+
+static void checkKernels(const std::vector<offset> &a, const std::vector<offset> &b, offset delta) {
+    std::set<offset> bValues(b.begin(), b.end());
+    std::vector<offset> expected;
+    for (offset x : a)
+        if (bValues.count(x + delta) > 0)
+            expected.push_back(x);
+
+    std::vector<Kernel> kernels = { intersectPostings, intersectPostingsScalar, intersectPostingsGalloping };
+    if (isAVX2Supported())
+        kernels.push_back(intersectPostingsAVX2);
+    if (isAVX512Supported())
+        kernels.push_back(intersectPostingsAVX512);
+    std::vector<offset> result(a.size() + 1);
+    for (Kernel kernel : kernels) {
+        int64_t count = kernel(a.data(), a.size(), b.data(), b.size(), delta, result.data());
+        assert(count == (int64_t)expected.size());
+        assert(std::equal(expected.begin(), expected.end(), result.begin()));
+    }
+}
+
+void test_kernels() {
+    srand(17);
+    // ブロックの端数と、一方が空の場合
+    for (int aCount = 0; aCount <= 20; aCount++)
+        for (int bCount = 0; bCount <= 20; bCount++)
+            checkKernels(randomPostings(aCount, 40), randomPostings(bCount, 40), rand() % 3);
+    // 密度の違うリストと、長さの比が大きいリスト
+    for (int round = 0; round < 200; round++) {
+        int aCount = 1 + rand() % 2000, bCount = 1 + rand() % 2000;
+        if (round % 4 == 0)
+            bCount = 1 + rand() % 20;
+        offset range = std::max(aCount, bCount) * (1 + rand() % 4);
+        checkKernels(randomPostings(aCount, range), randomPostings(bCount, range), rand() % 4);
+    }
+    // 大きな位置(符号付き比較の上位ビット)
+    std::vector<offset> a, b;
+    for (int i = 0; i < 100; i++) {
+        a.push_back(MAX_OFFSET - 1000 + 3 * i);
+        b.push_back(MAX_OFFSET - 1000 + 2 * i + 1);
+    }
+    checkKernels(a, b, 1);
+    std::cout << "test_kernels passed (" << getIntersectionKernelName() << ").\n";
+}
+
+// 位置FIRST_POSITION + iのトークン
+static const offset FIRST_POSITION = 100;
+static std::vector<std::string> text;
+
+// よく現れる語からなるテキストを作る(長いフレーズが多数一致する)
+static void generateText(int length) {
+    static const char *WORDS[] = { "the", "of", "and", "to", "in" };
+    text.clear();
+    for (int i = 0; i < length; i++) {
+        if (rand() % 3 == 0)
+            text.push_back(WORDS[rand() % 5]);
+        else {
+            // 「the of and」を繰り返し含める
+            static const char *PATTERN[] = { "the", "of", "and" };
+            text.push_back(PATTERN[i % 3]);
+        }
+    }
+}
+
+static void addText(Index *index, size_t from, size_t to) {
+    std::vector<char*> terms;
+    std::vector<offset> postings;
+    for (size_t i = from; i < to; i++) {
+        terms.push_back((char*)text[i].c_str());
+        postings.push_back(FIRST_POSITION + i);
+    }
+    index->addPostings(terms.data(), postings.data(), terms.size());
+}
+
+static std::vector<offset> findPhrase(const std::vector<std::string> &words, offset deletedStart, offset deletedEnd) {
+    std::vector<offset> result;
+    for (size_t i = 0; i + words.size() <= text.size(); i++) {
+        offset start = FIRST_POSITION + i, end = start + words.size() - 1;
+        if ((end >= deletedStart) && (start <= deletedEnd))
+            continue;
+        bool match = true;
+        for (size_t k = 0; (k < words.size()) && (match); k++)
+            match = (text[i + k] == words[k]);
+        if (match)
+            result.push_back(start);
+    }
+    return result;
+}
+
+static void checkPhrase(Index *index, const char *query, const std::vector<std::string> &words,
+        offset deletedStart, offset deletedEnd) {
+    std::vector<offset> expected = findPhrase(words, deletedStart, deletedEnd);
+    GCLQuery q(index, query);
+    assert(q.parse());
+    ExtentList *list = q.getResult();
+    offset start, end, position = 0;
+    size_t found = 0;
+    while (list->getFirstStartBiggerEq(position, &start, &end)) {
+        assert(found < expected.size());
+        assert(start == expected[found]);
+        assert(end == start + (offset)words.size() - 1);
+        found++;
+        position = start + 1;
+    }
+    assert(found == expected.size());
+
+    // 離れた位置への移動と、後方への探索が混ざっても結果は同じ
+    GCLQuery q2(index, query);
+    assert(q2.parse());
+    list = q2.getResult();
+    for (int i = 0; i < 2000; i++) {
+        position = FIRST_POSITION + rand() % (text.size() + 10);
+        auto it = std::lower_bound(expected.begin(), expected.end(), position);
+        bool result = list->getFirstStartBiggerEq(position, &start, &end);
+        assert(result == (it != expected.end()));
+        if (result)
+            assert(start == *it);
+        if (i % 3 == 0) {
+            auto last = std::upper_bound(expected.begin(), expected.end(), position);
+            result = list->getLastStartSmallerEq(position, &start, &end);
+            assert(result == (last != expected.begin()));
+            if (result)
+                assert(start == *(last - 1));
+        }
+    }
+}
+
+static void checkNextN(IndexView *view, const char *term) {
+    PostingList list(view, term);
+    PostingList reference(view, term);
+    for (int i = 0; i < 300; i++) {
+        offset from = FIRST_POSITION + rand() % (text.size() + 10) - 5;
+        offset to = from + rand() % 5000;
+        int n = 1 + rand() % 700;
+        std::vector<offset> starts(n), ends(n);
+        int count = list.getNextN(from, to, n, starts.data(), ends.data());
+        offset s, e, position = from;
+        for (int k = 0; k < count; k++) {
+            assert(reference.getFirstStartBiggerEq(position, &s, &e));
+            assert((starts[k] == s) && (ends[k] == e));
+            position = s + 1;
+        }
+        if (count < n)
+            assert((!reference.getFirstStartBiggerEq(position, &s, &e)) || (e > to));
+    }
+}
+
+void test_phrases() {
+    cleanup();
+    srand(23);
+    generateText(60000);
+    offset deletedStart = FIRST_POSITION + 25000, deletedEnd = FIRST_POSITION + 25999;
+    {
+        Index index(TEST_DIR, false);
+        // 読み取り元が複数(セグメント2つとUpdateList)になるように分けて追加する
+        addText(&index, 0, 20000);
+        index.flushUpdateList();
+        addText(&index, 20000, 40000);
+        index.flushUpdateList();
+        addText(&index, 40000, text.size());
+        index.notifyOfAddressSpaceChange(-1, deletedStart, deletedEnd - deletedStart + 1);
+
+        IndexView *view = index.acquireView();
+        checkNextN(view, "the");
+        checkNextN(view, "in");
+        view->release();
+
+        checkPhrase(&index, "\"the of\"", { "the", "of" }, deletedStart, deletedEnd);
+        checkPhrase(&index, "\"the of and the of and the of\"",
+            { "the", "of", "and", "the", "of", "and", "the", "of" }, deletedStart, deletedEnd);
+        checkPhrase(&index, "\"in the\"", { "in", "the" }, deletedStart, deletedEnd);
+        checkPhrase(&index, "\"to in to\"", { "to", "in", "to" }, deletedStart, deletedEnd);
+        checkPhrase(&index, "\"of of of\"", { "of", "of", "of" }, deletedStart, deletedEnd);
+        checkPhrase(&index, "\"and nonexistent\"", { "and", "nonexistent" }, deletedStart, deletedEnd);
+    }
+    cleanup();
+    std::cout << "test_phrases passed.\n";
+}
+
+int main() {
+    const char *argv[] = { "intersection_test" };
+    initializeConfiguratorFromCommandLineParameters(1, argv);
+    setLogLevel(LOG_ERROR + 1);
+
+    test_kernels();
+    test_phrases();
+
+    std::cout << "All intersection tests passed.\n";
+}
@@ -0,0 +1,195 @@
+#include <iostream>
+#include <cassert>
+#include <cstdlib>
+#include <string>
+#include <utility>
+#include <vector>
+#include "../../extentlist/extentlist.h"
+#include "../../filemanager/filemanager.h"
+#include "../../index/index.h"
+#include "../../index/indexview.h"
+#include "../../query/gclquery.h"
+#include "../../query/querybatch.h"
+#include "../../utils/all.h"
+
+static const char *TEST_DIR = "/tmp/test_querybatch";
+
+static void cleanup() {
+    std::string command = "rm -rf " + std::string(TEST_DIR);
+    system(command.c_str());
+}
+
+// 位置FIRST_POSITION + iのトークン
+static const offset FIRST_POSITION = 1;
+static std::vector<std::string> text;
+
+// 20語ごとに<doc>..</doc>で囲んだ、a〜hからなるテキストを作る
+static void generateText(int documents) {
+    static const char *WORDS[] = { "a", "b", "c", "d", "e", "f", "g", "h" };
+    text.clear();
+    for (int i = 0; i < documents; i++) {
+        text.push_back("<doc>");
+        for (int k = 0; k < 18; k++)
+            text.push_back(WORDS[rand() % 8]);
+        text.push_back("</doc>");
+    }
+}
+
+static void addText(Index *index, size_t from, size_t to) {
+    std::vector<char*> terms;
+    std::vector<offset> postings;
+    for (size_t i = from; i < to; i++) {
+        terms.push_back((char*)text[i].c_str());
+        postings.push_back(FIRST_POSITION + i);
+    }
+    index->addPostings(terms.data(), postings.data(), terms.size());
+}
+
+typedef std::vector<std::pair<offset, offset>> Extents;
+
+// 1つずつ評価した場合の結果
+static Extents evaluate(Index *index, const char *query, uid_t userID) {
+    Extents result;
+    GCLQuery q(index, query, userID);
+    assert(q.parse());
+    ExtentList *list = q.getResult();
+    offset start, end, position = 0;
+    while (list->getFirstStartBiggerEq(position, &start, &end)) {
+        result.push_back({ start, end });
+        position = start + 1;
+    }
+    return result;
+}
+
+static const char *QUERIES[] = {
+    "a", "\"a b\"", "a ^ b", "a + h", "\"c d e\"", "(\"<doc>\"..\"</doc>\") > \"a b\"",
+    "(\"<doc>\"..\"</doc>\") > (c ^ g)", "b .. f", "\"e\" < (\"<doc>\"..\"</doc>\")",
+    "(a + b) ^ \"g h\"", "\"f f\"", "nonexistent", "\"b a\"", "d ^ (e + h)", nullptr
+};
+
+static void checkBatch(Index *index, int maxResults, uid_t userID, bool checkSharing) {
+    QueryBatch batch(index, maxResults, userID);
+    std::vector<int> ids;
+    for (int i = 0; QUERIES[i] != nullptr; i++)
+        ids.push_back(batch.addQuery(QUERIES[i]));
+    // 正規化すると同じになる問い合わせと、構文エラー
+    int duplicate = batch.addQuery("  a   ^ b ");
+    int invalid = batch.addQuery("(a ^");
+    assert(batch.getQueryCount() == (int)ids.size() + 2);
+    batch.execute();
+    batch.execute();
+
+    for (size_t i = 0; i < ids.size(); i++) {
+        assert(batch.isValid(ids[i]));
+        Extents expected = evaluate(index, QUERIES[i], userID);
+        int count = batch.getResultCount(ids[i]);
+        assert(count == (int)std::min(expected.size(), (size_t)maxResults));
+        assert(batch.isTruncated(ids[i]) == ((int)expected.size() > maxResults));
+        for (int k = 0; k < count; k++) {
+            assert(batch.getStarts(ids[i])[k] == expected[k].first);
+            assert(batch.getEnds(ids[i])[k] == expected[k].second);
+        }
+    }
+    assert(batch.getResultCount(duplicate) == batch.getResultCount(ids[2]));
+    assert(batch.getStarts(duplicate) == batch.getStarts(ids[2]));
+    assert(!batch.isValid(invalid));
+    assert(batch.getErrorMessage(invalid)[0] != 0);
+    assert(batch.getResultCount(invalid) == 0);
+
+    // 同じ語を含む問い合わせが多いので、大部分のブロックは共有される
+    if (checkSharing)
+        assert(batch.getSharedBlockCount() > batch.getDecodedBlockCount());
+}
+
+void test_batch() {
+    cleanup();
+    srand(31);
+    generateText(6000);
+    {
+        Index index(TEST_DIR, false);
+        // セグメント2つ(マージ後はLongListStore)とUpdateListに分けて追加する
+        size_t chunk = text.size() / 3;
+        addText(&index, 0, chunk);
+        index.flushUpdateList();
+        index.waitForMerges();
+        addText(&index, chunk, 2 * chunk);
+        index.flushUpdateList();
+        index.waitForMerges();
+        addText(&index, 2 * chunk, text.size());
+        // 一部を削除する
+        index.notifyOfAddressSpaceChange(-1, FIRST_POSITION + 50000, 2000);
+
+        checkBatch(&index, 1000000, index.indexOwner, true);
+        checkBatch(&index, 10, index.indexOwner, false);
+    }
+    cleanup();
+    std::cout << "test_batch passed.\n";
+}
+
+void test_small_cache() {
+    cleanup();
+    srand(37);
+    generateText(3000);
+    const char *argv[] = { "querybatch_test", "--QUERY_BATCH_CACHE_SIZE=4096" };
+    initializeConfiguratorFromCommandLineParameters(2, argv);
+    {
+        Index index(TEST_DIR, false);
+        addText(&index, 0, text.size() / 2);
+        index.flushUpdateList();
+        addText(&index, text.size() / 2, text.size());
+
+        // ブロックが追い出されても結果は変わらない
+        QueryBatch batch(&index, 1000000);
+        std::vector<int> ids;
+        for (int i = 0; QUERIES[i] != nullptr; i++)
+            ids.push_back(batch.addQuery(QUERIES[i]));
+        batch.execute();
+        for (size_t i = 0; i < ids.size(); i++) {
+            Extents expected = evaluate(&index, QUERIES[i], index.indexOwner);
+            assert(batch.getResultCount(ids[i]) == (int)expected.size());
+            for (size_t k = 0; k < expected.size(); k++)
+                assert(batch.getStarts(ids[i])[k] == expected[k].first);
+        }
+    }
+    const char *defaultArgv[] = { "querybatch_test" };
+    initializeConfiguratorFromCommandLineParameters(1, defaultArgv);
+    cleanup();
+    std::cout << "test_small_cache passed.\n";
+}
+
+void test_visibility() {
+    cleanup();
+    srand(41);
+    generateText(200);
+    const uid_t USER = 12345;
+    {
+        Index index(TEST_DIR, false);
+        addText(&index, 0, text.size());
+        // 前半はUSERから見えず、後半は見える
+        FileManager *fm = index.getFileManager();
+        offset half = (text.size() / 2 / 20) * 20;
+        assert(fm->addFile(0, "a.xml", 0, 0, 0600, FIRST_POSITION, half) >= 0);
+        assert(fm->addFile(0, "b.xml", 0, 0, 0644, FIRST_POSITION + half, text.size() - half) >= 0);
+        checkBatch(&index, 1000000, USER, false);
+
+        QueryBatch batch(&index, 1000000, USER);
+        int id = batch.addQuery("\"<doc>\"..\"</doc>\"");
+        batch.execute();
+        assert(batch.getResultCount(id) == (int)(text.size() - half) / 20);
+        assert(batch.getStarts(id)[0] == FIRST_POSITION + half);
+    }
+    cleanup();
+    std::cout << "test_visibility passed.\n";
+}
+
+int main() {
+    const char *argv[] = { "querybatch_test" };
+    initializeConfiguratorFromCommandLineParameters(1, argv);
+    setLogLevel(LOG_ERROR + 1);
+
+    test_batch();
+    test_small_cache();
+    test_visibility();
+
+    std::cout << "All query batch tests passed.\n";
+}
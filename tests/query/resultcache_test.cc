@@ -0,0 +1,315 @@
+#include <iostream>
+#include <cassert>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include "../../filemanager/filemanager.h"
+#include "../../index/extentset.h"
+#include "../../index/index.h"
+#include "../../index/resultcache.h"
+#include "../../index/tokenizer.h"
+#include "../../query/bm25query.h"
+#include "../../query/gclquery.h"
+#include "../../query/xpathquery.h"
+#include "../../utils/all.h"
+
+static const char *TEST_DIR = "/tmp/test_resultcache";
+
+static void cleanup() {
+    std::string command = "rm -rf " + std::string(TEST_DIR);
+    system(command.c_str());
+}
+
+// 次に追加するテキストの先頭の位置
+static offset nextPosition;
+
+// XMLをトークナイザで分割してインデックスに追加し、最初のトークンの位置を返す
+static offset addText(Index *index, const std::string &xml) {
+    StreamTokenizer tokenizer(true);
+    tokenizer.reset(nextPosition);
+    tokenizer.setInput(xml.c_str(), xml.size(), true);
+    std::vector<std::string> terms;
+    std::vector<offset> postings;
+    Token token;
+    while (tokenizer.getNextToken(&token)) {
+        terms.push_back(std::string(token.text));
+        postings.push_back(token.position);
+    }
+    std::vector<char*> pointers;
+    for (auto &term : terms)
+        pointers.push_back((char*)term.c_str());
+    index->addPostings(pointers.data(), postings.data(), pointers.size());
+    offset first = nextPosition;
+    nextPosition = postings.back() + 1;
+    return first;
+}
+
+static int evaluateXPath(Index *index, const char *query) {
+    XPathQuery q(index, query);
+    assert(q.parse());
+    return q.evaluate();
+}
+
+void test_normalization() {
+    std::string result;
+    ResultCache::normalizeQuery("  //Sec/TITLE[contains(.,   'A  b')]  ", &result);
+    assert(result == "//sec/title[contains(., 'a b')]");
+    ResultCache::normalizeQuery("", &result);
+    assert(result.empty());
+    std::cout << "test_normalization passed.\n";
+}
+
+void test_xpath_invalidation() {
+    cleanup();
+    nextPosition = 1;
+    {
+        Index index(TEST_DIR, false);
+        ResultCache *cache = index.getResultCache();
+        assert(cache != nullptr);
+        offset first = addText(&index, "<doc><a>x y</a><b>z</b></doc>");
+        addText(&index, "<doc><a>y</a></doc>");
+
+        assert(evaluateXPath(&index, "//a") == 2);
+        assert(cache->getMissCount() == 1);
+        assert(evaluateXPath(&index, " //A ") == 2);
+        assert(cache->getHitCount() == 1);
+        assert(evaluateXPath(&index, "//b") == 1);
+
+        // <a>を含まない追加では//aの結果は変わらない
+        addText(&index, "<doc><b>w</b></doc>");
+        assert(evaluateXPath(&index, "//a") == 2);
+        assert(cache->getHitCount() == 2);
+        assert(cache->getInvalidationCount() == 0);
+        assert(evaluateXPath(&index, "//b") == 2);
+        assert(cache->getInvalidationCount() == 1);
+
+        // <a>を含む追加では評価し直す
+        addText(&index, "<doc><c><a>z</a></c></doc>");
+        assert(evaluateXPath(&index, "//a") == 3);
+        assert(cache->getInvalidationCount() == 2);
+        assert(evaluateXPath(&index, "//c/a") == 1);
+
+        // 結果と重ならない削除は影響しない
+        offset b = first + 5;
+        index.notifyOfAddressSpaceChange(-1, b, 3);
+        int64_t hits = cache->getHitCount();
+        assert(evaluateXPath(&index, "//a") == 3);
+        assert(cache->getHitCount() == hits + 1);
+        assert(evaluateXPath(&index, "//b") == 1);
+
+        // 結果と重なる削除では評価し直す
+        index.notifyOfAddressSpaceChange(-1, first + 1, 4);
+        int64_t invalidations = cache->getInvalidationCount();
+        assert(evaluateXPath(&index, "//a") == 2);
+        assert(cache->getInvalidationCount() == invalidations + 1);
+        assert(evaluateXPath(&index, "//c/a") == 1);
+    }
+    cleanup();
+    std::cout << "test_xpath_invalidation passed.\n";
+}
+
+// 閉じていない要素を含む結果は、どの追加でも評価し直す
+void test_open_elements() {
+    cleanup();
+    nextPosition = 1;
+    {
+        Index index(TEST_DIR, false);
+        addText(&index, "<doc><sec><title>x</title>");
+        assert(evaluateXPath(&index, "//sec[contains(., 'w')]/title") == 0);
+        addText(&index, "w</sec></doc>");
+        assert(evaluateXPath(&index, "//sec[contains(., 'w')]/title") == 1);
+    }
+    cleanup();
+    std::cout << "test_open_elements passed.\n";
+}
+
+void test_bm25_invalidation() {
+    cleanup();
+    nextPosition = 1;
+    {
+        Index index(TEST_DIR, false);
+        ResultCache *cache = index.getResultCache();
+        addText(&index, "<doc>x y</doc><doc>x z</doc>");
+        BM25Query q(&index, "x y", 10);
+        assert(q.parse());
+        assert(q.evaluate(BM25Query::METHOD_MAXSCORE) == 2);
+        ScoredDocument top = q.getResults()[0];
+
+        // 語の順序が違っても同じ問い合わせ
+        BM25Query q2(&index, "Y  x", 10);
+        assert(q2.parse());
+        assert(q2.evaluate(BM25Query::METHOD_MAXSCORE) == 2);
+        assert(cache->getHitCount() == 1);
+        assert(q2.getResults()[0].document == top.document);
+        assert(q2.getResults()[0].score == top.score);
+
+        // 文書の統計が変わるので、どの追加でも無効になる
+        addText(&index, "<doc>z</doc>");
+        BM25Query q3(&index, "x y", 10);
+        assert(q3.parse());
+        assert(q3.evaluate(BM25Query::METHOD_MAXSCORE) == 2);
+        assert(cache->getHitCount() == 1);
+        assert(q3.getResults()[0].score != top.score);
+    }
+    cleanup();
+    std::cout << "test_bm25_invalidation passed.\n";
+}
+
+void test_memory_bound() {
+    cleanup();
+    {
+        Index index(TEST_DIR, false);
+        ResultCache cache(&index, 64 * 1024, 4);
+        std::vector<std::string> noDependencies;
+        std::string value(1000, 'v');
+        for (int i = 0; i < 1000; i++) {
+            std::string query = "query " + std::to_string(i);
+            cache.insert(query.c_str(), 1, index.getUpdateGeneration(), value, nullptr, noDependencies, false);
+            assert(cache.getMemoryUsed() <= 64 * 1024);
+        }
+        assert(cache.getEntryCount() > 20);
+        assert(cache.getEntryCount() < 64);
+
+        // 最近追加したものは残り、古いものは捨てられている
+        std::string result;
+        assert(cache.lookup("query 999", 1, &result));
+        assert(result == value);
+        assert(!cache.lookup("query 0", 1, &result));
+
+        // ユーザーごとに別のエントリ
+        assert(!cache.lookup("query 999", 2, &result));
+
+        // 大きすぎる結果は保持しない
+        cache.insert("huge", 1, index.getUpdateGeneration(), std::string(20000, 'v'), nullptr, noDependencies, false);
+        assert(!cache.lookup("huge", 1, &result));
+
+        cache.clear();
+        assert(cache.getEntryCount() == 0);
+        assert(cache.getMemoryUsed() == 0);
+    }
+    cleanup();
+    std::cout << "test_memory_bound passed.\n";
+}
+
+/*
+世代が読まれていない間の追加は1つの記録にまとめられる。
+変更の記録が捨てられた世代のエントリは無効になる
+*/
+void test_change_log() {
+    cleanup();
+    nextPosition = 1;
+    {
+        Index index(TEST_DIR, false);
+        ResultCache *cache = index.getResultCache();
+        std::vector<std::string> dependencies = { "nonexistent" };
+        unsigned int generation = index.getUpdateGeneration();
+        cache->insert("old", 1, generation, "result", nullptr, dependencies, false);
+        offset first = addText(&index, "x");
+        for (int i = 0; i < 9; i++)
+            addText(&index, "y");
+        std::vector<IndexChange> changes;
+        assert(index.getChangesSince(generation, &changes));
+        assert(changes.size() == 1);
+        assert(changes[0].start == first);
+        assert(changes[0].end == first + 9);
+        assert(!changes[0].deletion);
+        assert(index.getUpdateGeneration() == generation + 10);
+
+        std::string result;
+        assert(cache->lookup("old", 1, &result));
+        for (int i = 0; i <= Index::MAX_CHANGE_LOG_LENGTH; i++) {
+            addText(&index, "x");
+            index.getUpdateGeneration();
+        }
+        assert(!index.getChangesSince(generation, &changes));
+        assert(!cache->lookup("old", 1, &result));
+    }
+    cleanup();
+    std::cout << "test_change_log passed.\n";
+}
+
+static int evaluateGCL(Index *index, const char *query, uid_t userID) {
+    GCLQuery q(index, query, userID);
+    assert(q.parse());
+    ExtentList *list = q.getResult();
+    int count = 0;
+    offset start, end, position = 0;
+    while (list->getFirstStartBiggerEq(position, &start, &end)) {
+        count++;
+        position = start + 1;
+    }
+    return count;
+}
+
+/*
+ユーザーを指定した問い合わせは、そのユーザーが読めるファイルの範囲の結果だけを返す。
+パーミッションの変更でキャッシュされた結果は無効になる
+*/
+void test_visibility() {
+    cleanup();
+    nextPosition = 1;
+    const uid_t USER = 12345;
+    {
+        Index index(TEST_DIR, false);
+        FileManager *fm = index.getFileManager();
+        offset first = addText(&index, "<doc><a>x y</a></doc>");
+        offset second = addText(&index, "<doc><a>x</a><a>y</a></doc>");
+        offset third = addText(&index, "<doc>x</doc>");
+        int32_t a = fm->addFile(0, "a.xml", 0, 0, 0644, first, second - first);
+        int32_t b = fm->addFile(0, "b.xml", 0, 0, 0600, second, third - second);
+        assert(a >= 0 && b >= 0);
+
+        assert(evaluateGCL(&index, "\"x\"", index.indexOwner) == 3);
+        assert(evaluateGCL(&index, "\"x\"", USER) == 1);
+        assert(evaluateGCL(&index, "\"<doc>\"..\"</doc>\"", USER) == 1);
+        assert(evaluateXPath(&index, "//a") == 3);
+        XPathQuery x(&index, "//a", USER);
+        assert(x.parse());
+        assert(x.evaluate() == 1);
+        assert(x.getResults()[0].start == first + 1);
+
+        BM25Query q(&index, "x", 10, USER);
+        assert(q.parse());
+        assert(q.evaluate(BM25Query::METHOD_BLOCK_MAX_WAND) == 1);
+        assert(q.getResults()[0].document == first);
+
+        // 権限の変更で、キャッシュされた結果も見えるようになる
+        assert(fm->changeFileAttributes(b, 0, 0, 0644));
+        XPathQuery x2(&index, "//a", USER);
+        assert(x2.parse());
+        assert(x2.evaluate() == 3);
+        // ファイルとして登録されていない3つめの文書は見えない
+        assert(evaluateGCL(&index, "\"x\"", USER) == 2);
+        BM25Query q2(&index, "x", 10, USER);
+        assert(q2.parse());
+        assert(q2.evaluate(BM25Query::METHOD_MAXSCORE) == 2);
+
+        assert(fm->changeFileAttributes(a, 0, 0, 0600));
+        XPathQuery x3(&index, "//a", USER);
+        assert(x3.parse());
+        assert(x3.evaluate() == 2);
+        assert(evaluateXPath(&index, "//a") == 3);
+    }
+    cleanup();
+    std::cout << "test_visibility passed.\n";
+}
+
+int main() {
+    const char *argv[] = {
+        "resultcache_test", "--ENABLE_XPATH=true", "--DOCUMENT_LEVEL_INDEXING=1"
+    };
+    initializeConfiguratorFromCommandLineParameters(3, argv);
+    setLogLevel(LOG_ERROR + 1);
+
+    test_normalization();
+    test_xpath_invalidation();
+    test_open_elements();
+    test_bm25_invalidation();
+    test_memory_bound();
+    test_change_log();
+    test_visibility();
+
+    std::cout << "All result cache tests passed.\n";
+}
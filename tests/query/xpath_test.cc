@@ -0,0 +1,270 @@
+#include <iostream>
+#include <cassert>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include "../../index/index.h"
+#include "../../index/tokenizer.h"
+#include "../../query/xpathquery.h"
+#include "../../utils/all.h"
+
+static const char *TEST_DIR = "/tmp/test_xpath";
+
+static void cleanup() {
+    std::string command = "rm -rf " + std::string(TEST_DIR);
+    system(command.c_str());
+}
+
+// テキストの先頭の位置
+static const offset FIRST_POSITION = 1000;
+
+typedef struct {
+    std::string name;
+    offset start, end;
+    int level;
+} Element;
+
+// 生成したXMLの要素と、位置FIRST_POSITION + iのトークン
+static std::vector<Element> elements;
+static std::vector<std::string> tokens;
+
+static const char *NAMES[] = { "a", "b", "sec", "title" };
+static const char *WORDS[] = { "x", "y", "z", "w" };
+
+static void generateElement(std::string *xml, const char *name, int level) {
+    size_t index = elements.size();
+    elements.push_back({ name, (offset)(FIRST_POSITION + tokens.size()), 0, level });
+    *xml += std::string("<") + name + (rand() % 3 == 0 ? " id=\"1\">" : ">");
+    tokens.push_back(std::string("<") + name + ">");
+    int children = (level < 6 ? rand() % 4 : 0);
+    for (int i = 0; i <= children; i++) {
+        int words = rand() % 4;
+        for (int w = 0; w < words; w++) {
+            const char *word = WORDS[rand() % 4];
+            *xml += std::string(word) + " ";
+            tokens.push_back(word);
+        }
+        if (i < children)
+            generateElement(xml, NAMES[rand() % 4], level + 1);
+    }
+    *xml += std::string("</") + name + ">\n";
+    tokens.push_back(std::string("</") + name + ">");
+    elements[index].end = FIRST_POSITION + tokens.size() - 1;
+}
+
+// XMLをトークナイザで分割し、半端な大きさに分けてインデックスに追加する
+static void addText(Index *index, const std::string &xml, offset firstPosition) {
+    StreamTokenizer tokenizer(true);
+    tokenizer.reset(firstPosition);
+    tokenizer.setInput(xml.c_str(), xml.size(), true);
+    std::vector<std::string> terms;
+    std::vector<offset> postings;
+    Token token;
+    while (tokenizer.getNextToken(&token)) {
+        terms.push_back(std::string(token.text));
+        postings.push_back(token.position);
+    }
+    std::vector<char*> pointers;
+    for (auto &term : terms)
+        pointers.push_back((char*)term.c_str());
+    for (size_t i = 0; i < pointers.size(); i += 97) {
+        int n = std::min((size_t)97, pointers.size() - i);
+        index->addPostings(&pointers[i], &postings[i], n);
+    }
+}
+
+typedef struct {
+    bool descendant;
+    std::string name;
+    std::vector<std::pair<bool, std::vector<std::string>>> predicates;
+} Step;
+
+// elementの中(directTextの場合は子要素の外)にphraseが現れるかどうか
+static bool containsPhrase(size_t element, bool directText, const std::vector<std::string> &phrase) {
+    const Element &e = elements[element];
+    for (offset p = e.start + 1; p + (offset)phrase.size() - 1 < e.end; p++) {
+        bool match = true;
+        for (size_t k = 0; (k < phrase.size()) && (match); k++)
+            match = (tokens[p + k - FIRST_POSITION] == phrase[k]);
+        if (!match)
+            continue;
+        if (!directText)
+            return true;
+        bool insideChild = false;
+        for (auto &child : elements)
+            if ((child.level == e.level + 1) && (child.start > e.start) && (child.start < p) && (child.end > p))
+                insideChild = true;
+        if (!insideChild)
+            return true;
+    }
+    return false;
+}
+
+// すべての要素を調べてパスを評価する
+static std::vector<size_t> evaluateReference(const std::vector<Step> &steps) {
+    std::vector<size_t> context;
+    for (size_t s = 0; s < steps.size(); s++) {
+        std::vector<size_t> next;
+        for (size_t i = 0; i < elements.size(); i++) {
+            const Element &e = elements[i];
+            if ((!steps[s].name.empty()) && (e.name != steps[s].name))
+                continue;
+            bool related = false;
+            if (s == 0)
+                related = (steps[s].descendant) || (e.level == 1);
+            for (size_t c : context) {
+                const Element &a = elements[c];
+                if ((a.start < e.start) && (a.end >= e.end) && ((steps[s].descendant) || (a.level == e.level - 1)))
+                    related = true;
+            }
+            for (auto &predicate : steps[s].predicates)
+                related = (related) && (containsPhrase(i, predicate.first, predicate.second));
+            if (related)
+                next.push_back(i);
+        }
+        context = next;
+    }
+    return context;
+}
+
+static void checkQuery(Index *index, const char *query, const std::vector<Step> &steps) {
+    std::vector<size_t> expected = evaluateReference(steps);
+    XPathQuery q(index, query);
+    if (!q.parse()) {
+        std::cout << q.getErrorMessage() << "\n";
+        assert(false);
+    }
+    int count = q.evaluate();
+    if (count != (int)expected.size()) {
+        std::cout << query << ": " << count << " results, expected " << expected.size() << "\n";
+        assert(false);
+    }
+    const XPathElement *results = q.getResults();
+    for (int i = 0; i < count; i++) {
+        const Element &e = elements[expected[i]];
+        assert(results[i].start == e.start);
+        assert(results[i].end == e.end);
+        assert(results[i].level == e.level);
+    }
+}
+
+static void checkAllQueries(Index *index) {
+    checkQuery(index, "/doc", { { false, "doc", {} } });
+    checkQuery(index, "/doc/a", { { false, "doc", {} }, { false, "a", {} } });
+    checkQuery(index, "//a", { { true, "a", {} } });
+    checkQuery(index, "//a//b", { { true, "a", {} }, { true, "b", {} } });
+    checkQuery(index, "//a/b", { { true, "a", {} }, { false, "b", {} } });
+    checkQuery(index, "/doc/*/b", { { false, "doc", {} }, { false, "", {} }, { false, "b", {} } });
+    checkQuery(index, "//sec//*", { { true, "sec", {} }, { true, "", {} } });
+    checkQuery(index, "//A/B", { { true, "a", {} }, { false, "b", {} } });
+    checkQuery(index, "//a/b[contains(., \"x y\")]",
+        { { true, "a", {} }, { false, "b", { { false, { "x", "y" } } } } });
+    checkQuery(index, "//b[contains(text(), \"x\")]", { { true, "b", { { true, { "x" } } } } });
+    checkQuery(index, "//*[ contains( text() , 'z w' ) ]", { { true, "", { { true, { "z", "w" } } } } });
+    checkQuery(index, "//sec/title[contains(., \"x\")][contains(., 'y')]",
+        { { true, "sec", {} }, { false, "title", { { false, { "x" } }, { false, { "y" } } } } });
+    checkQuery(index, "//sec[contains(text(), 'w')]//title",
+        { { true, "sec", { { true, { "w" } } } }, { true, "title", {} } });
+    checkQuery(index, "/a", { { false, "a", {} } });
+    checkQuery(index, "//nonexistent", { { true, "nonexistent", {} } });
+    checkQuery(index, "//a[contains(., 'nonexistent')]", { { true, "a", { { false, { "nonexistent" } } } } });
+}
+
+void test_structural_queries() {
+    cleanup();
+    srand(3);
+    std::string first, second;
+    for (int d = 0; d < 150; d++)
+        generateElement(&first, "doc", 1);
+    size_t firstTokens = tokens.size();
+    for (int d = 0; d < 150; d++)
+        generateElement(&second, "doc", 1);
+    {
+        Index index(TEST_DIR, false);
+        // 前半はセグメントとLongListStoreに、後半はUpdateListに置く
+        addText(&index, first, FIRST_POSITION);
+        index.flushUpdateList();
+        index.waitForMerges();
+        addText(&index, second, FIRST_POSITION + firstTokens);
+
+        int64_t count;
+        free(index.getPostings("<level!1>", &count));
+        assert(count == 300);
+        free(index.getPostings("</level!1>", &count));
+        assert(count == 300);
+        checkAllQueries(&index);
+        index.flushUpdateList();
+        index.waitForMerges();
+    }
+    {
+        Index index(TEST_DIR, false);
+        checkAllQueries(&index);
+    }
+    cleanup();
+    std::cout << "test_structural_queries passed.\n";
+}
+
+// 閉じられていない要素は、それを含む要素の終了タグで閉じられる
+void test_unbalanced_markup() {
+    cleanup();
+    {
+        Index index(TEST_DIR, false);
+        addText(&index, "<r><p>one<br>two</p></zz><q>three</q></r>", 1);
+        struct {
+            const char *query;
+            int count;
+        } queries[] = {
+            { "/r/p/br", 1 }, { "/r/q", 1 }, { "/r/br", 0 }, { "//br[contains(text(), 'two')]", 1 },
+            { "/r/p[contains(text(), 'two')]", 0 }, { "/r/p[contains(text(), 'one')]", 1 },
+            { "/r/p[contains(., 'two')]", 1 }, { "//zz", 0 }
+        };
+        for (auto &query : queries) {
+            XPathQuery q(&index, query.query);
+            assert(q.parse());
+            assert(q.evaluate() == query.count);
+        }
+        XPathQuery q(&index, "//br");
+        assert(q.parse());
+        assert(q.evaluate() == 1);
+        // <br>は</p>の位置で閉じられる
+        assert(q.getResults()[0].start == 4);
+        assert(q.getResults()[0].end == 6);
+    }
+    cleanup();
+    std::cout << "test_unbalanced_markup passed.\n";
+}
+
+void test_syntax_errors() {
+    cleanup();
+    {
+        Index index(TEST_DIR, false);
+        const char *queries[] = {
+            "a/b", "/", "//", "/a[", "/a[foo(., 'x')]", "/a[contains(., 'x']", "/a[contains(@id, 'x')]",
+            "/a[contains(., \"x)]", "/a b", ""
+        };
+        for (const char *query : queries) {
+            XPathQuery q(&index, query);
+            assert(!q.parse());
+            assert(q.getErrorMessage()[0] != 0);
+            assert(q.evaluate() == 0);
+        }
+    }
+    cleanup();
+    std::cout << "test_syntax_errors passed.\n";
+}
+
+int main() {
+    const char *argv[] = {
+        "xpath_test", "--ENABLE_XPATH=true", "--LONG_LIST_THRESHOLD=300"
+    };
+    initializeConfiguratorFromCommandLineParameters(3, argv);
+    setLogLevel(LOG_ERROR + 1);
+
+    test_structural_queries();
+    test_unbalanced_markup();
+    test_syntax_errors();
+
+    std::cout << "All XPath tests passed.\n";
+}
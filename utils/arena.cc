@@ -0,0 +1,70 @@
+#include <cassert>
+#include <cstdlib>
+#include "arena.h"
+#include "alloc.h"
+
+MemoryArena::MemoryArena(int blockSize) {
+    assert(blockSize >= ALIGNMENT);
+    this->blockSize = blockSize;
+    blocksAllocated = 8;
+    blocks = typed_malloc(char*, blocksAllocated);
+    blockCount = 0;
+    currentBlock = -1;
+    currentPos = blockSize;
+    bytesUsed = 0;
+}
+
+MemoryArena::~MemoryArena() {
+    for (int i = 0; i < blockCount; i++)
+        free(blocks[i]);
+    free(blocks);
+}
+
+bool MemoryArena::fitsInCurrentBlock(int size) {
+    size = (size + ALIGNMENT - 1) & ~(ALIGNMENT - 1);
+    if (currentPos + size <= blockSize)
+        return true;
+    // clear後は、既に確保済みの次のブロックを追加コストなしで使える
+    return (currentBlock + 1 < blockCount) && (size <= blockSize);
+}
+
+void *MemoryArena::allocate(int size, int64_t limit) {
+    size = (size + ALIGNMENT - 1) & ~(ALIGNMENT - 1);
+    if (size > blockSize)
+        return nullptr;
+    if (currentPos + size > blockSize) {
+        if (currentBlock + 1 >= blockCount) {
+            if ((limit >= 0) && (getBytesAllocated() + blockSize > limit))
+                return nullptr;
+            if (blockCount >= blocksAllocated) {
+                blocksAllocated *= 2;
+                typed_realloc(char*, blocks, blocksAllocated);
+            }
+            blocks[blockCount++] = typed_malloc(char, blockSize);
+        }
+        currentBlock++;
+        currentPos = 0;
+    }
+    void *result = &blocks[currentBlock][currentPos];
+    currentPos += size;
+    bytesUsed += size;
+    return result;
+}
+
+void MemoryArena::clear() {
+    currentBlock = -1;
+    currentPos = blockSize;
+    bytesUsed = 0;
+}
+
+int64_t MemoryArena::getBytesAllocated() {
+    return ((int64_t)blockCount) * blockSize;
+}
+
+int64_t MemoryArena::getBytesUsed() {
+    return bytesUsed;
+}
+
+int MemoryArena::getBlockSize() {
+    return blockSize;
+}
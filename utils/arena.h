@@ -0,0 +1,58 @@
+#ifndef __ARENA_H
+#define __ARENA_H
+
+#include <cstdint>
+
+/*
+MemoryArenaは固定サイズのブロックから順にメモリを切り出すバンプアロケータ。
+個々の領域を開放することはできず、clearですべてをまとめて破棄する。
+ブロックはclear後も保持され、次の利用時に再利用されるため、
+一度最大サイズまで成長した後はmallocが呼ばれなくなる
+*/
+class MemoryArena {
+
+public:
+
+    // すべての返されるアドレスはこの値の倍数に揃えられる
+    static const int ALIGNMENT = 8;
+
+    MemoryArena(int blockSize);
+
+    ~MemoryArena();
+
+    /*
+    size バイトの領域を返す。新しいブロックを確保する必要があり、
+    それによって確保済みメモリの合計がlimitを超える場合はnullptrを返す。
+    limitが負の場合は制限なし
+    */
+    void *allocate(int size, int64_t limit = -1);
+
+    // 新しいブロックを確保せずにsizeバイトを割り当てられるかどうか
+    bool fitsInCurrentBlock(int size);
+
+    // すべての割り当てを破棄する。確保済みのブロックは開放しない
+    void clear();
+
+    // mallocで確保したブロックの合計サイズ
+    int64_t getBytesAllocated();
+
+    // 割り当て済み(使用中)のバイト数
+    int64_t getBytesUsed();
+
+    int getBlockSize();
+
+private:
+
+    int blockSize;
+
+    // 確保済みのブロックと、その数
+    char **blocks;
+    int blockCount, blocksAllocated;
+
+    // 現在切り出しているブロックと、その中の次の空き位置
+    int currentBlock, currentPos;
+
+    int64_t bytesUsed;
+};
+
+#endif
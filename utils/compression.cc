@@ -0,0 +1,826 @@
+#include <cassert>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <strings.h>
+#include "compression.h"
+#include "alloc.h"
+#include "utils.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define COMPRESSION_X86 1
+#endif
+
+// falseの場合はCPUが対応していてもスカラー実装を使う
+static bool simdEnabled = true;
+
+static const char *METHOD_NAMES[COMPRESSION_METHOD_COUNT] = {
+    "none", "vbyte", "gamma", "delta", "simple9", "simple16", "pfordelta", "document"
+};
+
+static inline bool useAVX2() {
+    return (simdEnabled) && (cpuSupportsAVX2());
+}
+
+bool isSIMDAvailable() {
+    return cpuSupportsAVX2();
+}
+
+void setSIMDEnabled(bool enabled) {
+    simdEnabled = enabled;
+}
+
+int getCompressionMethod(const char *name) {
+    for (int i = 0; i < COMPRESSION_METHOD_COUNT; i++)
+        if (strcasecmp(name, METHOD_NAMES[i]) == 0)
+            return i;
+    return -1;
+}
+
+const char *getCompressionMethodName(int method) {
+    if ((method < 0) || (method >= COMPRESSION_METHOD_COUNT))
+        return "unknown";
+    return METHOD_NAMES[method];
+}
+
+// ブロックヘッダを書き込み、書き込んだバイト数を返す
+static int writeHeader(byte *buffer, int method, int listLength, offset first) {
+    buffer[0] = (byte)method;
+    int len = 1;
+    len += encodeVByte64((uint64_t)listLength, &buffer[len]);
+    if (listLength > 0)
+        len += encodeVByte64((uint64_t)first, &buffer[len]);
+    return len;
+}
+
+// ブロックヘッダを読み取り、読み取ったバイト数を返す
+static int readHeader(const byte *buffer, int *listLength, offset *first) {
+    uint64_t value;
+    int len = 1;
+    len += decodeVByte64(&buffer[len], &value);
+    *listLength = (int)value;
+    *first = 0;
+    if (value > 0) {
+        len += decodeVByte64(&buffer[len], &value);
+        *first = (offset)value;
+    }
+    return len;
+}
+
+void getBlockHeader(const byte *compressed, int *listLength, offset *firstPosting) {
+    readHeader(compressed, listLength, firstPosting);
+}
+
+static offset *allocateOutput(offset *outputBuffer, int listLength) {
+    if (outputBuffer != nullptr)
+        return outputBuffer;
+    return typed_malloc(offset, listLength + 1);
+}
+
+// 圧縮用に多めに確保したバッファを実際に使用したサイズまで縮める
+static byte *shrinkBuffer(byte *buffer, int used) {
+    typed_realloc(byte, buffer, used + 1);
+    return buffer;
+}
+
+
+/***************************************************************
+ * 差分の累積和
+ ***************************************************************/
+
+#ifdef COMPRESSION_X86
+__attribute__((target("avx2")))
+static void prefixSumAVX2(offset *values, int count, offset first) {
+    __m256i carry = _mm256_set1_epi64x(first);
+    __m256i zero = _mm256_setzero_si256();
+    int i = 0;
+    for (; i + 4 <= count; i += 4) {
+        __m256i v = _mm256_loadu_si256((__m256i*)&values[i]);
+        // [a, b, c, d] -> [a, a+b, b+c, c+d]
+        __m256i t = _mm256_permute4x64_epi64(v, _MM_SHUFFLE(2, 1, 0, 0));
+        t = _mm256_blend_epi32(t, zero, 0x03);
+        v = _mm256_add_epi64(v, t);
+        // -> [a, a+b, a+b+c, a+b+c+d]
+        t = _mm256_permute4x64_epi64(v, _MM_SHUFFLE(1, 0, 0, 0));
+        t = _mm256_blend_epi32(t, zero, 0x0F);
+        v = _mm256_add_epi64(v, t);
+        v = _mm256_add_epi64(v, carry);
+        _mm256_storeu_si256((__m256i*)&values[i], v);
+        carry = _mm256_permute4x64_epi64(v, _MM_SHUFFLE(3, 3, 3, 3));
+    }
+    offset last = (i > 0 ? values[i - 1] : first);
+    for (; i < count; i++)
+        last = values[i] = last + values[i];
+}
+#endif
+
+void prefixSum(offset *values, int count, offset first) {
+#ifdef COMPRESSION_X86
+    if ((count >= 8) && (useAVX2())) {
+        prefixSumAVX2(values, count, first);
+        return;
+    }
+#endif
+    offset last = first;
+    for (int i = 0; i < count; i++)
+        last = values[i] = last + values[i];
+}
+
+
+/***************************************************************
+ * 非圧縮
+ ***************************************************************/
+
+byte *compressNone(const offset *uncompressed, int listLength, int *byteLength) {
+    byte *result = typed_malloc(byte, MAX_COMPRESSION_HEADER_SIZE + listLength * sizeof(offset));
+    int len = writeHeader(result, COMPRESSION_NONE, listLength, uncompressed[0]);
+    for (int i = 1; i < listLength; i++) {
+        offset delta = uncompressed[i] - uncompressed[i - 1];
+        memcpy(&result[len], &delta, sizeof(offset));
+        len += sizeof(offset);
+    }
+    *byteLength = len;
+    return result;
+}
+
+offset *decompressNone(const byte *compressed, int byteLength, int *listLength, offset *outputBuffer) {
+    offset first;
+    int pos = readHeader(compressed, listLength, &first);
+    offset *result = allocateOutput(outputBuffer, *listLength);
+    if (*listLength == 0)
+        return result;
+    assert(pos + (*listLength - 1) * (int)sizeof(offset) <= byteLength);
+    result[0] = first;
+    memcpy(&result[1], &compressed[pos], (*listLength - 1) * sizeof(offset));
+    prefixSum(&result[1], *listLength - 1, first);
+    return result;
+}
+
+
+/***************************************************************
+ * vByte
+ ***************************************************************/
+
+byte *compressVByte(const offset *uncompressed, int listLength, int *byteLength) {
+    byte *result = typed_malloc(byte, MAX_COMPRESSION_HEADER_SIZE + listLength * 10);
+    int len = writeHeader(result, COMPRESSION_VBYTE, listLength, uncompressed[0]);
+    for (int i = 1; i < listLength; i++) {
+        assert(uncompressed[i] > uncompressed[i - 1]);
+        len += encodeVByte64((uint64_t)(uncompressed[i] - uncompressed[i - 1]), &result[len]);
+    }
+    *byteLength = len;
+    return shrinkBuffer(result, len);
+}
+
+#ifdef COMPRESSION_X86
+/*
+16バイト単位でMSBを調べ、すべてが1バイトの値であればまとめて64ビットに拡張する。
+ポスティングが密なリスト(差分の大部分が128未満)ではほとんどのバイトがこの経路を通る
+*/
+__attribute__((target("avx2")))
+static int decodeVByteGapsAVX2(const byte *input, int inputLength, offset *output, int count) {
+    int inPos = 0, outPos = 0;
+    while (outPos < count) {
+        if ((inPos + 16 <= inputLength) && (outPos + 16 <= count)) {
+            __m128i chunk = _mm_loadu_si128((const __m128i*)&input[inPos]);
+            if (_mm_movemask_epi8(chunk) == 0) {
+                for (int k = 0; k < 16; k += 4) {
+                    int32_t four;
+                    memcpy(&four, &input[inPos + k], sizeof(four));
+                    __m256i wide = _mm256_cvtepu8_epi64(_mm_cvtsi32_si128(four));
+                    _mm256_storeu_si256((__m256i*)&output[outPos + k], wide);
+                }
+                inPos += 16;
+                outPos += 16;
+                continue;
+            }
+        }
+        uint64_t value;
+        inPos += decodeVByte64(&input[inPos], &value);
+        output[outPos++] = (offset)value;
+    }
+    return inPos;
+}
+#endif
+
+offset *decompressVByte(const byte *compressed, int byteLength, int *listLength, offset *outputBuffer) {
+    offset first;
+    int pos = readHeader(compressed, listLength, &first);
+    offset *result = allocateOutput(outputBuffer, *listLength);
+    int n = *listLength;
+    if (n == 0)
+        return result;
+    result[0] = first;
+#ifdef COMPRESSION_X86
+    if (useAVX2()) {
+        decodeVByteGapsAVX2(&compressed[pos], byteLength - pos, &result[1], n - 1);
+        prefixSum(&result[1], n - 1, first);
+        return result;
+    }
+#endif
+    offset last = first;
+    for (int i = 1; i < n; i++) {
+        uint64_t value;
+        pos += decodeVByte64(&compressed[pos], &value);
+        last = result[i] = last + (offset)value;
+    }
+    return result;
+}
+
+
+/***************************************************************
+ * Elias-gamma / Elias-delta
+ ***************************************************************/
+
+// MSBから順にビットを書き込むライター
+typedef struct {
+    byte *buffer;
+    int bytePos;
+    uint64_t accumulator;
+    int bitsInAccumulator;
+} BitWriter;
+
+static inline void writeBits(BitWriter *w, uint64_t value, int count) {
+    while (count > 32) {
+        writeBits(w, value >> 32, count - 32);
+        value &= 0xFFFFFFFFULL;
+        count = 32;
+    }
+    if (count == 0)
+        return;
+    w->accumulator = (w->accumulator << count) | (value & ((1ULL << count) - 1));
+    w->bitsInAccumulator += count;
+    while (w->bitsInAccumulator >= 8) {
+        w->bitsInAccumulator -= 8;
+        w->buffer[w->bytePos++] = (byte)(w->accumulator >> w->bitsInAccumulator);
+    }
+}
+
+static inline void flushBits(BitWriter *w) {
+    if (w->bitsInAccumulator > 0)
+        w->buffer[w->bytePos++] = (byte)(w->accumulator << (8 - w->bitsInAccumulator));
+    w->bitsInAccumulator = 0;
+}
+
+// MSBから順にビットを読み取るリーダー。bitsは常に左詰め
+typedef struct {
+    const byte *buffer;
+    int bytePos, byteLength;
+    uint64_t bits;
+    int bitCount;
+} BitReader;
+
+static inline void refill(BitReader *r) {
+    while (r->bitCount <= 56) {
+        uint64_t b = (r->bytePos < r->byteLength ? r->buffer[r->bytePos] : 0);
+        r->bytePos++;
+        r->bits |= b << (56 - r->bitCount);
+        r->bitCount += 8;
+    }
+}
+
+static inline uint64_t readBits(BitReader *r, int count) {
+    uint64_t result = 0;
+    while (count > 0) {
+        int n = (count > 32 ? 32 : count);
+        refill(r);
+        result = (result << n) | (r->bits >> (64 - n));
+        r->bits <<= n;
+        r->bitCount -= n;
+        count -= n;
+    }
+    return result;
+}
+
+// 先頭に続く0ビットの数を読み取り、直後の1ビットを消費する
+static inline int readUnary(BitReader *r) {
+    int zeros = 0;
+    refill(r);
+    while (r->bits == 0) {
+        zeros += r->bitCount;
+        r->bits = 0;
+        r->bitCount = 0;
+        refill(r);
+    }
+    int lz = __builtin_clzll(r->bits);
+    zeros += lz;
+    r->bits <<= (lz + 1);
+    r->bitCount -= (lz + 1);
+    return zeros;
+}
+
+static inline int bitLength(uint64_t value) {
+    return 64 - __builtin_clzll(value);
+}
+
+static inline void writeGamma(BitWriter *w, uint64_t value) {
+    int n = bitLength(value) - 1;
+    writeBits(w, 0, n);
+    writeBits(w, value, n + 1);
+}
+
+static inline uint64_t readGamma(BitReader *r) {
+    int n = readUnary(r);
+    return (1ULL << n) | readBits(r, n);
+}
+
+static byte *compressBitwise(const offset *uncompressed, int listLength, int *byteLength, int method) {
+    byte *result = typed_malloc(byte, MAX_COMPRESSION_HEADER_SIZE + listLength * 16 + 8);
+    BitWriter w;
+    w.buffer = result;
+    w.bytePos = writeHeader(result, method, listLength, uncompressed[0]);
+    w.accumulator = 0;
+    w.bitsInAccumulator = 0;
+    for (int i = 1; i < listLength; i++) {
+        assert(uncompressed[i] > uncompressed[i - 1]);
+        uint64_t delta = (uint64_t)(uncompressed[i] - uncompressed[i - 1]);
+        if (method == COMPRESSION_GAMMA)
+            writeGamma(&w, delta);
+        else {
+            int n = bitLength(delta);
+            writeGamma(&w, (uint64_t)n);
+            writeBits(&w, delta, n - 1);
+        }
+    }
+    flushBits(&w);
+    *byteLength = w.bytePos;
+    return shrinkBuffer(result, w.bytePos);
+}
+
+static offset *decompressBitwise(const byte *compressed, int byteLength,
+        int *listLength, offset *outputBuffer, int method) {
+    offset first;
+    BitReader r;
+    r.buffer = compressed;
+    r.bytePos = readHeader(compressed, listLength, &first);
+    r.byteLength = byteLength;
+    r.bits = 0;
+    r.bitCount = 0;
+    offset *result = allocateOutput(outputBuffer, *listLength);
+    int n = *listLength;
+    if (n == 0)
+        return result;
+    result[0] = first;
+    offset last = first;
+    for (int i = 1; i < n; i++) {
+        uint64_t delta;
+        if (method == COMPRESSION_GAMMA)
+            delta = readGamma(&r);
+        else {
+            int len = (int)readGamma(&r);
+            delta = (1ULL << (len - 1)) | readBits(&r, len - 1);
+        }
+        last = result[i] = last + (offset)delta;
+    }
+    return result;
+}
+
+byte *compressGamma(const offset *uncompressed, int listLength, int *byteLength) {
+    return compressBitwise(uncompressed, listLength, byteLength, COMPRESSION_GAMMA);
+}
+
+offset *decompressGamma(const byte *compressed, int byteLength, int *listLength, offset *outputBuffer) {
+    return decompressBitwise(compressed, byteLength, listLength, outputBuffer, COMPRESSION_GAMMA);
+}
+
+byte *compressDelta(const offset *uncompressed, int listLength, int *byteLength) {
+    return compressBitwise(uncompressed, listLength, byteLength, COMPRESSION_DELTA);
+}
+
+offset *decompressDelta(const byte *compressed, int byteLength, int *listLength, offset *outputBuffer) {
+    return decompressBitwise(compressed, byteLength, listLength, outputBuffer, COMPRESSION_DELTA);
+}
+
+
+/***************************************************************
+ * Simple-9 / Simple-16
+ ***************************************************************/
+
+/*
+セレクタごとの各値のビット幅。(個数, ビット幅)の組を並べたもので、
+ビット幅の合計は常に28になる。Simple-9は一様な幅のみを使う
+*/
+static const int SIMPLE9_COUNT[9] = { 28, 14, 9, 7, 5, 4, 3, 2, 1 };
+static const int SIMPLE9_BITS[9] = { 1, 2, 3, 4, 5, 7, 9, 14, 28 };
+
+static const int SIMPLE16_RUNS[16][6] = {
+    { 28, 1, 0, 0, 0, 0 }, { 7, 2, 14, 1, 0, 0 }, { 7, 1, 7, 2, 7, 1 }, { 14, 1, 7, 2, 0, 0 },
+    { 14, 2, 0, 0, 0, 0 }, { 1, 4, 8, 3, 0, 0 }, { 1, 3, 4, 4, 3, 3 }, { 7, 4, 0, 0, 0, 0 },
+    { 4, 5, 2, 4, 0, 0 }, { 2, 4, 4, 5, 0, 0 }, { 3, 6, 2, 5, 0, 0 }, { 2, 5, 3, 6, 0, 0 },
+    { 4, 7, 0, 0, 0, 0 }, { 1, 10, 2, 9, 0, 0 }, { 2, 14, 0, 0, 0, 0 }, { 1, 28, 0, 0, 0, 0 }
+};
+
+static int simple16Count[16];
+static int simple16Bits[16][28];
+static bool simple16Initialized = false;
+
+static void initializeSimple16() {
+    if (simple16Initialized)
+        return;
+    for (int s = 0; s < 16; s++) {
+        int n = 0;
+        for (int r = 0; r < 6; r += 2)
+            for (int k = 0; k < SIMPLE16_RUNS[s][r]; k++)
+                simple16Bits[s][n++] = SIMPLE16_RUNS[s][r + 1];
+        simple16Count[s] = n;
+    }
+    simple16Initialized = true;
+}
+
+static bool containsLargeGap(const offset *uncompressed, int listLength) {
+    for (int i = 1; i < listLength; i++)
+        if (uncompressed[i] - uncompressed[i - 1] >= (ONE << 28))
+            return true;
+    return false;
+}
+
+static byte *compressSimple(const offset *uncompressed, int listLength, int *byteLength, bool simple16) {
+    if (containsLargeGap(uncompressed, listLength))
+        return compressVByte(uncompressed, listLength, byteLength);
+    initializeSimple16();
+    int gapCount = listLength - 1;
+    uint32_t *gaps = typed_malloc(uint32_t, gapCount + 1);
+    for (int i = 0; i < gapCount; i++)
+        gaps[i] = (uint32_t)(uncompressed[i + 1] - uncompressed[i]);
+
+    byte *result = typed_malloc(byte, MAX_COMPRESSION_HEADER_SIZE + (gapCount + 1) * 4);
+    int len = writeHeader(result, (simple16 ? COMPRESSION_SIMPLE_16 : COMPRESSION_SIMPLE_9),
+            listLength, uncompressed[0]);
+    int selectorCount = (simple16 ? 16 : 9);
+    int pos = 0;
+    while (pos < gapCount) {
+        for (int s = 0; s < selectorCount; s++) {
+            int n = (simple16 ? simple16Count[s] : SIMPLE9_COUNT[s]);
+            if (n > gapCount - pos)
+                n = gapCount - pos;
+            bool fits = true;
+            for (int k = 0; (k < n) && (fits); k++) {
+                int bits = (simple16 ? simple16Bits[s][k] : SIMPLE9_BITS[s]);
+                if (gaps[pos + k] >= (1U << bits))
+                    fits = false;
+            }
+            if (!fits)
+                continue;
+            uint32_t word = ((uint32_t)s) << 28;
+            int shift = 0;
+            for (int k = 0; k < n; k++) {
+                int bits = (simple16 ? simple16Bits[s][k] : SIMPLE9_BITS[s]);
+                word |= gaps[pos + k] << shift;
+                shift += bits;
+            }
+            memcpy(&result[len], &word, sizeof(word));
+            len += sizeof(word);
+            pos += n;
+            break;
+        }
+    }
+    free(gaps);
+    *byteLength = len;
+    return shrinkBuffer(result, len);
+}
+
+static offset *decompressSimple(const byte *compressed, int byteLength,
+        int *listLength, offset *outputBuffer, bool simple16) {
+    offset first;
+    int pos = readHeader(compressed, listLength, &first);
+    offset *result = allocateOutput(outputBuffer, *listLength);
+    int n = *listLength;
+    if (n == 0)
+        return result;
+    initializeSimple16();
+    result[0] = first;
+    int outPos = 1;
+    while (outPos < n) {
+        assert(pos + 4 <= byteLength);
+        uint32_t word;
+        memcpy(&word, &compressed[pos], sizeof(word));
+        pos += sizeof(word);
+        int s = word >> 28;
+        if (simple16) {
+            int count = simple16Count[s];
+            const int *bits = simple16Bits[s];
+            for (int k = 0; (k < count) && (outPos < n); k++) {
+                result[outPos++] = word & ((1U << bits[k]) - 1);
+                word >>= bits[k];
+            }
+        } else {
+            int count = SIMPLE9_COUNT[s];
+            int bits = SIMPLE9_BITS[s];
+            uint32_t mask = (1U << bits) - 1;
+            for (int k = 0; (k < count) && (outPos < n); k++) {
+                result[outPos++] = word & mask;
+                word >>= bits;
+            }
+        }
+    }
+    prefixSum(&result[1], n - 1, first);
+    return result;
+}
+
+byte *compressSimple9(const offset *uncompressed, int listLength, int *byteLength) {
+    return compressSimple(uncompressed, listLength, byteLength, false);
+}
+
+offset *decompressSimple9(const byte *compressed, int byteLength, int *listLength, offset *outputBuffer) {
+    return decompressSimple(compressed, byteLength, listLength, outputBuffer, false);
+}
+
+byte *compressSimple16(const offset *uncompressed, int listLength, int *byteLength) {
+    return compressSimple(uncompressed, listLength, byteLength, true);
+}
+
+offset *decompressSimple16(const byte *compressed, int byteLength, int *listLength, offset *outputBuffer) {
+    return decompressSimple(compressed, byteLength, listLength, outputBuffer, true);
+}
+
+
+/***************************************************************
+ * PForDelta
+ *
+ * 差分列をPFORDELTA_BLOCK_SIZE個ずつのブロックに分け、ブロックごとに
+ * ビット幅bを選ぶ。2^b以上の値は例外として(位置, 値)の組で別に保存する。
+ * ブロック形式: [b 1バイト][例外数 1バイト][b*n ビット][例外の(位置, vByte値)...]
+ * ペイロードの末尾には、8バイト単位の読み取りがバッファ外に出ないよう8バイトの
+ * パディングを置く
+ ***************************************************************/
+
+static const int PFOR_MAX_BITS = 32;
+
+static int choosePForBits(const uint64_t *values, int n) {
+    int histogram[65];
+    memset(histogram, 0, sizeof(histogram));
+    for (int i = 0; i < n; i++)
+        histogram[values[i] == 0 ? 0 : bitLength(values[i])]++;
+    int bestBits = PFOR_MAX_BITS, bestCost = MAX_INT;
+    int exceptions = n;
+    for (int b = 0; b <= PFOR_MAX_BITS; b++) {
+        exceptions -= histogram[b];
+        // 例外1個あたり、位置1バイトと値のvByte表現(概算)のコストがかかる
+        int cost = (n * b + 7) / 8 + exceptions * (1 + (b + 8) / 7);
+        if ((exceptions < 256) && (cost < bestCost)) {
+            bestCost = cost;
+            bestBits = b;
+        }
+    }
+    return bestBits;
+}
+
+byte *compressPForDelta(const offset *uncompressed, int listLength, int *byteLength) {
+    int gapCount = listLength - 1;
+    byte *result = typed_malloc(byte, MAX_COMPRESSION_HEADER_SIZE + gapCount * 16 + (gapCount / PFORDELTA_BLOCK_SIZE + 1) * 2 + 16);
+    int len = writeHeader(result, COMPRESSION_PFORDELTA, listLength, uncompressed[0]);
+    uint64_t values[PFORDELTA_BLOCK_SIZE];
+    for (int blockStart = 0; blockStart < gapCount; blockStart += PFORDELTA_BLOCK_SIZE) {
+        int n = gapCount - blockStart;
+        if (n > PFORDELTA_BLOCK_SIZE)
+            n = PFORDELTA_BLOCK_SIZE;
+        for (int k = 0; k < n; k++) {
+            assert(uncompressed[blockStart + k + 1] > uncompressed[blockStart + k]);
+            values[k] = (uint64_t)(uncompressed[blockStart + k + 1] - uncompressed[blockStart + k]);
+        }
+        int bits = choosePForBits(values, n);
+        uint64_t limit = (bits == 64 ? ~0ULL : (1ULL << bits));
+        int exceptionCount = 0;
+        for (int k = 0; k < n; k++)
+            if (values[k] >= limit)
+                exceptionCount++;
+        result[len++] = (byte)bits;
+        result[len++] = (byte)exceptionCount;
+
+        // ビット列は下位ビットから順に詰める
+        int packedBytes = (n * bits + 7) / 8;
+        memset(&result[len], 0, packedBytes + 8);
+        for (int k = 0; k < n; k++) {
+            if ((values[k] >= limit) || (bits == 0))
+                continue;
+            int bitPos = k * bits;
+            uint64_t word;
+            memcpy(&word, &result[len + (bitPos >> 3)], sizeof(word));
+            word |= values[k] << (bitPos & 7);
+            memcpy(&result[len + (bitPos >> 3)], &word, sizeof(word));
+        }
+        len += packedBytes;
+        for (int k = 0; k < n; k++) {
+            if (values[k] >= limit) {
+                result[len++] = (byte)k;
+                len += encodeVByte64(values[k], &result[len]);
+            }
+        }
+    }
+    memset(&result[len], 0, 8);
+    len += 8;
+    *byteLength = len;
+    return shrinkBuffer(result, len);
+}
+
+static inline void unpackScalar(const byte *packed, int bits, int n, offset *output) {
+    if (bits == 0) {
+        for (int k = 0; k < n; k++)
+            output[k] = 0;
+        return;
+    }
+    uint64_t mask = (1ULL << bits) - 1;
+    for (int k = 0; k < n; k++) {
+        int bitPos = k * bits;
+        uint64_t word;
+        memcpy(&word, &packed[bitPos >> 3], sizeof(word));
+        output[k] = (offset)((word >> (bitPos & 7)) & mask);
+    }
+}
+
+#ifdef COMPRESSION_X86
+/*
+4個の値を同時に取り出す。各値を含む8バイトをバイト単位のgatherで読み込み、
+要素ごとの可変シフトとマスクで値を切り出す
+*/
+__attribute__((target("avx2")))
+static void unpackAVX2(const byte *packed, int bits, int n, offset *output) {
+    if (bits == 0) {
+        unpackScalar(packed, bits, n, output);
+        return;
+    }
+    __m256i mask = _mm256_set1_epi64x((long long)((1ULL << bits) - 1));
+    __m256i seven = _mm256_set1_epi64x(7);
+    __m256i bitPos = _mm256_setr_epi64x(0, bits, 2 * bits, 3 * bits);
+    __m256i step = _mm256_set1_epi64x(4 * bits);
+    int k = 0;
+    for (; k + 4 <= n; k += 4) {
+        __m256i byteOffsets = _mm256_srli_epi64(bitPos, 3);
+        __m256i words = _mm256_i64gather_epi64((const long long*)packed, byteOffsets, 1);
+        __m256i shifts = _mm256_and_si256(bitPos, seven);
+        words = _mm256_and_si256(_mm256_srlv_epi64(words, shifts), mask);
+        _mm256_storeu_si256((__m256i*)&output[k], words);
+        bitPos = _mm256_add_epi64(bitPos, step);
+    }
+    if (k < n) {
+        uint64_t m = (1ULL << bits) - 1;
+        for (; k < n; k++) {
+            int p = k * bits;
+            uint64_t word;
+            memcpy(&word, &packed[p >> 3], sizeof(word));
+            output[k] = (offset)((word >> (p & 7)) & m);
+        }
+    }
+}
+#endif
+
+offset *decompressPForDelta(const byte *compressed, int byteLength, int *listLength, offset *outputBuffer) {
+    offset first;
+    int pos = readHeader(compressed, listLength, &first);
+    offset *result = allocateOutput(outputBuffer, *listLength);
+    int n = *listLength;
+    if (n == 0)
+        return result;
+    result[0] = first;
+    assert(pos + 8 <= byteLength);
+    int gapCount = n - 1;
+    bool avx2 = useAVX2();
+    for (int blockStart = 0; blockStart < gapCount; blockStart += PFORDELTA_BLOCK_SIZE) {
+        int count = gapCount - blockStart;
+        if (count > PFORDELTA_BLOCK_SIZE)
+            count = PFORDELTA_BLOCK_SIZE;
+        int bits = compressed[pos++];
+        int exceptionCount = compressed[pos++];
+        offset *output = &result[1 + blockStart];
+#ifdef COMPRESSION_X86
+        if (avx2)
+            unpackAVX2(&compressed[pos], bits, count, output);
+        else
+            unpackScalar(&compressed[pos], bits, count, output);
+#else
+        unpackScalar(&compressed[pos], bits, count, output);
+#endif
+        pos += (count * bits + 7) / 8;
+        for (int e = 0; e < exceptionCount; e++) {
+            int k = compressed[pos++];
+            uint64_t value;
+            pos += decodeVByte64(&compressed[pos], &value);
+            output[k] = (offset)value;
+        }
+    }
+    (void)avx2;
+    prefixSum(&result[1], gapCount, first);
+    return result;
+}
+
+
+/***************************************************************
+ * 文書単位のポスティング
+ *
+ * ペイロードは[開始位置の差分のビット幅][文書長のビット幅][tfの最小値][文書長の最小値]の
+ * 4バイトに続いて、2番目以降のポスティングごとに開始位置の差分(固定幅)、
+ * tf(最小値からの差 + 1をElias-gamma)、文書長の符号(最小値からの差を固定幅)を
+ * 順に詰めたビット列。ほとんどのtfは1か2なので、tfは1〜3ビットで済む
+ ***************************************************************/
+
+static inline int bitWidth(uint64_t value) {
+    return (value == 0 ? 0 : bitLength(value));
+}
+
+byte *compressDocument(const offset *uncompressed, int listLength, int *byteLength) {
+    const int shift = COMPRESSION_DOCUMENT_SHIFT;
+    byte *result = typed_malloc(byte, MAX_COMPRESSION_HEADER_SIZE + 4 + listLength * 16 + 8);
+    int len = writeHeader(result, COMPRESSION_DOCUMENT, listLength, uncompressed[0]);
+
+    uint64_t maxGap = 0;
+    int minMiddle = 255, minLow = 255, maxLow = 0;
+    for (int i = 1; i < listLength; i++) {
+        assert(uncompressed[i] > uncompressed[i - 1]);
+        uint64_t gap = (uint64_t)((uncompressed[i] >> shift) - (uncompressed[i - 1] >> shift));
+        if (gap > maxGap)
+            maxGap = gap;
+        int middle = (int)((uncompressed[i] >> 8) & 255), low = (int)(uncompressed[i] & 255);
+        if (middle < minMiddle)
+            minMiddle = middle;
+        if (low < minLow)
+            minLow = low;
+        if (low > maxLow)
+            maxLow = low;
+    }
+    if (listLength == 1)
+        minMiddle = minLow = maxLow = 0;
+    int gapBits = bitWidth(maxGap);
+    int lowBits = bitWidth((uint64_t)(maxLow - minLow));
+    result[len++] = (byte)gapBits;
+    result[len++] = (byte)lowBits;
+    result[len++] = (byte)minMiddle;
+    result[len++] = (byte)minLow;
+
+    BitWriter w;
+    w.buffer = result;
+    w.bytePos = len;
+    w.accumulator = 0;
+    w.bitsInAccumulator = 0;
+    for (int i = 1; i < listLength; i++) {
+        writeBits(&w, (uint64_t)((uncompressed[i] >> shift) - (uncompressed[i - 1] >> shift)), gapBits);
+        writeGamma(&w, (uint64_t)(((uncompressed[i] >> 8) & 255) - minMiddle + 1));
+        writeBits(&w, (uint64_t)((uncompressed[i] & 255) - minLow), lowBits);
+    }
+    flushBits(&w);
+    *byteLength = w.bytePos;
+    return shrinkBuffer(result, w.bytePos);
+}
+
+offset *decompressDocument(const byte *compressed, int byteLength, int *listLength, offset *outputBuffer) {
+    const int shift = COMPRESSION_DOCUMENT_SHIFT;
+    offset first;
+    int pos = readHeader(compressed, listLength, &first);
+    offset *result = allocateOutput(outputBuffer, *listLength);
+    int n = *listLength;
+    if (n == 0)
+        return result;
+    result[0] = first;
+    int gapBits = compressed[pos], lowBits = compressed[pos + 1];
+    offset minMiddle = compressed[pos + 2], minLow = compressed[pos + 3];
+
+    BitReader r;
+    r.buffer = compressed;
+    r.bytePos = pos + 4;
+    r.byteLength = byteLength;
+    r.bits = 0;
+    r.bitCount = 0;
+    offset high = first >> shift;
+    for (int i = 1; i < n; i++) {
+        high += (offset)readBits(&r, gapBits);
+        offset middle = minMiddle + (offset)readGamma(&r) - 1;
+        offset low = minLow + (offset)readBits(&r, lowBits);
+        result[i] = (high << shift) | (middle << 8) | low;
+    }
+    return result;
+}
+
+
+/***************************************************************
+ * 共通インタフェース
+ ***************************************************************/
+
+static const Compressor COMPRESSORS[COMPRESSION_METHOD_COUNT] = {
+    compressNone, compressVByte, compressGamma, compressDelta,
+    compressSimple9, compressSimple16, compressPForDelta, compressDocument
+};
+
+static const Decompressor DECOMPRESSORS[COMPRESSION_METHOD_COUNT] = {
+    decompressNone, decompressVByte, decompressGamma, decompressDelta,
+    decompressSimple9, decompressSimple16, decompressPForDelta, decompressDocument
+};
+
+byte *compressList(const offset *uncompressed, int listLength, int *byteLength, int method) {
+    if ((method < 0) || (method >= COMPRESSION_METHOD_COUNT))
+        return nullptr;
+    if (listLength <= 0) {
+        byte *result = typed_malloc(byte, MAX_COMPRESSION_HEADER_SIZE);
+        *byteLength = writeHeader(result, method, 0, 0);
+        return result;
+    }
+    return COMPRESSORS[method](uncompressed, listLength, byteLength);
+}
+
+offset *decompressList(const byte *compressed, int byteLength, int *listLength, offset *outputBuffer) {
+    int method = compressed[0];
+    if (method >= COMPRESSION_METHOD_COUNT) {
+        *listLength = 0;
+        return nullptr;
+    }
+    return DECOMPRESSORS[method](compressed, byteLength, listLength, outputBuffer);
+}
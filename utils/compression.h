@@ -1,6 +1,146 @@
 #ifndef __COMPRESSION_H
 #define __COMPRESSION_H
 
+/*
+ポスティングリスト(昇順に並んだoffset値の列)を圧縮・展開するためのコーデック群。
+すべての圧縮関数は同じブロック形式を出力する:
+
+    [圧縮方式 1バイト][要素数 vByte][先頭ポスティング vByte][差分列のペイロード]
+
+先頭のポスティングは絶対値で保存し、2番目以降は直前の値との差分(>= 1)を
+各コーデックで符号化する。ブロックの先頭に圧縮方式が入っているため、
+decompressListは方式を意識せずに任意のブロックを展開できる。
+*/
+
+#include <cstdint>
+#include "../index/index_type.h"
+
 using byte = unsigned char;
 
-#endif
\ No newline at end of file
+#define COMPRESSION_NONE 0
+#define COMPRESSION_VBYTE 1
+#define COMPRESSION_GAMMA 2
+#define COMPRESSION_DELTA 3
+#define COMPRESSION_SIMPLE_9 4
+#define COMPRESSION_SIMPLE_16 5
+#define COMPRESSION_PFORDELTA 6
+#define COMPRESSION_DOCUMENT 7
+
+#define COMPRESSION_METHOD_COUNT 8
+
+// 特に指定がない場合に使用する圧縮方式
+#define DEFAULT_COMPRESSION_METHOD COMPRESSION_VBYTE
+
+/*
+PForDeltaのブロック長。ペイロードはこの個数ごとにビット幅を選び直す。
+SIMDの展開処理はこの長さを前提にしている
+*/
+#define PFORDELTA_BLOCK_SIZE 128
+
+/*
+COMPRESSION_DOCUMENTが前提とするポスティングの形式。上位ビットの差分と、
+下位COMPRESSION_DOCUMENT_SHIFTビットの2つのバイトを別々に符号化する(doclevel.hを参照)
+*/
+#define COMPRESSION_DOCUMENT_SHIFT 16
+
+// 圧縮済みブロックのヘッダが取りうる最大バイト数
+#define MAX_COMPRESSION_HEADER_SIZE 20
+
+typedef byte *(*Compressor)(const offset *uncompressed, int listLength, int *byteLength);
+
+typedef offset *(*Decompressor)(const byte *compressed, int byteLength, int *listLength, offset *outputBuffer);
+
+/*
+以下の圧縮関数は、昇順に並んだlistLength個のポスティングを圧縮し、
+typed_mallocで確保したバッファを返す。メモリは呼び出し元で開放しなければいけない。
+圧縮後のバイト数はbyteLengthに格納される。
+*/
+byte *compressNone(const offset *uncompressed, int listLength, int *byteLength);
+byte *compressVByte(const offset *uncompressed, int listLength, int *byteLength);
+byte *compressGamma(const offset *uncompressed, int listLength, int *byteLength);
+byte *compressDelta(const offset *uncompressed, int listLength, int *byteLength);
+
+/*
+Simple-9/16は1ワードに28ビットまでの値しか格納できない。
+2^28以上の差分を含むリストはvByteで圧縮される(ブロックの圧縮方式もvByteになる)
+*/
+byte *compressSimple9(const offset *uncompressed, int listLength, int *byteLength);
+byte *compressSimple16(const offset *uncompressed, int listLength, int *byteLength);
+byte *compressPForDelta(const offset *uncompressed, int listLength, int *byteLength);
+
+/*
+文書単位のポスティング((文書の開始位置 << 16) | (tf << 8) | 文書長の符号)向けの圧縮方式。
+全体の差分ではなく、開始位置の差分、tf、文書長の符号に分けて符号化する。開始位置の差分と
+文書長の符号はブロック内の最大値に合わせたビット幅で、tfはElias-gammaで詰める。
+差分をそのまま符号化すると下位16ビットのために1ポスティングあたり2バイト以上が余分に必要になる。
+任意の昇順のリストを圧縮できるが、位置のポスティングにはvByteやPForDeltaの方が適している
+*/
+byte *compressDocument(const offset *uncompressed, int listLength, int *byteLength);
+
+/*
+以下の展開関数は、対応する圧縮関数が出力したブロックを展開する。
+outputBufferがnullptrの場合は新しいバッファをtyped_mallocで確保して返す。
+そうでない場合、outputBufferには少なくともlistLength個の要素を書き込めなければならない
+*/
+offset *decompressNone(const byte *compressed, int byteLength, int *listLength, offset *outputBuffer);
+offset *decompressVByte(const byte *compressed, int byteLength, int *listLength, offset *outputBuffer);
+offset *decompressGamma(const byte *compressed, int byteLength, int *listLength, offset *outputBuffer);
+offset *decompressDelta(const byte *compressed, int byteLength, int *listLength, offset *outputBuffer);
+offset *decompressSimple9(const byte *compressed, int byteLength, int *listLength, offset *outputBuffer);
+offset *decompressSimple16(const byte *compressed, int byteLength, int *listLength, offset *outputBuffer);
+offset *decompressPForDelta(const byte *compressed, int byteLength, int *listLength, offset *outputBuffer);
+offset *decompressDocument(const byte *compressed, int byteLength, int *listLength, offset *outputBuffer);
+
+// 指定された圧縮方式でリストを圧縮する。未知の方式の場合はnullptrを返す
+byte *compressList(const offset *uncompressed, int listLength, int *byteLength, int method);
+
+// ブロックの先頭バイトから圧縮方式を判別し、リストを展開する
+offset *decompressList(const byte *compressed, int byteLength, int *listLength, offset *outputBuffer);
+
+// ブロックを展開せずに要素数と先頭のポスティングを取得する
+void getBlockHeader(const byte *compressed, int *listLength, offset *firstPosting);
+
+// 圧縮方式の名前("vbyte"、"gamma"など)から方式IDを返す。未知の名前の場合は-1
+int getCompressionMethod(const char *name);
+
+const char *getCompressionMethodName(int method);
+
+/*
+SIMDによる一括展開処理が使用可能かどうか。
+実行時にCPUの機能を調べて決定する。setSIMDEnabled(false)でスカラー実装に固定できる
+(主にテストでスカラー実装と結果を比較するために使う)
+*/
+bool isSIMDAvailable();
+void setSIMDEnabled(bool enabled);
+
+/*
+差分列を先頭値firstからの累積和に変換する(その場で書き換える)。
+AVX2が使える場合はベクトル化された実装が使われる
+*/
+void prefixSum(offset *values, int count, offset first);
+
+// valueをvByte形式でbufferに書き込み、書き込んだバイト数を返す(最大10バイト)
+static inline int encodeVByte64(uint64_t value, byte *buffer) {
+    int len = 0;
+    while (value >= 128) {
+        buffer[len++] = (byte)(value & 127) | 128;
+        value >>= 7;
+    }
+    buffer[len++] = (byte)value;
+    return len;
+}
+
+// bufferからvByte形式の値を読み取り、読み取ったバイト数を返す
+static inline int decodeVByte64(const byte *buffer, uint64_t *value) {
+    uint64_t result = 0;
+    int shift = 0, len = 0;
+    while (buffer[len] >= 128) {
+        result |= ((uint64_t)(buffer[len++] & 127)) << shift;
+        shift += 7;
+    }
+    result |= ((uint64_t)buffer[len++]) << shift;
+    *value = result;
+    return len;
+}
+
+#endif
@@ -0,0 +1,146 @@
+#include <iostream>
+#include <cassert>
+#include <cstdlib>
+#include <cstring>
+#include "compression.h"
+#include "alloc.h"
+
+// 平均間隔gapで昇順のリストを作る。ときどき大きな差分を混ぜる
+static offset *createList(int length, int gap, unsigned int seed) {
+    srand(seed);
+    offset *list = typed_malloc(offset, length);
+    offset current = rand() % 1000;
+    for (int i = 0; i < length; i++) {
+        list[i] = current;
+        offset delta = 1 + rand() % gap;
+        if (rand() % 97 == 0)
+            delta += (ONE << 30);
+        current += delta;
+    }
+    return list;
+}
+
+static void checkRoundTrip(const offset *list, int length, int method) {
+    int byteLength;
+    byte *compressed = compressList(list, length, &byteLength, method);
+    assert(compressed != nullptr);
+    int decodedLength;
+    offset *decoded = decompressList(compressed, byteLength, &decodedLength, nullptr);
+    assert(decodedLength == length);
+    for (int i = 0; i < length; i++)
+        assert(decoded[i] == list[i]);
+
+    int headerLength;
+    offset first;
+    getBlockHeader(compressed, &headerLength, &first);
+    assert(headerLength == length);
+    if (length > 0)
+        assert(first == list[0]);
+    free(decoded);
+    free(compressed);
+}
+
+void test_round_trip() {
+    int lengths[] = { 1, 2, 3, 15, 16, 17, 127, 128, 129, 1000, 10007 };
+    int gaps[] = { 1, 3, 100, 100000 };
+    for (int method = 0; method < COMPRESSION_METHOD_COUNT; method++)
+        for (int length : lengths)
+            for (int gap : gaps) {
+                offset *list = createList(length, gap, length * 31 + gap);
+                checkRoundTrip(list, length, method);
+                free(list);
+            }
+    std::cout << "test_round_trip passed.\n";
+}
+
+void test_large_offsets() {
+    offset list[] = { MAX_OFFSET - 5, MAX_OFFSET - 3, MAX_OFFSET };
+    offset sparse[] = { 0, ONE << 20, ONE << 40, MAX_OFFSET };
+    for (int method = 0; method < COMPRESSION_METHOD_COUNT; method++) {
+        checkRoundTrip(list, 3, method);
+        checkRoundTrip(sparse, 4, method);
+    }
+    std::cout << "test_large_offsets passed.\n";
+}
+
+void test_simd_matches_scalar() {
+    offset *list = createList(5000, 50, 42);
+    for (int method = 0; method < COMPRESSION_METHOD_COUNT; method++) {
+        int byteLength, n1, n2;
+        byte *compressed = compressList(list, 5000, &byteLength, method);
+        setSIMDEnabled(false);
+        offset *scalar = decompressList(compressed, byteLength, &n1, nullptr);
+        setSIMDEnabled(true);
+        offset *simd = decompressList(compressed, byteLength, &n2, nullptr);
+        assert(n1 == n2);
+        assert(memcmp(scalar, simd, n1 * sizeof(offset)) == 0);
+        free(scalar);
+        free(simd);
+        free(compressed);
+    }
+    free(list);
+    std::cout << "test_simd_matches_scalar passed (SIMD "
+              << (isSIMDAvailable() ? "available" : "not available") << ").\n";
+}
+
+void test_compression_ratio() {
+    offset *list = createList(100000, 8, 7);
+    int raw;
+    byte *none = compressList(list, 100000, &raw, COMPRESSION_NONE);
+    for (int method = 1; method < COMPRESSION_METHOD_COUNT; method++) {
+        // COMPRESSION_DOCUMENTは密な位置のリストには向かない(test_document_postingsを参照)
+        if (method == COMPRESSION_DOCUMENT)
+            continue;
+        int byteLength;
+        byte *compressed = compressList(list, 100000, &byteLength, method);
+        assert(byteLength < raw / 4);
+        free(compressed);
+    }
+    free(none);
+    free(list);
+    std::cout << "test_compression_ratio passed.\n";
+}
+
+// 文書単位のポスティングの形式((開始位置 << 16) | (tf << 8) | 文書長の符号)のリスト
+void test_document_postings() {
+    srand(5);
+    int length = 128;
+    offset list[128];
+    offset start = 1000;
+    for (int i = 0; i < length; i++) {
+        start += 1 + rand() % 4000;
+        int tf = 1 + (rand() % 10 == 0 ? rand() % 20 : 0);
+        list[i] = (start << 16) | (tf << 8) | (40 + rand() % 80);
+    }
+    checkRoundTrip(list, length, COMPRESSION_DOCUMENT);
+
+    int documentLength, vbyteLength, pforLength;
+    free(compressList(list, length, &documentLength, COMPRESSION_DOCUMENT));
+    free(compressList(list, length, &vbyteLength, COMPRESSION_VBYTE));
+    free(compressList(list, length, &pforLength, COMPRESSION_PFORDELTA));
+    assert(documentLength * 4 < vbyteLength * 3);
+    assert(documentLength < pforLength);
+
+    // 下位16ビットが同じ値でも、開始位置が同じでも展開できる
+    offset same[] = { (ONE << 16) | 257, (ONE << 17) | 257, (ONE << 17) | 258, (ONE << 17) | 512 };
+    checkRoundTrip(same, 4, COMPRESSION_DOCUMENT);
+    std::cout << "test_document_postings passed.\n";
+}
+
+void test_method_names() {
+    for (int method = 0; method < COMPRESSION_METHOD_COUNT; method++)
+        assert(getCompressionMethod(getCompressionMethodName(method)) == method);
+    assert(getCompressionMethod("nonsense") == -1);
+    std::cout << "test_method_names passed.\n";
+}
+
+int main() {
+    test_round_trip();
+    test_large_offsets();
+    test_simd_matches_scalar();
+    test_compression_ratio();
+    test_document_postings();
+    test_method_names();
+
+    std::cout << "All compression tests passed.\n";
+}
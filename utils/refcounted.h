@@ -0,0 +1,39 @@
+#ifndef __REFCOUNTED_H
+#define __REFCOUNTED_H
+
+/*
+RefCountedは参照カウントで寿命を管理するオブジェクトの基底クラス。
+作成直後の参照カウントは1で、releaseで0になった時点でdeleteされる。
+カウントの増減はアトミックに行われるので、複数のスレッドから共有してよい
+*/
+
+#include <atomic>
+
+class RefCounted {
+
+private:
+
+    std::atomic<int> referenceCount;
+
+public:
+
+    RefCounted() : referenceCount(1) {}
+
+    virtual ~RefCounted() {}
+
+    void addReference() {
+        referenceCount.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    // 参照を1つ開放する。最後の参照だった場合はオブジェクトを破棄する
+    void release() {
+        if (referenceCount.fetch_sub(1, std::memory_order_acq_rel) == 1)
+            delete this;
+    }
+
+    int getReferenceCount() {
+        return referenceCount.load(std::memory_order_acquire);
+    }
+};
+
+#endif
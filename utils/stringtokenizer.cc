@@ -9,6 +9,9 @@ StringTokenizer::StringTokenizer(const char *string, const char *delim) {
     strcpy(this->delim, delim);
     nextPosition = 0;
     stringLength = strlen(string);
+    memset(isDelimiter, 0, sizeof(isDelimiter));
+    for (int i = 0; delim[i] != 0; i++)
+        isDelimiter[(unsigned char)delim[i]] = true;
 }
 
 StringTokenizer::~StringTokenizer() {
@@ -31,16 +34,8 @@ char *StringTokenizer::getNext() {
     if (nextPosition >= stringLength)
         return nullptr;
     int pos = nextPosition;
-    while (string[pos] != 0) {
-        bool found = false;
-        for (int i = 0; delim[i] != 0; i++) {
-            if (string[pos] == delim[i])
-                found = true;
-        }
-        if (found)
-            break;
+    while ((string[pos] != 0) && (!isDelimiter[(unsigned char)string[pos]]))
         pos++;
-    }
     if (string[pos] == 0)
         string[pos + 1] = 0;
     else
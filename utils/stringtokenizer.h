@@ -34,6 +34,9 @@ private:
 
     char *string, *delim;
 
+    // 区切り文字の表。文字ごとにdelimを走査しないように、コンストラクタで作成する
+    bool isDelimiter[256];
+
     int nextPosition, stringLength;
 };
 
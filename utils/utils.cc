@@ -113,4 +113,19 @@ char *evaluateRelativePathName(const char *dir, const char *file) {
 	sprintf(result, "%s%s%s", dir, (dir[dirLen - 1] == '/' ? "" : "/"), file);
 	collapsePath(result);
 	return result;
+}
+
+static bool detectAVX2() {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+#else
+    return false;
+#endif
+}
+
+bool cpuSupportsAVX2() {
+    // 関数内のstatic変数の初期化はスレッドセーフなので、複数のスレッドから同時に呼び出してよい
+    static const bool supported = detectAVX2();
+    return supported;
 }
\ No newline at end of file
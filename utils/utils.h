@@ -42,4 +42,7 @@ bool startsWith(const char *longString, const char *shortString, bool caseSensit
 // メモリは呼び出し元で開放しなければいけない
 char *evaluateRelativePathName(const char *dir, const char *file);
 
+// CPUがAVX2命令に対応していればtrueを返す。CPUを調べるのは最初の呼び出しの一度だけ
+bool cpuSupportsAVX2();
+
 #endif
\ No newline at end of file